@@ -9,6 +9,8 @@
  * at the end of this file.
  * ---------------------------------------------------------------------- */
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -71,6 +73,31 @@ int ply_get_ply_user_data(p_ply ply, void **pdata, long *idata);
 p_ply ply_open(const char *name, p_ply_error_cb error_cb, long idata, 
         void *pdata);
 
+/* ----------------------------------------------------------------------
+ * Memory allocation callback prototype
+ *
+ * adata: contextual information set in ply_open_alloc
+ * pointer: block to resize or free, NULL for a new one
+ * old_size: size of the block in bytes, 0 if pointer is NULL
+ * new_size: size wanted in bytes, 0 to free the block
+ *
+ * Returns the block, or NULL if out of memory or freeing
+ * ---------------------------------------------------------------------- */
+typedef void *(*p_ply_alloc_cb)(void *adata, void *pointer, size_t old_size,
+        size_t new_size);
+
+/* ----------------------------------------------------------------------
+ * Opens a PLY file for reading, as ply_open, with all memory used by the
+ * handle coming from alloc_cb
+ *
+ * alloc_cb: memory allocation callback function, NULL for the C library's
+ * adata: contextual information passed to alloc_cb
+ *
+ * Returns 1 if successful, 0 otherwise
+ * ---------------------------------------------------------------------- */
+p_ply ply_open_alloc(const char *name, p_ply_error_cb error_cb, long idata, 
+        void *pdata, p_ply_alloc_cb alloc_cb, void *adata);
+
 /* ----------------------------------------------------------------------
  * Reads and parses the header of a PLY file returned by ply_open
  *
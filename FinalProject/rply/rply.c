@@ -189,6 +189,8 @@ typedef t_ply_odriver *p_ply_odriver;
  * wlength: number of values in list property being written
  * error_cb: error callback
  * pdata/idata: user data defined with ply_open/ply_create
+ * alloc_cb: memory allocation callback
+ * adata: user data defined with ply_open_alloc
  * ---------------------------------------------------------------------- */
 typedef struct t_ply_ {
     e_ply_io_mode io_mode;
@@ -211,6 +213,8 @@ typedef struct t_ply_ {
     p_ply_error_cb error_cb;
     void *pdata;
     long idata;
+    p_ply_alloc_cb alloc_cb;
+    void *adata;
 } t_ply;
 
 /* ----------------------------------------------------------------------
@@ -264,7 +268,10 @@ static void ply_ferror(p_ply ply, const char *fmt, ...);
 static void ply_init(p_ply ply);
 static void ply_element_init(p_ply_element element);
 static void ply_property_init(p_ply_property property);
-static p_ply ply_alloc(void);
+static void *ply_default_alloc(void *adata, void *pointer, size_t old_size,
+        size_t new_size);
+static p_ply ply_alloc(p_ply_alloc_cb alloc_cb, void *adata);
+static void ply_free(p_ply ply);
 static p_ply_element ply_grow_element(p_ply ply);
 static p_ply_property ply_grow_property(p_ply ply, p_ply_element element);
 static void *ply_grow_array(p_ply ply, void **pointer, long *nmemb, long size);
@@ -354,8 +361,15 @@ static int ply_read_header_magic(p_ply ply) {
  * ---------------------------------------------------------------------- */
 p_ply ply_open(const char *name, p_ply_error_cb error_cb, 
         long idata, void *pdata) {
+    return ply_open_alloc(name, error_cb, idata, pdata, NULL, NULL);
+}
+
+p_ply ply_open_alloc(const char *name, p_ply_error_cb error_cb, 
+        long idata, void *pdata, p_ply_alloc_cb alloc_cb, void *adata) {
     FILE *fp = NULL; 
-    p_ply ply = ply_alloc();
+    p_ply ply = NULL;
+    if (alloc_cb == NULL) alloc_cb = ply_default_alloc;
+    ply = ply_alloc(alloc_cb, adata);
     if (error_cb == NULL) error_cb = ply_error_cb;
     if (!ply) {
         error_cb(NULL, "Out of memory");
@@ -367,14 +381,14 @@ p_ply ply_open(const char *name, p_ply_error_cb error_cb,
     ply->error_cb = error_cb;
     if (!ply_type_check()) {
         error_cb(ply, "Incompatible type system");
-        free(ply);
+        ply_free(ply);
         return NULL;
     }
     assert(name);
     fp = fopen(name, "rb");
     if (!fp) {
         error_cb(ply, "Unable to open file");
-        free(ply);
+        ply_free(ply);
         return NULL;
     }
     ply->fp = fp;
@@ -447,7 +461,7 @@ int ply_read(p_ply ply) {
 p_ply ply_create(const char *name, e_ply_storage_mode storage_mode, 
         p_ply_error_cb error_cb, long idata, void *pdata) {
     FILE *fp = NULL;
-    p_ply ply = ply_alloc();
+    p_ply ply = ply_alloc(ply_default_alloc, NULL);
     if (error_cb == NULL) error_cb = ply_error_cb;
     if (!ply) {
         error_cb(NULL, "Out of memory");
@@ -455,14 +469,14 @@ p_ply ply_create(const char *name, e_ply_storage_mode storage_mode,
     }
     if (!ply_type_check()) {
         error_cb(ply, "Incompatible type system");
-        free(ply);
+        ply_free(ply);
         return NULL;
     }
     assert(name && storage_mode <= PLY_DEFAULT);
     fp = fopen(name, "wb");
     if (!fp) {
         error_cb(ply, "Unable to create file");
-        free(ply);
+        ply_free(ply);
         return NULL;
     }
     ply->idata = idata;
@@ -671,13 +685,18 @@ int ply_close(p_ply ply) {
     if (ply->element) {
         for (i = 0; i < ply->nelements; i++) {
             p_ply_element element = &ply->element[i];
-            if (element->property) free(element->property);
+            if (element->property) 
+                ply->alloc_cb(ply->adata, element->property, 
+                        element->nproperties*sizeof(t_ply_property), 0);
         }
-        free(ply->element);
+        ply->alloc_cb(ply->adata, ply->element, 
+                ply->nelements*sizeof(t_ply_element), 0);
     }
-    if (ply->obj_info) free(ply->obj_info);
-    if (ply->comment) free(ply->comment);
-    free(ply);
+    if (ply->obj_info) 
+        ply->alloc_cb(ply->adata, ply->obj_info, ply->nobj_infos*LINESIZE, 0);
+    if (ply->comment) 
+        ply->alloc_cb(ply->adata, ply->comment, ply->ncomments*LINESIZE, 0);
+    ply_free(ply);
     return 1;
 }
 
@@ -1110,19 +1129,37 @@ static void ply_property_init(p_ply_property property) {
     property->idata = 0;
 }
 
-static p_ply ply_alloc(void) {
-    p_ply ply = (p_ply) calloc(1, sizeof(t_ply));
+static void *ply_default_alloc(void *adata, void *pointer, size_t old_size,
+        size_t new_size) {
+    (void) adata;
+    (void) old_size;
+    if (new_size == 0) {
+        free(pointer);
+        return NULL;
+    }
+    return realloc(pointer, new_size);
+}
+
+static p_ply ply_alloc(p_ply_alloc_cb alloc_cb, void *adata) {
+    p_ply ply = (p_ply) alloc_cb(adata, NULL, 0, sizeof(t_ply));
     if (!ply) return NULL;
+    memset(ply, 0, sizeof(t_ply));
     ply_init(ply);
+    ply->alloc_cb = alloc_cb;
+    ply->adata = adata;
     return ply;
 }
 
+static void ply_free(p_ply ply) {
+    ply->alloc_cb(ply->adata, ply, sizeof(t_ply), 0);
+}
+
 static void *ply_grow_array(p_ply ply, void **pointer, 
         long *nmemb, long size) {
     void *temp = *pointer;
     long count = *nmemb + 1;
-    if (!temp) temp = malloc(count*size);
-    else temp = realloc(temp, count*size);
+    temp = ply->alloc_cb(ply->adata, temp, (size_t) *nmemb*size, 
+            (size_t) count*size);
     if (!temp) {
         ply_ferror(ply, "Out of memory");
         return NULL;
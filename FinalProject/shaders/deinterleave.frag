@@ -0,0 +1,60 @@
+#version 130
+
+uniform sampler2D depthTex;
+uniform sampler2D normTex;
+
+// Which pixel of each 4x4 block this layer gathers
+uniform ivec2 layerOffset;
+
+// 1.0 to rebuild normals from depth instead of reading normTex
+uniform float reconstructNormals;
+uniform mat4 invProjMat;
+
+vec3 viewPositionAt(ivec2 pixel, float depth)
+{
+  vec2 coord = (vec2(pixel) + vec2(0.5)) / vec2(textureSize(depthTex, 0));
+  vec4 viewPosition = invProjMat * vec4((2.0 * vec3(coord, depth)) - vec3(1.0), 1.0);
+  return viewPosition.xyz / viewPosition.w;
+}
+
+float depthAt(ivec2 pixel)
+{
+  return texelFetch(depthTex, clamp(pixel, ivec2(0), textureSize(depthTex, 0) - ivec2(1)), 0).r;
+}
+
+// Same reconstruction as normalFromDepth() in ssao.frag
+vec3 normalFromDepth(ivec2 pixel, float depth)
+{
+  ivec2 dx = ivec2(1, 0);
+  ivec2 dy = ivec2(0, 1);
+  float l1 = depthAt(pixel - dx);
+  float l2 = depthAt(pixel - 2 * dx);
+  float r1 = depthAt(pixel + dx);
+  float r2 = depthAt(pixel + 2 * dx);
+  float d1 = depthAt(pixel - dy);
+  float d2 = depthAt(pixel - 2 * dy);
+  float u1 = depthAt(pixel + dy);
+  float u2 = depthAt(pixel + 2 * dy);
+
+  vec3 center = viewPositionAt(pixel, depth);
+  vec3 horizontal = abs(2.0 * l1 - l2 - depth) < abs(2.0 * r1 - r2 - depth) ?
+      center - viewPositionAt(pixel - dx, l1) : viewPositionAt(pixel + dx, r1) - center;
+  vec3 vertical = abs(2.0 * d1 - d2 - depth) < abs(2.0 * u1 - u2 - depth) ?
+      center - viewPositionAt(pixel - dy, d1) : viewPositionAt(pixel + dy, u1) - center;
+  return normalize(cross(horizontal, vertical));
+}
+
+void main()
+{
+  ivec2 source = ivec2(gl_FragCoord.xy) * 4 + layerOffset;
+
+  float depth = texelFetch(depthTex, source, 0).r;
+  gl_FragData[0] = vec4(depth, 0.0, 0.0, 0.0);
+  if (reconstructNormals > 0.5) {
+    // Scale and bias normal from [-1, 1] to [0, 1], like phong.frag does
+    gl_FragData[1] = vec4(0.5 * (normalFromDepth(source, depth) + vec3(1.0)), 0.0);
+  }
+  else {
+    gl_FragData[1] = texelFetch(normTex, source, 0);
+  }
+}
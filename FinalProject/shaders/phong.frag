@@ -1,13 +1,28 @@
+#extension GL_ARB_uniform_buffer_object : enable
+
 varying vec3 normalV;
 varying vec3 positionV;
 
 varying vec3 normTest;
 
+#ifdef GL_ARB_uniform_buffer_object
+layout(std140) uniform FrameData
+{
+  mat4 modelViewMat;
+  mat4 modelViewProjMat;
+  mat4 normalMat;
+  vec3 lAmbient;
+  vec3 lPosition;
+  vec3 lDiffuse;
+  vec3 lSpecular;
+};
+#else
 uniform vec3 lAmbient;
 
 uniform vec3 lPosition;
 uniform vec3 lDiffuse;
 uniform vec3 lSpecular;
+#endif
 
 uniform vec3 kAmbient;
 uniform vec3 kDiffuse;
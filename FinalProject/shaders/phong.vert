@@ -1,9 +1,31 @@
+#extension GL_ARB_uniform_buffer_object : enable
+
 attribute vec3 positionIn;
 attribute vec3 normalIn;
+// The instance's model transform, a row at a time (the fourth row is always
+// 0 0 0 1). Scaling is uniform, so it turns normals as well.
+attribute vec4 instanceRow0;
+attribute vec4 instanceRow1;
+attribute vec4 instanceRow2;
 
+#ifdef GL_ARB_uniform_buffer_object
+// Written each frame into the frame ring (framering.h); phong.frag declares
+// the same block
+layout(std140) uniform FrameData
+{
+  mat4 modelViewMat;
+  mat4 modelViewProjMat;
+  mat4 normalMat;
+  vec3 lAmbient;
+  vec3 lPosition;
+  vec3 lDiffuse;
+  vec3 lSpecular;
+};
+#else
 uniform mat4 modelViewMat;
 uniform mat4 modelViewProjMat;
 uniform mat4 normalMat;
+#endif
 
 varying vec3 normalV;
 varying vec3 positionV;
@@ -11,8 +33,12 @@ varying vec3 normTest;
 
 void main()
 {
-  normTest = normalIn;
-  normalV = vec3(normalMat * vec4(normalIn, 0.0));
-  positionV = vec3(modelViewMat * vec4(positionIn, 1.0));
-  gl_Position = modelViewProjMat * vec4(positionIn, 1.0);
+  vec4 position = vec4(positionIn, 1.0);
+  vec4 worldPosition = vec4(dot(instanceRow0, position), dot(instanceRow1, position), dot(instanceRow2, position), 1.0);
+  vec3 worldNormal = vec3(dot(instanceRow0.xyz, normalIn), dot(instanceRow1.xyz, normalIn), dot(instanceRow2.xyz, normalIn));
+
+  normTest = worldNormal;
+  normalV = vec3(normalMat * vec4(worldNormal, 0.0));
+  positionV = vec3(modelViewMat * worldPosition);
+  gl_Position = modelViewProjMat * worldPosition;
 }
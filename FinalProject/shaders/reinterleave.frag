@@ -0,0 +1,12 @@
+#version 130
+
+uniform sampler2DArray aoTex;
+
+void main()
+{
+  // Every 4x4 block of the output takes one texel from each layer
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  int layer = (pixel.x % 4) + (pixel.y % 4) * 4;
+
+  gl_FragColor = texelFetch(aoTex, ivec3(pixel / 4, layer), 0);
+}
@@ -1,17 +1,62 @@
+#version 130
+
 varying vec2 texCoord;
 
 uniform sampler2D depthTex;
 uniform sampler2D normTex;
 uniform sampler2D randomTex;
 uniform vec2 randomTexCoordScale;
+// Shifts the random texture lookup, in random texture coordinates
+uniform vec2 randomTexOffset;
 
 uniform mat4 projMat;
 uniform mat4 invProjMat;
 
-uniform vec3 sampleOffsets[16];
+uniform vec3 sampleOffsets[64];
 
 uniform float sampleRadius;
 
+// Number of entries of sampleOffsets used this frame
+uniform int sampleCount;
+// Per-frame rotation of the kernel about the normal, in radians
+uniform float frameAngle;
+
+// 1.0 to rebuild normals from depth instead of reading normTex
+uniform float reconstructNormals;
+// 1 / size of the depth texture
+uniform vec2 invRes;
+
+vec3 viewPositionAt(vec2 coord, float depth)
+{
+  vec4 viewPosition = invProjMat * vec4((2.0 * vec3(coord, depth)) - vec3(1.0), 1.0);
+  return viewPosition.xyz / viewPosition.w;
+}
+
+// Rebuilds the view-space normal from the depth of the 2 pixels on each side.
+// For each axis, the side whose second pixel lines up best with the center
+// and first pixel is taken to lie on the same surface, and only that side is
+// used, so normals stay sharp across depth discontinuities.
+vec3 normalFromDepth(vec2 coord, float depth)
+{
+  vec2 dx = vec2(invRes.x, 0.0);
+  vec2 dy = vec2(0.0, invRes.y);
+  float l1 = texture(depthTex, coord - dx).r;
+  float l2 = texture(depthTex, coord - 2.0 * dx).r;
+  float r1 = texture(depthTex, coord + dx).r;
+  float r2 = texture(depthTex, coord + 2.0 * dx).r;
+  float d1 = texture(depthTex, coord - dy).r;
+  float d2 = texture(depthTex, coord - 2.0 * dy).r;
+  float u1 = texture(depthTex, coord + dy).r;
+  float u2 = texture(depthTex, coord + 2.0 * dy).r;
+
+  vec3 center = viewPositionAt(coord, depth);
+  vec3 horizontal = abs(2.0 * l1 - l2 - depth) < abs(2.0 * r1 - r2 - depth) ?
+      center - viewPositionAt(coord - dx, l1) : viewPositionAt(coord + dx, r1) - center;
+  vec3 vertical = abs(2.0 * d1 - d2 - depth) < abs(2.0 * u1 - u2 - depth) ?
+      center - viewPositionAt(coord - dy, d1) : viewPositionAt(coord + dy, u1) - center;
+  return normalize(cross(horizontal, vertical));
+}
+
 void main()
 {
   // Holds an occlusion factor for this fragment, to be output at the end
@@ -27,22 +72,35 @@ void main()
   vec4 viewPosition = invProjMat * vec4(clipPosition, 1.0);
   viewPosition /= viewPosition.w;
 
-  vec3 normal = texture(normTex, texCoord).xyz;
-  // Scale and bias
-  normal = (2.0 * normal) - vec3(1.0);
-  normal = normalize(normal);
+  vec3 normal;
+  if (reconstructNormals > 0.5) {
+    normal = normalFromDepth(texCoord, depth);
+  }
+  else {
+    normal = texture(normTex, texCoord).xyz;
+    // Scale and bias
+    normal = (2.0 * normal) - vec3(1.0);
+    normal = normalize(normal);
+  }
 
   // Construct our rotation matrix (used to transform sample offsets) based on a random vector lookup
-  vec3 randomVector = texture(randomTex, texCoord * randomTexCoordScale).xyz;
+  vec3 randomVector = texture(randomTex, texCoord * randomTexCoordScale + randomTexOffset).xyz;
   // Go from [0, 1] to [-1, 1], normalizing along the way
   randomVector = normalize((2.0 * randomVector) - vec3(1.0));
 
   vec3 tangent = normalize(randomVector - normal * dot(normal, randomVector));
   vec3 bitangent = cross(normal, tangent);
 
-  mat3 orientMat = mat3(tangent, bitangent, normal);
+  // Spin the kernel about the normal, so successive frames sample different directions
+  float cosAngle = cos(frameAngle);
+  float sinAngle = sin(frameAngle);
+  mat3 orientMat = mat3(cosAngle * tangent + sinAngle * bitangent,
+                        cosAngle * bitangent - sinAngle * tangent, normal);
+
+  for (int i = 0; i < 64; i++) {
+    if (i >= sampleCount)
+      break;
 
-  for (int i = 0; i < 16; i++) {
     // Construct our view-space location to sample
     vec3 testSample = (orientMat * sampleOffsets[i]) * sampleRadius + viewPosition.xyz;
 
@@ -58,7 +116,7 @@ void main()
   }
 
   // Normalize occlusion factor
-  occlusion /= 16;
+  occlusion /= float(sampleCount);
 
   // Subtract from 1 to give a direct scale factor for lighting
   occlusion = 1.0 - occlusion;
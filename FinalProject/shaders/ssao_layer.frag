@@ -0,0 +1,88 @@
+#version 130
+
+// Same algorithm as ssao.frag, but run on one quarter-resolution layer of
+// the deinterleaved depth and normals. Every pixel in a layer shares the
+// same random vector, so neighboring samples land on neighboring texels.
+
+uniform sampler2DArray depthTex;
+uniform sampler2DArray normTex;
+uniform int layer;
+uniform ivec2 layerOffset;
+// Size of the full resolution image
+uniform vec2 fullRes;
+
+// The random vector shared by this layer, in [-1, 1]
+uniform vec3 randomVector;
+
+uniform mat4 projMat;
+uniform mat4 invProjMat;
+
+uniform vec3 sampleOffsets[64];
+
+uniform float sampleRadius;
+
+// Number of entries of sampleOffsets used this frame
+uniform int sampleCount;
+// Per-frame rotation of the kernel about the normal, in radians
+uniform float frameAngle;
+
+void main()
+{
+  // Holds an occlusion factor for this fragment, to be output at the end
+  float occlusion = 0.0;
+
+  // Where this texel came from in the full resolution image
+  ivec2 layerTexel = ivec2(gl_FragCoord.xy);
+  vec2 texCoord = (vec2(layerTexel * 4 + layerOffset) + vec2(0.5)) / fullRes;
+
+  // Construct a position for the rendered fragment
+  float depth = texelFetch(depthTex, ivec3(layerTexel, layer), 0).r;
+  vec3 screenPosition = vec3(texCoord, depth);
+  // Go from [0, 1] to [-1, 1]
+  vec3 clipPosition = (2.0 * screenPosition) - vec3(1.0);
+
+  // Undo the projection to get back to view coordinates
+  vec4 viewPosition = invProjMat * vec4(clipPosition, 1.0);
+  viewPosition /= viewPosition.w;
+
+  vec3 normal = texelFetch(normTex, ivec3(layerTexel, layer), 0).xyz;
+  // Scale and bias
+  normal = (2.0 * normal) - vec3(1.0);
+  normal = normalize(normal);
+
+  vec3 tangent = normalize(randomVector - normal * dot(normal, randomVector));
+  vec3 bitangent = cross(normal, tangent);
+
+  // Spin the kernel about the normal, so successive frames sample different directions
+  float cosAngle = cos(frameAngle);
+  float sinAngle = sin(frameAngle);
+  mat3 orientMat = mat3(cosAngle * tangent + sinAngle * bitangent,
+                        cosAngle * bitangent - sinAngle * tangent, normal);
+
+  for (int i = 0; i < 64; i++) {
+    if (i >= sampleCount)
+      break;
+
+    // Construct our view-space location to sample
+    vec3 testSample = (orientMat * sampleOffsets[i]) * sampleRadius + viewPosition.xyz;
+
+    // Transform the sample location into clip coords for depth comparison
+    vec4 clipSample = projMat * vec4(testSample, 1.0);
+    clipSample.xy /= clipSample.w;
+    // Scale and bias to screen coords, [-1, 1] -> [0, 1]
+    vec2 screenSample = (clipSample.xy + vec2(1.0)) * 0.5;
+
+    // Only look within this layer; its texels are a quarter-res copy of the depth
+    float lookupDepth = texture(depthTex, vec3(screenSample, float(layer))).x;
+    float rangeCheck = abs(lookupDepth - depth) > sampleRadius ? 0.0 : 1.0;
+    occlusion += (lookupDepth < depth ? 1.0 : 0.0) * rangeCheck;
+  }
+
+  // Normalize occlusion factor
+  occlusion /= float(sampleCount);
+
+  // Subtract from 1 to give a direct scale factor for lighting
+  occlusion = 1.0 - occlusion;
+
+  gl_FragColor = vec4(occlusion, occlusion, occlusion, 1.0);
+}
@@ -0,0 +1,51 @@
+#version 130
+
+varying vec2 texCoord;
+
+uniform sampler2D aoTex;
+uniform sampler2D depthTex;
+uniform sampler2D historyTex;
+
+// Undoes the scene projection and view transform for this frame
+uniform mat4 invProjMat;
+uniform mat4 invViewMat;
+// The scene view-projection transform from the previous frame
+uniform mat4 prevViewProjMat;
+
+// 0.0 if historyTex holds nothing usable (first frame, mode just enabled)
+uniform float historyValid;
+// Upper bound on how many frames are averaged together
+uniform float maxHistoryLength;
+// Allowed relative difference between reprojected and stored view depth
+uniform float depthRejectThreshold;
+
+void main()
+{
+  float currentAO = texture(aoTex, texCoord).r;
+
+  // Rebuild the world-space position of this fragment
+  float depth = texture(depthTex, texCoord).r;
+  vec3 clipPosition = (2.0 * vec3(texCoord, depth)) - vec3(1.0);
+  vec4 viewPosition = invProjMat * vec4(clipPosition, 1.0);
+  viewPosition /= viewPosition.w;
+  vec4 worldPosition = invViewMat * viewPosition;
+
+  // Find where it was on screen last frame
+  vec4 prevClip = prevViewProjMat * worldPosition;
+  vec2 prevTexCoord = ((prevClip.xy / prevClip.w) + vec2(1.0)) * 0.5;
+
+  // History holds (occlusion, frames accumulated, view depth)
+  vec4 history = texture(historyTex, prevTexCoord);
+
+  float accepted = historyValid;
+  if (prevClip.w <= 0.0 || any(lessThan(prevTexCoord, vec2(0.0))) || any(greaterThan(prevTexCoord, vec2(1.0))))
+    accepted = 0.0;
+  // Disocclusion: something else was visible there last frame
+  if (abs(history.b - prevClip.w) > depthRejectThreshold * prevClip.w)
+    accepted = 0.0;
+
+  float historyLength = min(history.g * accepted + 1.0, maxHistoryLength);
+  float occlusion = mix(history.r, currentAO, 1.0 / historyLength);
+
+  gl_FragColor = vec4(occlusion, historyLength, -viewPosition.z, 1.0);
+}
@@ -0,0 +1,188 @@
+#include "arena.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+// What blocks are rounded up to: Windows reserves address space 64 KB at a
+// time, and the start of a block is aligned for anything but a page
+const size_t blockGranularity = 65536;
+// Bigger allocations get a block of their own
+const size_t sharedAllocationBytes = arenaBlockBytes / 4;
+
+std::atomic<size_t> totalReserved(0);
+std::atomic<size_t> peakTotalReserved(0);
+
+size_t alignUp(size_t value, size_t alignment)
+{
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+unsigned char* mapBlock(size_t bytes)
+{
+#ifdef _WIN32
+  void* memory = VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+  void* memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED)
+    memory = NULL;
+#endif
+  if (memory == NULL) {
+    fprintf(stderr, "Out of memory: couldn't get %lu MB for loading\n", (unsigned long)(bytes >> 20));
+    exit(1);
+  }
+
+  size_t total = totalReserved += bytes;
+  size_t peak = peakTotalReserved;
+  while (total > peak && !peakTotalReserved.compare_exchange_weak(peak, total))
+    ;
+  return static_cast<unsigned char*>(memory);
+}
+
+void unmapBlock(unsigned char* memory, size_t bytes)
+{
+#ifdef _WIN32
+  VirtualFree(memory, 0, MEM_RELEASE);
+#else
+  munmap(memory, bytes);
+#endif
+  totalReserved -= bytes;
+}
+
+}
+
+Arena::Arena() : current(-1), reserved(0), peakReserved(0)
+{
+}
+
+Arena::~Arena()
+{
+  release();
+}
+
+void* Arena::allocate(size_t bytes, size_t alignment)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  Block block;
+  if (bytes > sharedAllocationBytes) {
+    block.size = alignUp(bytes, blockGranularity);
+    block.used = bytes;
+  }
+  else {
+    if (current >= 0) {
+      Block& last = blocks[current];
+      size_t start = alignUp(last.used, alignment);
+      if (start + bytes <= last.size) {
+        last.used = start + bytes;
+        return last.memory + start;
+      }
+    }
+    block.size = arenaBlockBytes;
+    block.used = bytes;
+    current = (int)blocks.size();
+  }
+  block.memory = mapBlock(block.size);
+  blocks.push_back(block);
+  reserved += block.size;
+  if (reserved > peakReserved)
+    peakReserved = reserved;
+  return block.memory;
+}
+
+void* Arena::reallocate(void* pointer, size_t oldBytes, size_t newBytes, size_t alignment)
+{
+  if (pointer == NULL)
+    return allocate(newBytes, alignment);
+  if (newBytes == 0) {
+    deallocate(pointer, oldBytes);
+    return NULL;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    Block* block = findBlock(pointer);
+    unsigned char* start = static_cast<unsigned char*>(pointer);
+    size_t offset = start - block->memory;
+    if (offset + oldBytes == block->used && offset + newBytes <= block->size) {
+      block->used = offset + newBytes;
+      return pointer;
+    }
+  }
+  void* moved = allocate(newBytes, alignment);
+  memcpy(moved, pointer, oldBytes < newBytes ? oldBytes : newBytes);
+  deallocate(pointer, oldBytes);
+  return moved;
+}
+
+void Arena::deallocate(void* pointer, size_t bytes)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  Block* block = findBlock(pointer);
+  size_t offset = static_cast<unsigned char*>(pointer) - block->memory;
+  if (offset + bytes != block->used)
+    return;
+  block->used = offset;
+  if (block->used == 0 && block - &blocks[0] != current)
+    dropBlock(block - &blocks[0]);
+}
+
+void Arena::release()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  for (size_t i = 0; i < blocks.size(); i++)
+    unmapBlock(blocks[i].memory, blocks[i].size);
+  blocks.clear();
+  current = -1;
+  reserved = 0;
+}
+
+size_t Arena::reservedBytes() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return reserved;
+}
+
+size_t Arena::peakReservedBytes() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return peakReserved;
+}
+
+// The block "pointer" was allocated from. Needs the lock.
+Arena::Block* Arena::findBlock(void* pointer)
+{
+  unsigned char* address = static_cast<unsigned char*>(pointer);
+  for (size_t i = 0; i < blocks.size(); i++) {
+    if (address >= blocks[i].memory && address < blocks[i].memory + blocks[i].size)
+      return &blocks[i];
+  }
+  fprintf(stderr, "Freed memory that isn't from this arena\n");
+  abort();
+}
+
+// Hands a block that's no longer used back to the system. Needs the lock.
+void Arena::dropBlock(size_t index)
+{
+  unmapBlock(blocks[index].memory, blocks[index].size);
+  reserved -= blocks[index].size;
+  blocks.erase(blocks.begin() + index);
+  if (current > (int)index)
+    current--;
+}
+
+ArenaMemoryStats arenaMemoryStats()
+{
+  ArenaMemoryStats stats;
+  stats.reservedBytes = totalReserved;
+  stats.peakReservedBytes = peakTotalReserved;
+  return stats;
+}
@@ -0,0 +1,134 @@
+// File: arena.h
+//
+// A linear allocator for loading. Memory comes straight from the system in
+// large blocks and is handed out from the front of the current one; freeing
+// only gives back what was allocated last, so a load's temporaries pile up
+// until the whole arena is released at once, when every block goes back to
+// the system. Nothing of a load is left behind in the heap to hold resident
+// memory up, as the heap's free lists do once a big load has gone through
+// them. Allocations too big to share a block get one of their own, which
+// goes back as soon as they're freed.
+//
+// ArenaAllocator puts standard containers in an arena, and ArenaVector is a
+// std::vector there. Without an arena they use the heap.
+
+#ifndef SP_ARENA_H_
+#define SP_ARENA_H_
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Blocks are at least this big
+const size_t arenaBlockBytes = 4 << 20;
+
+class Arena
+{
+public:
+  Arena();
+  // Releases everything
+  ~Arena();
+
+  // "bytes" starting at a multiple of "alignment" (a power of two). Exits if
+  // the system is out of memory.
+  void* allocate(size_t bytes, size_t alignment);
+  // Resizes "pointer", "oldBytes" long, to "newBytes", in place if it was the
+  // last thing allocated and there's room, and otherwise by copying it to a
+  // new allocation. A NULL "pointer" allocates.
+  void* reallocate(void* pointer, size_t oldBytes, size_t newBytes, size_t alignment);
+  // Gives back "pointer", "bytes" long, if it was the last thing allocated in
+  // its block; otherwise it stays taken until release()
+  void deallocate(void* pointer, size_t bytes);
+
+  // Hands every block back to the system. Nothing allocated before may be
+  // used after.
+  void release();
+
+  // Bytes taken from the system, and the most there have been since the
+  // arena was made
+  size_t reservedBytes() const;
+  size_t peakReservedBytes() const;
+
+private:
+  struct Block
+  {
+    unsigned char* memory;
+    size_t size;
+    size_t used;
+  };
+
+  Arena(const Arena&);
+  Arena& operator=(const Arena&);
+
+  Block* findBlock(void* pointer);
+  void dropBlock(size_t index);
+
+  mutable std::mutex mutex;
+  std::vector<Block> blocks;
+  // The block small allocations come from, -1 for none yet
+  int current;
+  size_t reserved;
+  size_t peakReserved;
+};
+
+// Bytes every arena has taken from the system, now and at the most
+struct ArenaMemoryStats
+{
+  size_t reservedBytes;
+  size_t peakReservedBytes;
+};
+ArenaMemoryStats arenaMemoryStats();
+
+template <class T>
+class ArenaAllocator
+{
+public:
+  typedef T value_type;
+  // Containers take the arena with them when moved, swapped or assigned, so
+  // their memory always comes back to the arena it came from
+  typedef std::true_type propagate_on_container_copy_assignment;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  ArenaAllocator() : arena(NULL) { }
+  explicit ArenaAllocator(Arena* arena) : arena(arena) { }
+  template <class U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) { }
+
+  T* allocate(size_t count)
+  {
+    if (arena == NULL)
+      return static_cast<T*>(::operator new(count * sizeof(T)));
+    return static_cast<T*>(arena->allocate(count * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T* pointer, size_t count)
+  {
+    if (arena == NULL)
+      ::operator delete(pointer);
+    else
+      arena->deallocate(pointer, count * sizeof(T));
+  }
+
+  // NULL for the heap
+  Arena* arena;
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+  return a.arena == b.arena;
+}
+
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+  return a.arena != b.arena;
+}
+
+template <class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+
+#endif // SP_ARENA_H_
@@ -0,0 +1,314 @@
+// File: benchmark.cpp
+//
+// Benchmark mode. Every frame's time is measured from before the camera is
+// placed to after the GPU has finished it, and each pass is timed on its own
+// (see finishEachPass), so the numbers only depend on the build, the driver
+// and the options given.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "GL/glew.h"
+
+#include "benchmark.h"
+#include "render.h"
+#include "stats.h"
+#include "vec3.h"
+#include "walltime.h"
+
+using std::string;
+using std::vector;
+
+bool benchmarkEnabled = false;
+
+namespace {
+
+// One pose along the camera path
+struct CameraKey
+{
+  Vec3 eye;
+  Vec3 lookat;
+};
+
+// Benchmark options
+int measuredFrames = 300;
+int warmupFrames = 30;
+string cameraPathFile;
+string outputFile;
+
+// Keyframes from cameraPathFile. Empty means orbit the starting position.
+vector<CameraKey> cameraPath;
+CameraKey startPose;
+
+// The run goes through each phase in turn: warm-up frames, then measured
+// frames. Phase 0 has occlusion off, phase 1 has it on.
+const int phaseCount = 2;
+int phase;
+int phaseFrame;
+double frameStart;
+
+vector<double> frameMs[phaseCount];
+vector<double> passMs[phaseCount][passCount];
+
+void loadCameraPath(const char* path)
+{
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    fprintf(stderr, "Couldn't open camera path %s\n", path);
+    exit(1);
+  }
+
+  // One "eyeX eyeY eyeZ lookatX lookatY lookatZ" per line, # for comments
+  char line[256];
+  int lineNum = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    lineNum++;
+    char* start = line + strspn(line, " \t\r\n");
+    if (*start == '\0' || *start == '#')
+      continue;
+    CameraKey key;
+    if (sscanf(start, "%f %f %f %f %f %f", &key.eye.x, &key.eye.y, &key.eye.z,
+        &key.lookat.x, &key.lookat.y, &key.lookat.z) != 6) {
+      fprintf(stderr, "%s:%d: expected eye and lookat positions (6 numbers)\n", path, lineNum);
+      exit(1);
+    }
+    cameraPath.push_back(key);
+  }
+  fclose(file);
+
+  if (cameraPath.empty()) {
+    fprintf(stderr, "Camera path %s has no positions\n", path);
+    exit(1);
+  }
+}
+
+// Camera pose "t" of the way along the path, from 0 to 1
+CameraKey cameraPose(double t)
+{
+  CameraKey pose;
+  if (cameraPath.empty()) {
+    // Circle the starting position once around the y axis
+    const static double pi = acos(0.0) * 2;
+    float theta = (float)(2.0 * pi * t);
+    Vec3 offset = startPose.eye.add(startPose.lookat.scale(-1));
+    Vec3 rotated;
+    rotated.x = (float)cos(theta)*offset.x + (float)sin(theta)*offset.z;
+    rotated.y = offset.y;
+    rotated.z =-(float)sin(theta)*offset.x + (float)cos(theta)*offset.z;
+    pose.eye = startPose.lookat.add(rotated);
+    pose.lookat = startPose.lookat;
+    return pose;
+  }
+
+  // Linear interpolation between keyframes, spread evenly over the run
+  double position = t * (cameraPath.size() - 1);
+  int index = (int)position;
+  if (index >= (int)cameraPath.size() - 1)
+    return cameraPath.back();
+  float blend = (float)(position - index);
+  const CameraKey& a = cameraPath[index];
+  const CameraKey& b = cameraPath[index + 1];
+  pose.eye = a.eye.scale(1.0f - blend).add(b.eye.scale(blend));
+  pose.lookat = a.lookat.scale(1.0f - blend).add(b.lookat.scale(blend));
+  return pose;
+}
+
+const char* phaseName(int p)
+{
+  return p == 0 ? "ao_off" : "ao_on";
+}
+
+bool endsWith(const string& s, const char* suffix)
+{
+  size_t length = strlen(suffix);
+  return s.size() >= length && s.compare(s.size() - length, length, suffix) == 0;
+}
+
+string jsonString(const char* s)
+{
+  string result = "\"";
+  for (; *s != '\0'; s++) {
+    if (*s == '"' || *s == '\\')
+      result += '\\';
+    result += *s;
+  }
+  return result + "\"";
+}
+
+void writeCSV(FILE* file)
+{
+  fprintf(file, "# renderer: %s\n", (const char*)glGetString(GL_RENDERER));
+  fprintf(file, "# %dx%d, %s occlusion, %s normals, %d samples, %d warm-up + %d measured frames, camera %s\n",
+      wWidth, wHeight, aoModeName(), reconstructNormalsState ? "reconstructed" : "stored", kernelSize,
+      warmupFrames, measuredFrames, cameraPathFile.empty() ? "orbit" : cameraPathFile.c_str());
+  fprintf(file, "state,pass,frames,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n");
+  for (int p = 0; p < phaseCount; p++) {
+    for (int pass = -1; pass < passCount; pass++) {
+      const vector<double>& samples = pass < 0 ? frameMs[p] : passMs[p][pass];
+      if (samples.empty())
+        continue;
+      SampleStats stats = summarizeSamples(samples);
+      fprintf(file, "%s,%s,%d,%.4f,%.4f,%.4f,%.4f,%.4f\n", phaseName(p), pass < 0 ? "total" : renderPassNames[pass],
+          stats.count, stats.mean, stats.p50, stats.p95, stats.p99, stats.max);
+    }
+  }
+}
+
+void writeJSON(FILE* file)
+{
+  fprintf(file, "{\n");
+  fprintf(file, "  \"renderer\": %s,\n", jsonString((const char*)glGetString(GL_RENDERER)).c_str());
+  fprintf(file, "  \"width\": %d,\n  \"height\": %d,\n", wWidth, wHeight);
+  fprintf(file, "  \"occlusion_mode\": %s,\n", jsonString(aoModeName()).c_str());
+  fprintf(file, "  \"reconstructed_normals\": %s,\n", reconstructNormalsState ? "true" : "false");
+  fprintf(file, "  \"kernel_size\": %d,\n", kernelSize);
+  fprintf(file, "  \"warmup_frames\": %d,\n  \"measured_frames\": %d,\n", warmupFrames, measuredFrames);
+  fprintf(file, "  \"camera_path\": %s,\n", jsonString(cameraPathFile.empty() ? "orbit" : cameraPathFile.c_str()).c_str());
+  fprintf(file, "  \"culling\": %s,\n", jsonString(!cullingEnabled ? "off" : gpuCullingState ? "gpu" : "cpu").c_str());
+  fprintf(file, "  \"meshlets_tested\": %lld,\n  \"meshlets_rejected\": %lld,\n", lastDrawStats.clustersTested,
+      lastDrawStats.clustersOutsideFrustum + lastDrawStats.clustersBackfacing);
+  fprintf(file, "  \"instances\": %d,\n  \"culled\": %d,\n  \"occluded\": %d,\n  \"triangles\": %lld,\n  \"draw_calls\": %d,\n",
+      lastDrawStats.instances, lastDrawStats.culled, lastDrawStats.occluded, lastDrawStats.triangles, lastDrawStats.drawCalls);
+  fprintf(file, "  \"results\": [");
+  bool first = true;
+  for (int p = 0; p < phaseCount; p++) {
+    for (int pass = -1; pass < passCount; pass++) {
+      const vector<double>& samples = pass < 0 ? frameMs[p] : passMs[p][pass];
+      if (samples.empty())
+        continue;
+      SampleStats stats = summarizeSamples(samples);
+      fprintf(file, "%s\n    { \"state\": \"%s\", \"pass\": \"%s\", \"frames\": %d, \"mean_ms\": %.4f, "
+          "\"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f }", first ? "" : ",",
+          phaseName(p), pass < 0 ? "total" : renderPassNames[pass], stats.count, stats.mean, stats.p50,
+          stats.p95, stats.p99, stats.max);
+      first = false;
+    }
+  }
+  fprintf(file, "\n  ]\n}\n");
+}
+
+void writeResults()
+{
+  if (outputFile.empty()) {
+    writeCSV(stdout);
+    return;
+  }
+
+  FILE* file = fopen(outputFile.c_str(), "w");
+  if (file == NULL) {
+    fprintf(stderr, "Couldn't write benchmark results to %s\n", outputFile.c_str());
+    exit(1);
+  }
+  if (endsWith(outputFile, ".json"))
+    writeJSON(file);
+  else
+    writeCSV(file);
+  fclose(file);
+  printf("Wrote benchmark results to %s\n", outputFile.c_str());
+}
+
+}
+
+bool parseBenchmarkArgument(int argc, char* argv[], int& i)
+{
+  if (strcmp(argv[i], "--benchmark") == 0) {
+    benchmarkEnabled = true;
+  }
+  else if (strcmp(argv[i], "--benchmark-frames") == 0 && i + 1 < argc) {
+    measuredFrames = atoi(argv[++i]);
+    if (measuredFrames < 1)
+      measuredFrames = 1;
+  }
+  else if (strcmp(argv[i], "--benchmark-warmup") == 0 && i + 1 < argc) {
+    warmupFrames = atoi(argv[++i]);
+    if (warmupFrames < 0)
+      warmupFrames = 0;
+  }
+  else if (strcmp(argv[i], "--camera-path") == 0 && i + 1 < argc) {
+    cameraPathFile = argv[++i];
+  }
+  else if (strcmp(argv[i], "--benchmark-output") == 0 && i + 1 < argc) {
+    outputFile = argv[++i];
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+void printBenchmarkUsage()
+{
+  fprintf(stderr, "  --benchmark            time a fixed camera path with occlusion off, then on\n");
+  fprintf(stderr, "  --benchmark-frames N   measured frames per state (default 300)\n");
+  fprintf(stderr, "  --benchmark-warmup N   untimed frames before each state (default 30)\n");
+  fprintf(stderr, "  --camera-path FILE     eye and lookat keyframes, one per line (default: orbit)\n");
+  fprintf(stderr, "  --benchmark-output F   write results to F, as JSON if it ends in .json, else CSV\n");
+}
+
+void startBenchmark()
+{
+  startPose.eye = eye;
+  startPose.lookat = lookat;
+  if (!cameraPathFile.empty())
+    loadCameraPath(cameraPathFile.c_str());
+
+  finishEachPass = true;
+  phase = 0;
+  phaseFrame = 0;
+  for (int p = 0; p < phaseCount; p++) {
+    frameMs[p].clear();
+    for (int pass = 0; pass < passCount; pass++)
+      passMs[p][pass].clear();
+  }
+
+  printf("Benchmarking %d frames (after %d warm-up frames) with occlusion off, then on (%s)...\n",
+      measuredFrames, warmupFrames, aoModeName());
+}
+
+void beginBenchmarkFrame()
+{
+  ambientOcclusionState = phase;
+  if (phaseFrame == 0)
+    aoHistoryValid = false;
+
+  // Warm-up frames all look from the start of the path
+  int measured = phaseFrame - warmupFrames;
+  double t = measured > 0 && measuredFrames > 1 ? (double)measured / (measuredFrames - 1) : 0.0;
+  CameraKey pose = cameraPose(t);
+  eye = pose.eye;
+  lookat = pose.lookat;
+
+  glFinish();
+  frameStart = wallClockMs();
+}
+
+bool endBenchmarkFrame()
+{
+  glFinish();
+  double elapsed = wallClockMs() - frameStart;
+
+  if (phaseFrame >= warmupFrames) {
+    frameMs[phase].push_back(elapsed);
+    for (int pass = 0; pass < passCount; pass++) {
+      if (lastPassMs[pass] >= 0.0)
+        passMs[phase][pass].push_back(lastPassMs[pass]);
+    }
+  }
+
+  phaseFrame++;
+  if (phaseFrame < warmupFrames + measuredFrames)
+    return false;
+
+  phase++;
+  phaseFrame = 0;
+  if (phase < phaseCount)
+    return false;
+
+  finishEachPass = false;
+  writeResults();
+  return true;
+}
@@ -0,0 +1,28 @@
+// File: benchmark.h
+//
+// Benchmark mode: flies the camera along a fixed path for a fixed number of
+// frames, first with ambient occlusion off and then on, and reports the
+// distribution of frame and pass times. Works the same under GLUT and
+// headless; the caller brackets each frame it draws with
+// beginBenchmarkFrame() and endBenchmarkFrame().
+
+#ifndef SP_BENCHMARK_H_
+#define SP_BENCHMARK_H_
+
+extern bool benchmarkEnabled;
+
+// If argv[i] is one of the benchmark options, applies it, advances i past
+// any value it takes, and returns true
+bool parseBenchmarkArgument(int argc, char* argv[], int& i);
+void printBenchmarkUsage();
+
+// Loads the camera path and sets up the run. Call once the scene is loaded.
+void startBenchmark();
+
+// Sets up the camera and occlusion state for the next frame
+void beginBenchmarkFrame();
+// Records the frame just drawn (and presented, if there's a window). Returns
+// true once every frame has been drawn and the results are written out.
+bool endBenchmarkFrame();
+
+#endif // SP_BENCHMARK_H_
@@ -0,0 +1,439 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+
+#include "scene.h"
+#include "trace.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SP_BVH_SSE 1
+#include <emmintrin.h>
+#else
+#define SP_BVH_SSE 0
+#endif
+
+using std::vector;
+
+namespace {
+
+// Leaves hold at most this many instances, and split beyond it even when
+// the surface area heuristic would rather not
+const int maxLeafSize = 8;
+// Candidate split planes per axis
+const int binCount = 16;
+
+void emptyBounds(AABB& bounds)
+{
+  for (int axis = 0; axis < 3; axis++) {
+    bounds.min[axis] = FLT_MAX;
+    bounds.max[axis] = -FLT_MAX;
+  }
+}
+
+void growBounds(AABB& bounds, const AABB& other)
+{
+  for (int axis = 0; axis < 3; axis++) {
+    bounds.min[axis] = std::min(bounds.min[axis], other.min[axis]);
+    bounds.max[axis] = std::max(bounds.max[axis], other.max[axis]);
+  }
+}
+
+double surfaceArea(const AABB& bounds)
+{
+  double size[3];
+  for (int axis = 0; axis < 3; axis++)
+    size[axis] = std::max(0.0f, bounds.max[axis] - bounds.min[axis]);
+  return 2.0 * (size[0] * size[1] + size[1] * size[2] + size[2] * size[0]);
+}
+
+bool sameBounds(const AABB& a, const AABB& b)
+{
+  for (int axis = 0; axis < 3; axis++) {
+    if (a.min[axis] != b.min[axis] || a.max[axis] != b.max[axis])
+      return false;
+  }
+  return true;
+}
+
+float centroid(const AABB& bounds, int axis)
+{
+  return (bounds.min[axis] + bounds.max[axis]) * 0.5f;
+}
+
+// Sets a node's bounds from what's under it
+void fitNode(InstanceBVH& bvh, int index)
+{
+  BVHNode& node = bvh.nodes[index];
+  emptyBounds(node.bounds);
+  if (node.count > 0) {
+    for (int i = node.first; i < node.first + node.count; i++)
+      growBounds(node.bounds, bvh.bounds[bvh.primitives[i]]);
+  }
+  else {
+    growBounds(node.bounds, bvh.nodes[node.first].bounds);
+    growBounds(node.bounds, bvh.nodes[node.first + 1].bounds);
+  }
+}
+
+// Splits a node in two, or leaves it a leaf if that's cheaper. New nodes
+// are appended and pushed onto "pending".
+void splitNode(InstanceBVH& bvh, int index, vector<int>& pending)
+{
+  BVHNode node = bvh.nodes[index];
+  AABB centroids;
+  emptyBounds(centroids);
+  for (int i = node.first; i < node.first + node.count; i++) {
+    const AABB& bounds = bvh.bounds[bvh.primitives[i]];
+    for (int axis = 0; axis < 3; axis++) {
+      float c = centroid(bounds, axis);
+      centroids.min[axis] = std::min(centroids.min[axis], c);
+      centroids.max[axis] = std::max(centroids.max[axis], c);
+    }
+  }
+
+  // Bin the centroids along each axis and sweep for the cheapest split
+  double bestCost = DBL_MAX;
+  int bestAxis = -1;
+  int bestBin = 0;
+  for (int axis = 0; axis < 3; axis++) {
+    float extent = centroids.max[axis] - centroids.min[axis];
+    if (extent <= 0.0f)
+      continue;
+    float binScale = binCount / extent;
+    int counts[binCount] = { 0 };
+    AABB bins[binCount];
+    for (int bin = 0; bin < binCount; bin++)
+      emptyBounds(bins[bin]);
+    for (int i = node.first; i < node.first + node.count; i++) {
+      const AABB& bounds = bvh.bounds[bvh.primitives[i]];
+      int bin = std::min(binCount - 1, (int)((centroid(bounds, axis) - centroids.min[axis]) * binScale));
+      counts[bin]++;
+      growBounds(bins[bin], bounds);
+    }
+
+    // rightArea[b] covers bins b and up
+    double rightArea[binCount];
+    int rightCount[binCount];
+    AABB right;
+    emptyBounds(right);
+    int count = 0;
+    for (int bin = binCount - 1; bin > 0; bin--) {
+      growBounds(right, bins[bin]);
+      count += counts[bin];
+      rightArea[bin] = surfaceArea(right);
+      rightCount[bin] = count;
+    }
+    AABB left;
+    emptyBounds(left);
+    count = 0;
+    for (int bin = 0; bin < binCount - 1; bin++) {
+      growBounds(left, bins[bin]);
+      count += counts[bin];
+      if (count == 0 || rightCount[bin + 1] == 0)
+        continue;
+      double cost = count * surfaceArea(left) + rightCount[bin + 1] * rightArea[bin + 1];
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestBin = bin;
+      }
+    }
+  }
+
+  // Testing a node costs about what testing an instance does, and a child is
+  // reached about as often as its share of the parent's surface area
+  double nodeArea = surfaceArea(node.bounds);
+  double splitCost = nodeArea > 0.0 ? 1.0 + bestCost / nodeArea : DBL_MAX;
+  if (node.count <= maxLeafSize && (bestAxis < 0 || splitCost >= node.count))
+    return;
+
+  int* begin = &bvh.primitives[node.first];
+  int* end = begin + node.count;
+  int* middle;
+  if (bestAxis >= 0) {
+    float binScale = binCount / (centroids.max[bestAxis] - centroids.min[bestAxis]);
+    float minCentroid = centroids.min[bestAxis];
+    const vector<AABB>& bounds = bvh.bounds;
+    middle = std::partition(begin, end, [&](int primitive) {
+      int bin = std::min(binCount - 1, (int)((centroid(bounds[primitive], bestAxis) - minCentroid) * binScale));
+      return bin <= bestBin;
+    });
+  }
+  else {
+    // Every centroid is in the same place; any split will do
+    middle = begin + node.count / 2;
+  }
+
+  int leftCount = (int)(middle - begin);
+  BVHNode children[2];
+  children[0].first = node.first;
+  children[0].count = leftCount;
+  children[1].first = node.first + leftCount;
+  children[1].count = node.count - leftCount;
+  int firstChild = (int)bvh.nodes.size();
+  for (int child = 0; child < 2; child++) {
+    children[child].parent = index;
+    bvh.nodes.push_back(children[child]);
+    fitNode(bvh, firstChild + child);
+    pending.push_back(firstChild + child);
+  }
+  bvh.nodes[index].first = firstChild;
+  bvh.nodes[index].count = 0;
+}
+
+// Which side of the planes a box is on: outside one, inside all of them
+// (as far as "planeMask" goes; unset bits are planes the box is already
+// known to be inside), or neither
+enum PlaneTest { outsidePlanes, insidePlanes, crossingPlanes };
+
+#if SP_BVH_SSE
+// The planes as four lanes a group, the second group padded out with
+// planes everything is inside
+struct PlaneGroups
+{
+  __m128 a[2], b[2], c[2], d[2];
+  __m128 absA[2], absB[2], absC[2];
+};
+
+void groupPlanes(const Frustum& frustum, PlaneGroups& groups)
+{
+  float lanes[4][8];
+  for (int plane = 0; plane < 8; plane++) {
+    for (int k = 0; k < 4; k++)
+      lanes[k][plane] = plane < 6 ? frustum.planes[plane][k] : (k == 3 ? FLT_MAX : 0.0f);
+  }
+  __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  for (int group = 0; group < 2; group++) {
+    groups.a[group] = _mm_loadu_ps(&lanes[0][group * 4]);
+    groups.b[group] = _mm_loadu_ps(&lanes[1][group * 4]);
+    groups.c[group] = _mm_loadu_ps(&lanes[2][group * 4]);
+    groups.d[group] = _mm_loadu_ps(&lanes[3][group * 4]);
+    groups.absA[group] = _mm_and_ps(groups.a[group], signMask);
+    groups.absB[group] = _mm_and_ps(groups.b[group], signMask);
+    groups.absC[group] = _mm_and_ps(groups.c[group], signMask);
+  }
+}
+
+// Tests the box's center against each plane, allowing for how far its
+// corners reach towards that plane. Clears bits of "planeMask" for planes
+// the box is inside.
+PlaneTest testBox(const AABB& box, const PlaneGroups& planes, int& planeMask)
+{
+  __m128 cx = _mm_set1_ps((box.min[0] + box.max[0]) * 0.5f);
+  __m128 cy = _mm_set1_ps((box.min[1] + box.max[1]) * 0.5f);
+  __m128 cz = _mm_set1_ps((box.min[2] + box.max[2]) * 0.5f);
+  __m128 ex = _mm_set1_ps((box.max[0] - box.min[0]) * 0.5f);
+  __m128 ey = _mm_set1_ps((box.max[1] - box.min[1]) * 0.5f);
+  __m128 ez = _mm_set1_ps((box.max[2] - box.min[2]) * 0.5f);
+  int outside = 0;
+  int inside = 0;
+  for (int group = 0; group < 2; group++) {
+    __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planes.a[group], cx), _mm_mul_ps(planes.b[group], cy)),
+        _mm_add_ps(_mm_mul_ps(planes.c[group], cz), planes.d[group]));
+    __m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planes.absA[group], ex), _mm_mul_ps(planes.absB[group], ey)),
+        _mm_mul_ps(planes.absC[group], ez));
+    outside |= _mm_movemask_ps(_mm_cmplt_ps(distance, _mm_sub_ps(_mm_setzero_ps(), reach))) << (group * 4);
+    inside |= _mm_movemask_ps(_mm_cmpge_ps(distance, reach)) << (group * 4);
+  }
+  if (outside & planeMask)
+    return outsidePlanes;
+  planeMask &= ~inside;
+  return planeMask == 0 ? insidePlanes : crossingPlanes;
+}
+#else
+typedef Frustum PlaneGroups;
+
+void groupPlanes(const Frustum& frustum, PlaneGroups& groups)
+{
+  groups = frustum;
+}
+
+PlaneTest testBox(const AABB& box, const PlaneGroups& planes, int& planeMask)
+{
+  for (int plane = 0; plane < 6; plane++) {
+    if (!(planeMask & (1 << plane)))
+      continue;
+    const float* p = planes.planes[plane];
+    float distance = p[3], reach = 0.0f;
+    for (int axis = 0; axis < 3; axis++) {
+      distance += p[axis] * (box.min[axis] + box.max[axis]) * 0.5f;
+      reach += fabsf(p[axis]) * (box.max[axis] - box.min[axis]) * 0.5f;
+    }
+    if (distance < -reach)
+      return outsidePlanes;
+    if (distance >= reach)
+      planeMask &= ~(1 << plane);
+  }
+  return planeMask == 0 ? insidePlanes : crossingPlanes;
+}
+#endif
+
+}
+
+void vertexDataBounds(const float* vertexData, size_t floats, AABB& bounds)
+{
+  emptyBounds(bounds);
+  for (size_t vertex = 0; vertex + floatsPerVertex <= floats; vertex += floatsPerVertex) {
+    for (int axis = 0; axis < 3; axis++) {
+      bounds.min[axis] = std::min(bounds.min[axis], vertexData[vertex + axis]);
+      bounds.max[axis] = std::max(bounds.max[axis], vertexData[vertex + axis]);
+    }
+  }
+}
+
+void transformBounds(const AABB& bounds, const Mat4& transform, AABB& result)
+{
+  // Column-major: row r, column c is at c * 4 + r
+  const float* m = &transform.m11;
+  for (int row = 0; row < 3; row++) {
+    result.min[row] = result.max[row] = m[12 + row];
+    for (int column = 0; column < 3; column++) {
+      float a = m[column * 4 + row] * bounds.min[column];
+      float b = m[column * 4 + row] * bounds.max[column];
+      result.min[row] += std::min(a, b);
+      result.max[row] += std::max(a, b);
+    }
+  }
+}
+
+void frustumFromMatrix(const Mat4& viewProj, Frustum& frustum)
+{
+  // A point is inside when -w <= x, y, z <= w in clip space, so each plane
+  // is the last row of the matrix plus or minus one of the others
+  const float* m = &viewProj.m11;
+  for (int plane = 0; plane < 6; plane++) {
+    int row = plane / 2;
+    float sign = plane % 2 == 0 ? 1.0f : -1.0f;
+    for (int k = 0; k < 4; k++)
+      frustum.planes[plane][k] = m[k * 4 + 3] + sign * m[k * 4 + row];
+    float length = sqrtf(frustum.planes[plane][0] * frustum.planes[plane][0] +
+        frustum.planes[plane][1] * frustum.planes[plane][1] + frustum.planes[plane][2] * frustum.planes[plane][2]);
+    if (length > 0.0f) {
+      for (int k = 0; k < 4; k++)
+        frustum.planes[plane][k] /= length;
+    }
+  }
+}
+
+void buildBVH(const vector<AABB>& bounds, InstanceBVH& bvh)
+{
+  TRACE_ZONE("buildBVH");
+  int count = (int)bounds.size();
+  bvh.bounds = bounds;
+  bvh.nodes.clear();
+  bvh.primitives.resize(count);
+  for (int i = 0; i < count; i++)
+    bvh.primitives[i] = i;
+  bvh.leafOf.assign(count, 0);
+  bvh.builtArea = bvh.area = 0.0;
+  if (count == 0)
+    return;
+
+  bvh.nodes.reserve(2 * count);
+  BVHNode root = { AABB(), 0, count, -1 };
+  bvh.nodes.push_back(root);
+  fitNode(bvh, 0);
+  vector<int> pending(1, 0);
+  while (!pending.empty()) {
+    int index = pending.back();
+    pending.pop_back();
+    splitNode(bvh, index, pending);
+  }
+
+  for (size_t index = 0; index < bvh.nodes.size(); index++) {
+    const BVHNode& node = bvh.nodes[index];
+    bvh.area += surfaceArea(node.bounds);
+    for (int i = node.first; node.count > 0 && i < node.first + node.count; i++)
+      bvh.leafOf[bvh.primitives[i]] = (int)index;
+  }
+  bvh.builtArea = bvh.area;
+}
+
+bool updateBVH(InstanceBVH& bvh, const vector<int>& changed, const vector<AABB>& bounds)
+{
+  TRACE_ZONE("updateBVH");
+  if (bvh.bounds.size() != bounds.size()) {
+    buildBVH(bounds, bvh);
+    return true;
+  }
+
+  for (size_t i = 0; i < changed.size(); i++)
+    bvh.bounds[changed[i]] = bounds[changed[i]];
+
+  if (changed.size() * 8 > bvh.nodes.size()) {
+    // With this many changes, most nodes would be refit several times over
+    // on the way up; once each, children before parents, is cheaper
+    bvh.area = 0.0;
+    for (int index = (int)bvh.nodes.size() - 1; index >= 0; index--) {
+      fitNode(bvh, index);
+      bvh.area += surfaceArea(bvh.nodes[index].bounds);
+    }
+  }
+  else {
+    // Refit from each changed leaf up, stopping where nothing changes
+    for (size_t i = 0; i < changed.size(); i++) {
+      for (int index = bvh.leafOf[changed[i]]; index >= 0; index = bvh.nodes[index].parent) {
+        AABB old = bvh.nodes[index].bounds;
+        fitNode(bvh, index);
+        if (sameBounds(old, bvh.nodes[index].bounds))
+          break;
+        bvh.area += surfaceArea(bvh.nodes[index].bounds) - surfaceArea(old);
+      }
+    }
+  }
+
+  if (bvh.area > 2.0 * bvh.builtArea) {
+    buildBVH(bounds, bvh);
+    return true;
+  }
+  return false;
+}
+
+void cullBVH(const InstanceBVH& bvh, const Frustum& frustum, vector<int>& visible, CullStats* stats)
+{
+  TRACE_ZONE("cullBVH");
+  visible.clear();
+  int nodesVisited = 0;
+  if (!bvh.nodes.empty()) {
+    PlaneGroups planes;
+    groupPlanes(frustum, planes);
+
+    // Each entry carries the planes its node still has to be tested against
+    const int allPlanes = (1 << 6) - 1;
+    struct Entry { int node; int planeMask; };
+    vector<Entry> stack;
+    stack.reserve(64);
+    Entry root = { 0, allPlanes };
+    stack.push_back(root);
+    while (!stack.empty()) {
+      Entry entry = stack.back();
+      stack.pop_back();
+      const BVHNode& node = bvh.nodes[entry.node];
+      nodesVisited++;
+      if (entry.planeMask != 0 && testBox(node.bounds, planes, entry.planeMask) == outsidePlanes)
+        continue;
+
+      if (node.count == 0) {
+        Entry children[2] = { { node.first + 1, entry.planeMask }, { node.first, entry.planeMask } };
+        stack.push_back(children[0]);
+        stack.push_back(children[1]);
+        continue;
+      }
+      for (int i = node.first; i < node.first + node.count; i++) {
+        int primitive = bvh.primitives[i];
+        int planeMask = entry.planeMask;
+        if (planeMask == 0 || testBox(bvh.bounds[primitive], planes, planeMask) != outsidePlanes)
+          visible.push_back(primitive);
+      }
+    }
+  }
+
+  if (stats != NULL) {
+    stats->visible = (int)visible.size();
+    stats->culled = (int)bvh.primitives.size() - stats->visible;
+    stats->nodesVisited = nodesVisited;
+  }
+}
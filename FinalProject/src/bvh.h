@@ -0,0 +1,86 @@
+// File: bvh.h
+//
+// A bounding volume hierarchy over scene instances, for frustum culling. It's
+// built once over every instance's world-space box, refit when instances
+// move, and rebuilt from scratch only when refitting has loosened it too
+// much. Culling walks it with the six frustum planes, four at a time with
+// SSE, and skips the plane tests for whole subtrees that are fully inside.
+
+#ifndef SP_BVH_H_
+#define SP_BVH_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "mat4.h"
+
+// An axis-aligned box
+struct AABB
+{
+  float min[3];
+  float max[3];
+};
+
+// Bounds of "floats" floats of vertex data in scene.h's format
+void vertexDataBounds(const float* vertexData, size_t floats, AABB& bounds);
+
+// Bounds of "bounds" after "transform"
+void transformBounds(const AABB& bounds, const Mat4& transform, AABB& result);
+
+// The planes bounding what "viewProj" (projection times view) maps into the
+// view volume, as a*x + b*y + c*z + d >= 0 inside, normalized so d is a
+// distance. Left, right, bottom, top, near, far.
+struct Frustum
+{
+  float planes[6][4];
+};
+void frustumFromMatrix(const Mat4& viewProj, Frustum& frustum);
+
+// A node is a leaf if "count" is nonzero, covering "count" entries of
+// InstanceBVH::primitives from "first"; otherwise its children are nodes
+// "first" and "first" + 1. Children always come after their parent.
+struct BVHNode
+{
+  AABB bounds;
+  int first;
+  int count;
+  int parent;
+};
+
+struct InstanceBVH
+{
+  std::vector<BVHNode> nodes;
+  // Instance indices, in leaf order
+  std::vector<int> primitives;
+  // The leaf each instance is in
+  std::vector<int> leafOf;
+  // Each instance's bounds as of the last build or refit
+  std::vector<AABB> bounds;
+  // Total surface area of the nodes, just after the last build and now.
+  // Culling costs about this much, so it's what refitting is judged by.
+  double builtArea;
+  double area;
+};
+
+// Builds "bvh" over "bounds", one per instance, splitting where the surface
+// area heuristic says is cheapest
+void buildBVH(const std::vector<AABB>& bounds, InstanceBVH& bvh);
+
+// Gives the instances in "changed" their new "bounds" and refits the nodes
+// above them. Rebuilds instead once the tree's area has doubled since it was
+// built. Returns true if it rebuilt.
+bool updateBVH(InstanceBVH& bvh, const std::vector<int>& changed, const std::vector<AABB>& bounds);
+
+// What one cullBVH() call did
+struct CullStats
+{
+  int visible;
+  int culled;
+  int nodesVisited;
+};
+
+// Sets "visible" to the instances whose boxes aren't entirely outside one of
+// the planes of "frustum", in leaf order. "stats" may be NULL.
+void cullBVH(const InstanceBVH& bvh, const Frustum& frustum, std::vector<int>& visible, CullStats* stats);
+
+#endif // SP_BVH_H_
@@ -0,0 +1,414 @@
+#include "capture.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#define dup _dup
+#define dup2 _dup2
+#define fdopen _fdopen
+#define fileno _fileno
+#else
+#include <unistd.h>
+#endif
+
+#include "image.h"
+#include "trace.h"
+#include "walltime.h"
+
+using std::string;
+using std::vector;
+
+bool captureEnabled = false;
+
+namespace {
+
+// One buffer of the readback ring
+struct CaptureSlot
+{
+  GLuint buffer;
+  GLsync fence;
+  // Read into, and not yet handed to the writer
+  bool pending;
+  int frameNumber;
+};
+
+// A frame on its way to (or back from) the writer
+struct CapturedFrame
+{
+  int frameNumber;
+  // RGBA, bottom row first, as glReadPixels() gives it
+  vector<unsigned char> pixels;
+};
+
+CaptureFormat format = captureNone;
+string outputPath;
+int framesPerSecond = 60;
+FILE* videoFile = NULL;
+bool videoHeaderWritten = false;
+
+GLuint sourceFramebuffer = 0;
+int frameWidth = 0;
+int frameHeight = 0;
+bool useFences = false;
+
+CaptureSlot slots[captureRingSize];
+// The slot the next frame goes in, which is also the oldest one in flight
+int nextSlot = 0;
+int framesIssued = 0;
+
+// Shared with the writer thread
+std::thread writer;
+std::mutex queueMutex;
+std::condition_variable queueChanged;
+std::deque<CapturedFrame*> writeQueue;
+vector<CapturedFrame*> freeFrames;
+vector<CapturedFrame*> allFrames;
+bool writerStopping = false;
+std::atomic<bool> writeFailed(false);
+
+// Counters for finishCapture()
+int framesWritten = 0;
+int readbackWaits = 0;
+int writerWaits = 0;
+double mapMs = 0.0;
+
+void failWrite(const string& what)
+{
+  if (!writeFailed.exchange(true))
+    fprintf(stderr, "Couldn't write %s, capture stopped.\n", what.c_str());
+}
+
+void writePPMFrame(const CapturedFrame& frame, vector<unsigned char>& rgb)
+{
+  int count = frameWidth * frameHeight;
+  rgb.resize(count * 3);
+  for (int i = 0; i < count; i++) {
+    rgb[i * 3] = frame.pixels[i * 4];
+    rgb[i * 3 + 1] = frame.pixels[i * 4 + 1];
+    rgb[i * 3 + 2] = frame.pixels[i * 4 + 2];
+  }
+  char name[32];
+  sprintf(name, "frame_%04d.ppm", frame.frameNumber);
+  string path = outputPath + "/" + name;
+  if (!writePPM(path.c_str(), &rgb[0], frameWidth, frameHeight, true))
+    failWrite(path);
+}
+
+// 4:2:0 BT.601 video range, each chroma sample the average of a 2x2 block
+void writeY4MFrame(const CapturedFrame& frame, vector<unsigned char>& yuv)
+{
+  int chromaWidth = (frameWidth + 1) / 2;
+  int chromaHeight = (frameHeight + 1) / 2;
+  yuv.resize(frameWidth * frameHeight + 2 * chromaWidth * chromaHeight);
+  unsigned char* yPlane = &yuv[0];
+  unsigned char* uPlane = yPlane + frameWidth * frameHeight;
+  unsigned char* vPlane = uPlane + chromaWidth * chromaHeight;
+
+  for (int y = 0; y < frameHeight; y++) {
+    // Video rows run top down
+    const unsigned char* row = &frame.pixels[(frameHeight - 1 - y) * frameWidth * 4];
+    for (int x = 0; x < frameWidth; x++) {
+      const unsigned char* p = row + x * 4;
+      yPlane[y * frameWidth + x] = (unsigned char)(16.5f + 0.2568f * p[0] + 0.5041f * p[1] + 0.0979f * p[2]);
+    }
+  }
+  for (int cy = 0; cy < chromaHeight; cy++) {
+    for (int cx = 0; cx < chromaWidth; cx++) {
+      float r = 0.0f, g = 0.0f, b = 0.0f;
+      for (int dy = 0; dy < 2; dy++) {
+        int y = std::min(cy * 2 + dy, frameHeight - 1);
+        const unsigned char* row = &frame.pixels[(frameHeight - 1 - y) * frameWidth * 4];
+        for (int dx = 0; dx < 2; dx++) {
+          const unsigned char* p = row + std::min(cx * 2 + dx, frameWidth - 1) * 4;
+          r += p[0];
+          g += p[1];
+          b += p[2];
+        }
+      }
+      r *= 0.25f;
+      g *= 0.25f;
+      b *= 0.25f;
+      uPlane[cy * chromaWidth + cx] = (unsigned char)(128.5f - 0.1482f * r - 0.2910f * g + 0.4392f * b);
+      vPlane[cy * chromaWidth + cx] = (unsigned char)(128.5f + 0.4392f * r - 0.3678f * g - 0.0714f * b);
+    }
+  }
+
+  if (!videoHeaderWritten) {
+    fprintf(videoFile, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", frameWidth, frameHeight, framesPerSecond);
+    videoHeaderWritten = true;
+  }
+  fputs("FRAME\n", videoFile);
+  if (fwrite(&yuv[0], 1, yuv.size(), videoFile) != yuv.size())
+    failWrite(outputPath);
+}
+
+void writerLoop()
+{
+  traceSetThreadName("capture writer");
+  vector<unsigned char> converted;
+  for (;;) {
+    CapturedFrame* frame;
+    {
+      std::unique_lock<std::mutex> lock(queueMutex);
+      queueChanged.wait(lock, [] { return !writeQueue.empty() || writerStopping; });
+      if (writeQueue.empty())
+        return;
+      frame = writeQueue.front();
+      writeQueue.pop_front();
+    }
+
+    if (!writeFailed) {
+      TRACE_ZONE("writeCapturedFrame");
+      if (format == capturePPM)
+        writePPMFrame(*frame, converted);
+      else
+        writeY4MFrame(*frame, converted);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      freeFrames.push_back(frame);
+    }
+    queueChanged.notify_all();
+  }
+}
+
+// A frame to copy into, waiting for the writer to give one back if they're
+// all queued
+CapturedFrame* takeFreeFrame()
+{
+  std::unique_lock<std::mutex> lock(queueMutex);
+  if (freeFrames.empty()) {
+    TRACE_ZONE("waitForCaptureWriter");
+    writerWaits++;
+    queueChanged.wait(lock, [] { return !freeFrames.empty(); });
+  }
+  CapturedFrame* frame = freeFrames.back();
+  freeFrames.pop_back();
+  return frame;
+}
+
+// Hands a slot's frame to the writer once the GPU has finished copying it.
+// Without "wait", gives up (returning false) if it hasn't.
+bool collectSlot(CaptureSlot& slot, bool wait)
+{
+  if (!slot.pending)
+    return true;
+
+  if (useFences) {
+    GLenum status = glClientWaitSync(slot.fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+      if (!wait)
+        return false;
+      TRACE_ZONE("waitForReadback");
+      readbackWaits++;
+      do {
+        status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+      } while (status == GL_TIMEOUT_EXPIRED);
+    }
+    glDeleteSync(slot.fence);
+    slot.fence = 0;
+  }
+  else if (!wait) {
+    // With no way to ask, leave frames until their buffer is needed again,
+    // by when the copy is almost certainly done
+    return false;
+  }
+
+  CapturedFrame* frame = takeFreeFrame();
+  double start = wallClockMs();
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+  const void* data = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+  if (data != NULL) {
+    memcpy(&frame->pixels[0], data, frame->pixels.size());
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  mapMs += wallClockMs() - start;
+  slot.pending = false;
+
+  if (data == NULL) {
+    fprintf(stderr, "Couldn't map captured frame %d.\n", slot.frameNumber);
+    std::lock_guard<std::mutex> lock(queueMutex);
+    freeFrames.push_back(frame);
+    return true;
+  }
+
+  frame->frameNumber = slot.frameNumber;
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    writeQueue.push_back(frame);
+  }
+  queueChanged.notify_all();
+  framesWritten++;
+  return true;
+}
+
+}
+
+bool parseCaptureArgument(int argc, char* argv[], int& i)
+{
+  if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+    setCaptureOutput(capturePPM, argv[++i]);
+  }
+  else if (strcmp(argv[i], "--capture-y4m") == 0 && i + 1 < argc) {
+    setCaptureOutput(captureY4M, argv[++i]);
+  }
+  else if (strcmp(argv[i], "--capture-fps") == 0 && i + 1 < argc) {
+    framesPerSecond = atoi(argv[++i]);
+    if (framesPerSecond < 1)
+      framesPerSecond = 1;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+void printCaptureUsage()
+{
+  fprintf(stderr, "  --capture DIR          write every frame to DIR/frame_NNNN.ppm\n");
+  fprintf(stderr, "  --capture-y4m FILE     write every frame to FILE as y4m video (- for stdout)\n");
+  fprintf(stderr, "  --capture-fps N        frame rate the y4m header gives (default 60)\n");
+}
+
+void setCaptureOutput(CaptureFormat newFormat, const char* path)
+{
+  format = newFormat;
+  outputPath = path;
+  captureEnabled = true;
+  if (format != captureY4M)
+    return;
+
+  if (strcmp(path, "-") == 0) {
+    // Keep the real stdout for the video, and send everything else printed
+    // there to stderr so it can't end up in the stream
+    fflush(stdout);
+    videoFile = fdopen(dup(fileno(stdout)), "wb");
+    dup2(fileno(stderr), fileno(stdout));
+    outputPath = "stdout";
+  }
+  else {
+    videoFile = fopen(path, "wb");
+  }
+  if (videoFile == NULL) {
+    fprintf(stderr, "Couldn't open %s\n", path);
+    exit(1);
+  }
+#ifdef _WIN32
+  _setmode(fileno(videoFile), _O_BINARY);
+#endif
+}
+
+void startCapture(GLuint framebuffer, int width, int height)
+{
+  if (!captureEnabled)
+    return;
+  if (!GLEW_VERSION_2_1 && !GLEW_ARB_pixel_buffer_object) {
+    printf("No pixel buffer object support, not capturing.\n");
+    captureEnabled = false;
+    return;
+  }
+  useFences = GLEW_VERSION_3_2 || GLEW_ARB_sync;
+
+  sourceFramebuffer = framebuffer;
+  frameWidth = width;
+  frameHeight = height;
+  GLsizeiptr size = (GLsizeiptr)width * height * 4;
+  for (int i = 0; i < captureRingSize; i++) {
+    glGenBuffers(1, &slots[i].buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slots[i].buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+    slots[i].fence = 0;
+    slots[i].pending = false;
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  for (int i = 0; i < captureQueueFrames; i++) {
+    CapturedFrame* frame = new CapturedFrame;
+    frame->pixels.resize(size);
+    allFrames.push_back(frame);
+    freeFrames.push_back(frame);
+  }
+  writerStopping = false;
+  writer = std::thread(writerLoop);
+
+  printf("Capturing frames to %s%s.\n", outputPath.c_str(), format == captureY4M ? " as y4m" : "");
+}
+
+void captureFrame()
+{
+  if (!captureEnabled || writeFailed)
+    return;
+  TRACE_ZONE("captureFrame");
+
+  // Hand over whatever has finished copying, oldest first, stopping at the
+  // first that hasn't so frames reach the writer in order
+  for (int i = 0; i < captureRingSize; i++) {
+    if (!collectSlot(slots[(nextSlot + i) % captureRingSize], false))
+      break;
+  }
+
+  // The whole ring is in flight, so the oldest has to finish first
+  CaptureSlot& slot = slots[nextSlot];
+  collectSlot(slot, true);
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, sourceFramebuffer);
+  glReadBuffer(sourceFramebuffer == 0 ? GL_BACK : GL_COLOR_ATTACHMENT0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+  // With a pack buffer bound this only queues the copy
+  glReadPixels(0, 0, frameWidth, frameHeight, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  if (useFences)
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  slot.pending = true;
+  slot.frameNumber = framesIssued++;
+  nextSlot = (nextSlot + 1) % captureRingSize;
+}
+
+bool finishCapture()
+{
+  if (!captureEnabled)
+    return true;
+  TRACE_ZONE("finishCapture");
+  for (int i = 0; i < captureRingSize; i++)
+    collectSlot(slots[(nextSlot + i) % captureRingSize], true);
+
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    writerStopping = true;
+  }
+  queueChanged.notify_all();
+  writer.join();
+
+  for (int i = 0; i < captureRingSize; i++)
+    glDeleteBuffers(1, &slots[i].buffer);
+  for (size_t i = 0; i < allFrames.size(); i++)
+    delete allFrames[i];
+  allFrames.clear();
+  freeFrames.clear();
+  if (videoFile != NULL) {
+    if (fclose(videoFile) != 0)
+      failWrite(outputPath);
+    videoFile = NULL;
+  }
+  captureEnabled = false;
+
+  printf("Captured %d frames to %s (%.3f ms a frame mapping and copying). Waited for the GPU %d times and for the "
+      "writer %d times.\n", framesWritten, outputPath.c_str(), framesWritten > 0 ? mapMs / framesWritten : 0.0,
+      readbackWaits, writerWaits);
+  return !writeFailed;
+}
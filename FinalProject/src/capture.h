@@ -0,0 +1,52 @@
+// File: capture.h
+//
+// Saves rendered frames, to a PPM sequence or as a y4m video stream (which
+// encoders like ffmpeg read from a pipe), without stalling rendering. Each
+// frame is read into one of a ring of pixel buffer objects, so the copy
+// happens on the GPU's timeline, and a fence marks when it's done. A frame is
+// only mapped once its fence has passed, usually a frame or two later, and the
+// mapped pixels go to a writer thread, so neither the GPU readback nor the
+// disk or pipe ever holds up the next frame.
+
+#ifndef SP_CAPTURE_H_
+#define SP_CAPTURE_H_
+
+#include "GL/glew.h"
+
+// Frames of readbacks that can be in flight at once
+const int captureRingSize = 3;
+// Frames the writer can fall behind by before rendering waits for it
+const int captureQueueFrames = 8;
+
+enum CaptureFormat { captureNone, capturePPM, captureY4M };
+
+// Set once an output is chosen
+extern bool captureEnabled;
+
+// If argv[i] is one of the capture options, applies it, advances i past any
+// value it takes, and returns true
+bool parseCaptureArgument(int argc, char* argv[], int& i);
+void printCaptureUsage();
+
+// Captures to "path": a directory for capturePPM (frames are written as
+// frame_NNNN.ppm), a file or "-" (stdout) for captureY4M. Streaming to
+// stdout sends everything else printed there to stderr instead.
+void setCaptureOutput(CaptureFormat format, const char* path);
+
+// Creates the buffers and starts the writer thread. Frames are read from the
+// color of "framebuffer" (0 for the window's back buffer), which is "width"
+// by "height". Needs a current context; turns capture off if there's no
+// pixel buffer object support.
+void startCapture(GLuint framebuffer, int width, int height);
+
+// Queues a copy of the frame just drawn, and hands any earlier ones that have
+// finished copying to the writer. Only waits on the GPU if every buffer in
+// the ring is still busy.
+void captureFrame();
+
+// Waits for every frame still in flight to be written and stops the writer,
+// then prints how many frames were captured and how often anything waited.
+// Returns false if writing failed.
+bool finishCapture();
+
+#endif // SP_CAPTURE_H_
@@ -0,0 +1,71 @@
+#include "cpuframe.h"
+
+#include <cstddef>
+
+#include "scene.h"
+#include "kernel.h"
+#include "trace.h"
+#include "walltime.h"
+
+using std::vector;
+
+void sceneDraws(const vector<float>& modelData, vector<RasterDraw>& draws)
+{
+  draws.clear();
+  RasterDraw model = { modelData.empty() ? NULL : &modelData[0], (int)modelData.size() / floatsPerVertex,
+      &modelMaterial };
+  RasterDraw floor = { floorVertexData, floorVertexCount, &floorMaterial };
+  draws.push_back(model);
+  draws.push_back(floor);
+}
+
+void cpuOcclusionSettings(int kernelSize, int noiseSize, unsigned int seed, bool reconstructNormals,
+    SSAOSettings& settings)
+{
+  occlusionProjection(settings.projMat, settings.invProjMat);
+  generateSSAOKernel(kernelSize, seed, settings.sampleOffsets);
+  settings.sampleRadius = defaultSampleRadius;
+  settings.frameAngle = 0.0f;
+  generateRotationNoise(noiseSize, seed, settings.randomDirections);
+  settings.noiseSize = noiseSize;
+  settings.noiseShiftX = 0;
+  settings.noiseShiftY = 0;
+  settings.reconstructNormals = reconstructNormals;
+  settings.quantizeOcclusion = true;
+}
+
+void renderFrameCPU(const vector<RasterDraw>& draws, const SSAOSettings* settings, const Vec3& eye,
+    const Vec3& lookat, int threadCount, GBuffer& gbuffer, vector<unsigned char>& pixels,
+    CPUFrameTimes* times, RasterStats* stats)
+{
+  TRACE_ZONE("renderFrameCPU");
+  Mat4 view, proj;
+  sceneMatrices(eye, lookat, view, proj);
+  bool writeNormals = settings != NULL && !settings->reconstructNormals;
+
+  double start = wallClockMs();
+  rasterizeGBuffer(draws, view, proj, writeNormals, gbuffer, threadCount, stats);
+  double rasterDone = wallClockMs();
+
+  int pixelCount = gbuffer.width * gbuffer.height;
+  vector<float> blurred;
+  double occlusionDone = rasterDone;
+  if (settings != NULL) {
+    vector<float> occlusion;
+    computeOcclusionCPU(gbuffer, *settings, occlusion, threadCount);
+    occlusionDone = wallClockMs();
+    blurOcclusionCPU(occlusion, gbuffer.width, gbuffer.height, settings->quantizeOcclusion, blurred, threadCount);
+  }
+  else {
+    blurred.assign(pixelCount, 1.0f);
+  }
+  double blurDone = wallClockMs();
+  shadeWithOcclusionCPU(gbuffer, blurred, pixels);
+
+  if (times != NULL) {
+    times->rasterMs = rasterDone - start;
+    times->occlusionMs = occlusionDone - rasterDone;
+    times->blurMs = blurDone - occlusionDone;
+    times->totalMs = wallClockMs() - start;
+  }
+}
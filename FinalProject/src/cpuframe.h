@@ -0,0 +1,41 @@
+// File: cpuframe.h
+//
+// A whole frame on the CPU: the G-buffer from the software rasterizer, then
+// occlusion, blur and shading from the CPU occlusion pass. Shared by the CPU
+// renderer (cpurender.cpp) and the regression check (regress.cpp).
+
+#ifndef SP_CPUFRAME_H_
+#define SP_CPUFRAME_H_
+
+#include <vector>
+
+#include "vec3.h"
+#include "cpussao.h"
+#include "rasterizer.h"
+
+// How long each stage of a frame took, in ms
+struct CPUFrameTimes
+{
+  double rasterMs;
+  double occlusionMs;
+  double blurMs;
+  double totalMs;
+};
+
+// The draws drawModel() makes: the model in "modelData" (as loadModelMesh()
+// gives it, which has to outlive the draws) and then the floor
+void sceneDraws(const std::vector<float>& modelData, std::vector<RasterDraw>& draws);
+
+// Occlusion settings matching the GL renderers' fragment shader path, with
+// a kernel and rotation texture made from the given size and seed
+void cpuOcclusionSettings(int kernelSize, int noiseSize, unsigned int seed, bool reconstructNormals,
+    SSAOSettings& settings);
+
+// Renders "draws" seen from "eye" into "pixels" (8-bit RGB, bottom row
+// first), at the size "gbuffer" has set. Occlusion is skipped if "settings"
+// is NULL. "times" and "stats" may be NULL.
+void renderFrameCPU(const std::vector<RasterDraw>& draws, const SSAOSettings* settings, const Vec3& eye,
+    const Vec3& lookat, int threadCount, GBuffer& gbuffer, std::vector<unsigned char>& pixels,
+    CPUFrameTimes* times, RasterStats* stats);
+
+#endif // SP_CPUFRAME_H_
@@ -0,0 +1,258 @@
+// File: cpurender.cpp
+//
+// Renders the scene entirely on the CPU: the G-buffer with the software
+// rasterizer (rasterizer.cpp), then occlusion, blur and shading with the CPU
+// occlusion pass (cpussao.cpp). It uses no GL at all, so frames can be
+// rendered, checked and timed on machines with no GPU or display. The camera
+// orbits the model the same way the headless renderer's does.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "vec3.h"
+#include "scene.h"
+#include "kernel.h"
+#include "cpuframe.h"
+#include "parallel.h"
+#include "image.h"
+#include "stats.h"
+#include "trace.h"
+
+using std::string;
+using std::vector;
+
+// Options
+int frameCount = 60;
+int frameWidth = 1024;
+int frameHeight = 768;
+string outputDir;
+float orbitDegrees = 360.0f;
+int threadCount = 0;
+int kernelSize = defaultKernelSize;
+int noiseSize = defaultNoiseSize;
+unsigned int kernelSeed = defaultKernelSeed;
+bool ambientOcclusion = true;
+bool reconstructNormals = false;
+bool scaling = false;
+
+// Per-stage times of every frame rendered, in ms
+struct StageTimes
+{
+  vector<double> raster;
+  vector<double> occlusion;
+  vector<double> blur;
+  vector<double> total;
+};
+
+void printUsage(const char* program)
+{
+  fprintf(stderr, "Usage: %s [options]\n", program);
+  fprintf(stderr, "  --frames N             frames to render (default 60)\n");
+  fprintf(stderr, "  --size W H             frame size (default 1024 768)\n");
+  fprintf(stderr, "  --output DIR           write each frame to DIR/frame_NNNN.ppm\n");
+  fprintf(stderr, "  --orbit-degrees D      how far the camera circles over the run (default 360)\n");
+  fprintf(stderr, "  --threads N            threads to render with (default: one per core)\n");
+  fprintf(stderr, "  --scaling              time the frames at 1, 2, 4... threads up to one per core\n");
+  fprintf(stderr, "  --kernel-size N        occlusion samples per pixel (%d-%d, default %d)\n",
+      minKernelSize, maxKernelSize, defaultKernelSize);
+  fprintf(stderr, "  --noise-size N         rotation texture size (1-%d, default %d)\n", maxNoiseSize,
+      defaultNoiseSize);
+  fprintf(stderr, "  --seed N               kernel and rotation texture seed (default %u)\n", defaultKernelSeed);
+  fprintf(stderr, "  --no-ao                skip the occlusion pass\n");
+  fprintf(stderr, "  --reconstruct-normals  rebuild normals from depth instead of rasterizing them\n");
+  printTraceUsage();
+}
+
+void parseArguments(int argc, char* argv[])
+{
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frameCount = atoi(argv[++i]);
+      if (frameCount < 1)
+        frameCount = 1;
+    }
+    else if (strcmp(argv[i], "--size") == 0 && i + 2 < argc) {
+      frameWidth = atoi(argv[++i]);
+      frameHeight = atoi(argv[++i]);
+      if (frameWidth < 1 || frameHeight < 1) {
+        fprintf(stderr, "Frame size has to be positive.\n");
+        exit(1);
+      }
+    }
+    else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+      outputDir = argv[++i];
+    }
+    else if (strcmp(argv[i], "--orbit-degrees") == 0 && i + 1 < argc) {
+      orbitDegrees = (float)atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threadCount = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--scaling") == 0) {
+      scaling = true;
+    }
+    else if (strcmp(argv[i], "--kernel-size") == 0 && i + 1 < argc) {
+      kernelSize = atoi(argv[++i]);
+      if (kernelSize < minKernelSize)
+        kernelSize = minKernelSize;
+      if (kernelSize > maxKernelSize)
+        kernelSize = maxKernelSize;
+    }
+    else if (strcmp(argv[i], "--noise-size") == 0 && i + 1 < argc) {
+      noiseSize = atoi(argv[++i]);
+      if (noiseSize < 1)
+        noiseSize = 1;
+      if (noiseSize > maxNoiseSize)
+        noiseSize = maxNoiseSize;
+    }
+    else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      kernelSeed = (unsigned int)strtoul(argv[++i], NULL, 10);
+    }
+    else if (strcmp(argv[i], "--no-ao") == 0) {
+      ambientOcclusion = false;
+    }
+    else if (strcmp(argv[i], "--reconstruct-normals") == 0) {
+      reconstructNormals = true;
+    }
+    else if (!parseTraceArgument(argc, argv, i)) {
+      fprintf(stderr, "Unknown argument %s\n", argv[i]);
+      printUsage(argv[0]);
+      exit(1);
+    }
+  }
+}
+
+// The eye, moved around the model in the x/z plane by "frame"'s share of the
+// orbit, as the headless renderer places it
+Vec3 orbitEye(const Vec3& startEye, const Vec3& lookat, int frame)
+{
+  const static double pi = acos(0.0) * 2;
+  Vec3 offset = startEye.add(lookat.scale(-1));
+  float theta = (float)(orbitDegrees * pi / 180.0 * frame / frameCount);
+
+  Vec3 rotated;
+  rotated.x = (float)cos(theta)*offset.x + (float)sin(theta)*offset.z;
+  rotated.y = offset.y;
+  rotated.z =-(float)sin(theta)*offset.x + (float)cos(theta)*offset.z;
+  return lookat.add(rotated);
+}
+
+// Renders every frame with "threads" threads, adding up the stage times and
+// writing the frames out if "save" is set
+void renderFrames(const vector<RasterDraw>& draws, const SSAOSettings& settings, int threads, bool save,
+    StageTimes& times, RasterStats& lastStats)
+{
+  Vec3 lookat(0, 0, 0);
+  Vec3 startEye(0, 1.5f, 1.5f);
+
+  GBuffer gbuffer;
+  gbuffer.width = frameWidth;
+  gbuffer.height = frameHeight;
+  vector<unsigned char> pixels;
+
+  for (int frame = 0; frame < frameCount; frame++) {
+    CPUFrameTimes frameTimes;
+    renderFrameCPU(draws, ambientOcclusion ? &settings : NULL, orbitEye(startEye, lookat, frame), lookat, threads,
+        gbuffer, pixels, &frameTimes, &lastStats);
+    times.raster.push_back(frameTimes.rasterMs);
+    times.occlusion.push_back(frameTimes.occlusionMs);
+    times.blur.push_back(frameTimes.blurMs);
+    times.total.push_back(frameTimes.totalMs);
+
+    if (save) {
+      TRACE_ZONE("saveFrame");
+      char name[32];
+      sprintf(name, "frame_%04d.ppm", frame);
+      string path = outputDir + "/" + name;
+      if (!writePPM(path.c_str(), &pixels[0], frameWidth, frameHeight, true)) {
+        fprintf(stderr, "Couldn't write %s\n", path.c_str());
+        exit(1);
+      }
+    }
+  }
+}
+
+void printStage(const char* name, const vector<double>& samples)
+{
+  SampleStats stats = summarizeSamples(samples);
+  printf("  %-10s mean %7.2f ms  p50 %7.2f  p95 %7.2f  max %7.2f\n", name, stats.mean, stats.p50, stats.p95, stats.max);
+}
+
+void reportFrames(const StageTimes& times, const RasterStats& stats)
+{
+  printStage("raster", times.raster);
+  if (ambientOcclusion) {
+    printStage("occlusion", times.occlusion);
+    printStage("blur", times.blur);
+  }
+  printStage("frame", times.total);
+  printf("Last frame: %d of %d triangles drawn, %lld binned to tiles, %lld blocks rasterized, %lld skipped by depth, "
+      "%lld pixels shaded (setup %.2f ms, raster %.2f ms).\n",
+      stats.trianglesDrawn, stats.triangles, stats.binnedTriangles, stats.blocksRasterized, stats.blocksCulled,
+      stats.pixelsShaded, stats.setupMs, stats.rasterMs);
+}
+
+// Times the whole run at 1, 2, 4... threads, up to one per core, and prints
+// the speedup of each over one thread
+void reportScaling(const vector<RasterDraw>& draws, const SSAOSettings& settings)
+{
+  int cores = defaultThreadCount();
+  vector<int> counts;
+  for (int threads = 1; threads < cores; threads *= 2)
+    counts.push_back(threads);
+  counts.push_back(cores);
+
+  printf("%8s %12s %12s %12s %9s\n", "threads", "raster ms", "occlusion ms", "frame ms", "speedup");
+  double baseline = 0.0;
+  for (size_t i = 0; i < counts.size(); i++) {
+    StageTimes times;
+    RasterStats stats;
+    renderFrames(draws, settings, counts[i], false, times, stats);
+    double frameMs = summarizeSamples(times.total).mean;
+    if (i == 0)
+      baseline = frameMs;
+    printf("%8d %12.2f %12.2f %12.2f %8.2fx\n", counts[i], summarizeSamples(times.raster).mean,
+        summarizeSamples(times.occlusion).mean, frameMs, baseline / frameMs);
+  }
+}
+
+// entry point
+int main(int argc, char* argv[])
+{
+  parseArguments(argc, argv);
+
+  vector<float> modelData;
+  if (!loadModelMesh(modelPath, modelData)) {
+    fprintf(stderr, "Couldn't load %s\n", modelPath);
+    exit(1);
+  }
+  printf("Loaded %s, %d triangles.\n", modelPath, (int)modelData.size() / floatsPerVertex / 3);
+
+  vector<RasterDraw> draws;
+  sceneDraws(modelData, draws);
+  SSAOSettings settings;
+  cpuOcclusionSettings(kernelSize, noiseSize, kernelSeed, reconstructNormals, settings);
+
+  if (scaling) {
+    reportScaling(draws, settings);
+  }
+  else {
+    printf("Rendering %d %dx%d frames on %d threads, %s occlusion%s.\n", frameCount, frameWidth, frameHeight,
+        threadCount > 0 ? threadCount : defaultThreadCount(), ambientOcclusion ? "CPU" : "no",
+        reconstructNormals ? ", normals from depth" : "");
+    StageTimes times;
+    RasterStats stats;
+    renderFrames(draws, settings, threadCount, !outputDir.empty(), times, stats);
+    if (!outputDir.empty())
+      printf("Wrote %d frames to %s\n", frameCount, outputDir.c_str());
+    reportFrames(times, stats);
+  }
+
+  if (traceEnabled)
+    writeTrace();
+  return 0;
+}
@@ -0,0 +1,347 @@
+// File: cpussao.cpp
+//
+// Rows are spread over threads a few at a time (parallel.h), and the sample loop
+// takes four samples at once with SSE where the compiler targets it. Texture
+// lookups follow the GL rules for the textures render.cpp creates: nearest
+// filtering, clamped at the edges, with the random texture repeating.
+
+#include "cpussao.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SP_CPUSSAO_SSE 1
+#include <emmintrin.h>
+#else
+#define SP_CPUSSAO_SSE 0
+#endif
+
+#include "vec3.h"
+#include "parallel.h"
+#include "trace.h"
+
+using std::vector;
+
+namespace {
+
+// Rows a thread takes at a time
+const int rowsPerTask = 8;
+
+// Rounds to the nearest value a half float holds, as the RGB16F random
+// texture stores it
+float roundToHalf(float value)
+{
+  if (value == 0.0f)
+    return 0.0f;
+  int exponent;
+  frexpf(value, &exponent);
+  // 11 significant bits, and nothing finer than 2^-24
+  int step = std::max(exponent - 11, -24);
+  return ldexpf(floorf(ldexpf(value, -step) + 0.5f), step);
+}
+
+// Rounds to the nearest value an 8-bit normalized texture holds
+float roundToByte(float value)
+{
+  value = std::min(std::max(value, 0.0f), 1.0f);
+  return floorf(value * 255.0f + 0.5f) / 255.0f;
+}
+
+// The occlusion pass for one image, with everything it looks up per pixel
+// gathered in one place
+class OcclusionPass
+{
+public:
+  OcclusionPass(const GBuffer& gbuffer, const SSAOSettings& settings)
+    : gbuffer(gbuffer), settings(settings), width(gbuffer.width), height(gbuffer.height),
+      proj(reinterpret_cast<const float*>(&settings.projMat)),
+      invProj(reinterpret_cast<const float*>(&settings.invProjMat))
+  {
+    sampleCount = (int)settings.sampleOffsets.size() / 3;
+    // Split into x, y and z, padded out to a multiple of 4
+    int padded = (sampleCount + 3) & ~3;
+    offsetX.assign(padded, 0.0f);
+    offsetY.assign(padded, 0.0f);
+    offsetZ.assign(padded, 0.0f);
+    for (int i = 0; i < sampleCount; i++) {
+      offsetX[i] = settings.sampleOffsets[i * 3 + 0];
+      offsetY[i] = settings.sampleOffsets[i * 3 + 1];
+      offsetZ[i] = settings.sampleOffsets[i * 3 + 2];
+    }
+
+    // Decode the random directions once, as the shader would read them
+    int noiseTexels = settings.noiseSize * settings.noiseSize;
+    randomVectors.resize(noiseTexels);
+    for (int i = 0; i < noiseTexels; i++) {
+      Vec3 stored(roundToHalf(settings.randomDirections[i * 3 + 0]), roundToHalf(settings.randomDirections[i * 3 + 1]),
+          roundToHalf(settings.randomDirections[i * 3 + 2]));
+      // Go from [0, 1] to [-1, 1], normalizing along the way
+      randomVectors[i] = stored.scale(2.0f).subtract(Vec3(1.0f)).normalized();
+    }
+
+    cosAngle = cosf(settings.frameAngle);
+    sinAngle = sinf(settings.frameAngle);
+  }
+
+  void run(int firstRow, int endRow, float* occlusion) const
+  {
+    for (int y = firstRow; y < endRow; y++) {
+      for (int x = 0; x < width; x++)
+        occlusion[y * width + x] = occlusionAt(x, y);
+    }
+  }
+
+private:
+  float depthAt(int x, int y) const
+  {
+    x = std::min(std::max(x, 0), width - 1);
+    y = std::min(std::max(y, 0), height - 1);
+    return gbuffer.depth[y * width + x];
+  }
+
+  Vec3 viewPositionAt(float u, float v, float depth) const
+  {
+    float clip[4] = { 2.0f * u - 1.0f, 2.0f * v - 1.0f, 2.0f * depth - 1.0f, 1.0f };
+    float view[4];
+    for (int row = 0; row < 4; row++) {
+      view[row] = invProj[row] * clip[0] + invProj[4 + row] * clip[1] + invProj[8 + row] * clip[2] +
+          invProj[12 + row] * clip[3];
+    }
+    return Vec3(view[0] / view[3], view[1] / view[3], view[2] / view[3]);
+  }
+
+  Vec3 viewPositionAtPixel(int x, int y, float depth) const
+  {
+    return viewPositionAt((x + 0.5f) / width, (y + 0.5f) / height, depth);
+  }
+
+  // Same reconstruction as normalFromDepth() in ssao.frag
+  Vec3 normalFromDepth(int x, int y, float depth) const
+  {
+    float l1 = depthAt(x - 1, y);
+    float l2 = depthAt(x - 2, y);
+    float r1 = depthAt(x + 1, y);
+    float r2 = depthAt(x + 2, y);
+    float d1 = depthAt(x, y - 1);
+    float d2 = depthAt(x, y - 2);
+    float u1 = depthAt(x, y + 1);
+    float u2 = depthAt(x, y + 2);
+
+    Vec3 center = viewPositionAtPixel(x, y, depth);
+    Vec3 horizontal = fabsf(2.0f * l1 - l2 - depth) < fabsf(2.0f * r1 - r2 - depth) ?
+        center.subtract(viewPositionAtPixel(x - 1, y, l1)) : viewPositionAtPixel(x + 1, y, r1).subtract(center);
+    Vec3 vertical = fabsf(2.0f * d1 - d2 - depth) < fabsf(2.0f * u1 - u2 - depth) ?
+        center.subtract(viewPositionAtPixel(x, y - 1, d1)) : viewPositionAtPixel(x, y + 1, u1).subtract(center);
+    return horizontal.cross(vertical).normalized();
+  }
+
+  float occlusionAt(int x, int y) const
+  {
+    float depth = gbuffer.depth[y * width + x];
+    Vec3 viewPosition = viewPositionAtPixel(x, y, depth);
+
+    Vec3 normal;
+    if (settings.reconstructNormals) {
+      normal = normalFromDepth(x, y, depth);
+    }
+    else {
+      const float* stored = &gbuffer.normals[(y * width + x) * 3];
+      // Scale and bias
+      normal = Vec3(stored[0], stored[1], stored[2]).scale(2.0f).subtract(Vec3(1.0f)).normalized();
+    }
+
+    int noiseSize = settings.noiseSize;
+    const Vec3& randomVector = randomVectors[((y + settings.noiseShiftY) % noiseSize) * noiseSize +
+        (x + settings.noiseShiftX) % noiseSize];
+    Vec3 tangent = randomVector.subtract(normal.scale(normal.dot(randomVector))).normalized();
+    Vec3 bitangent = normal.cross(tangent);
+
+    // Columns of the matrix orienting the kernel about the normal
+    Vec3 columns[3] = {
+      tangent.scale(cosAngle).add(bitangent.scale(sinAngle)),
+      bitangent.scale(cosAngle).subtract(tangent.scale(sinAngle)),
+      normal
+    };
+
+    int occluded = countOccluded(columns, viewPosition, depth);
+    return 1.0f - (float)occluded / sampleCount;
+  }
+
+  // Looks up the depth under a sample's projected screen position
+  float sampleDepth(float screenX, float screenY) const
+  {
+    float px = screenX * width;
+    float py = screenY * height;
+    // Written so NaNs clamp too
+    px = px >= 0.0f ? std::min(px, width - 1.0f) : 0.0f;
+    py = py >= 0.0f ? std::min(py, height - 1.0f) : 0.0f;
+    return gbuffer.depth[(int)py * width + (int)px];
+  }
+
+#if SP_CPUSSAO_SSE
+  int countOccluded(const Vec3 columns[3], const Vec3& viewPosition, float depth) const
+  {
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 radius = _mm_set1_ps(settings.sampleRadius);
+    const __m128 centerDepth = _mm_set1_ps(depth);
+    const __m128 signBit = _mm_set1_ps(-0.0f);
+    const __m128 maxX = _mm_set1_ps(width - 1.0f);
+    const __m128 maxY = _mm_set1_ps(height - 1.0f);
+    const __m128 scaleX = _mm_set1_ps((float)width);
+    const __m128 scaleY = _mm_set1_ps((float)height);
+
+    __m128 c0x = _mm_set1_ps(columns[0].x), c0y = _mm_set1_ps(columns[0].y), c0z = _mm_set1_ps(columns[0].z);
+    __m128 c1x = _mm_set1_ps(columns[1].x), c1y = _mm_set1_ps(columns[1].y), c1z = _mm_set1_ps(columns[1].z);
+    __m128 c2x = _mm_set1_ps(columns[2].x), c2y = _mm_set1_ps(columns[2].y), c2z = _mm_set1_ps(columns[2].z);
+    __m128 vx = _mm_set1_ps(viewPosition.x), vy = _mm_set1_ps(viewPosition.y), vz = _mm_set1_ps(viewPosition.z);
+
+    __m128 total = zero;
+    for (int i = 0; i < sampleCount; i += 4) {
+      __m128 ox = _mm_loadu_ps(&offsetX[i]);
+      __m128 oy = _mm_loadu_ps(&offsetY[i]);
+      __m128 oz = _mm_loadu_ps(&offsetZ[i]);
+
+      // Construct our view-space location to sample
+      __m128 sx = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c0x, ox), _mm_mul_ps(c1x, oy)),
+          _mm_mul_ps(c2x, oz)), radius), vx);
+      __m128 sy = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c0y, ox), _mm_mul_ps(c1y, oy)),
+          _mm_mul_ps(c2y, oz)), radius), vy);
+      __m128 sz = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c0z, ox), _mm_mul_ps(c1z, oy)),
+          _mm_mul_ps(c2z, oz)), radius), vz);
+
+      // Into clip coords; only x, y and w are needed
+      __m128 clipX = projectRow(0, sx, sy, sz);
+      __m128 clipY = projectRow(1, sx, sy, sz);
+      __m128 clipW = projectRow(3, sx, sy, sz);
+      // Scale and bias to screen coords, then to texels
+      __m128 px = _mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_div_ps(clipX, clipW), one), half), scaleX);
+      __m128 py = _mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_div_ps(clipY, clipW), one), half), scaleY);
+      // Clamp to the edges. max() returns its second operand for NaNs.
+      px = _mm_min_ps(_mm_max_ps(px, zero), maxX);
+      py = _mm_min_ps(_mm_max_ps(py, zero), maxY);
+      int texelX[4];
+      int texelY[4];
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(texelX), _mm_cvttps_epi32(px));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(texelY), _mm_cvttps_epi32(py));
+      const float* depthData = &gbuffer.depth[0];
+      __m128 lookupDepth = _mm_set_ps(depthData[texelY[3] * width + texelX[3]], depthData[texelY[2] * width + texelX[2]],
+          depthData[texelY[1] * width + texelX[1]], depthData[texelY[0] * width + texelX[0]]);
+
+      // Occluded if in front, and within range
+      __m128 difference = _mm_andnot_ps(signBit, _mm_sub_ps(lookupDepth, centerDepth));
+      __m128 inRange = _mm_cmpngt_ps(difference, radius);
+      __m128 occluded = _mm_and_ps(_mm_cmplt_ps(lookupDepth, centerDepth), inRange);
+      // Padding lanes past the last sample don't count
+      __m128 lanes = _mm_cmplt_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps((float)(sampleCount - i)));
+      total = _mm_add_ps(total, _mm_and_ps(_mm_and_ps(occluded, lanes), one));
+    }
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, total);
+    return (int)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+  }
+
+  __m128 projectRow(int row, __m128 x, __m128 y, __m128 z) const
+  {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(proj[row]), x), _mm_mul_ps(_mm_set1_ps(proj[4 + row]), y)),
+        _mm_add_ps(_mm_mul_ps(_mm_set1_ps(proj[8 + row]), z), _mm_set1_ps(proj[12 + row])));
+  }
+#else
+  int countOccluded(const Vec3 columns[3], const Vec3& viewPosition, float depth) const
+  {
+    int occluded = 0;
+    for (int i = 0; i < sampleCount; i++) {
+      // Construct our view-space location to sample
+      Vec3 offset = columns[0].scale(offsetX[i]).add(columns[1].scale(offsetY[i])).add(columns[2].scale(offsetZ[i]));
+      Vec3 testSample = offset.scale(settings.sampleRadius).add(viewPosition);
+
+      // Transform the sample location into clip coords for depth comparison
+      float clip[4];
+      for (int row = 0; row < 4; row++)
+        clip[row] = proj[row] * testSample.x + proj[4 + row] * testSample.y + proj[8 + row] * testSample.z + proj[12 + row];
+      // Scale and bias to screen coords, [-1, 1] -> [0, 1]
+      float lookupDepth = sampleDepth((clip[0] / clip[3] + 1.0f) * 0.5f, (clip[1] / clip[3] + 1.0f) * 0.5f);
+
+      bool inRange = !(fabsf(lookupDepth - depth) > settings.sampleRadius);
+      if (lookupDepth < depth && inRange)
+        occluded++;
+    }
+    return occluded;
+  }
+#endif
+
+  const GBuffer& gbuffer;
+  const SSAOSettings& settings;
+  int width;
+  int height;
+  // Column-major, as Mat4 stores them
+  const float* proj;
+  const float* invProj;
+
+  int sampleCount;
+  vector<float> offsetX;
+  vector<float> offsetY;
+  vector<float> offsetZ;
+  vector<Vec3> randomVectors;
+  float cosAngle;
+  float sinAngle;
+};
+
+}
+
+void computeOcclusionCPU(const GBuffer& gbuffer, const SSAOSettings& settings, vector<float>& occlusion,
+    int threadCount)
+{
+  TRACE_ZONE("computeOcclusionCPU");
+  occlusion.resize(gbuffer.width * gbuffer.height);
+  OcclusionPass pass(gbuffer, settings);
+  float* output = &occlusion[0];
+  parallelFor(gbuffer.height, rowsPerTask, threadCount, [&](int firstRow, int endRow) {
+    pass.run(firstRow, endRow, output);
+  });
+}
+
+void blurOcclusionCPU(const vector<float>& occlusion, int width, int height, bool quantize,
+    vector<float>& blurred, int threadCount)
+{
+  TRACE_ZONE("blurOcclusionCPU");
+  vector<float> stored(occlusion);
+  if (quantize) {
+    for (size_t i = 0; i < stored.size(); i++)
+      stored[i] = roundToByte(stored[i]);
+  }
+
+  blurred.resize(width * height);
+  parallelFor(height, rowsPerTask, threadCount, [&](int firstRow, int endRow) {
+    for (int y = firstRow; y < endRow; y++) {
+      for (int x = 0; x < width; x++) {
+        float scaleFactor = 0.0f;
+        for (int dx = 0; dx < 4; dx++) {
+          for (int dy = 0; dy < 4; dy++) {
+            int sx = std::min(x + dx, width - 1);
+            int sy = std::min(y + dy, height - 1);
+            scaleFactor += stored[sy * width + sx];
+          }
+        }
+        // Average out the accumulated scaleFactor
+        blurred[y * width + x] = scaleFactor / 16.0f;
+      }
+    }
+  });
+}
+
+void shadeWithOcclusionCPU(const GBuffer& gbuffer, const vector<float>& blurred, vector<unsigned char>& pixels)
+{
+  int count = gbuffer.width * gbuffer.height;
+  pixels.resize(count * 3);
+  for (int i = 0; i < count; i++) {
+    for (int c = 0; c < 3; c++) {
+      // The color texture only has 8 bits a channel
+      float value = blurred[i] * roundToByte(gbuffer.color[i * 3 + c]);
+      pixels[i * 3 + c] = (unsigned char)(roundToByte(value) * 255.0f + 0.5f);
+    }
+  }
+}
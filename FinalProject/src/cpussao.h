@@ -0,0 +1,69 @@
+// File: cpussao.h
+//
+// The occlusion and blur passes (ssao.frag and blur.frag) on the CPU: the
+// same kernel, the same tiled random rotations, the same range check and the
+// same 4x4 box blur, working from copies of the G-buffer. It needs no GL at
+// all, so it serves both as a reference to check the GPU output against and
+// as a way to make occlusion images where there's no usable GL.
+//
+// Rows of every image run from the bottom up, as GL stores them.
+
+#ifndef SP_CPUSSAO_H_
+#define SP_CPUSSAO_H_
+
+#include <vector>
+
+#include "mat4.h"
+
+// What the occlusion pass reads
+struct GBuffer
+{
+  int width;
+  int height;
+  // Window-space depth, one per pixel
+  std::vector<float> depth;
+  // Normals as the normal texture stores them, scaled and biased to [0, 1]
+  // (RGB triples). Unused when normals are rebuilt from depth.
+  std::vector<float> normals;
+  // Lit color (RGB triples), scaled by the blurred occlusion
+  std::vector<float> color;
+};
+
+// Everything else the occlusion pass uses, as the shader's uniforms
+struct SSAOSettings
+{
+  Mat4 projMat;
+  Mat4 invProjMat;
+  // View-space offsets (x, y, z triples), one per sample taken
+  std::vector<float> sampleOffsets;
+  float sampleRadius;
+  // Rotation of the kernel about the normal, in radians
+  float frameAngle;
+  // The tiling random rotation texture and how far its lookup is shifted, in
+  // texels. Directions are scaled and biased to [0, 1].
+  std::vector<float> randomDirections;
+  int noiseSize;
+  int noiseShiftX;
+  int noiseShiftY;
+  bool reconstructNormals;
+  // Round occlusion to 8 bits before blurring, as the fragment shader path
+  // does by storing it in an RGBA8 texture. The compute path doesn't.
+  bool quantizeOcclusion;
+};
+
+// Fills "occlusion" with one lighting scale factor per pixel (1 is
+// unoccluded), as ssao.frag writes it. Splits the rows over "threadCount"
+// threads, or one per core if that's 0.
+void computeOcclusionCPU(const GBuffer& gbuffer, const SSAOSettings& settings, std::vector<float>& occlusion,
+    int threadCount);
+
+// Averages each pixel's occlusion with the 4x4 block to its upper right,
+// clamped at the edges, as blur.frag does
+void blurOcclusionCPU(const std::vector<float>& occlusion, int width, int height, bool quantize,
+    std::vector<float>& blurred, int threadCount);
+
+// Scales the G-buffer color by "blurred", giving the final frame as 8-bit RGB
+void shadeWithOcclusionCPU(const GBuffer& gbuffer, const std::vector<float>& blurred,
+    std::vector<unsigned char>& pixels);
+
+#endif // SP_CPUSSAO_H_
@@ -0,0 +1,172 @@
+#include "framering.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "trace.h"
+#include "walltime.h"
+
+using std::vector;
+
+namespace {
+
+bool persistent = false;
+GLuint ringBuf = 0;
+// The whole ring, mapped for good
+unsigned char* ringMemory = NULL;
+// Without persistent mapping, this frame's data is written here first
+vector<unsigned char> scratch;
+size_t regionBytes = 0;
+int currentRegion = 0;
+// Bytes of the current region handed out, and what the frame has asked for
+// in all, whether it fit or not
+size_t used = 0;
+size_t wanted = 0;
+GLsync regionFences[frameRingRegions];
+
+FrameRingStats stats;
+
+size_t alignUp(size_t value, size_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+void createRing()
+{
+  GLsizeiptr total = (GLsizeiptr)(regionBytes * frameRingRegions);
+  glGenBuffers(1, &ringBuf);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, ringBuf);
+  if (persistent) {
+#ifdef GL_ARB_buffer_storage
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_COPY_WRITE_BUFFER, total, NULL, flags);
+    ringMemory = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, total, flags));
+#endif
+  }
+  else {
+    glBufferData(GL_COPY_WRITE_BUFFER, total, NULL, GL_STREAM_DRAW);
+    scratch.resize(regionBytes);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  for (int region = 0; region < frameRingRegions; region++)
+    regionFences[region] = 0;
+}
+
+// Waits until the GPU has finished with everything written to "region"
+void waitForRegion(int region)
+{
+  GLsync fence = regionFences[region];
+  if (fence == 0)
+    return;
+  if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+    TRACE_ZONE("waitForFrameRing");
+    double start = wallClockMs();
+    GLenum status;
+    do {
+      status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    } while (status == GL_TIMEOUT_EXPIRED);
+    double waited = wallClockMs() - start;
+    stats.fenceWaits++;
+    stats.fenceWaitMs += waited;
+    stats.maxFenceWaitMs = std::max(stats.maxFenceWaitMs, waited);
+  }
+  glDeleteSync(fence);
+  regionFences[region] = 0;
+}
+
+}
+
+void initFrameRing(size_t bytes)
+{
+#ifdef GL_ARB_buffer_storage
+  persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+#else
+  // GLEW headers from before 1.10, like the one bundled for Visual Studio,
+  // don't have buffer storage
+  persistent = false;
+#endif
+  // Regions start on any alignment a slice can ask for
+  regionBytes = 65536;
+  while (regionBytes < bytes)
+    regionBytes *= 2;
+  createRing();
+  if (persistent && ringMemory == NULL) {
+    glDeleteBuffers(1, &ringBuf);
+    persistent = false;
+    createRing();
+  }
+  currentRegion = frameRingRegions - 1;
+  resetFrameRingStats();
+}
+
+bool frameRingPersistent()
+{
+  return persistent;
+}
+
+void beginFrameRing()
+{
+  // Make room for everything the last frame wanted, once the GPU is done
+  // with the old ring
+  if (wanted > regionBytes) {
+    TRACE_ZONE("growFrameRing");
+    for (int region = 0; region < frameRingRegions; region++)
+      waitForRegion(region);
+    glDeleteBuffers(1, &ringBuf);
+    ringMemory = NULL;
+    while (regionBytes < wanted)
+      regionBytes *= 2;
+    createRing();
+    stats.grows++;
+  }
+
+  currentRegion = (currentRegion + 1) % frameRingRegions;
+  waitForRegion(currentRegion);
+  used = 0;
+  wanted = 0;
+  stats.frames++;
+}
+
+void endFrameRing()
+{
+  if (persistent)
+    regionFences[currentRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+bool allocateFrameData(size_t size, size_t alignment, FrameSlice& slice)
+{
+  wanted = alignUp(wanted, alignment) + size;
+  size_t start = alignUp(used, alignment);
+  if (start + size > regionBytes) {
+    stats.overflows++;
+    return false;
+  }
+  slice.buffer = ringBuf;
+  slice.offset = (GLintptr)(currentRegion * regionBytes + start);
+  slice.size = (GLsizeiptr)size;
+  slice.data = persistent ? ringMemory + slice.offset : &scratch[start];
+  used = start + size;
+  return true;
+}
+
+void flushFrameData(const FrameSlice& slice)
+{
+  if (persistent)
+    return;
+  glBindBuffer(GL_COPY_WRITE_BUFFER, slice.buffer);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, slice.offset, slice.size, slice.data);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+FrameRingStats frameRingStats()
+{
+  stats.persistent = persistent;
+  stats.regionBytes = regionBytes;
+  return stats;
+}
+
+void resetFrameRingStats()
+{
+  memset(&stats, 0, sizeof(stats));
+}
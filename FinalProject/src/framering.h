@@ -0,0 +1,71 @@
+// File: framering.h
+//
+// Room in a GL buffer for data that's written fresh every frame: the
+// instances in view, meshlet draw commands and the scene pass's per-frame
+// uniforms. The buffer is split into frameRingRegions regions, one per frame
+// in flight, and each frame's data is carved out of its region in order.
+// With buffer storage (GL 4.4) the buffer stays mapped, persistent and
+// coherent, so the data is written straight into it, and a fence after each
+// frame says when its region can be written again; the driver copies nothing
+// and never has to wait behind the GPU. Without it, each piece is handed over
+// with glBufferSubData().
+//
+// A frame whose data doesn't fit makes the region grow, between frames, to
+// what it asked for.
+
+#ifndef SP_FRAMERING_H_
+#define SP_FRAMERING_H_
+
+#include <cstddef>
+
+#include "GL/glew.h"
+
+const int frameRingRegions = 3;
+
+// Where a piece of this frame's data goes
+struct FrameSlice
+{
+  GLuint buffer;
+  GLintptr offset;
+  GLsizeiptr size;
+  // Write it here, then call flushFrameData()
+  void* data;
+};
+
+// Makes the ring, with "regionBytes" a frame to start with. Needs a current
+// context.
+void initFrameRing(size_t regionBytes);
+
+// True if the ring is persistently mapped
+bool frameRingPersistent();
+
+// Moves on to the next frame's region, first waiting for the GPU to be done
+// with what was last written there
+void beginFrameRing();
+// Puts a fence after everything that used this frame's region
+void endFrameRing();
+
+// Carves "size" bytes, starting at a multiple of "alignment", out of this
+// frame's region. Returns false if they don't fit.
+bool allocateFrameData(size_t size, size_t alignment, FrameSlice& slice);
+// Hands what was written to "slice".data to the GL, if it isn't already there
+void flushFrameData(const FrameSlice& slice);
+
+struct FrameRingStats
+{
+  bool persistent;
+  size_t regionBytes;
+  long long frames;
+  // Frames that found their region's fence not yet passed, and how long they
+  // waited for it
+  long long fenceWaits;
+  double fenceWaitMs;
+  double maxFenceWaitMs;
+  // Allocations that didn't fit, and times the ring grew because of them
+  long long overflows;
+  int grows;
+};
+FrameRingStats frameRingStats();
+void resetFrameRingStats();
+
+#endif // SP_FRAMERING_H_
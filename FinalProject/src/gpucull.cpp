@@ -0,0 +1,316 @@
+#include "gpucull.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "shaders.h"
+#include "trace.h"
+
+using std::vector;
+
+namespace {
+
+// An instance as cull.comp reads it
+struct GpuInstance
+{
+  GLfloat rows[12];
+  GLfloat boundsMin[3];
+  GLuint command;
+  GLfloat boundsMax[3];
+  GLuint lodCount;
+};
+
+// As glMultiDrawArraysIndirect() reads it
+struct DrawCommand
+{
+  GLuint count;
+  GLuint instanceCount;
+  GLuint first;
+  GLuint baseInstance;
+};
+
+const int floatsPerInstance = 12;
+// Culls whose counts can be waiting to be read back
+const int readbackRingSize = 3;
+// Levels of a pyramid over up to 2048x2048
+const int maxHiZLevels = 12;
+
+GLuint cullProg;
+GLint cullProgInstanceCount;
+GLint cullProgFrustumPlanes;
+GLint cullProgUseHiZ;
+GLint cullProgHiZTexture;
+GLint cullProgHiZLevels;
+GLint cullProgHiZViewProjMat;
+GLint cullProgEyePos;
+GLint cullProgLodScale;
+
+GLuint hiZProg;
+GLint hiZProgSourceTexture;
+GLint hiZProgSourceLevel;
+GLint hiZProgCopySource;
+
+vector<GpuCullMesh> meshes;
+int instanceCount = 0;
+
+// Every instance, as cull.comp reads it
+GLuint instanceBuf;
+// Transforms of the instances that survived, written by cull.comp
+GLuint visibleBuf;
+GLuint commandBuf;
+GLuint counterBuf;
+// Each command's level of detail error
+GLuint lodErrorBuf;
+// What commandBuf is reset to before culling: every command with no instances
+vector<DrawCommand> emptyCommands;
+
+GLuint hiZTexture;
+int hiZWidth, hiZHeight, hiZLevels;
+// The frame the pyramid was built in, and its view-projection
+int hiZFrame = -1;
+Mat4 hiZViewProj;
+
+// The counts of each cull are copied into the next of these, with a fence
+// after the copy, and read back at a later cull once the fence has passed.
+// Until then the last counts read stand.
+GLuint readbackBufs[readbackRingSize];
+GLsync readbackFences[readbackRingSize];
+int readbackCurrent = 0;
+GpuCullStats lastStats;
+
+void readStats(GLuint buffer)
+{
+  vector<DrawCommand> commands(meshes.size());
+  GLuint occluded = 0;
+  glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+  glGetBufferSubData(GL_COPY_READ_BUFFER, 0, commands.size() * sizeof(DrawCommand), commands.data());
+  glGetBufferSubData(GL_COPY_READ_BUFFER, commands.size() * sizeof(DrawCommand), sizeof(GLuint), &occluded);
+
+  lastStats.visible = 0;
+  lastStats.triangles = 0;
+  for (size_t mesh = 0; mesh < meshes.size(); mesh++) {
+    lastStats.visible += commands[mesh].instanceCount;
+    lastStats.triangles += (long long)meshes[mesh].vertexCount / 3 * commands[mesh].instanceCount;
+  }
+  lastStats.occluded = occluded;
+  lastStats.frustumCulled = instanceCount - lastStats.visible - lastStats.occluded;
+}
+
+// Reads back every cull whose copy has finished, oldest first, without
+// waiting for the GPU
+void collectStats()
+{
+  for (int i = 0; i < readbackRingSize; i++) {
+    int slot = (readbackCurrent + i) % readbackRingSize;
+    if (readbackFences[slot] == 0)
+      continue;
+    // The GPU finishes them in order, so the rest aren't done either
+    if (glClientWaitSync(readbackFences[slot], 0, 0) == GL_TIMEOUT_EXPIRED)
+      break;
+    glDeleteSync(readbackFences[slot]);
+    readbackFences[slot] = 0;
+    readStats(readbackBufs[slot]);
+  }
+}
+
+} // namespace
+
+void initGpuCulling(const vector<GpuCullMesh>& cullMeshes, int width, int height)
+{
+  TRACE_ZONE("initGpuCulling");
+  cullProg = createComputeProgram(loadShader(GL_COMPUTE_SHADER, "shaders/cull.comp"));
+  cullProgInstanceCount = glGetUniformLocation(cullProg, "instanceCount");
+  cullProgFrustumPlanes = glGetUniformLocation(cullProg, "frustumPlanes");
+  cullProgUseHiZ = glGetUniformLocation(cullProg, "useHiZ");
+  cullProgHiZTexture = glGetUniformLocation(cullProg, "hiZTex");
+  cullProgHiZLevels = glGetUniformLocation(cullProg, "hiZLevels");
+  cullProgHiZViewProjMat = glGetUniformLocation(cullProg, "hiZViewProj");
+  cullProgEyePos = glGetUniformLocation(cullProg, "eyePos");
+  cullProgLodScale = glGetUniformLocation(cullProg, "lodScale");
+
+  hiZProg = createComputeProgram(loadShader(GL_COMPUTE_SHADER, "shaders/hiz.comp"));
+  hiZProgSourceTexture = glGetUniformLocation(hiZProg, "sourceTex");
+  hiZProgSourceLevel = glGetUniformLocation(hiZProg, "sourceLevel");
+  hiZProgCopySource = glGetUniformLocation(hiZProg, "copySource");
+
+  // Each mesh level's command draws from its own region of visibleBuf, big
+  // enough for all the mesh's instances
+  meshes = cullMeshes;
+  int regionsSize = 0;
+  instanceCount = 0;
+  emptyCommands.resize(meshes.size());
+  vector<GLfloat> lodErrors(meshes.size());
+  for (size_t mesh = 0; mesh < meshes.size(); mesh++) {
+    DrawCommand command = { (GLuint)meshes[mesh].vertexCount, 0, (GLuint)meshes[mesh].firstVertex, (GLuint)regionsSize };
+    emptyCommands[mesh] = command;
+    lodErrors[mesh] = meshes[mesh].lodError;
+    regionsSize += meshes[mesh].instanceCount;
+    if (meshes[mesh].lod == 0)
+      instanceCount += meshes[mesh].instanceCount;
+  }
+
+  glGenBuffers(1, &instanceBuf);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuf);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(instanceCount, 1) * sizeof(GpuInstance), NULL, GL_DYNAMIC_DRAW);
+  glGenBuffers(1, &visibleBuf);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuf);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(regionsSize, 1) * floatsPerInstance * sizeof(GLfloat), NULL, GL_DYNAMIC_COPY);
+  glGenBuffers(1, &commandBuf);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuf);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, emptyCommands.size() * sizeof(DrawCommand), NULL, GL_DYNAMIC_COPY);
+  glGenBuffers(1, &counterBuf);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuf);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+  glGenBuffers(1, &lodErrorBuf);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, lodErrorBuf);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(lodErrors.size(), (size_t)1) * sizeof(GLfloat), lodErrors.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  glGenBuffers(readbackRingSize, readbackBufs);
+  for (int i = 0; i < readbackRingSize; i++) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBufs[i]);
+    glBufferData(GL_COPY_WRITE_BUFFER, emptyCommands.size() * sizeof(DrawCommand) + sizeof(GLuint), NULL, GL_STREAM_READ);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  // Floats, so the reduction can be a plain max
+  hiZWidth = width;
+  hiZHeight = height;
+  hiZLevels = 1;
+  while (hiZLevels < maxHiZLevels && std::max(width, height) >> hiZLevels > 0)
+    hiZLevels++;
+  glGenTextures(1, &hiZTexture);
+  glBindTexture(GL_TEXTURE_2D, hiZTexture);
+  glTexStorage2D(GL_TEXTURE_2D, hiZLevels, GL_R32F, width, height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  hiZFrame = -1;
+  for (int i = 0; i < readbackRingSize; i++) {
+    if (readbackFences[i] != 0)
+      glDeleteSync(readbackFences[i]);
+    readbackFences[i] = 0;
+  }
+  readbackCurrent = 0;
+  memset(&lastStats, 0, sizeof(lastStats));
+}
+
+void updateGpuInstances(int first, int count, const GLfloat* transforms, const AABB* bounds, const int* instanceMeshes,
+    const int* lodCounts)
+{
+  if (count <= 0)
+    return;
+  vector<GpuInstance> data(count);
+  for (int i = 0; i < count; i++) {
+    GpuInstance& instance = data[i];
+    memcpy(instance.rows, &transforms[i * floatsPerInstance], sizeof(instance.rows));
+    memcpy(instance.boundsMin, bounds[i].min, sizeof(instance.boundsMin));
+    memcpy(instance.boundsMax, bounds[i].max, sizeof(instance.boundsMax));
+    instance.command = (GLuint)instanceMeshes[i];
+    instance.lodCount = (GLuint)lodCounts[i];
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuf);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(GpuInstance), count * sizeof(GpuInstance), data.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void buildHiZ(GLuint depthTexture, const Mat4& viewProj, int frame)
+{
+  TRACE_ZONE("buildHiZ");
+  glUseProgram(hiZProg);
+  glActiveTexture(GL_TEXTURE0);
+  glUniform1i(hiZProgSourceTexture, 0);
+
+  // Level 0 straight from the depth buffer, then each level from the last
+  for (int level = 0; level < hiZLevels; level++) {
+    int width = std::max(hiZWidth >> level, 1);
+    int height = std::max(hiZHeight >> level, 1);
+    glBindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : hiZTexture);
+    glUniform1f(hiZProgCopySource, level == 0 ? 1.0f : 0.0f);
+    glUniform1i(hiZProgSourceLevel, std::max(level - 1, 0));
+    glBindImageTexture(0, hiZTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  hiZViewProj = viewProj;
+  hiZFrame = frame;
+}
+
+void cullOnGpu(const Frustum& frustum, const Vec3& eye, float lodScale, int frame)
+{
+  TRACE_ZONE("cullOnGpu");
+  collectStats();
+  // If the GPU is still copying into this cull's buffer from a whole ring
+  // ago, those counts are dropped rather than waited for
+  if (readbackFences[readbackCurrent] != 0) {
+    glDeleteSync(readbackFences[readbackCurrent]);
+    readbackFences[readbackCurrent] = 0;
+  }
+
+  GLuint zero = 0;
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuf);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, emptyCommands.size() * sizeof(DrawCommand), emptyCommands.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuf);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), &zero);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  glUseProgram(cullProg);
+  glUniform1ui(cullProgInstanceCount, (GLuint)instanceCount);
+  glUniform4fv(cullProgFrustumPlanes, 6, &frustum.planes[0][0]);
+  bool useHiZ = hiZFrame >= 0 && hiZFrame == frame - 1;
+  glUniform1f(cullProgUseHiZ, useHiZ ? 1.0f : 0.0f);
+  glUniform1i(cullProgHiZLevels, hiZLevels);
+  glUniformMatrix4fv(cullProgHiZViewProjMat, 1, GL_FALSE, reinterpret_cast<GLfloat*>(&hiZViewProj));
+  glUniform3f(cullProgEyePos, eye.x, eye.y, eye.z);
+  glUniform1f(cullProgLodScale, lodScale);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, hiZTexture);
+  glUniform1i(cullProgHiZTexture, 0);
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instanceBuf);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandBuf);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, visibleBuf);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, counterBuf);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, lodErrorBuf);
+  glDispatchCompute((instanceCount + 63) / 64, 1, 1);
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glBindBuffer(GL_COPY_READ_BUFFER, commandBuf);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBufs[readbackCurrent]);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, emptyCommands.size() * sizeof(DrawCommand));
+  glBindBuffer(GL_COPY_READ_BUFFER, counterBuf);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, emptyCommands.size() * sizeof(DrawCommand), sizeof(GLuint));
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  readbackFences[readbackCurrent] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  readbackCurrent = (readbackCurrent + 1) % readbackRingSize;
+}
+
+void drawGpuCulled(const GLint rowAttribs[3])
+{
+  glBindBuffer(GL_ARRAY_BUFFER, visibleBuf);
+  for (int row = 0; row < 3; row++) {
+    glEnableVertexAttribArray(rowAttribs[row]);
+    glVertexAttribPointer(rowAttribs[row], 4, GL_FLOAT, GL_FALSE, floatsPerInstance * sizeof(GLfloat),
+        reinterpret_cast<void*>(row * 4 * sizeof(GLfloat)));
+    glVertexAttribDivisor(rowAttribs[row], 1);
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuf);
+  glMultiDrawArraysIndirect(GL_TRIANGLES, NULL, (GLsizei)emptyCommands.size(), 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  for (int row = 0; row < 3; row++) {
+    glVertexAttribDivisor(rowAttribs[row], 0);
+    glDisableVertexAttribArray(rowAttribs[row]);
+  }
+}
+
+GpuCullStats gpuCullStats()
+{
+  return lastStats;
+}
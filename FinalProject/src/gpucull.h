@@ -0,0 +1,73 @@
+// File: gpucull.h
+//
+// Culling on the GPU. A compute pass tests every instance against the frustum
+// and against a max-depth pyramid built from the last frame's depth buffer,
+// picks a level of detail for the survivors, writes their transforms out
+// grouped by mesh and level, and counts them into one indirect draw command
+// per mesh level. The whole scene is then drawn with one
+// glMultiDrawArraysIndirect() call, so the CPU's share of a frame doesn't
+// grow with the number of instances. Needs GL 4.3.
+
+#ifndef SP_GPUCULL_H_
+#define SP_GPUCULL_H_
+
+#include <vector>
+
+#include "GL/glew.h"
+
+#include "bvh.h"
+#include "mat4.h"
+#include "vec3.h"
+
+// One level of detail of a mesh: its vertices in the shared vertex buffer,
+// how many instances of the mesh there are, which level it is and how far
+// its surface may be from the full mesh's. A mesh's levels are consecutive,
+// finest first.
+struct GpuCullMesh
+{
+  GLint firstVertex;
+  GLsizei vertexCount;
+  int instanceCount;
+  int lod;
+  float lodError;
+};
+
+// Compiles the culling shaders and makes room for the instances of "meshes",
+// and for a pyramid over a "width" x "height" depth buffer
+void initGpuCulling(const std::vector<GpuCullMesh>& meshes, int width, int height);
+
+// Uploads instances "first" to "first" + "count": their transforms, as the top
+// three rows (12 floats each), their world-space bounds, the index in
+// "meshes" of the finest level of what they're instances of, and how many
+// levels it has. Each pointer starts at "first".
+void updateGpuInstances(int first, int count, const GLfloat* transforms, const AABB* bounds, const int* meshes,
+    const int* lodCounts);
+
+// Builds the pyramid from "depthTexture", drawn with "viewProj" in frame "frame"
+void buildHiZ(GLuint depthTexture, const Mat4& viewProj, int frame);
+
+// Culls every instance against "frustum", and against the pyramid too if it
+// was built in the frame before "frame", and writes the draw commands. Each
+// survivor is drawn at its coarsest level whose error, times the instance's
+// scale and "lodScale", is within its distance from "eye"; a "lodScale" of
+// zero draws everything at full detail.
+void cullOnGpu(const Frustum& frustum, const Vec3& eye, float lodScale, int frame);
+
+// Draws what the last cullOnGpu() left, every mesh level in one call. The vertex
+// attributes must already point at the shared vertex buffer; the instance
+// transforms go in "rowAttribs", one row each.
+void drawGpuCulled(const GLint rowAttribs[3]);
+
+// What a cullOnGpu() call found. The counts are read back once a fence says
+// the GPU has copied them out, a frame or more late, so neither culling nor
+// drawing ever waits on them.
+struct GpuCullStats
+{
+  int visible;
+  int frustumCulled;
+  int occluded;
+  long long triangles;
+};
+GpuCullStats gpuCullStats();
+
+#endif // SP_GPUCULL_H_
@@ -0,0 +1,260 @@
+#include "gputimer.h"
+
+#include <vector>
+
+#include "GL/glew.h"
+
+#include "trace.h"
+
+using std::vector;
+
+namespace {
+
+// The queries for one frame
+struct FrameQueries
+{
+  GLuint begin[gpuTimerMaxPasses];
+  GLuint end[gpuTimerMaxPasses];
+  bool ran[gpuTimerMaxPasses];
+  // Issued, and not yet read back
+  bool pending;
+  int frameNumber;
+};
+
+// The last gpuTimerWindow samples of one pass
+struct RollingWindow
+{
+  double samples[gpuTimerWindow];
+  int count;
+  int next;
+};
+
+bool supported = false;
+int passCount = 0;
+const char* const* passNames = NULL;
+
+FrameQueries frames[gpuTimerFrames];
+// The slot the current (or next) frame uses
+int currentSlot = 0;
+int frameCounter = 0;
+int droppedFrames = 0;
+
+// One per pass, then one for the whole frame
+RollingWindow windows[gpuTimerMaxPasses + 1];
+
+FILE* logFile = NULL;
+
+// Added to GL timestamps (converted to us) to put them on the trace clock
+double gpuToTraceUs = 0.0;
+
+// Lines the GL timestamp clock up with the trace clock. The two drift
+// apart slowly, so this is redone every so often.
+void calibrateTraceClock()
+{
+  GLint64 gpuNow = 0;
+  glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+  gpuToTraceUs = traceNowUs() - gpuNow / 1000.0;
+}
+
+void addSample(RollingWindow& window, double ms)
+{
+  window.samples[window.next] = ms;
+  window.next = (window.next + 1) % gpuTimerWindow;
+  if (window.count < gpuTimerWindow)
+    window.count++;
+}
+
+SampleStats windowStats(const RollingWindow& window)
+{
+  return summarizeSamples(vector<double>(window.samples, window.samples + window.count));
+}
+
+// Reads back a frame's results. Without "wait", gives up (returning false) if
+// they aren't in yet.
+bool collectFrame(FrameQueries& frame, bool wait)
+{
+  if (!frame.pending)
+    return true;
+
+  // Queries finish in order, so the frame is done once its last one is
+  int last = -1;
+  for (int pass = 0; pass < passCount; pass++) {
+    if (frame.ran[pass])
+      last = pass;
+  }
+  if (!wait) {
+    GLint available = 0;
+    glGetQueryObjectiv(frame.end[last], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+      return false;
+  }
+
+  GLuint64 frameBegin = 0;
+  GLuint64 frameEnd = 0;
+  bool first = true;
+  double passMs[gpuTimerMaxPasses];
+  for (int pass = 0; pass < passCount; pass++) {
+    if (!frame.ran[pass])
+      continue;
+    GLuint64 begin = 0;
+    GLuint64 end = 0;
+    glGetQueryObjectui64v(frame.begin[pass], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(frame.end[pass], GL_QUERY_RESULT, &end);
+    passMs[pass] = (end - begin) / 1000000.0;
+    addSample(windows[pass], passMs[pass]);
+    if (traceEnabled)
+      traceRecordGpu(passNames[pass], begin / 1000.0 + gpuToTraceUs, end / 1000.0 + gpuToTraceUs);
+    if (first || begin < frameBegin)
+      frameBegin = begin;
+    if (first || end > frameEnd)
+      frameEnd = end;
+    first = false;
+  }
+  double frameMs = (frameEnd - frameBegin) / 1000000.0;
+  addSample(windows[passCount], frameMs);
+
+  if (logFile != NULL) {
+    fprintf(logFile, "%d", frame.frameNumber);
+    for (int pass = 0; pass < passCount; pass++) {
+      if (frame.ran[pass])
+        fprintf(logFile, ",%.4f", passMs[pass]);
+      else
+        fprintf(logFile, ",");
+    }
+    fprintf(logFile, ",%.4f\n", frameMs);
+  }
+
+  frame.pending = false;
+  return true;
+}
+
+// Collects finished frames, oldest first
+void collectFrames(bool wait)
+{
+  for (int i = 0; i < gpuTimerFrames; i++) {
+    FrameQueries& frame = frames[(currentSlot + i) % gpuTimerFrames];
+    if (!collectFrame(frame, wait))
+      break;
+  }
+}
+
+}
+
+void initGpuTimers(int count, const char* const names[])
+{
+  supported = (GLEW_VERSION_3_3 || GLEW_ARB_timer_query) && count <= gpuTimerMaxPasses;
+  if (!supported)
+    return;
+
+  passCount = count;
+  passNames = names;
+  for (int i = 0; i < gpuTimerFrames; i++) {
+    glGenQueries(passCount, frames[i].begin);
+    glGenQueries(passCount, frames[i].end);
+    frames[i].pending = false;
+  }
+  resetGpuTimerStats();
+  if (traceEnabled)
+    calibrateTraceClock();
+}
+
+bool gpuTimersSupported()
+{
+  return supported;
+}
+
+void beginGpuFrame()
+{
+  if (!supported)
+    return;
+
+  collectFrames(false);
+  if (traceEnabled && frameCounter % gpuTimerWindow == 0)
+    calibrateTraceClock();
+
+  // If this slot's results still aren't back after gpuTimerFrames frames,
+  // give up on them rather than wait
+  FrameQueries& frame = frames[currentSlot];
+  if (frame.pending) {
+    frame.pending = false;
+    droppedFrames++;
+  }
+  for (int pass = 0; pass < passCount; pass++)
+    frame.ran[pass] = false;
+}
+
+void beginGpuPass(int pass)
+{
+  if (!supported)
+    return;
+  glQueryCounter(frames[currentSlot].begin[pass], GL_TIMESTAMP);
+}
+
+void endGpuPass(int pass)
+{
+  if (!supported)
+    return;
+  FrameQueries& frame = frames[currentSlot];
+  glQueryCounter(frame.end[pass], GL_TIMESTAMP);
+  frame.ran[pass] = true;
+}
+
+void endGpuFrame()
+{
+  if (!supported)
+    return;
+
+  FrameQueries& frame = frames[currentSlot];
+  frame.pending = false;
+  for (int pass = 0; pass < passCount; pass++) {
+    if (frame.ran[pass])
+      frame.pending = true;
+  }
+  frame.frameNumber = frameCounter++;
+  currentSlot = (currentSlot + 1) % gpuTimerFrames;
+}
+
+void flushGpuTimers()
+{
+  if (!supported)
+    return;
+  collectFrames(true);
+}
+
+SampleStats gpuPassStats(int pass)
+{
+  return windowStats(windows[pass]);
+}
+
+SampleStats gpuFrameStats()
+{
+  return windowStats(windows[passCount]);
+}
+
+void resetGpuTimerStats()
+{
+  for (int i = 0; i <= gpuTimerMaxPasses; i++) {
+    windows[i].count = 0;
+    windows[i].next = 0;
+  }
+  for (int i = 0; i < gpuTimerFrames; i++)
+    frames[i].pending = false;
+  droppedFrames = 0;
+}
+
+int gpuTimerDroppedFrames()
+{
+  return droppedFrames;
+}
+
+void setGpuTimerLog(FILE* log)
+{
+  logFile = log;
+  if (logFile == NULL || !supported)
+    return;
+
+  fprintf(logFile, "frame");
+  for (int pass = 0; pass < passCount; pass++)
+    fprintf(logFile, ",%s_ms", passNames[pass]);
+  fprintf(logFile, ",frame_ms\n");
+}
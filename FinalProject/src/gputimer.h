@@ -0,0 +1,50 @@
+// File: gputimer.h
+//
+// GPU timing of render passes with GL_TIMESTAMP queries. Each frame's
+// queries go in one slot of a small ring, and results are read back a few
+// frames later, once the GPU reports them available, so timing never makes
+// the CPU wait. Finished frames feed a rolling window of per-pass times.
+
+#ifndef SP_GPUTIMER_H_
+#define SP_GPUTIMER_H_
+
+#include <cstdio>
+
+#include "stats.h"
+
+// Frames of queries that can be in flight at once
+const int gpuTimerFrames = 4;
+// Most passes a frame can time
+const int gpuTimerMaxPasses = 8;
+// Frames the rolling statistics cover
+const int gpuTimerWindow = 120;
+
+// Sets up timing of "passCount" passes, named by "passNames" (used for the
+// log). Needs a current context; does nothing without timer query support.
+void initGpuTimers(int passCount, const char* const passNames[]);
+bool gpuTimersSupported();
+
+// Bracket a frame, and each pass inside it. Passes that don't run in a frame
+// are just left out.
+void beginGpuFrame();
+void beginGpuPass(int pass);
+void endGpuPass(int pass);
+void endGpuFrame();
+
+// Waits for every frame in flight and collects it
+void flushGpuTimers();
+
+// Rolling statistics, in ms, over the last gpuTimerWindow frames the pass
+// ran in. The frame time runs from the start of the first pass to the end
+// of the last.
+SampleStats gpuPassStats(int pass);
+SampleStats gpuFrameStats();
+// Empties the rolling window (frames still in flight are dropped too)
+void resetGpuTimerStats();
+// Frames whose results weren't back before their slot was needed again
+int gpuTimerDroppedFrames();
+
+// Writes a CSV line per finished frame to "log" (NULL to stop)
+void setGpuTimerLog(FILE* log);
+
+#endif // SP_GPUTIMER_H_
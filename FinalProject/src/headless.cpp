@@ -0,0 +1,488 @@
+// File: headless.cpp
+//
+// Renders the scene without a window: creates an OpenGL context through EGL's
+// surfaceless platform (works on Mesa's llvmpipe with no GPU or display),
+// draws a fixed number of frames from a scripted camera into an offscreen
+// framebuffer, and optionally captures each frame (capture.h). It can also
+// check the last frame against the CPU occlusion pass in cpussao.cpp.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "GL/glew.h"
+
+#include "vec3.h"
+#include "render.h"
+#include "image.h"
+#include "benchmark.h"
+#include "gputimer.h"
+#include "trace.h"
+#include "cpussao.h"
+#include "walltime.h"
+#include "capture.h"
+#include "streaming.h"
+#include "jobs.h"
+#include "framering.h"
+#include "arena.h"
+#include "memusage.h"
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+using std::string;
+using std::vector;
+
+// Headless options
+int frameCount = 60;
+string outputDir;
+string timerLogFile;
+bool cpuReference = false;
+int cpuThreads = 0;
+bool streamFrames = false;
+
+FILE* timerLog = NULL;
+float orbitDegrees = 360.0f;
+// Where the camera starts, looking at the origin
+Vec3 cameraStart(0, 1.5f, 1.5f);
+
+EGLDisplay display = EGL_NO_DISPLAY;
+EGLContext context = EGL_NO_CONTEXT;
+
+GLuint offscreenFramebuffer;
+GLuint offscreenColorRenderbuffer;
+GLuint offscreenDepthRenderbuffer;
+
+void printUsage(const char* program)
+{
+  fprintf(stderr, "Usage: %s [options]\n", program);
+  fprintf(stderr, "  --frames N             frames to render (default 60)\n");
+  fprintf(stderr, "  --output DIR           write each frame to DIR/frame_NNNN.ppm (same as --capture DIR)\n");
+  fprintf(stderr, "  --orbit-degrees D      how far the camera circles over the run (default 360)\n");
+  fprintf(stderr, "  --eye X Y Z            where the camera starts (default 0 1.5 1.5)\n");
+  fprintf(stderr, "  --timer-log FILE       write every frame's GPU pass times to FILE as CSV\n");
+  fprintf(stderr, "  --cpu-reference        compare the last frame with occlusion computed on the CPU\n");
+  fprintf(stderr, "  --cpu-threads N        threads for the CPU occlusion (default: one per core)\n");
+  fprintf(stderr, "  --stream               draw while the scene streams in, and report on it, before the run\n");
+  printRenderUsage();
+  printBenchmarkUsage();
+  printCaptureUsage();
+  printTraceUsage();
+}
+
+void parseArguments(int argc, char* argv[])
+{
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frameCount = atoi(argv[++i]);
+      if (frameCount < 1)
+        frameCount = 1;
+    }
+    else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+      outputDir = argv[++i];
+      setCaptureOutput(capturePPM, outputDir.c_str());
+    }
+    else if (strcmp(argv[i], "--orbit-degrees") == 0 && i + 1 < argc) {
+      orbitDegrees = (float)atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--eye") == 0 && i + 3 < argc) {
+      cameraStart.x = (float)atof(argv[++i]);
+      cameraStart.y = (float)atof(argv[++i]);
+      cameraStart.z = (float)atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--timer-log") == 0 && i + 1 < argc) {
+      timerLogFile = argv[++i];
+    }
+    else if (strcmp(argv[i], "--cpu-reference") == 0) {
+      cpuReference = true;
+    }
+    else if (strcmp(argv[i], "--cpu-threads") == 0 && i + 1 < argc) {
+      cpuThreads = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--stream") == 0) {
+      streamFrames = true;
+    }
+    else if (!parseRenderArgument(argc, argv, i) && !parseBenchmarkArgument(argc, argv, i) &&
+        !parseCaptureArgument(argc, argv, i) && !parseTraceArgument(argc, argv, i)) {
+      fprintf(stderr, "Unknown argument %s\n", argv[i]);
+      printUsage(argv[0]);
+      exit(1);
+    }
+  }
+}
+
+// Tries for a 4.3 compatibility context, so the compute shader path is
+// available, and settles for whatever the driver gives otherwise
+EGLContext createContext(EGLConfig config)
+{
+  const EGLint attribs43[] = {
+    EGL_CONTEXT_MAJOR_VERSION_KHR, 4,
+    EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT_KHR,
+    EGL_NONE
+  };
+  EGLContext result = eglCreateContext(display, config, EGL_NO_CONTEXT, attribs43);
+  if (result == EGL_NO_CONTEXT)
+    result = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+  return result;
+}
+
+void initializeEGL()
+{
+  // Prefer the surfaceless platform, which needs no display server at all
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (getPlatformDisplay != NULL)
+    display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+  if (display == EGL_NO_DISPLAY)
+    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+  EGLint major, minor;
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+    fprintf(stderr, "EGL initialization failed.\n");
+    exit(1);
+  }
+  printf("EGL %d.%d (%s)\n", major, minor, eglQueryString(display, EGL_VENDOR));
+
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    fprintf(stderr, "EGL has no desktop OpenGL support.\n");
+    exit(1);
+  }
+
+  // Everything is drawn into our own framebuffer, so the config doesn't need
+  // to support any kind of surface
+  const EGLint configAttribs[] = {
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_SURFACE_TYPE, 0,
+    EGL_NONE
+  };
+  EGLConfig config = (EGLConfig)0;
+  EGLint configCount = 0;
+  if (!eglChooseConfig(display, configAttribs, &config, 1, &configCount) || configCount < 1)
+    config = (EGLConfig)0; // EGL_NO_CONFIG_KHR
+
+  context = createContext(config);
+  if (context == EGL_NO_CONTEXT) {
+    fprintf(stderr, "Couldn't create an OpenGL context (EGL error 0x%x).\n", eglGetError());
+    exit(1);
+  }
+  if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+    fprintf(stderr, "Couldn't make the OpenGL context current (EGL error 0x%x).\n", eglGetError());
+    exit(1);
+  }
+}
+
+void initializeGLEW()
+{
+  // Core entry points of newer contexts aren't all advertised by extension
+  glewExperimental = GL_TRUE;
+  GLenum glewResult = glewInit();
+  // GLEW also probes GLX, which fails without an X display even when the GL
+  // functions themselves loaded fine
+  if (glewResult != GLEW_OK && !GLEW_VERSION_2_0) {
+    fprintf(stderr, "GLEW initialization failed.\n");
+    exit(1);
+  }
+  // Clear any error GLEW's probing left behind
+  while (glGetError() != GL_NO_ERROR)
+    ;
+  printf("OpenGL %s (%s)\n", (const char*)glGetString(GL_VERSION), (const char*)glGetString(GL_RENDERER));
+}
+
+// Creates the framebuffer frames are drawn into in place of a window
+void createOffscreenFramebuffer()
+{
+  glGenRenderbuffers(1, &offscreenColorRenderbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, offscreenColorRenderbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, wWidth, wHeight);
+
+  glGenRenderbuffers(1, &offscreenDepthRenderbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, offscreenDepthRenderbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, wWidth, wHeight);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glGenFramebuffers(1, &offscreenFramebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, offscreenFramebuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreenColorRenderbuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, offscreenDepthRenderbuffer);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    fprintf(stderr, "Offscreen framebuffer is incomplete.\n");
+    exit(1);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  outputFramebuffer = offscreenFramebuffer;
+  // Without a window, nothing sizes the viewport for us
+  glViewport(0, 0, wWidth, wHeight);
+}
+
+// Moves the camera around the model, in the x/z plane, by "frame"'s share of
+// the orbit. The eye keeps its starting height and distance.
+void placeCamera(const Vec3& startEye, int frame)
+{
+  const static double pi = acos(0.0) * 2;
+  Vec3 offset = startEye.add(lookat.scale(-1));
+  float theta = (float)(orbitDegrees * pi / 180.0 * frame / frameCount);
+
+  Vec3 rotated;
+  rotated.x = (float)cos(theta)*offset.x + (float)sin(theta)*offset.z;
+  rotated.y = offset.y;
+  rotated.z =-(float)sin(theta)*offset.x + (float)cos(theta)*offset.z;
+  eye = lookat.add(rotated);
+}
+
+// Redoes the last frame's occlusion and blur on the CPU, from the same
+// G-buffer, and reports how far GL's output is from it
+void compareWithCPU()
+{
+  if (!ambientOcclusionState) {
+    printf("Occlusion is off, so there's nothing for the CPU reference to check.\n");
+    return;
+  }
+  if (temporalAOState || (deinterleavedAOState && !computeAOState)) {
+    printf("The CPU reference only covers the interleaved and compute shader paths, not %s%s.\n",
+        aoModeName(), temporalAOState ? " with temporal accumulation" : "");
+    return;
+  }
+
+  GBuffer gbuffer;
+  readGBuffer(gbuffer);
+  SSAOSettings settings;
+  occlusionSettings(settings);
+
+  double start = wallClockMs();
+  vector<float> occlusion;
+  vector<float> blurred;
+  computeOcclusionCPU(gbuffer, settings, occlusion, cpuThreads);
+  blurOcclusionCPU(occlusion, wWidth, wHeight, settings.quantizeOcclusion, blurred, cpuThreads);
+  double elapsed = wallClockMs() - start;
+
+  vector<unsigned char> cpuPixels;
+  shadeWithOcclusionCPU(gbuffer, blurred, cpuPixels);
+
+  vector<unsigned char> glPixels(wWidth * wHeight * 3);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, offscreenFramebuffer);
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, wWidth, wHeight, GL_RGB, GL_UNSIGNED_BYTE, &glPixels[0]);
+
+  int maxDifference = 0;
+  long long totalDifference = 0;
+  int pixelsOff = 0;
+  for (int pixel = 0; pixel < wWidth * wHeight; pixel++) {
+    int pixelDifference = 0;
+    for (int c = 0; c < 3; c++) {
+      int difference = abs((int)cpuPixels[pixel * 3 + c] - (int)glPixels[pixel * 3 + c]);
+      totalDifference += difference;
+      if (difference > pixelDifference)
+        pixelDifference = difference;
+    }
+    if (pixelDifference > maxDifference)
+      maxDifference = pixelDifference;
+    // One step either way is just rounding
+    if (pixelDifference > 1)
+      pixelsOff++;
+  }
+
+  printf("CPU reference (%s): %.1f ms for occlusion and blur.\n", aoModeName(), elapsed);
+  printf("  mean difference %.4f/255, max %d/255, %.3f%% of pixels off by more than 1/255\n",
+      (double)totalDifference / (wWidth * wHeight * 3), maxDifference, 100.0 * pixelsOff / (wWidth * wHeight));
+
+  if (!outputDir.empty()) {
+    string path = outputDir + "/cpu_reference.ppm";
+    if (!writePPM(path.c_str(), &cpuPixels[0], wWidth, wHeight, true)) {
+      fprintf(stderr, "Couldn't write %s\n", path.c_str());
+      exit(1);
+    }
+    printf("Wrote the CPU reference frame to %s\n", path.c_str());
+  }
+}
+
+void openTimerLog()
+{
+  if (timerLogFile.empty())
+    return;
+  if (!gpuTimersSupported()) {
+    printf("No timer query support, not writing %s\n", timerLogFile.c_str());
+    return;
+  }
+  timerLog = fopen(timerLogFile.c_str(), "w");
+  if (timerLog == NULL) {
+    fprintf(stderr, "Couldn't write %s\n", timerLogFile.c_str());
+    exit(1);
+  }
+  setGpuTimerLog(timerLog);
+}
+
+void closeTimerLog()
+{
+  if (timerLog == NULL)
+    return;
+  // Everything still in flight goes into the log first
+  flushGpuTimers();
+  setGpuTimerLog(NULL);
+  fclose(timerLog);
+  timerLog = NULL;
+  printf("Wrote GPU pass times to %s\n", timerLogFile.c_str());
+}
+
+// Draws from the starting view while the scene streams in, then says how
+// long that took and how long the slowest of those frames was. The first
+// frame isn't timed, as in renderFrames().
+void renderWhileStreaming(const Vec3& startEye)
+{
+  double start = wallClockMs();
+  double slowest = 0.0;
+  int frames = 1;
+  placeCamera(startEye, 0);
+  renderFrame();
+  while (!sceneStreamedIn()) {
+    double frameStart = wallClockMs();
+    renderFrame();
+    glFinish();
+    slowest = std::max(slowest, wallClockMs() - frameStart);
+    frames++;
+  }
+  discardPassTimes();
+
+  StreamingStats stats = streamingStats();
+  printf("Streaming: everything was in after %d frames (%.0f ms), the slowest %.1f ms.\n", frames,
+      wallClockMs() - start, slowest);
+  printf("  %.1f MB uploaded %s over %d frames, at most %.2f ms a frame; %d frames found the ring busy.\n",
+      stats.bytesUploaded / (1024.0 * 1024.0), stats.persistent ? "through the staging ring" : "with glBufferSubData",
+      stats.uploadFrames, stats.maxUploadMs, stats.busyFrames);
+}
+
+void renderFrames(const Vec3& startEye)
+{
+  printf("Rendering %d frames, %s occlusion%s.\n", frameCount,
+      ambientOcclusionState ? aoModeName() : "no", reconstructNormalsState ? ", normals from depth" : "");
+
+  // One untimed frame first, so shader compilation and first-use costs don't
+  // end up in the pass times
+  placeCamera(startEye, 0);
+  renderFrame();
+  discardPassTimes();
+  openTimerLog();
+  resetJobStats();
+  resetFrameRingStats();
+
+  long long drawn = 0, culled = 0, occluded = 0, triangles = 0;
+  long long clustersTested = 0, clustersOutside = 0, clustersBackfacing = 0;
+  double cullMs = 0.0;
+  for (int frame = 0; frame < frameCount; frame++) {
+    placeCamera(startEye, frame);
+    renderFrame();
+    captureFrame();
+    drawn += lastDrawStats.instances - 1;
+    culled += lastDrawStats.culled;
+    occluded += lastDrawStats.occluded;
+    triangles += lastDrawStats.triangles;
+    clustersTested += lastDrawStats.clustersTested;
+    clustersOutside += lastDrawStats.clustersOutsideFrustum;
+    clustersBackfacing += lastDrawStats.clustersBackfacing;
+    cullMs += lastDrawStats.cullMs;
+  }
+  closeTimerLog();
+  reportPassTimes();
+  printf("Instances: %.1f drawn and %.1f culled a frame on average, %.3f ms a frame culling%s.\n",
+      (double)drawn / frameCount, (double)culled / frameCount, cullMs / frameCount,
+      cullingEnabled ? (gpuCullingState ? " on the GPU" : "") : " (off)");
+  if (cullingEnabled && gpuCullingState)
+    printf("  %.1f of the culled instances a frame were hidden by the last frame's depth.\n", (double)occluded / frameCount);
+  printf("Triangles: %.0f drawn a frame on average%s.\n", (double)triangles / frameCount,
+      lodState ? "" : " (levels of detail off)");
+  if (clustersTested > 0) {
+    printf("Meshlets: %.0f tested a frame on average, %.1f%% rejected (%.1f%% outside the frustum, %.1f%% facing away).\n",
+        (double)clustersTested / frameCount, 100.0 * (clustersOutside + clustersBackfacing) / clustersTested,
+        100.0 * clustersOutside / clustersTested, 100.0 * clustersBackfacing / clustersTested);
+  }
+  JobStats jobs = jobStats();
+  if (jobs.jobsRun > 0) {
+    printf("Jobs: %.1f run a frame on %d workers; %lld stolen, %lld steals found nothing, %lld contended locks, "
+        "%lld worker sleeps.\n", (double)jobs.jobsRun / frameCount, jobWorkerCount(), jobs.steals, jobs.failedSteals,
+        jobs.contendedLocks, jobs.sleeps);
+  }
+  FrameRingStats ring = frameRingStats();
+  if (ring.frames > 0) {
+    printf("Frame ring: %s, %lu KB a frame; %lld of %lld frames waited on a fence, %.3f ms in all (at most %.3f), "
+        "%lld overflows, grown %d times.\n", ring.persistent ? "persistently mapped" : "glBufferSubData",
+        (unsigned long)(ring.regionBytes / 1024), ring.fenceWaits, ring.frames, ring.fenceWaitMs, ring.maxFenceWaitMs,
+        ring.overflows, ring.grows);
+  }
+  if (cpuReference)
+    compareWithCPU();
+}
+
+// entry point
+int main(int argc, char* argv[])
+{
+  setupState();
+  parseArguments(argc, argv);
+  generateKernel();
+
+  initializeEGL();
+  initializeGLEW();
+
+  // initialize the camera
+  eye = cameraStart;
+  lookat = Vec3(0, 0, 0);
+  Vec3 startEye = eye;
+
+  // initialize gl
+  initializeOpenGL();
+  loadShaders();
+  createOffscreenFramebuffer();
+
+  // load the model
+  size_t residentBeforeLoad = residentBytes();
+  loadModel();
+  if (streamFrames)
+    renderWhileStreaming(startEye);
+  else
+    waitForScene();
+  ArenaMemoryStats arenas = arenaMemoryStats();
+  printf("Memory: %.0f MB resident before loading and %.0f MB after, %.0f MB at the peak; loading arenas held "
+      "%.0f MB at most, %.0f MB still.\n", residentBeforeLoad / 1048576.0, residentBytes() / 1048576.0,
+      peakResidentBytes() / 1048576.0, arenas.peakReservedBytes / 1048576.0, arenas.reservedBytes / 1048576.0);
+  startCapture(offscreenFramebuffer, wWidth, wHeight);
+
+  if (benchmarkEnabled) {
+    openTimerLog();
+    startBenchmark();
+    do {
+      beginBenchmarkFrame();
+      renderFrame();
+      captureFrame();
+    } while (!endBenchmarkFrame());
+    closeTimerLog();
+  }
+  else {
+    renderFrames(startEye);
+  }
+
+  bool captured = finishCapture();
+
+  GLenum error = glGetError();
+  if (error != GL_NO_ERROR)
+    fprintf(stderr, "OpenGL error 0x%x while rendering.\n", error);
+
+  if (traceEnabled) {
+    flushGpuTimers();
+    writeTrace();
+  }
+
+  eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglDestroyContext(display, context);
+  eglTerminate(display);
+
+  return error == GL_NO_ERROR && captured ? 0 : 1;
+}
@@ -0,0 +1,72 @@
+#include "image.h"
+
+#include <cstdio>
+
+bool writePPM(const char* path, const unsigned char* pixels, int width, int height, bool bottomUp)
+{
+  FILE* file = fopen(path, "wb");
+  if (file == NULL)
+    return false;
+
+  fprintf(file, "P6\n%d %d\n255\n", width, height);
+  bool ok = true;
+  for (int y = 0; y < height && ok; y++) {
+    int row = bottomUp ? height - 1 - y : y;
+    ok = fwrite(pixels + (size_t)row * width * 3, 3, width, file) == (size_t)width;
+  }
+
+  if (fclose(file) != 0)
+    ok = false;
+  return ok;
+}
+
+namespace {
+
+// Reads the next number in a PPM header, skipping whitespace and comments
+bool readHeaderNumber(FILE* file, int& value)
+{
+  int c = fgetc(file);
+  for (;;) {
+    if (c == '#') {
+      while (c != '\n' && c != EOF)
+        c = fgetc(file);
+    }
+    else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+      c = fgetc(file);
+    }
+    else {
+      break;
+    }
+  }
+  if (c < '0' || c > '9')
+    return false;
+  value = 0;
+  while (c >= '0' && c <= '9') {
+    value = value * 10 + (c - '0');
+    if (value > 1 << 20)
+      return false;
+    c = fgetc(file);
+  }
+  // Exactly one whitespace character ends the number, which "c" already is
+  return c != EOF;
+}
+
+}
+
+bool readPPM(const char* path, std::vector<unsigned char>& pixels, int& width, int& height)
+{
+  FILE* file = fopen(path, "rb");
+  if (file == NULL)
+    return false;
+
+  int maxValue = 0;
+  bool ok = fgetc(file) == 'P' && fgetc(file) == '6' && readHeaderNumber(file, width) &&
+      readHeaderNumber(file, height) && readHeaderNumber(file, maxValue) && maxValue == 255 &&
+      width > 0 && height > 0;
+  if (ok) {
+    pixels.resize((size_t)width * height * 3);
+    ok = fread(&pixels[0], 3, (size_t)width * height, file) == (size_t)width * height;
+  }
+  fclose(file);
+  return ok;
+}
@@ -0,0 +1,16 @@
+#ifndef SP_IMAGE_H_
+#define SP_IMAGE_H_
+
+#include <vector>
+
+// Writes tightly packed 8-bit RGB pixels to "path" as a binary PPM. If
+// "bottomUp" is set, the first row in "pixels" is the bottom of the image, as
+// glReadPixels() returns it. Returns false if the file can't be written.
+bool writePPM(const char* path, const unsigned char* pixels, int width, int height, bool bottomUp);
+
+// Reads a binary PPM with 8-bit channels (as writePPM() writes them) into
+// "pixels", top row first. Returns false if it can't be read or is in some
+// other format.
+bool readPPM(const char* path, std::vector<unsigned char>& pixels, int& width, int& height);
+
+#endif // SP_IMAGE_H_
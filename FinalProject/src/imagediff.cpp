@@ -0,0 +1,141 @@
+#include "imagediff.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+using std::vector;
+
+namespace {
+
+const int ssimWindowSize = 8;
+const int ssimWindowStep = 4;
+
+float luma(const unsigned char* pixel)
+{
+  return 0.299f * pixel[0] + 0.587f * pixel[1] + 0.114f * pixel[2];
+}
+
+int pixelDifference(const unsigned char* a, const unsigned char* b)
+{
+  int difference = 0;
+  for (int c = 0; c < 3; c++)
+    difference = std::max(difference, abs((int)a[c] - (int)b[c]));
+  return difference;
+}
+
+// SSIM of one window of the two luma images
+double windowSSIM(const vector<float>& a, const vector<float>& b, int width, int x0, int y0)
+{
+  const double c1 = (0.01 * 255) * (0.01 * 255);
+  const double c2 = (0.03 * 255) * (0.03 * 255);
+  const int count = ssimWindowSize * ssimWindowSize;
+
+  double sumA = 0.0, sumB = 0.0, sumAA = 0.0, sumBB = 0.0, sumAB = 0.0;
+  for (int y = y0; y < y0 + ssimWindowSize; y++) {
+    for (int x = x0; x < x0 + ssimWindowSize; x++) {
+      double va = a[y * width + x];
+      double vb = b[y * width + x];
+      sumA += va;
+      sumB += vb;
+      sumAA += va * va;
+      sumBB += vb * vb;
+      sumAB += va * vb;
+    }
+  }
+  double meanA = sumA / count;
+  double meanB = sumB / count;
+  double varianceA = sumAA / count - meanA * meanA;
+  double varianceB = sumBB / count - meanB * meanB;
+  double covariance = sumAB / count - meanA * meanB;
+  return ((2 * meanA * meanB + c1) * (2 * covariance + c2)) /
+      ((meanA * meanA + meanB * meanB + c1) * (varianceA + varianceB + c2));
+}
+
+}
+
+ImageDifference compareImages(const vector<unsigned char>& image, const vector<unsigned char>& reference,
+    int width, int height, int tolerance)
+{
+  ImageDifference result;
+  result.maxDifference = 0;
+  int pixelsOver = 0;
+  double squaredError = 0.0;
+  vector<float> imageLuma(width * height);
+  vector<float> referenceLuma(width * height);
+  for (int pixel = 0; pixel < width * height; pixel++) {
+    const unsigned char* a = &image[pixel * 3];
+    const unsigned char* b = &reference[pixel * 3];
+    int difference = pixelDifference(a, b);
+    result.maxDifference = std::max(result.maxDifference, difference);
+    if (difference > tolerance)
+      pixelsOver++;
+    for (int c = 0; c < 3; c++)
+      squaredError += (double)(a[c] - b[c]) * (a[c] - b[c]);
+    imageLuma[pixel] = luma(a);
+    referenceLuma[pixel] = luma(b);
+  }
+  result.fractionOver = (double)pixelsOver / (width * height);
+
+  double meanSquaredError = squaredError / (width * height * 3);
+  if (meanSquaredError > 0.0)
+    result.psnr = 10.0 * log10(255.0 * 255.0 / meanSquaredError);
+  else
+    result.psnr = std::numeric_limits<double>::infinity();
+
+  double ssimTotal = 0.0;
+  int windows = 0;
+  for (int y = 0; y + ssimWindowSize <= height; y += ssimWindowStep) {
+    for (int x = 0; x + ssimWindowSize <= width; x += ssimWindowStep) {
+      ssimTotal += windowSSIM(imageLuma, referenceLuma, width, x, y);
+      windows++;
+    }
+  }
+  result.ssim = windows > 0 ? ssimTotal / windows : 1.0;
+  return result;
+}
+
+void differenceHeatmap(const vector<unsigned char>& image, const vector<unsigned char>& reference,
+    int width, int height, int tolerance, vector<unsigned char>& heatmap)
+{
+  // Blue, green, yellow, red
+  static const float ramp[4][3] = { { 0, 0, 255 }, { 0, 255, 0 }, { 255, 255, 0 }, { 255, 0, 0 } };
+  float fullScale = 4.0f * std::max(tolerance, 1);
+
+  heatmap.resize(width * height * 3);
+  for (int pixel = 0; pixel < width * height; pixel++) {
+    int difference = pixelDifference(&image[pixel * 3], &reference[pixel * 3]);
+    unsigned char* out = &heatmap[pixel * 3];
+    if (difference == 0) {
+      unsigned char gray = (unsigned char)(luma(&reference[pixel * 3]) * 0.25f);
+      out[0] = out[1] = out[2] = gray;
+      continue;
+    }
+    float t = std::min(difference / fullScale, 1.0f) * 3.0f;
+    int segment = std::min((int)t, 2);
+    float blend = t - segment;
+    for (int c = 0; c < 3; c++)
+      out[c] = (unsigned char)(ramp[segment][c] + (ramp[segment + 1][c] - ramp[segment][c]) * blend);
+  }
+}
+
+void downsampleImage(const vector<unsigned char>& image, int width, int height, int factor,
+    vector<unsigned char>& result)
+{
+  int resultWidth = width / factor;
+  int resultHeight = height / factor;
+  result.resize(resultWidth * resultHeight * 3);
+  for (int y = 0; y < resultHeight; y++) {
+    for (int x = 0; x < resultWidth; x++) {
+      for (int c = 0; c < 3; c++) {
+        int sum = 0;
+        for (int dy = 0; dy < factor; dy++) {
+          for (int dx = 0; dx < factor; dx++)
+            sum += image[((y * factor + dy) * width + x * factor + dx) * 3 + c];
+        }
+        result[(y * resultWidth + x) * 3 + c] = (unsigned char)((sum + factor * factor / 2) / (factor * factor));
+      }
+    }
+  }
+}
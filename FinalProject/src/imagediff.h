@@ -0,0 +1,40 @@
+// File: imagediff.h
+//
+// Measures how far a rendered frame is from a reference one, for the
+// regression check (regress.cpp). Images are tightly packed 8-bit RGB.
+
+#ifndef SP_IMAGEDIFF_H_
+#define SP_IMAGEDIFF_H_
+
+#include <vector>
+
+struct ImageDifference
+{
+  // Largest difference in any channel of any pixel, out of 255
+  int maxDifference;
+  // Share of pixels with a channel more than the tolerance off, 0 to 1
+  double fractionOver;
+  // Peak signal to noise ratio over all channels, in dB; infinite if the
+  // images are identical
+  double psnr;
+  // Mean structural similarity of the luma, over 8x8 windows; 1 if identical
+  double ssim;
+};
+
+// Compares two images of the same size. Pixels count as off if any channel
+// differs by more than "tolerance".
+ImageDifference compareImages(const std::vector<unsigned char>& image, const std::vector<unsigned char>& reference,
+    int width, int height, int tolerance);
+
+// Fills "heatmap" with a picture of where the images differ: the reference,
+// dimmed, with differing pixels colored from blue (slightly off) through
+// green and yellow to red (four times the tolerance or more)
+void differenceHeatmap(const std::vector<unsigned char>& image, const std::vector<unsigned char>& reference,
+    int width, int height, int tolerance, std::vector<unsigned char>& heatmap);
+
+// Shrinks "image" by "factor" each way, averaging each factor x factor block
+// into one pixel; rows and columns left over at the edges are dropped
+void downsampleImage(const std::vector<unsigned char>& image, int width, int height, int factor,
+    std::vector<unsigned char>& result);
+
+#endif // SP_IMAGEDIFF_H_
@@ -0,0 +1,325 @@
+#include "jobs.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "parallel.h"
+#include "trace.h"
+
+using std::vector;
+
+struct JobState
+{
+  std::function<void()> body;
+  bool background;
+  // Unfinished jobs this one waits on, plus one until addJob() has queued
+  // it on all of them
+  std::atomic<int> pending;
+  std::atomic<bool> finished;
+  // Guards dependents, and finished being set
+  std::mutex mutex;
+  vector<Job> dependents;
+};
+
+namespace {
+
+// Jobs waiting for a thread, with the lock that guards them
+struct JobQueue
+{
+  std::mutex mutex;
+  std::deque<Job> jobs;
+};
+
+std::atomic<long long> jobsRun(0);
+std::atomic<long long> steals(0);
+std::atomic<long long> failedSteals(0);
+std::atomic<long long> contendedLocks(0);
+std::atomic<long long> sleeps(0);
+
+// The worker the calling thread is, -1 for any other thread
+thread_local int workerIndex = -1;
+
+void lockQueue(JobQueue& queue, std::unique_lock<std::mutex>& lock)
+{
+  lock = std::unique_lock<std::mutex>(queue.mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    contendedLocks++;
+    lock.lock();
+  }
+}
+
+class JobPool
+{
+public:
+  JobPool() : queuedJobs(0), queuedBackground(0), sleepers(0), stopping(false)
+  {
+    int workerCount = std::max(defaultThreadCount() - 1, 1);
+    for (int i = 0; i < workerCount; i++)
+      deques.push_back(std::unique_ptr<JobQueue>(new JobQueue));
+    for (int i = 0; i < workerCount; i++)
+      workers.push_back(std::thread(&JobPool::runWorker, this, i));
+  }
+
+  // Lets the workers finish what they're running, then stops them. Whatever
+  // is still queued is dropped.
+  ~JobPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      stopping = true;
+    }
+    changed.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+      if (workers[i].get_id() == std::this_thread::get_id())
+        workers[i].detach();
+      else
+        workers[i].join();
+    }
+  }
+
+  int workerCount() const { return (int)workers.size(); }
+
+  // Queues a job whose dependencies have all finished: a worker's own go on
+  // the back of its deque, anyone else's on the shared queue
+  void queue(const Job& job)
+  {
+    JobQueue& target = job->background ? background : workerIndex >= 0 ? *deques[workerIndex] : shared;
+    {
+      std::unique_lock<std::mutex> lock;
+      lockQueue(target, lock);
+      target.jobs.push_back(job);
+    }
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    if (job->background)
+      queuedBackground++;
+    else
+      queuedJobs++;
+    if (sleepers > 0)
+      changed.notify_all();
+  }
+
+  // Runs jobs until "job" has finished
+  void wait(const Job& job)
+  {
+    while (!job->finished) {
+      if (runJob(false))
+        continue;
+      std::unique_lock<std::mutex> lock(sleepMutex);
+      sleepers++;
+      changed.wait(lock, [&] { return job->finished || queuedJobs > 0; });
+      sleepers--;
+    }
+  }
+
+  // Tells waiting threads a job has finished
+  void finished()
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    if (sleepers > 0)
+      changed.notify_all();
+  }
+
+private:
+  void runWorker(int self)
+  {
+    workerIndex = self;
+    traceSetThreadName("job worker");
+    while (!stopping) {
+      if (runJob(true))
+        continue;
+      std::unique_lock<std::mutex> lock(sleepMutex);
+      if (queuedJobs > 0 || queuedBackground > 0 || stopping)
+        continue;
+      sleeps++;
+      sleepers++;
+      changed.wait(lock, [&] { return queuedJobs > 0 || queuedBackground > 0 || stopping; });
+      sleepers--;
+    }
+  }
+
+  // Runs one job if there's one the calling thread can take, and returns
+  // whether it did
+  bool runJob(bool takeBackground)
+  {
+    Job job = take(takeBackground);
+    if (!job)
+      return false;
+    run(job);
+    return true;
+  }
+
+  Job take(bool takeBackground)
+  {
+    Job job;
+    int self = workerIndex;
+    if (self >= 0 && popBack(*deques[self], job))
+      return job;
+    if (popFront(shared, job, false))
+      return job;
+    int count = (int)deques.size();
+    for (int i = 1; i <= count; i++) {
+      int victim = ((self < 0 ? 0 : self) + i) % count;
+      if (victim != self && popFront(*deques[victim], job, true))
+        return job;
+    }
+    if (takeBackground && popFront(background, job, false))
+      return job;
+    return Job();
+  }
+
+  bool popBack(JobQueue& queue, Job& job)
+  {
+    std::unique_lock<std::mutex> lock;
+    lockQueue(queue, lock);
+    if (queue.jobs.empty())
+      return false;
+    job = std::move(queue.jobs.back());
+    queue.jobs.pop_back();
+    queuedJobs--;
+    return true;
+  }
+
+  bool popFront(JobQueue& queue, Job& job, bool stealing)
+  {
+    std::unique_lock<std::mutex> lock;
+    lockQueue(queue, lock);
+    if (queue.jobs.empty()) {
+      if (stealing)
+        failedSteals++;
+      return false;
+    }
+    job = std::move(queue.jobs.front());
+    queue.jobs.pop_front();
+    if (job->background)
+      queuedBackground--;
+    else
+      queuedJobs--;
+    if (stealing)
+      steals++;
+    return true;
+  }
+
+  void run(const Job& job);
+
+  vector<std::unique_ptr<JobQueue>> deques;
+  JobQueue shared;
+  JobQueue background;
+  vector<std::thread> workers;
+
+  // Guards sleeping and waking
+  std::mutex sleepMutex;
+  std::condition_variable changed;
+  std::atomic<int> queuedJobs;
+  std::atomic<int> queuedBackground;
+  int sleepers;
+  std::atomic<bool> stopping;
+};
+
+JobPool& pool()
+{
+  static JobPool jobPool;
+  return jobPool;
+}
+
+// Counts off a finished dependency, queueing "job" if it was the last
+void release(const Job& job)
+{
+  if (--job->pending == 0)
+    pool().queue(job);
+}
+
+void JobPool::run(const Job& job)
+{
+  job->body();
+  job->body = std::function<void()>();
+  jobsRun++;
+
+  vector<Job> dependents;
+  {
+    std::lock_guard<std::mutex> lock(job->mutex);
+    job->finished = true;
+    dependents.swap(job->dependents);
+  }
+  for (size_t i = 0; i < dependents.size(); i++)
+    release(dependents[i]);
+  finished();
+}
+
+Job makeJob(const std::function<void()>& body, bool background)
+{
+  Job job = std::make_shared<JobState>();
+  job->body = body;
+  job->background = background;
+  job->pending = 1;
+  job->finished = false;
+  return job;
+}
+
+}
+
+Job addJob(const std::function<void()>& body, const vector<Job>& after)
+{
+  Job job = makeJob(body, false);
+  for (size_t i = 0; i < after.size(); i++) {
+    std::lock_guard<std::mutex> lock(after[i]->mutex);
+    if (!after[i]->finished) {
+      job->pending++;
+      after[i]->dependents.push_back(job);
+    }
+  }
+  release(job);
+  return job;
+}
+
+Job addBackgroundJob(const std::function<void()>& body)
+{
+  Job job = makeJob(body, true);
+  release(job);
+  return job;
+}
+
+void waitForJob(const Job& job)
+{
+  if (!job->finished)
+    pool().wait(job);
+}
+
+void waitForJobs(const vector<Job>& jobs)
+{
+  for (size_t i = 0; i < jobs.size(); i++)
+    waitForJob(jobs[i]);
+}
+
+bool jobFinished(const Job& job)
+{
+  return job->finished;
+}
+
+int jobWorkerCount()
+{
+  return pool().workerCount();
+}
+
+JobStats jobStats()
+{
+  JobStats stats;
+  stats.jobsRun = jobsRun;
+  stats.steals = steals;
+  stats.failedSteals = failedSteals;
+  stats.contendedLocks = contendedLocks;
+  stats.sleeps = sleeps;
+  return stats;
+}
+
+void resetJobStats()
+{
+  jobsRun = 0;
+  steals = 0;
+  failedSteals = 0;
+  contendedLocks = 0;
+  sleeps = 0;
+}
@@ -0,0 +1,58 @@
+// File: jobs.h
+//
+// A pool of worker threads that runs jobs for the rest of the program.
+// Each worker has its own deque: jobs it adds go on the back and it takes
+// its next one from there, while an idle worker steals from the front of
+// someone else's. Jobs added by other threads go on a shared queue. A job can
+// wait on others; it isn't queued until they've all finished. A thread
+// waiting for a job runs other jobs meanwhile rather than block.
+//
+// Background jobs (loading, say) are kept apart: only an otherwise idle
+// worker takes one, and a waiting thread never does, so waiting for a frame's
+// work can't get stuck behind them.
+
+#ifndef SP_JOBS_H_
+#define SP_JOBS_H_
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+struct JobState;
+typedef std::shared_ptr<JobState> Job;
+
+// Queues "body" to run once every job in "after" has finished
+Job addJob(const std::function<void()>& body, const std::vector<Job>& after = std::vector<Job>());
+
+// Queues "body" as a background job
+Job addBackgroundJob(const std::function<void()>& body);
+
+// Returns once "job" has finished, running other jobs meanwhile
+void waitForJob(const Job& job);
+void waitForJobs(const std::vector<Job>& jobs);
+
+// True once "job" has finished, without waiting
+bool jobFinished(const Job& job);
+
+// Worker threads in the pool: one less than there are cores, as whoever adds
+// the jobs usually helps run them, but at least one for background jobs
+int jobWorkerCount();
+
+// Counts since the last resetJobStats(), for seeing how much the workers get
+// in each other's way
+struct JobStats
+{
+  long long jobsRun;
+  // Jobs taken from another worker's deque, and looks at one that came away
+  // empty handed
+  long long steals;
+  long long failedSteals;
+  // Times a thread found a deque or queue locked by someone else
+  long long contendedLocks;
+  // Times a worker ran out of jobs and went to sleep
+  long long sleeps;
+};
+JobStats jobStats();
+void resetJobStats();
+
+#endif // SP_JOBS_H_
@@ -0,0 +1,207 @@
+#include "kernel.h"
+
+#include <cmath>
+
+using std::vector;
+
+namespace {
+
+// Small, seedable generator so kernels don't depend on the C library's rand()
+class KernelRandom
+{
+public:
+  explicit KernelRandom(unsigned int seed) : state(seed * 2654435761u + 1u) { }
+
+  // Uniform in [0, 1)
+  float next()
+  {
+    // xorshift32
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (state >> 8) * (1.0f / 16777216.0f);
+  }
+
+private:
+  unsigned int state;
+};
+
+const float pi = 3.14159265f;
+
+// Void-and-cluster (Ulichney 1993). Ranks every cell of a toroidal size x size
+// grid so that, for any n, the n lowest ranked cells are evenly spread.
+class VoidAndCluster
+{
+public:
+  VoidAndCluster(int size, unsigned int seed) : size(size), cells(size * size),
+      pattern(cells, false), energy(cells, 0.0f), falloff(cells)
+  {
+    // Gaussian energy each set cell adds to the others, by toroidal offset
+    const float sigma = 1.5f;
+    for (int y = 0; y < size; y++) {
+      for (int x = 0; x < size; x++) {
+        float dx = (float)(x <= size / 2 ? x : size - x);
+        float dy = (float)(y <= size / 2 ? y : size - y);
+        falloff[y * size + x] = expf(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+      }
+    }
+
+    // Random starting pattern with about a tenth of the cells set
+    KernelRandom random(seed);
+    int initialCount = cells / 10 > 0 ? cells / 10 : 1;
+    int placed = 0;
+    while (placed < initialCount) {
+      int cell = (int)(random.next() * cells);
+      if (cell >= cells || pattern[cell])
+        continue;
+      set(cell, true);
+      placed++;
+    }
+
+    // Move points from the tightest cluster to the largest void until that
+    // stops changing anything
+    for (int iteration = 0; iteration < cells * 4; iteration++) {
+      int cluster = extreme(true, true);
+      set(cluster, false);
+      int hole = extreme(false, false);
+      set(hole, true);
+      if (hole == cluster)
+        break;
+    }
+    initialPattern = pattern;
+    initialOnes = initialCount;
+  }
+
+  void rank(vector<int>& ranks)
+  {
+    ranks.assign(cells, 0);
+
+    // Phase 1: peel the starting points off from the tightest cluster down
+    int ones = initialOnes;
+    while (ones > 0) {
+      int cluster = extreme(true, true);
+      set(cluster, false);
+      ones--;
+      ranks[cluster] = ones;
+    }
+
+    // Phase 2: fill the largest voids, up to half full
+    restore();
+    ones = initialOnes;
+    while (ones < (cells + 1) / 2) {
+      int hole = extreme(false, false);
+      set(hole, true);
+      ranks[hole] = ones;
+      ones++;
+    }
+
+    // Phase 3: from here the unset cells are the minority, so fill the
+    // tightest cluster of unset cells first
+    invert();
+    while (ones < cells) {
+      int cluster = extreme(true, true);
+      set(cluster, false);
+      ranks[cluster] = ones;
+      ones++;
+    }
+  }
+
+private:
+  void set(int cell, bool value)
+  {
+    if (pattern[cell] == value)
+      return;
+    pattern[cell] = value;
+    float sign = value ? 1.0f : -1.0f;
+    int cx = cell % size;
+    int cy = cell / size;
+    for (int y = 0; y < size; y++) {
+      int dy = (y - cy + size) % size;
+      for (int x = 0; x < size; x++) {
+        int dx = (x - cx + size) % size;
+        energy[y * size + x] += sign * falloff[dy * size + dx];
+      }
+    }
+  }
+
+  // Finds the highest (or lowest) energy cell among the set (or unset) cells
+  int extreme(bool amongSet, bool highest)
+  {
+    int best = -1;
+    for (int cell = 0; cell < cells; cell++) {
+      if (pattern[cell] != amongSet)
+        continue;
+      if (best < 0 || (highest ? energy[cell] > energy[best] : energy[cell] < energy[best]))
+        best = cell;
+    }
+    return best;
+  }
+
+  void restore()
+  {
+    for (int cell = 0; cell < cells; cell++)
+      set(cell, initialPattern[cell]);
+  }
+
+  void invert()
+  {
+    vector<bool> inverted(cells);
+    for (int cell = 0; cell < cells; cell++)
+      inverted[cell] = !pattern[cell];
+    for (int cell = 0; cell < cells; cell++)
+      set(cell, inverted[cell]);
+  }
+
+  int size;
+  int cells;
+  vector<bool> pattern;
+  vector<bool> initialPattern;
+  int initialOnes;
+  vector<float> energy;
+  vector<float> falloff;
+};
+
+}
+
+void generateSSAOKernel(int sampleCount, unsigned int seed, vector<float>& offsets)
+{
+  KernelRandom random(seed);
+  offsets.resize(sampleCount * 3);
+
+  for (int i = 0; i < sampleCount; i++) {
+    // Cosine weighted direction about +z
+    float u1 = random.next();
+    float u2 = random.next();
+    float r = sqrtf(u1);
+    float phi = 2.0f * pi * u2;
+    float x = r * cosf(phi);
+    float y = r * sinf(phi);
+    float z = sqrtf(1.0f - u1);
+
+    // Spread lengths over the kernel, one jittered stratum per sample, biased
+    // towards the center
+    float t = (i + random.next()) / sampleCount;
+    float length = 0.1f + 0.9f * t * t;
+
+    offsets[i * 3] = x * length;
+    offsets[i * 3 + 1] = y * length;
+    offsets[i * 3 + 2] = z * length;
+  }
+}
+
+void generateRotationNoise(int size, unsigned int seed, vector<float>& directions)
+{
+  vector<int> ranks;
+  VoidAndCluster(size, seed).rank(ranks);
+
+  int cells = size * size;
+  directions.resize(cells * 3);
+  for (int cell = 0; cell < cells; cell++) {
+    // Each rank gets its own evenly spaced angle
+    float angle = 2.0f * pi * (ranks[cell] + 0.5f) / cells;
+    // Scale and bias from [-1, 1] to [0, 1]
+    directions[cell * 3] = 0.5f * cosf(angle) + 0.5f;
+    directions[cell * 3 + 1] = 0.5f * sinf(angle) + 0.5f;
+    directions[cell * 3 + 2] = 0.5f;
+  }
+}
@@ -0,0 +1,35 @@
+#ifndef SP_KERNEL_H_
+#define SP_KERNEL_H_
+
+#include <vector>
+
+// Smallest and largest kernels generateSSAOKernel() will make
+const int minKernelSize = 4;
+const int maxKernelSize = 64;
+// Largest rotation texture generateRotationNoise() is asked for. Its time
+// grows with the fourth power of the size: 64 takes about a third of a
+// second, 128 several seconds.
+const int maxNoiseSize = 64;
+
+// Settings the programs start with
+const int defaultKernelSize = 16;
+const int defaultNoiseSize = 4;
+const unsigned int defaultKernelSeed = 1;
+// How far samples reach, in view space. Also the largest depth difference
+// (in window-space depth) a sample still counts as occluding at.
+const float defaultSampleRadius = 0.01f;
+
+// Fills "offsets" with "sampleCount" view-space sample offsets (x, y, z
+// triples) in the +z hemisphere, cosine weighted about +z. Sample lengths grow
+// from 0.1 to 1.0 along the kernel, quadratically, so more samples land close
+// to the origin. The same seed always gives the same kernel.
+void generateSSAOKernel(int sampleCount, unsigned int seed, std::vector<float>& offsets);
+
+// Fills "directions" with a "size" by "size" tiling texture of unit vectors in
+// the xy plane (RGB triples, already scaled and biased from [-1, 1] to [0, 1]).
+// Rotation angles are laid out as blue noise, so neighboring texels always
+// differ a lot and the pattern has no low-frequency structure when tiled.
+// The same seed always gives the same texture.
+void generateRotationNoise(int size, unsigned int seed, std::vector<float>& directions);
+
+#endif // SP_KERNEL_H_
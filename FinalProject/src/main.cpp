@@ -3,466 +3,170 @@
 // Class: CS 5610
 // Final Project
 //
-// Contains nearly all the code for Final Project, including model loading,
-// OpenGL drawing, and more.
+// The interactive program: creates the GLUT window and handles input. The
+// drawing itself lives in render.cpp, and moving the camera in update.cpp.
 
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
-#include <vector>
+#include <cstring>
 
 #include "GL/glew.h"
 #include "GL/glut.h"
-#include "rply.h"
+#ifdef FREEGLUT
+#include "GL/freeglut_ext.h"
+#endif
 
 #include "vec3.h"
-#include "mat4.h"
-#include "texture.h"
-#include "shaders.h"
+#include "kernel.h"
+#include "render.h"
+#include "benchmark.h"
+#include "gputimer.h"
+#include "trace.h"
+#include "capture.h"
+#include "update.h"
+#include "walltime.h"
 
-using std::vector;
-
-const static int wWidth = 1024;
-const static int wHeight = 768;
-
-void initializeOpenGL();
-void loadShaders();
-void setupState();
-void loadModel();
+void parseArguments(int argc, char* argv[]);
 
 void myGlutKeyboard(unsigned char key, int x, int y);
 void myGlutSpecial(int key, int x, int y);
 void myGlutMouse(int button, int state, int x, int y);
 void myGlutMotion(int x, int y);
 void myGlutIdle();
-
-void drawModel(bool ssao);
-void doSSAO();
-void doBlur();
+void myGlutTimer(int value);
 
 int main_window;
 
-// the camera info
-Vec3 eye;
-Vec3 lookat;
-
-// Shader programs and attrib/uniform locations
-GLuint phongProg;
-GLint phongProgPosAttrib;
-GLint phongProgNormAttrib;
-GLint phongProgModelViewMat;
-GLint phongProgMvpMat;
-GLint phongProgNormalMat;
-GLint phongProgLAmb;
-GLint phongProgLPos;
-GLint phongProgLDif;
-GLint phongProgLSpc;
-GLint phongProgKAmb;
-GLint phongProgKDif;
-GLint phongProgKSpc;
-GLint phongProgKShn;
-GLint phongProgDoSSAO;
-
-GLuint aoProg;
-GLint aoProgPosAttrib;
-GLint aoProgDepthTexture;
-GLint aoProgNormTexture;
-GLint aoProgRandomTexture;
-GLint aoProgProjMat;
-GLint aoProgInvProjMat;
-GLint aoProgSampleOffsets;
-GLint aoProgSampleRadius;
-GLint aoProgRandomTexCoordScale;
-
-GLuint blurProg;
-GLint blurProgPosAttrib;
-GLint blurProgAoTexture;
-GLint blurProgColorTexture;
-GLint blurProgInvRes;
-
-// Contain data for the model
-vector<GLfloat> modelVertices;
-vector<GLuint> faceIndices;
-vector<GLfloat> allModelData;
-
-GLuint vertexDataBuf;
-GLuint floorBuf;
-
-GLsizei faceIndexCount;
-
-// Program functionality variables
-// Shading related
-int ambientOcclusionState;
-float depthDiscontinuityRadius;
-
-// Framebuffers, textures to render to, renderbuffers, other textures
-GLuint framebuffer;
-GLuint depthTexture;
-GLuint colorTexture;
-GLuint normalTexture;
-GLuint aoTexture;
-GLuint depthRenderbuffer;
-GLuint randomTexture;
+// Where to write the camera position every frame, for --camera-path
+FILE* cameraRecordFile = NULL;
 
-// draw the scene
-void myGlutDisplay()
-{
-  static int frameNum = 0;
-  GLenum error = glGetError();
-  if (error != GL_NO_ERROR)
-  {
-    fprintf(stderr, "gl error\n");
-  }
-  glClearColor(0, 0, 0, 0);
-
-  // If we're rendering with ambient occlusion
-  if (ambientOcclusionState) {
-    // TODO: fill in yo
-    drawModel(true);
-    doSSAO();
-    doBlur();
-  }
-  else {
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-    drawModel(false);
-  }
-
-  frameNum++;
-  //printf("%d\n", frameNum);
+// At most this many frames a second, started by a timer rather than the idle
+// callback so GLUT sleeps in between; 0 for as many as it can draw
+int frameCap = 0;
+double nextFrameMs = 0.0;
+// Wait for vertical blank on buffer swaps
+bool vsyncEnabled = false;
 
-  glutSwapBuffers();
-}
-
-// entry point
-int main(int argc, char* argv[])
+void stopUpdatesAtExit()
 {
-  // Initialize glut
-  glutInit(&argc, argv);
-
-  setupState();
-
-  //
-  // create the glut window
-  //
-  glutInitDisplayMode(GLUT_RGBA|GLUT_DOUBLE|GLUT_DEPTH);
-  glutInitWindowSize(wWidth, wHeight);
-  glutInitWindowPosition(100,100);
-  main_window = glutCreateWindow("Sample Interface");
-
-  GLenum glewResult = glewInit();
-  if (glewResult != GLEW_OK) {
-    fprintf(stderr, "GLEW initialization failed.\n");
-    exit(1);
-  }
-
-  //
-  // set callbacks
-  //
-  glutDisplayFunc(myGlutDisplay);
-  glutIdleFunc(myGlutIdle);
-  glutKeyboardFunc(myGlutKeyboard);
-  glutSpecialFunc(myGlutSpecial);
-  glutMouseFunc(myGlutMouse);
-  glutMotionFunc(myGlutMotion);
-
-  // initialize the camera
-  eye = Vec3(0, 1.5f, 1.5f);
-  lookat = Vec3(0, 0, 0);
-
-  // initialize gl
-  initializeOpenGL();
-  loadShaders();
-  
-  // load the model
-  loadModel();
-
-  printf("Use 'a' key to enable/disable ambient occlusion.\n");
-  printf("Use up/down arrow keys to increase/decrease depth discontinuity radius.\n");
-
-  // give control over to glut
-  glutMainLoop();
-
-  return 0;
-}
-
-// ----------------- INITIALIZATION FUNCTIONS -------------- //
-void setupState()
-{
-  ambientOcclusionState = 0;
-  depthDiscontinuityRadius = 0.01f;
+  stopUpdates();
 }
 
-void initializeOpenGL()
+// Asks for buffer swaps to wait for vertical blank, returning false if there's
+// no way to
+bool enableVsync()
 {
-  glEnable(GL_DEPTH_TEST);
-
-  glEnable(GL_CULL_FACE);
-  glFrontFace(GL_CCW);
-  glCullFace(GL_BACK);
-
-  // Enable and configure textures on applicable texture units
-  glActiveTexture(GL_TEXTURE0);
-
-  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-
-  // Create our framebuffer
-  glGenFramebuffers(1, &framebuffer);
-
-  // Setup a texture to render depth to
-  glGenTextures(1, &depthTexture);
-  glBindTexture(GL_TEXTURE_2D, depthTexture);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, wWidth, wHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-  // Setup a texture to render color to
-  glGenTextures(1, &colorTexture);
-  glBindTexture(GL_TEXTURE_2D, colorTexture);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, wWidth, wHeight, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  
-  // Setup a texture to store normals in
-  glGenTextures(1, &normalTexture);
-  glBindTexture(GL_TEXTURE_2D, normalTexture);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, wWidth, wHeight, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-  // Setup a texture to store occlusion values in
-  glGenTextures(1, &aoTexture);
-  glBindTexture(GL_TEXTURE_2D, aoTexture);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, wWidth, wHeight, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  
-  // Setup a renderbuffer to use for depth
-  glGenRenderbuffers(1, &depthRenderbuffer);
-  glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
-  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, wWidth, wHeight);
-
-  // Set up a texture used to store random sample offset values
-  glGenTextures(1, &randomTexture);
-  glBindTexture(GL_TEXTURE_2D, randomTexture);
-  // All these were calculated offline, the values may look weird because they're
-  // already scaled and biased from [-1, 1] to [0, 1].
-  static const GLfloat randomDirections[48] = { 0.682909, 0.965344, 0.500000,
-      0.164830, 0.871026, 0.500000, 0.896964, 0.804005, 0.500000, 0.127030, 0.833006, 0.500000,
-      0.960280, 0.695300, 0.500000, 0.198356, 0.898761, 0.500000, 0.245320, 0.069723, 0.500000,
-      0.928136, 0.241738, 0.500000, 0.704112, 0.956441, 0.500000, 0.984019, 0.374598, 0.500000,
-      0.171691, 0.122888, 0.500000, 0.806018, 0.895415, 0.500000, 0.951012, 0.715844, 0.500000,
-      0.633597, 0.981822, 0.500000, 0.173631, 0.878791, 0.500000, 0.338373, 0.973156, 0.500000 };
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 4, 4, 0, GL_RGB, GL_FLOAT, randomDirections);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-  // Set up buffer for floor data
-  const static GLfloat floorData[36] = { -10.0f, -0.4f, -10.0f, 0.0f, 1.0f, 0.0f,
-      -10.0f, -0.4f, 10.0f, 0.0f, 1.0f, 0.0f, 10.0f, -0.4f, 10.0f, 0.0f, 1.0f, 0.0f,
-      10.0f, -0.4f, 10.0f, 0.0f, 1.0f, 0.0f, 10.0f, -0.4f, -10.0f, 0.0f, 1.0f, 0.0f,
-      -10.0f, -0.4f, -10.0f, 0.0f, 1.0f, 0.0f};
-  glGenBuffers(1, &floorBuf);
-  glBindBuffer(GL_ARRAY_BUFFER, floorBuf);
-  glBufferData(GL_ARRAY_BUFFER, 36 * sizeof(GLfloat), floorData, GL_STATIC_DRAW);
+#if defined(_WIN32)
+  typedef BOOL (WINAPI *SwapIntervalProc)(int interval);
+  SwapIntervalProc swapInterval = (SwapIntervalProc)wglGetProcAddress("wglSwapIntervalEXT");
+  return swapInterval != NULL && swapInterval(1);
+#elif defined(FREEGLUT)
+  typedef int (*SwapIntervalProc)(int interval);
+  const char* const names[] = { "glXSwapIntervalMESA", "glXSwapIntervalSGI" };
+  for (int i = 0; i < 2; i++) {
+    SwapIntervalProc swapInterval = (SwapIntervalProc)glutGetProcAddress(names[i]);
+    if (swapInterval != NULL && swapInterval(1) == 0)
+      return true;
+  }
+  return false;
+#else
+  return false;
+#endif
 }
 
-void loadShaders()
+// Saves the trace, with the GPU passes still in flight
+void writeTraceAtExit()
 {
-  // Phong shaders
-  phongProg = createProgram(loadShader(GL_VERTEX_SHADER, "shaders/phong.vert"),
-      loadShader(GL_FRAGMENT_SHADER, "shaders/phong.frag"));
-  
-  phongProgPosAttrib = glGetAttribLocation(phongProg, "positionIn");
-  phongProgNormAttrib = glGetAttribLocation(phongProg, "normalIn");
-  phongProgModelViewMat = glGetUniformLocation(phongProg, "modelViewMat");
-  phongProgMvpMat = glGetUniformLocation(phongProg, "modelViewProjMat");
-  phongProgNormalMat = glGetUniformLocation(phongProg, "normalMat");
-  phongProgLAmb = glGetUniformLocation(phongProg, "lAmbient");
-  phongProgLPos = glGetUniformLocation(phongProg, "lPosition");
-  phongProgLDif = glGetUniformLocation(phongProg, "lDiffuse");
-  phongProgLSpc = glGetUniformLocation(phongProg, "lSpecular");
-  phongProgKAmb = glGetUniformLocation(phongProg, "kAmbient");
-  phongProgKDif = glGetUniformLocation(phongProg, "kDiffuse");
-  phongProgKSpc = glGetUniformLocation(phongProg, "kSpecular");
-  phongProgKShn = glGetUniformLocation(phongProg, "kShininess");
-  phongProgDoSSAO = glGetUniformLocation(phongProg, "doSSAO");
-
-  // Ambient occlusion shaders
-  aoProg = createProgram(loadShader(GL_VERTEX_SHADER, "shaders/ssao.vert"),
-      loadShader(GL_FRAGMENT_SHADER, "shaders/ssao.frag"));
-
-  aoProgPosAttrib = glGetAttribLocation(aoProg, "positionIn");
-  aoProgDepthTexture = glGetUniformLocation(aoProg, "depthTex");
-  aoProgNormTexture = glGetUniformLocation(aoProg, "normTex");
-  aoProgRandomTexture = glGetUniformLocation(aoProg, "randomTex");
-  aoProgProjMat = glGetUniformLocation(aoProg, "projMat");
-  aoProgInvProjMat = glGetUniformLocation(aoProg, "invProjMat");
-  aoProgSampleOffsets = glGetUniformLocation(aoProg, "sampleOffsets");
-  aoProgSampleRadius = glGetUniformLocation(aoProg, "sampleRadius");
-  aoProgRandomTexCoordScale = glGetUniformLocation(aoProg, "randomTexCoordScale");
-
-  // Blur texture shaders
-  blurProg = createProgram(loadShader(GL_VERTEX_SHADER, "shaders/blur.vert"),
-      loadShader(GL_FRAGMENT_SHADER, "shaders/blur.frag"));
-
-  blurProgPosAttrib = glGetAttribLocation(blurProg, "positionIn");
-  blurProgAoTexture = glGetUniformLocation(blurProg, "aoTex");
-  blurProgColorTexture = glGetUniformLocation(blurProg, "colorTex");
-  blurProgInvRes = glGetUniformLocation(blurProg, "invRes");
-
+  flushGpuTimers();
+  writeTrace();
 }
 
-static GLfloat maxValue = 0.0;
-
-void load_error_cb(p_ply ply, const char* message)
+// Writes out the frames still being captured
+void finishCaptureAtExit()
 {
-  fprintf(stderr, "Error loading model: %s\n", message);
+  finishCapture();
 }
 
-int load_read_vertex_cb(p_ply_argument argument)
+// Puts what the last frame drew in the window title, when it changes
+void showDrawStats()
 {
-  // Get an offset into the modelVertices vector
-  long offset;
-  ply_get_argument_element(argument, NULL, &offset);
-  offset *= 3;
-
-  p_ply_property prop;
-  const char* propName;
-  ply_get_argument_property(argument, &prop, NULL, NULL);
-  ply_get_property_info(prop, &propName, NULL, NULL, NULL);
-  switch (propName[0]) {
-    case 'x':
-      break;
-    case 'y':
-      offset += 1;
-      break;
-    case 'z':
-      offset += 2;
-      break;
-  }
-  modelVertices[offset] = ply_get_argument_value(argument);
-  if (fabs(modelVertices[offset]) > fabs(maxValue)) {
-    maxValue = fabs(modelVertices[offset]);
-    //printf("%f\n", maxValue);
-  }
-  return 1;
+  static SceneDrawStats shown = { -1 };
+  if (lastDrawStats.instances == shown.instances && lastDrawStats.culled == shown.culled &&
+      lastDrawStats.drawCalls == shown.drawCalls)
+    return;
+  shown = lastDrawStats;
+  char title[128];
+  sprintf(title, "Sample Interface - %d instances drawn, %d culled, %d draw calls", lastDrawStats.instances - 1,
+      lastDrawStats.culled, lastDrawStats.drawCalls);
+  glutSetWindowTitle(title);
 }
 
-int load_read_face_cb(p_ply_argument argument)
+// draw the scene
+void myGlutDisplay()
 {
-  // Get an offset into the faceIndices vector
-  long offset;
-  ply_get_argument_element(argument, NULL, &offset);
-  offset *= 3;
-
-  long valueIndex;
-  ply_get_argument_property(argument, NULL, NULL, &valueIndex);
-  if (valueIndex >= 0) {
-    offset += valueIndex;
+  TRACE_ZONE("myGlutDisplay");
+  CameraState camera;
+  if (takeCamera(camera)) {
+    eye = camera.eye;
+    lookat = camera.lookat;
   }
-  faceIndices[offset] = ply_get_argument_value(argument);
-  return 1;
-}
-
-void loadModel()
-{
-  // ////////////hmm...>>>>>>>>>>>>
-  int result;
-  p_ply plyModel = ply_open("resources/bun_zipper.ply", load_error_cb, 0, NULL);
-  if (!plyModel)
-    return;
-
-  result = ply_read_header(plyModel);
-  if (!result)
-    return;
+  if (benchmarkEnabled)
+    beginBenchmarkFrame();
 
-  long vertexCount = ply_set_read_cb(plyModel, "vertex", "x", load_read_vertex_cb, NULL, 0);
-  ply_set_read_cb(plyModel, "vertex", "y", load_read_vertex_cb, NULL, 1);
-  ply_set_read_cb(plyModel, "vertex", "z", load_read_vertex_cb, NULL, 2);
+  renderFrame();
+  showDrawStats();
 
-  modelVertices.resize(vertexCount * 3);
-
-  long triCount = ply_set_read_cb(plyModel, "face", "vertex_indices", load_read_face_cb, NULL, 0);
-  faceIndices.resize(triCount * 3);
-  allModelData.resize(triCount * 3 * 6);
-
-  result = ply_read(plyModel);
-  if (!result) {
-    modelVertices.clear();
-    faceIndices.clear();
-    allModelData.clear();
+  if (cameraRecordFile != NULL) {
+    fprintf(cameraRecordFile, "%f %f %f %f %f %f\n", eye.x, eye.y, eye.z, lookat.x, lookat.y, lookat.z);
   }
 
-  ply_close(plyModel);
-
-  // Put ALL the data into |allModelData|.
-  // Scale vertices to unit cube
-  float scaleFactor = 1.0f / maxValue;
-  Vec3 halfUnit(0.0f, 0.5f, 0.0f);
-  for (vector<GLuint>::size_type faceIndex = 0; faceIndex < faceIndices.size() / 3; faceIndex++) {
-    GLuint vi1, vi2, vi3;
-    vi1 = faceIndices[faceIndex*3];
-    vi2 = faceIndices[faceIndex*3+1];
-    vi3 = faceIndices[faceIndex*3+2];
-    
-    Vec3 v1(modelVertices[vi1*3], modelVertices[vi1*3+1], modelVertices[vi1*3+2]);
-    Vec3 v2(modelVertices[vi2*3], modelVertices[vi2*3+1], modelVertices[vi2*3+2]);
-    Vec3 v3(modelVertices[vi3*3], modelVertices[vi3*3+1], modelVertices[vi3*3+2]);
-    
-    // Scale vertices to unit cube
-    v1 = v1.scale(scaleFactor);
-    v2 = v2.scale(scaleFactor);
-    v3 = v3.scale(scaleFactor);
-    
-    v1 = v1.subtract(halfUnit);
-    v2 = v2.subtract(halfUnit);
-    v3 = v3.subtract(halfUnit);
-
-    Vec3 normal = (v2 - v1).cross(v3 - v1);
-    normal.normalize();
-    
-    allModelData[faceIndex*18] = v1.x;
-    allModelData[faceIndex*18+1] = v1.y;
-    allModelData[faceIndex*18+2] = v1.z;
-    allModelData[faceIndex*18+3] = normal.x;
-    allModelData[faceIndex*18+4] = normal.y;
-    allModelData[faceIndex*18+5] = normal.z;
-    allModelData[faceIndex*18+6] = v2.x;
-    allModelData[faceIndex*18+7] = v2.y;
-    allModelData[faceIndex*18+8] = v2.z;
-    allModelData[faceIndex*18+9] = normal.x;
-    allModelData[faceIndex*18+10] = normal.y;
-    allModelData[faceIndex*18+11] = normal.z;
-    allModelData[faceIndex*18+12] = v3.x;
-    allModelData[faceIndex*18+13] = v3.y;
-    allModelData[faceIndex*18+14] = v3.z;
-    allModelData[faceIndex*18+15] = normal.x;
-    allModelData[faceIndex*18+16] = normal.y;
-    allModelData[faceIndex*18+17] = normal.z;
+  captureFrame();
+
+  {
+    TRACE_ZONE("glutSwapBuffers");
+    glutSwapBuffers();
   }
 
-  // Set up VBO for vertex data
-  glGenBuffers(1, &vertexDataBuf);
-  glBindBuffer(GL_ARRAY_BUFFER, vertexDataBuf);
-  glBufferData(GL_ARRAY_BUFFER, allModelData.size() * sizeof(GLfloat), allModelData.data(), GL_STATIC_DRAW);
+  if (benchmarkEnabled && endBenchmarkFrame())
+    exit(0);
+}
 
-  faceIndexCount = faceIndices.size();
-  
-  // Clear the vectors now, we're done with them
-  modelVertices.clear();
-  faceIndices.clear();
-  allModelData.clear();
+// Reads the options glutInit() left behind
+void parseArguments(int argc, char* argv[])
+{
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--record-camera") == 0 && i + 1 < argc) {
+      cameraRecordFile = fopen(argv[++i], "w");
+      if (cameraRecordFile == NULL) {
+        fprintf(stderr, "Couldn't open %s\n", argv[i]);
+        exit(1);
+      }
+    }
+    else if (strcmp(argv[i], "--fps-cap") == 0 && i + 1 < argc) {
+      frameCap = atoi(argv[++i]);
+      if (frameCap <= 0) {
+        fprintf(stderr, "--fps-cap needs a positive frame rate\n");
+        exit(1);
+      }
+    }
+    else if (strcmp(argv[i], "--vsync") == 0) {
+      vsyncEnabled = true;
+    }
+    else if (!parseRenderArgument(argc, argv, i) && !parseBenchmarkArgument(argc, argv, i) &&
+        !parseCaptureArgument(argc, argv, i) && !parseTraceArgument(argc, argv, i)) {
+      fprintf(stderr, "Unknown argument %s\n", argv[i]);
+      fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+      fprintf(stderr, "  --record-camera FILE   write the camera position every frame, for --camera-path\n");
+      fprintf(stderr, "  --fps-cap N            draw at most N frames a second, sleeping in between\n");
+      fprintf(stderr, "  --vsync                wait for vertical blank on buffer swaps\n");
+      printRenderUsage();
+      printBenchmarkUsage();
+      printCaptureUsage();
+      printTraceUsage();
+      exit(1);
+    }
+  }
 }
 
 // ------------------- CALLBACK FUNCTIONS ----------------- //
@@ -478,123 +182,50 @@ void myGlutIdle()
   glutPostRedisplay();
 }
 
+// Starts a frame every 1/frameCap seconds, in place of myGlutIdle()
+void myGlutTimer(int value)
+{
+  double frameMs = 1000.0 / frameCap;
+  double now = wallClockMs();
+  nextFrameMs += frameMs;
+  // Fell behind: start counting again from now rather than catch up
+  if (nextFrameMs < now)
+    nextFrameMs = now + frameMs;
+  glutTimerFunc((unsigned int)ceil(nextFrameMs - now), myGlutTimer, 0);
+
+  if (glutGetWindow() != main_window)
+    glutSetWindow(main_window);
+  glutPostRedisplay();
+}
+
 // mouse handling functions for the main window
 // left mouse translates, middle zooms, right rotates
-// keep track of which button is down and where the last position was
-int cur_button = -1;
-int last_x;
-int last_y;
+// the camera moves on the update thread (update.cpp); these just pass the
+// events on
 
 // catch mouse up/down events
 void myGlutMouse(int button, int state, int x, int y)
 {
-  if (state == GLUT_DOWN) {
-    cur_button = button;
-  }
-  else {
-    if (button == cur_button)
-      cur_button = -1;
-  }
-
-  last_x = x;
-  last_y = y;
+  InputEvent event;
+  event.type = inputMouseButton;
+  event.button = button == GLUT_LEFT_BUTTON ? mouseTranslate : button == GLUT_MIDDLE_BUTTON ? mouseZoom :
+      button == GLUT_RIGHT_BUTTON ? mouseRotate : mouseOther;
+  event.down = state == GLUT_DOWN;
+  event.x = x;
+  event.y = y;
+  pushInput(event);
 }
 
 // catch mouse move events
 void myGlutMotion(int x, int y)
 {
-  // the change in mouse position
-  int dx = x-last_x;
-  int dy = y-last_y;
-
-  float scale, len, theta;
-  Vec3 neye, neye2;
-  Vec3 f, r, u;
-
-  switch(cur_button) {
-  case GLUT_LEFT_BUTTON:
-    // translate
-    f = lookat.add(eye.scale(-1));
-    u.x = 0;
-    u.y = 1;
-    u.z = 0;
-
-    // scale the change by how far away we are
-    scale = f.norm() * 0.007;
-
-    r = f.cross(u);
-    u = r.cross(f);
-
-    r.normalize();
-    u.normalize();
-
-    eye = eye.add(r.scale(-1).scale(dx).scale(scale));
-    eye = eye.add(u.scale(dy).scale(scale));
-
-    lookat = lookat.add(r.scale(-1).scale(dx).scale(scale));
-    lookat = lookat.add(u.scale(dy).scale(scale));
-
-    break;
-
-  case GLUT_MIDDLE_BUTTON:
-    // zoom
-    f = lookat.add(eye.scale(-1));
-
-    len = f.norm();
-    f.normalize();
-
-    // scale the change by how far away we are
-    len -= sqrt(len)*dx*0.03;
-
-    eye = lookat.add(f.scale(-1).scale(len));
-
-    // make sure the eye and lookat points are sufficiently far away
-    // push the lookat point forward if it is too close
-    if (len < 1) {
-      printf("lookat move: %f\n", len);
-      lookat = eye.add(f);
-    }
-
-    break;
-
-  case GLUT_RIGHT_BUTTON:
-    // rotate
-
-    neye = eye.add(lookat.scale(-1));
-
-    // first rotate in the x/z plane
-    theta = -dx * 0.007;
-    neye2.x = (float)cos(theta)*neye.x + (float)sin(theta)*neye.z;
-    neye2.y = neye.y;
-    neye2.z =-(float)sin(theta)*neye.x + (float)cos(theta)*neye.z;
-
-
-    // now rotate vertically
-    theta = -dy * 0.007;
-
-    f = neye2.scale(-1);
-    u.x = 0;
-    u.y = 1;
-    u.z = 0;
-
-    r = f.cross(u);
-    u = r.cross(f);
-
-    len = f.norm();
-    f.normalize();
-    u.normalize();
-
-    neye = f.scale(cos(theta)).add(u.scale(sin(theta))).scale(len);
-
-    eye = lookat.add(neye.scale(-1));
-
-    break;
-  }
-
-  last_x = x;
-  last_y = y;
-
-  glutPostRedisplay();
+  InputEvent event;
+  event.type = inputMouseMotion;
+  event.button = mouseOther;
+  event.down = false;
+  event.x = x;
+  event.y = y;
+  pushInput(event);
 }
 
 // you can put keyboard shortcuts in here
@@ -611,6 +242,118 @@ void myGlutKeyboard(unsigned char key, int x, int y)
     else {
       printf("Disabled ambient occlusion.\n");
     }
+    aoHistoryValid = false;
+    break;
+  // Temporal SSAO
+  case 't':
+  case 'T':
+    temporalAOState = !temporalAOState;
+    if (temporalAOState) {
+      printf("Enabled temporal ambient occlusion (%d samples per frame).\n", temporalSamplesPerFrame);
+    }
+    else {
+      printf("Disabled temporal ambient occlusion.\n");
+    }
+    aoHistoryValid = false;
+    break;
+  // Deinterleaved SSAO
+  case 'd':
+  case 'D':
+    reportPassTimes();
+    deinterleavedAOState = !deinterleavedAOState;
+    if (deinterleavedAOState) {
+      printf("Enabled deinterleaved ambient occlusion.\n");
+    }
+    else {
+      printf("Disabled deinterleaved ambient occlusion.\n");
+    }
+    break;
+  // Compute shader SSAO
+  case 'c':
+  case 'C':
+    if (!computeAOSupported) {
+      printf("Compute shader ambient occlusion needs OpenGL 4.3.\n");
+      break;
+    }
+    reportPassTimes();
+    computeAOState = !computeAOState;
+    if (computeAOState) {
+      printf("Enabled compute shader ambient occlusion.\n");
+    }
+    else {
+      printf("Disabled compute shader ambient occlusion.\n");
+    }
+    break;
+  // Normals from depth
+  case 'n':
+  case 'N':
+    reportPassTimes();
+    reconstructNormalsState = !reconstructNormalsState;
+    if (reconstructNormalsState) {
+      printf("Reconstructing normals from depth, no normal G-buffer target.\n");
+    }
+    else {
+      printf("Reading normals from the normal G-buffer target.\n");
+    }
+    break;
+  // Frustum culling
+  case 'v':
+  case 'V':
+    cullingEnabled = !cullingEnabled;
+    printf("%s frustum culling.\n", cullingEnabled ? "Enabled" : "Disabled");
+    break;
+  // Culling on the GPU
+  case 'g':
+  case 'G':
+    if (!gpuCullingSupported) {
+      printf("GPU culling needs OpenGL 4.3.\n");
+      break;
+    }
+    gpuCullingState = !gpuCullingState;
+    printf("%s GPU culling and indirect drawing.\n", gpuCullingState ? "Enabled" : "Disabled");
+    break;
+  // Meshlet culling
+  case 'm':
+  case 'M':
+    if (!clusterCullingSupported) {
+      printf("Meshlet culling needs OpenGL 4.3.\n");
+      break;
+    }
+    clusterCullingState = !clusterCullingState;
+    printf("%s meshlet culling%s.\n", clusterCullingState ? "Enabled" : "Disabled",
+        clusterCullingState && gpuCullingState ? " (not while culling on the GPU)" : "");
+    break;
+  // Levels of detail
+  case 'l':
+  case 'L':
+    if (!lodsBuilt) {
+      printf("Levels of detail weren't built (started with --no-lod).\n");
+      break;
+    }
+    lodState = !lodState;
+    printf("%s levels of detail.\n", lodState ? "Enabled" : "Disabled");
+    break;
+  // Print the pass timings for the current mode
+  case 'p':
+  case 'P':
+    if (!reportPassTimes())
+      printf("No frames timed yet.\n");
+    break;
+  // Halve/double the kernel size
+  case '[':
+  case ']':
+    if (key == '[' && kernelSize / 2 >= minKernelSize)
+      setKernelSize(kernelSize / 2);
+    if (key == ']' && kernelSize * 2 <= maxKernelSize)
+      setKernelSize(kernelSize * 2);
+    reportPassTimes();
+    printf("Kernel size changed to %d\n", kernelSize);
+    break;
+  // Save the trace recorded so far
+  case 'x':
+  case 'X':
+    if (!writeTrace())
+      printf("Not tracing, start with --trace FILE to record a trace.\n");
     break;
   // quit
   case 27: // esc
@@ -639,162 +382,92 @@ void myGlutSpecial(int key, int x, int y)
   glutPostRedisplay();
 }
 
-// ------------------- DRAW FUNCTIONS ----------------- //
-void drawModel(bool ssao)
+// entry point
+int main(int argc, char* argv[])
 {
-  if (ssao) {
-    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalTexture, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
-    GLenum bufs[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
-    glDrawBuffers(2, bufs);
-  }
-  else {
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  // Initialize glut
+  glutInit(&argc, argv);
+
+  setupState();
+  parseArguments(argc, argv);
+  generateKernel();
+
+  //
+  // create the glut window
+  //
+  glutInitDisplayMode(GLUT_RGBA|GLUT_DOUBLE|GLUT_DEPTH);
+  glutInitWindowSize(wWidth, wHeight);
+  glutInitWindowPosition(100,100);
+  main_window = glutCreateWindow("Sample Interface");
+
+  GLenum glewResult = glewInit();
+  if (glewResult != GLEW_OK) {
+    fprintf(stderr, "GLEW initialization failed.\n");
+    exit(1);
   }
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  
-  glUseProgram(phongProg);
-  
-  const static double pi = acos(0.0) * 2;
-  Mat4 ident = Mat4::identityMatrix();
-  Mat4 view, viewNorm;
-  Mat4::lookAtMatrix(eye, lookat, Vec3(0, 1, 0), view, viewNorm);
-  Mat4 proj = Mat4::perspectiveMatrix(pi * 0.5, 1.333333f, 0.1f, 1000.0f);
-
-  Mat4 mvp = proj * view;
-
-  glUniformMatrix4fv(phongProgModelViewMat, 1, GL_FALSE, reinterpret_cast<float*>(&view));
-  glUniformMatrix4fv(phongProgMvpMat, 1, GL_FALSE, reinterpret_cast<float*>(&mvp));
-  glUniformMatrix4fv(phongProgNormalMat, 1, GL_FALSE, reinterpret_cast<float*>(&ident));
-
-  // Lighting uniforms
-  static GLfloat lAmb[3] = {1.0f, 1.0f, 1.0f};
-  static GLfloat lPos[3] = {0.0f, 0.0f, 0.5f};
-  static GLfloat lDif[3] = {1.0f, 1.0f, 1.0f};
-  static GLfloat lSpc[3] = {0.3f, 0.3f, 0.3f};
-  static GLfloat kAmb[3] = {0.2f, 0.1f, 0.0f};
-  static GLfloat kDif[3] = {0.6f, 0.2f, 0.1f};
-  static GLfloat kSpc[3] = {0.0f, 0.0f, 0.0f};
-  static GLfloat kShn = 0.0f;
-  glUniform3fv(phongProgLAmb, 1, lAmb);
-  glUniform3fv(phongProgLPos, 1, lPos);
-  glUniform3fv(phongProgLDif, 1, lDif);
-  glUniform3fv(phongProgLSpc, 1, lSpc);
-  glUniform3fv(phongProgKAmb, 1, kAmb);
-  glUniform3fv(phongProgKDif, 1, kDif);
-  glUniform3fv(phongProgKSpc, 1, kSpc);
-  glUniform1f(phongProgKShn, kShn);
-
-  if (ssao) {
-    glUniform1f(phongProgDoSSAO, 1.0f);
+
+  //
+  // set callbacks
+  //
+  glutDisplayFunc(myGlutDisplay);
+  if (frameCap > 0) {
+    nextFrameMs = wallClockMs();
+    glutTimerFunc(0, myGlutTimer, 0);
   }
   else {
-    glUniform1f(phongProgDoSSAO, 0.0f);
+    glutIdleFunc(myGlutIdle);
   }
+  glutKeyboardFunc(myGlutKeyboard);
+  glutSpecialFunc(myGlutSpecial);
+  glutMouseFunc(myGlutMouse);
+  glutMotionFunc(myGlutMotion);
 
-  // Set up vertex attributes
-  glEnableVertexAttribArray(phongProgPosAttrib);
-  glEnableVertexAttribArray(phongProgNormAttrib);
-  
-  glBindBuffer(GL_ARRAY_BUFFER, vertexDataBuf);
-  glVertexAttribPointer(phongProgPosAttrib, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), reinterpret_cast<void*>(0));
-  glVertexAttribPointer(phongProgNormAttrib, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), reinterpret_cast<void*>(3*sizeof(GLfloat)));
-
-  glDrawArrays(GL_TRIANGLES, 0, faceIndexCount);
-
-  static GLfloat floorKAmb[3] = {1.0f, 1.0f, 1.0f};
-  static GLfloat floorKDif[3] = {1.0f, 1.0f, 1.0f};
-  static GLfloat floorKSpc[3] = {1.0f, 1.0f, 1.0f};
-  static GLfloat floorKShn = 2.0f;
-  glUniform3fv(phongProgKAmb, 1, floorKAmb);
-  glUniform3fv(phongProgKDif, 1, floorKDif);
-  glUniform3fv(phongProgKSpc, 1, floorKSpc);
-  glUniform1f(phongProgKShn, floorKShn);
-
-  // Now draw the floor
-  glBindBuffer(GL_ARRAY_BUFFER, floorBuf);
-  glVertexAttribPointer(phongProgPosAttrib, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), reinterpret_cast<void*>(0));
-  glVertexAttribPointer(phongProgNormAttrib, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), reinterpret_cast<void*>(3*sizeof(GLfloat)));
-
-  glDrawArrays(GL_TRIANGLES, 0, 6);
-}
+  // initialize the camera
+  eye = Vec3(0, 1.5f, 1.5f);
+  lookat = Vec3(0, 0, 0);
+  startUpdates(eye, lookat);
+  atexit(stopUpdatesAtExit);
 
-void doSSAO()
-{
-  // All these were calculated offline
-  const static GLfloat offsets[48] = { -0.030026, -0.091874, 0.025644, 0.005745, -0.060426, 0.083852,
-      0.110698, -0.025912, 0.009211, -0.066202, 0.109803, 0.029828, 0.005172, 0.112933, 0.107859,
-      0.098871, -0.094032, 0.129172, -0.116010, -0.168980, 0.096531, 0.232979, 0.061169, 0.126916,
-      -0.243828, -0.177320, 0.121368, 0.079705, -0.237290, 0.292208, -0.333035, 0.151770, 0.264504,
-      -0.027741, -0.338065, 0.401220, 0.421871, -0.422317, 0.105886, -0.619888, -0.288012, 0.120912,
-      -0.485098, 0.605901, 0.142069, -0.783585, 0.276209, 0.321887 };
-  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-  glDrawBuffer(GL_COLOR_ATTACHMENT0);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, aoTexture, 0);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
-  // Detach any depth textures
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
-  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRenderbuffer);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-  glUseProgram(aoProg);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, depthTexture);
-  glActiveTexture(GL_TEXTURE1);
-  glBindTexture(GL_TEXTURE_2D, normalTexture);
-  glActiveTexture(GL_TEXTURE2);
-  glBindTexture(GL_TEXTURE_2D, randomTexture);
-  glActiveTexture(GL_TEXTURE0);
+  if (vsyncEnabled && !enableVsync())
+    printf("Couldn't turn on vsync here; frames aren't synced to the display.\n");
+
+  // initialize gl
+  initializeOpenGL();
+  loadShaders();
   
-  static const double pi = acos(0.0) * 0.5;
-  Mat4 projMat = Mat4::perspectiveMatrix(pi * 0.5, 1.333333f, 0.1f, 1000.0f);
-  Mat4 invProjMat = Mat4::perspectiveInvMatrix(pi * 0.5, 1.3333333f, 0.1f, 1000.0f);
+  // load the model
+  loadModel();
 
-  glUniform1i(aoProgDepthTexture, 0);
-  glUniform1i(aoProgNormTexture, 1);
-  glUniform1i(aoProgRandomTexture, 2);
-  glUniform2f(aoProgRandomTexCoordScale, wWidth / 4, wHeight / 4);
-  glUniformMatrix4fv(aoProgProjMat, 1, GL_FALSE, reinterpret_cast<GLfloat*>(&projMat));
-  glUniformMatrix4fv(aoProgInvProjMat, 1, GL_FALSE, reinterpret_cast<GLfloat*>(&invProjMat));
-  glUniform3fv(aoProgSampleOffsets, 16, offsets);
-  glUniform1f(aoProgSampleRadius, depthDiscontinuityRadius);
+  printf("Use 'a' key to enable/disable ambient occlusion.\n");
+  printf("Use up/down arrow keys to increase/decrease depth discontinuity radius.\n");
+  printf("Use 't' key to enable/disable temporal accumulation of ambient occlusion.\n");
+  printf("Use 'd' key to switch between interleaved and deinterleaved ambient occlusion.\n");
+  printf("Use 'c' key to switch between the compute shader and fragment shader ambient occlusion.\n");
+  printf("Use 'n' key to switch between stored and reconstructed-from-depth normals.\n");
+  printf("Use 'p' key to print the GPU time of each pass over the last %d frames.\n", gpuTimerWindow);
+  printf("Use '[' and ']' keys to halve/double the ambient occlusion kernel size.\n");
+  printf("Use 'v' key to enable/disable frustum culling (counts are in the title bar).\n");
+  printf("Use 'g' key to switch between culling on the CPU and on the GPU.\n");
+  printf("Use 'l' key to enable/disable levels of detail.\n");
+  printf("Use 'm' key to enable/disable culling each instance's meshlets on the CPU.\n");
+
+  if (traceEnabled) {
+    printf("Use 'x' key to save the trace (it's also saved on exit).\n");
+    atexit(writeTraceAtExit);
+  }
 
-  static const float verts[8] = { 1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, -1.0f, -1.0f };
+  // Registered after the trace's handler so it runs first, and the trace
+  // includes the last writes
+  if (captureEnabled) {
+    startCapture(0, wWidth, wHeight);
+    atexit(finishCaptureAtExit);
+  }
 
-  glEnableVertexAttribArray(aoProgPosAttrib);
+  if (benchmarkEnabled)
+    startBenchmark();
 
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glVertexAttribPointer(aoProgPosAttrib, 2, GL_FLOAT, GL_FALSE, 0, verts);
+  // give control over to glut
+  glutMainLoop();
 
-  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  return 0;
 }
-
-void doBlur()
-{
-  // Actually render to the screen
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-  glUseProgram(blurProg);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, aoTexture);
-  glActiveTexture(GL_TEXTURE1);
-  glBindTexture(GL_TEXTURE_2D, colorTexture);
-  glActiveTexture(GL_TEXTURE0);
-
-  glUniform1i(blurProgAoTexture, 0);
-  glUniform1i(blurProgColorTexture, 1);
-
-  glUniform2f(blurProgInvRes, 1.0f / wWidth, 1.0f / wHeight);
-
-  static const float verts[8] = { 1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, -1.0f, -1.0f };
-
-  glEnableVertexAttribArray(blurProgPosAttrib);
-
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glVertexAttribPointer(blurProgPosAttrib, 2, GL_FLOAT, GL_FALSE, 0, verts);
-
-  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-}
\ No newline at end of file
@@ -54,6 +54,12 @@ public:
     * i.e. this * v.
     */
   Vec3 multiply(const Vec3& p) const;
+
+  /**
+    * Returns the inverse of this matrix.
+    * Behavior undefined when this matrix is singular.
+    */
+  Mat4 inverse() const;
     
   /**
     * See add(Mat4 m).
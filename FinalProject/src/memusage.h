@@ -0,0 +1,11 @@
+#ifndef SP_MEMUSAGE_H_
+#define SP_MEMUSAGE_H_
+
+#include <cstddef>
+
+// Bytes of the process that are in physical memory now, and the most there
+// have been since it started. 0 where the system won't say.
+size_t residentBytes();
+size_t peakResidentBytes();
+
+#endif // SP_MEMUSAGE_H_
@@ -0,0 +1,357 @@
+#include "meshlet.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+#include "parallel.h"
+#include "trace.h"
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// Morton codes use this many bits an axis
+const int mortonBits = 10;
+// Sorted triangles are split into runs of this many, each scanned into
+// meshlets by one thread. Meshlets never cross a run.
+const int trianglesPerRun = 32 * maxMeshletTriangles;
+// Below this, the normals are more than about 84 degrees apart and no eye
+// position could see them all from behind
+const float minConeDot = 0.1f;
+
+// Changes whenever the cache file's layout or buildMeshlets()' output does
+const unsigned int cacheVersion = 1;
+const unsigned int cacheMagic = 0x4c4d5053; // "SPML"
+
+// Spreads the low 10 bits of "v" out to every third bit
+unsigned int spreadBits(unsigned int v)
+{
+  v = (v | (v << 16)) & 0x030000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+Vec3 vertexAt(const ArenaVector<float>& vertices, unsigned int index)
+{
+  return Vec3(vertices[index * 3], vertices[index * 3 + 1], vertices[index * 3 + 2]);
+}
+
+// Scans "count" sorted triangles from "first" of "triangleOrder" into
+// meshlets, with just their triangle ranges and vertex counts filled in
+void scanMeshlets(const ArenaVector<unsigned int>& indices, const ArenaVector<unsigned int>& triangleOrder,
+    int first, int count, vector<Meshlet>& meshlets)
+{
+  unsigned int meshletVertices[maxMeshletVertices];
+  Meshlet meshlet = Meshlet();
+  meshlet.firstTriangle = first;
+  for (int i = first; i < first + count; i++) {
+    const unsigned int* corners = &indices[triangleOrder[i] * 3];
+    unsigned int added[3];
+    int addedCount = 0;
+    for (int corner = 0; corner < 3; corner++) {
+      bool found = std::find(meshletVertices, meshletVertices + meshlet.vertexCount, corners[corner]) !=
+          meshletVertices + meshlet.vertexCount;
+      if (!found && std::find(added, added + addedCount, corners[corner]) == added + addedCount)
+        added[addedCount++] = corners[corner];
+    }
+    if (meshlet.vertexCount + addedCount > (unsigned int)maxMeshletVertices ||
+        meshlet.triangleCount == (unsigned int)maxMeshletTriangles) {
+      meshlets.push_back(meshlet);
+      meshlet = Meshlet();
+      meshlet.firstTriangle = i;
+      addedCount = 0;
+      for (int corner = 0; corner < 3; corner++) {
+        if (std::find(added, added + addedCount, corners[corner]) == added + addedCount)
+          added[addedCount++] = corners[corner];
+      }
+    }
+    for (int v = 0; v < addedCount; v++)
+      meshletVertices[meshlet.vertexCount++] = added[v];
+    meshlet.triangleCount++;
+  }
+  if (meshlet.triangleCount > 0)
+    meshlets.push_back(meshlet);
+}
+
+// Fills in a meshlet's sphere, around the middle of its box, and its cone,
+// around the average of its unit normals
+void boundMeshlet(const ArenaVector<float>& vertices, const ArenaVector<unsigned int>& indices,
+    const ArenaVector<unsigned int>& triangleOrder, Meshlet& meshlet)
+{
+  Vec3 low(INFINITY), high(-INFINITY);
+  Vec3 normalSum(0.0f);
+  vector<Vec3> normals;
+  normals.reserve(meshlet.triangleCount);
+  for (unsigned int i = meshlet.firstTriangle; i < meshlet.firstTriangle + meshlet.triangleCount; i++) {
+    const unsigned int* corners = &indices[triangleOrder[i] * 3];
+    Vec3 v[3];
+    for (int corner = 0; corner < 3; corner++) {
+      v[corner] = vertexAt(vertices, corners[corner]);
+      low = Vec3(std::min(low.x, v[corner].x), std::min(low.y, v[corner].y), std::min(low.z, v[corner].z));
+      high = Vec3(std::max(high.x, v[corner].x), std::max(high.y, v[corner].y), std::max(high.z, v[corner].z));
+    }
+    // Degenerate triangles aren't drawn, so they don't widen the cone
+    Vec3 normal = (v[1] - v[0]).cross(v[2] - v[0]);
+    if (normal.norm() > 0.0f) {
+      normal.normalize();
+      normals.push_back(normal);
+      normalSum = normalSum + normal;
+    }
+  }
+
+  Vec3 center = (low + high).scale(0.5f);
+  float radius = 0.0f;
+  for (unsigned int i = meshlet.firstTriangle; i < meshlet.firstTriangle + meshlet.triangleCount; i++) {
+    for (int corner = 0; corner < 3; corner++)
+      radius = std::max(radius, (vertexAt(vertices, indices[triangleOrder[i] * 3 + corner]) - center).norm());
+  }
+  meshlet.center[0] = center.x;
+  meshlet.center[1] = center.y;
+  meshlet.center[2] = center.z;
+  meshlet.radius = radius;
+
+  meshlet.coneAxis[0] = meshlet.coneAxis[1] = meshlet.coneAxis[2] = 0.0f;
+  meshlet.coneCutoff = 1.0f;
+  if (normalSum.norm() == 0.0f)
+    return;
+  Vec3 axis = normalSum.normalized();
+  float minDot = 1.0f;
+  for (size_t i = 0; i < normals.size(); i++)
+    minDot = std::min(minDot, normals[i].dot(axis));
+  meshlet.coneAxis[0] = axis.x;
+  meshlet.coneAxis[1] = axis.y;
+  meshlet.coneAxis[2] = axis.z;
+  if (minDot >= minConeDot)
+    meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+}
+
+// FNV-1a over 32-bit words, enough to tell meshes apart
+unsigned long long hashWords(const unsigned int* words, size_t count, unsigned long long hash)
+{
+  for (size_t i = 0; i < count; i++) {
+    hash ^= words[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+string cachePath(const char* cacheDir, const ArenaVector<float>& vertices,
+    const ArenaVector<unsigned int>& indices)
+{
+  unsigned long long hash = 14695981039346656037ULL;
+  unsigned int header[4] = { cacheVersion, (unsigned int)maxMeshletVertices, (unsigned int)maxMeshletTriangles,
+                             (unsigned int)indices.size() };
+  hash = hashWords(header, 4, hash);
+  hash = hashWords(reinterpret_cast<const unsigned int*>(vertices.data()), vertices.size(), hash);
+  hash = hashWords(indices.data(), indices.size(), hash);
+  char name[64];
+  snprintf(name, sizeof(name), "/ssao_meshlets_%016llx.bin", hash);
+  return string(cacheDir) + name;
+}
+
+// A cache file is its header (magic, version, triangle count, meshlet count),
+// the triangle order and then the meshlets
+bool readCache(const string& path, size_t triangleCount, ArenaVector<unsigned int>& triangleOrder,
+    vector<Meshlet>& meshlets)
+{
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL)
+    return false;
+  unsigned int header[4];
+  bool read = fread(header, sizeof(header), 1, file) == 1 && header[0] == cacheMagic &&
+      header[1] == cacheVersion && header[2] == triangleCount;
+  if (read) {
+    triangleOrder.resize(triangleCount);
+    meshlets.resize(header[3]);
+    read = fread(triangleOrder.data(), sizeof(unsigned int), triangleCount, file) == triangleCount &&
+        fread(meshlets.data(), sizeof(Meshlet), meshlets.size(), file) == meshlets.size() &&
+        fgetc(file) == EOF;
+  }
+  fclose(file);
+  return read;
+}
+
+void writeCache(const string& path, const ArenaVector<unsigned int>& triangleOrder,
+    const vector<Meshlet>& meshlets)
+{
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Couldn't write the meshlet cache %s\n", path.c_str());
+    return;
+  }
+  unsigned int header[4] = { cacheMagic, cacheVersion, (unsigned int)triangleOrder.size(),
+                             (unsigned int)meshlets.size() };
+  bool written = fwrite(header, sizeof(header), 1, file) == 1 &&
+      fwrite(triangleOrder.data(), sizeof(unsigned int), triangleOrder.size(), file) == triangleOrder.size() &&
+      fwrite(meshlets.data(), sizeof(Meshlet), meshlets.size(), file) == meshlets.size();
+  fclose(file);
+  // A partial file would only be rejected on reading, so don't leave one
+  if (!written) {
+    fprintf(stderr, "Couldn't write the meshlet cache %s\n", path.c_str());
+    remove(path.c_str());
+  }
+}
+
+} // namespace
+
+void buildMeshlets(const ArenaVector<float>& vertices, const ArenaVector<unsigned int>& indices, int threadCount,
+    ArenaVector<unsigned int>& triangleOrder, vector<Meshlet>& meshlets)
+{
+  TRACE_ZONE("buildMeshlets");
+  int triangleCount = (int)(indices.size() / 3);
+  triangleOrder.resize(triangleCount);
+  meshlets.clear();
+  if (triangleCount == 0)
+    return;
+
+  Vec3 low(INFINITY), high(-INFINITY);
+  for (size_t i = 0; i < vertices.size(); i += 3) {
+    low = Vec3(std::min(low.x, vertices[i]), std::min(low.y, vertices[i + 1]), std::min(low.z, vertices[i + 2]));
+    high = Vec3(std::max(high.x, vertices[i]), std::max(high.y, vertices[i + 1]), std::max(high.z, vertices[i + 2]));
+  }
+  Vec3 size = high - low;
+  float extent = std::max(std::max(size.x, size.y), std::max(size.z, 1e-20f));
+  float cells = (float)((1 << mortonBits) - 1);
+
+  // Morton code of each triangle's centroid, above the triangle's index
+  ArenaAllocator<unsigned long long> keyAllocator(indices.get_allocator());
+  ArenaVector<unsigned long long> keys(triangleCount, 0, keyAllocator);
+  parallelFor(triangleCount, 16384, threadCount, [&](int begin, int end) {
+    for (int t = begin; t < end; t++) {
+      Vec3 centroid = (vertexAt(vertices, indices[t * 3]) + vertexAt(vertices, indices[t * 3 + 1]) +
+                       vertexAt(vertices, indices[t * 3 + 2])).scale(1.0f / 3.0f);
+      Vec3 cell = (centroid - low).scale(cells / extent);
+      unsigned int code = spreadBits((unsigned int)cell.x) | (spreadBits((unsigned int)cell.y) << 1) |
+          (spreadBits((unsigned int)cell.z) << 2);
+      keys[t] = ((unsigned long long)code << 32) | (unsigned int)t;
+    }
+  });
+
+  // Bucket by the top bits of the code, then sort the buckets in parallel
+  const int bucketBits = 10;
+  const int bucketShift = 32 + 3 * mortonBits - bucketBits;
+  vector<int> bucketStarts((1 << bucketBits) + 1, 0);
+  for (int t = 0; t < triangleCount; t++)
+    bucketStarts[(keys[t] >> bucketShift) + 1]++;
+  for (int b = 0; b < 1 << bucketBits; b++)
+    bucketStarts[b + 1] += bucketStarts[b];
+  ArenaVector<unsigned long long> sorted(triangleCount, 0, keyAllocator);
+  {
+    vector<int> next(bucketStarts.begin(), bucketStarts.end() - 1);
+    for (int t = 0; t < triangleCount; t++)
+      sorted[next[keys[t] >> bucketShift]++] = keys[t];
+  }
+  parallelFor(1 << bucketBits, 16, threadCount, [&](int begin, int end) {
+    for (int b = begin; b < end; b++)
+      std::sort(sorted.begin() + bucketStarts[b], sorted.begin() + bucketStarts[b + 1]);
+  });
+  for (int t = 0; t < triangleCount; t++)
+    triangleOrder[t] = (unsigned int)sorted[t];
+
+  // Each run scanned into meshlets separately, then put back in order
+  int runCount = (triangleCount + trianglesPerRun - 1) / trianglesPerRun;
+  vector<vector<Meshlet> > runMeshlets(runCount);
+  parallelFor(runCount, 1, threadCount, [&](int begin, int end) {
+    for (int run = begin; run < end; run++) {
+      int first = run * trianglesPerRun;
+      scanMeshlets(indices, triangleOrder, first, std::min(trianglesPerRun, triangleCount - first), runMeshlets[run]);
+    }
+  });
+  for (int run = 0; run < runCount; run++)
+    meshlets.insert(meshlets.end(), runMeshlets[run].begin(), runMeshlets[run].end());
+
+  parallelFor((int)meshlets.size(), 256, threadCount, [&](int begin, int end) {
+    for (int m = begin; m < end; m++)
+      boundMeshlet(vertices, indices, triangleOrder, meshlets[m]);
+  });
+}
+
+bool buildMeshletsCached(const char* cacheDir, const ArenaVector<float>& vertices,
+    const ArenaVector<unsigned int>& indices, int threadCount, ArenaVector<unsigned int>& triangleOrder,
+    vector<Meshlet>& meshlets)
+{
+  if (cacheDir == NULL || cacheDir[0] == '\0') {
+    buildMeshlets(vertices, indices, threadCount, triangleOrder, meshlets);
+    return false;
+  }
+  TRACE_ZONE("buildMeshletsCached");
+  string path = cachePath(cacheDir, vertices, indices);
+  if (readCache(path, indices.size() / 3, triangleOrder, meshlets))
+    return true;
+  buildMeshlets(vertices, indices, threadCount, triangleOrder, meshlets);
+  writeCache(path, triangleOrder, meshlets);
+  return false;
+}
+
+void transformMeshlets(float scale, const Vec3& offset, vector<Meshlet>& meshlets)
+{
+  const float move[3] = { offset.x, offset.y, offset.z };
+  for (size_t m = 0; m < meshlets.size(); m++) {
+    for (int axis = 0; axis < 3; axis++)
+      meshlets[m].center[axis] = meshlets[m].center[axis] * scale + move[axis];
+    meshlets[m].radius *= scale;
+  }
+}
+
+void cullMeshlets(const Meshlet* meshlets, int count, const float rows[12], const Frustum& frustum,
+    const Vec3& eye, vector<MeshletRun>& runs, MeshletCullStats& stats)
+{
+  // The frustum planes and the eye in the instance's own space. A plane's
+  // normal picks up the instance's scale, so radii are scaled to match.
+  float planes[6][4], planeScales[6];
+  for (int p = 0; p < 6; p++) {
+    const float* plane = frustum.planes[p];
+    float length = 0.0f;
+    for (int column = 0; column < 3; column++) {
+      planes[p][column] = plane[0] * rows[column] + plane[1] * rows[4 + column] + plane[2] * rows[8 + column];
+      length += planes[p][column] * planes[p][column];
+    }
+    planes[p][3] = plane[0] * rows[3] + plane[1] * rows[7] + plane[2] * rows[11] + plane[3];
+    planeScales[p] = sqrtf(length);
+  }
+  float scaleSquared = rows[0] * rows[0] + rows[1] * rows[1] + rows[2] * rows[2];
+  float fromMove[3] = { eye.x - rows[3], eye.y - rows[7], eye.z - rows[11] };
+  float localEye[3];
+  for (int column = 0; column < 3; column++)
+    localEye[column] = (fromMove[0] * rows[column] + fromMove[1] * rows[4 + column] + fromMove[2] * rows[8 + column]) /
+        scaleSquared;
+
+  bool extending = false;
+  for (int m = 0; m < count; m++) {
+    const Meshlet& meshlet = meshlets[m];
+    bool outside = false;
+    for (int p = 0; p < 6 && !outside; p++) {
+      outside = planes[p][0] * meshlet.center[0] + planes[p][1] * meshlet.center[1] + planes[p][2] * meshlet.center[2] +
+          planes[p][3] < -meshlet.radius * planeScales[p];
+    }
+    if (outside) {
+      stats.outsideFrustum++;
+      extending = false;
+      continue;
+    }
+    float toCenter[3] = { meshlet.center[0] - localEye[0], meshlet.center[1] - localEye[1],
+                          meshlet.center[2] - localEye[2] };
+    float distance = sqrtf(toCenter[0] * toCenter[0] + toCenter[1] * toCenter[1] + toCenter[2] * toCenter[2]);
+    float along = toCenter[0] * meshlet.coneAxis[0] + toCenter[1] * meshlet.coneAxis[1] +
+        toCenter[2] * meshlet.coneAxis[2];
+    if (along >= meshlet.coneCutoff * distance + meshlet.radius) {
+      stats.backfacing++;
+      extending = false;
+      continue;
+    }
+    if (extending && runs.back().firstTriangle + runs.back().triangleCount == meshlet.firstTriangle) {
+      runs.back().triangleCount += meshlet.triangleCount;
+    }
+    else {
+      MeshletRun run = { meshlet.firstTriangle, meshlet.triangleCount };
+      runs.push_back(run);
+    }
+    extending = true;
+  }
+  stats.tested += count;
+}
@@ -0,0 +1,80 @@
+// File: meshlet.h
+//
+// Splits a mesh into meshlets: clusters of neighbouring triangles, each with
+// at most maxMeshletVertices distinct vertices and maxMeshletTriangles
+// triangles, a bounding sphere and a cone around its triangles' normals. A
+// cluster whose sphere is outside the frustum, or whose cone shows every
+// triangle in it facing away from the eye, can be skipped without looking at
+// its triangles.
+
+#ifndef SP_MESHLET_H_
+#define SP_MESHLET_H_
+
+#include <vector>
+
+#include "arena.h"
+#include "vec3.h"
+#include "bvh.h"
+
+const int maxMeshletVertices = 64;
+const int maxMeshletTriangles = 124;
+
+struct Meshlet
+{
+  // Its triangles, in the order buildMeshlets() puts the mesh's triangles
+  unsigned int firstTriangle;
+  unsigned int triangleCount;
+  unsigned int vertexCount;
+  float center[3];
+  float radius;
+  // Seen from p, every triangle faces away if
+  // dot(center - p, coneAxis) >= coneCutoff * |center - p| + radius.
+  // coneCutoff is 1 when the normals are too spread out for that to happen.
+  float coneAxis[3];
+  float coneCutoff;
+};
+
+// Builds the meshlets of a mesh ("vertices" x, y, z triples, every 3 of
+// "indices" a triangle, counter-clockwise from the front) over "threadCount"
+// threads (0 for one per core). "triangleOrder" gets the mesh's triangles
+// meshlet by meshlet. Triangles are sorted along a Morton curve through their
+// centroids, and each run of the sorted triangles is scanned into meshlets,
+// a meshlet ending whenever the next triangle won't fit. Its sort keys come
+// from the arena "indices" is in.
+void buildMeshlets(const ArenaVector<float>& vertices, const ArenaVector<unsigned int>& indices, int threadCount,
+    ArenaVector<unsigned int>& triangleOrder, std::vector<Meshlet>& meshlets);
+
+// buildMeshlets(), but reusing what an earlier call on an identical mesh
+// saved in "cacheDir", or saving this one's result there. NULL or "" to not
+// cache. Returns true if it came from the cache.
+bool buildMeshletsCached(const char* cacheDir, const ArenaVector<float>& vertices,
+    const ArenaVector<unsigned int>& indices, int threadCount, ArenaVector<unsigned int>& triangleOrder,
+    std::vector<Meshlet>& meshlets);
+
+// Moves meshlets along with their mesh when it's scaled by "scale" and then
+// moved by "offset"
+void transformMeshlets(float scale, const Vec3& offset, std::vector<Meshlet>& meshlets);
+
+// A run of consecutive triangles in buildMeshlets() order
+struct MeshletRun
+{
+  unsigned int firstTriangle;
+  unsigned int triangleCount;
+};
+
+struct MeshletCullStats
+{
+  long long tested;
+  long long outsideFrustum;
+  long long backfacing;
+};
+
+// Tests "count" meshlets of an instance drawn with "rows" (the top three rows
+// of its transform: a rotation and uniform scale, then a move) against the
+// world-space "frustum" and "eye", and appends the triangles of those that
+// pass to "runs", neighbouring meshlets merged into one run. Adds what it
+// tested and rejected to "stats".
+void cullMeshlets(const Meshlet* meshlets, int count, const float rows[12], const Frustum& frustum,
+    const Vec3& eye, std::vector<MeshletRun>& runs, MeshletCullStats& stats);
+
+#endif // SP_MESHLET_H_
@@ -0,0 +1,860 @@
+// File: microbench.cpp
+//
+// Microbenchmarks (Google Benchmark) for the pieces everything else is built
+// on: Vec3 and Mat4 math, PLY parsing, SGI image decoding, turning a model
+// into vertex data, the CPU rasterizer and occlusion passes, culling and the
+// job system. Meshes go from the bunny itself up to subdivided copies of it
+// of 1M to 50M triangles, so loading costs can be followed as models grow.
+//
+// Run it from FinalProject/ so the bunny is found. Any Google Benchmark flag
+// works; --benchmark_out=FILE --benchmark_out_format=json writes results to
+// keep and compare over time. Generated inputs are kept in --data-dir (the
+// system temporary directory by default) and reused by later runs.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "rply.h"
+
+#include "vec3.h"
+#include "mat4.h"
+#include "scene.h"
+#include "bvh.h"
+#include "kernel.h"
+#include "texture.h"
+#include "cpuframe.h"
+#include "parallel.h"
+#include "jobs.h"
+#include "simplify.h"
+#include "meshlet.h"
+
+using std::string;
+using std::vector;
+
+// Options
+string dataDir;
+long long maxTriangles = 5000000;
+
+// Sizes of the synthetic meshes; 0 is the bunny as it is
+const long long meshSizes[] = { 0, 1000000, 5000000, 10000000, 50000000 };
+// Sizes of the synthetic SGI images
+const int textureSizes[] = { 256, 1024, 4096 };
+
+namespace {
+
+// A model as the PLY file has it
+struct PlyMesh
+{
+  ArenaVector<float> vertices;
+  ArenaVector<unsigned int> faceIndices;
+  float maxValue;
+};
+
+int readVertex(p_ply_argument argument)
+{
+  PlyMesh* mesh;
+  long axis;
+  ply_get_argument_user_data(argument, reinterpret_cast<void**>(&mesh), &axis);
+  long index;
+  ply_get_argument_element(argument, NULL, &index);
+  float value = (float)ply_get_argument_value(argument);
+  mesh->vertices[index * 3 + axis] = value;
+  if (fabs(value) > mesh->maxValue)
+    mesh->maxValue = (float)fabs(value);
+  return 1;
+}
+
+int readFace(p_ply_argument argument)
+{
+  PlyMesh* mesh;
+  ply_get_argument_user_data(argument, reinterpret_cast<void**>(&mesh), NULL);
+  long index;
+  ply_get_argument_element(argument, NULL, &index);
+  long valueIndex;
+  ply_get_argument_property(argument, NULL, NULL, &valueIndex);
+  if (valueIndex >= 0 && valueIndex < 3)
+    mesh->faceIndices[index * 3 + valueIndex] = (unsigned int)ply_get_argument_value(argument);
+  return 1;
+}
+
+// Reads positions and faces the way loadModelMesh() does
+bool readPlyMesh(const string& path, PlyMesh& mesh)
+{
+  p_ply ply = ply_open(path.c_str(), NULL, 0, NULL);
+  if (!ply)
+    return false;
+  if (!ply_read_header(ply)) {
+    ply_close(ply);
+    return false;
+  }
+  mesh.maxValue = 0.0f;
+  long vertexCount = ply_set_read_cb(ply, "vertex", "x", readVertex, &mesh, 0);
+  ply_set_read_cb(ply, "vertex", "y", readVertex, &mesh, 1);
+  ply_set_read_cb(ply, "vertex", "z", readVertex, &mesh, 2);
+  long faceCount = ply_set_read_cb(ply, "face", "vertex_indices", readFace, &mesh, 0);
+  mesh.vertices.resize(vertexCount * 3);
+  mesh.faceIndices.resize(faceCount * 3);
+  bool read = ply_read(ply) != 0;
+  ply_close(ply);
+  return read;
+}
+
+bool fileExists(const string& path)
+{
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL)
+    return false;
+  fclose(file);
+  return true;
+}
+
+long long fileSize(const string& path)
+{
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL)
+    return 0;
+  fseek(file, 0, SEEK_END);
+  long long size = ftell(file);
+  fclose(file);
+  return size;
+}
+
+// Writes a binary PLY of the bunny with every triangle split into an n by n
+// grid of smaller ones, n picked to get at least "triangles". Each original
+// triangle gets its own grid vertices, so there are about half as many
+// vertices as triangles, as in a real scan.
+bool writeSubdividedBunny(const PlyMesh& bunny, long long triangles, const string& path)
+{
+  long long baseTriangles = (long long)bunny.faceIndices.size() / 3;
+  int n = (int)ceil(sqrt((double)triangles / baseTriangles));
+  long long gridVertices = (long long)(n + 1) * (n + 2) / 2;
+  if (baseTriangles * gridVertices > 0xffffffffLL)
+    return false;
+
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == NULL)
+    return false;
+  fprintf(file, "ply\nformat binary_little_endian 1.0\n");
+  fprintf(file, "element vertex %lld\nproperty float x\nproperty float y\nproperty float z\n",
+      baseTriangles * gridVertices);
+  fprintf(file, "element face %lld\nproperty list uchar int vertex_indices\nend_header\n",
+      baseTriangles * n * n);
+
+  // Grid vertex (i, j) is i steps along the first edge and j along the second
+  for (long long face = 0; face < baseTriangles; face++) {
+    const float* corner[3];
+    for (int c = 0; c < 3; c++)
+      corner[c] = &bunny.vertices[bunny.faceIndices[face * 3 + c] * 3];
+    for (int i = 0; i <= n; i++) {
+      for (int j = 0; i + j <= n; j++) {
+        float position[3];
+        for (int axis = 0; axis < 3; axis++) {
+          position[axis] = corner[0][axis] + (corner[1][axis] - corner[0][axis]) * i / n +
+              (corner[2][axis] - corner[0][axis]) * j / n;
+        }
+        fwrite(position, sizeof(float), 3, file);
+      }
+    }
+  }
+
+  vector<unsigned int> rowStart(n + 1);
+  for (int i = 0, start = 0; i <= n; i++) {
+    rowStart[i] = start;
+    start += n + 1 - i;
+  }
+  for (long long face = 0; face < baseTriangles; face++) {
+    unsigned int base = (unsigned int)(face * gridVertices);
+    for (int i = 0; i < n; i++) {
+      for (int j = 0; i + j < n; j++) {
+        unsigned char three = 3;
+        unsigned int a[3] = { base + rowStart[i] + j, base + rowStart[i + 1] + j, base + rowStart[i] + j + 1 };
+        fwrite(&three, 1, 1, file);
+        fwrite(a, sizeof(unsigned int), 3, file);
+        if (i + j < n - 1) {
+          unsigned int b[3] = { base + rowStart[i + 1] + j, base + rowStart[i + 1] + j + 1, base + rowStart[i] + j + 1 };
+          fwrite(&three, 1, 1, file);
+          fwrite(b, sizeof(unsigned int), 3, file);
+        }
+      }
+    }
+  }
+  return fclose(file) == 0;
+}
+
+// The mesh file a size stands for, generating it first if needed
+string meshPath(long long triangles)
+{
+  if (triangles == 0)
+    return modelPath;
+
+  char name[64];
+  sprintf(name, "/bunny_%lld.ply", triangles);
+  string path = dataDir + name;
+  if (!fileExists(path)) {
+    PlyMesh bunny;
+    if (!readPlyMesh(modelPath, bunny) || !writeSubdividedBunny(bunny, triangles, path)) {
+      fprintf(stderr, "Couldn't write %s\n", path.c_str());
+      exit(1);
+    }
+  }
+  return path;
+}
+
+void putBigEndian16(unsigned char* out, unsigned int value)
+{
+  out[0] = (unsigned char)(value >> 8);
+  out[1] = (unsigned char)value;
+}
+
+void putBigEndian32(unsigned char* out, unsigned int value)
+{
+  out[0] = (unsigned char)(value >> 24);
+  out[1] = (unsigned char)(value >> 16);
+  out[2] = (unsigned char)(value >> 8);
+  out[3] = (unsigned char)value;
+}
+
+// Run-length encodes one channel row as SGI images do: a count byte, with
+// the top bit set for that many literal bytes or clear for one repeated byte,
+// and a 0 at the end
+void encodeRow(const unsigned char* row, int length, vector<unsigned char>& out)
+{
+  int x = 0;
+  while (x < length) {
+    int run = 1;
+    while (x + run < length && run < 127 && row[x + run] == row[x])
+      run++;
+    if (run >= 3) {
+      out.push_back((unsigned char)run);
+      out.push_back(row[x]);
+      x += run;
+      continue;
+    }
+    // Literals up to the next run of 3
+    int literal = 0;
+    while (x + literal < length && literal < 127 &&
+        !(x + literal + 2 < length && row[x + literal] == row[x + literal + 1] && row[x + literal] == row[x + literal + 2]))
+      literal++;
+    out.push_back((unsigned char)(0x80 | literal));
+    out.insert(out.end(), row + x, row + x + literal);
+    x += literal;
+  }
+  out.push_back(0);
+}
+
+// Writes a "size" square RGB SGI image, run-length encoded or not. The
+// picture has flat bands (which compress) and noise (which doesn't).
+string texturePath(int size, bool rle)
+{
+  char name[64];
+  sprintf(name, "/texture_%d%s.rgb", size, rle ? "_rle" : "");
+  string path = dataDir + name;
+  if (fileExists(path))
+    return path;
+
+  vector<unsigned char> header(512, 0);
+  putBigEndian16(&header[0], 474);
+  header[2] = rle ? 1 : 0;
+  header[3] = 1;
+  putBigEndian16(&header[4], 3);
+  putBigEndian16(&header[6], size);
+  putBigEndian16(&header[8], size);
+  putBigEndian16(&header[10], 3);
+  putBigEndian32(&header[16], 255);
+
+  unsigned int seed = 1;
+  vector<unsigned char> rows[3];
+  vector<unsigned char> row(size);
+  vector<unsigned int> rowStart, rowLength;
+  vector<unsigned char> data;
+  // Verbatim images store each channel's rows, channel after channel
+  for (int channel = 0; channel < 3; channel++) {
+    for (int y = 0; y < size; y++) {
+      for (int x = 0; x < size; x++) {
+        seed = seed * 1664525u + 1013904223u;
+        bool band = ((x / 32) + (y / 32)) % 2 == 0;
+        row[x] = band ? (unsigned char)(channel * 80 + (y / 32) * 4) : (unsigned char)(seed >> 24);
+      }
+      if (rle) {
+        size_t start = data.size();
+        encodeRow(&row[0], size, data);
+        rowStart.push_back((unsigned int)start);
+        rowLength.push_back((unsigned int)(data.size() - start));
+      }
+      else {
+        data.insert(data.end(), row.begin(), row.end());
+      }
+    }
+  }
+
+  FILE* file = fopen(path.c_str(), "wb");
+  bool ok = file != NULL && fwrite(&header[0], 1, header.size(), file) == header.size();
+  if (ok && rle) {
+    // Row offsets count from the start of the file, past both tables
+    unsigned int dataStart = 512 + 2 * 4 * (unsigned int)rowStart.size();
+    vector<unsigned char> tables(8 * rowStart.size());
+    for (size_t i = 0; i < rowStart.size(); i++) {
+      putBigEndian32(&tables[i * 4], dataStart + rowStart[i]);
+      putBigEndian32(&tables[(rowStart.size() + i) * 4], rowLength[i]);
+    }
+    ok = fwrite(&tables[0], 1, tables.size(), file) == tables.size();
+  }
+  if (ok)
+    ok = fwrite(&data[0], 1, data.size(), file) == data.size();
+  if (file == NULL || fclose(file) != 0 || !ok) {
+    fprintf(stderr, "Couldn't write %s\n", path.c_str());
+    exit(1);
+  }
+  return path;
+}
+
+// Vectors to run math benchmarks over, spread around like model vertices
+const int mathBatch = 4096;
+
+vector<Vec3> randomVectors()
+{
+  vector<Vec3> vectors(mathBatch);
+  unsigned int seed = 7;
+  for (int i = 0; i < mathBatch; i++) {
+    float c[3];
+    for (int axis = 0; axis < 3; axis++) {
+      seed = seed * 1664525u + 1013904223u;
+      c[axis] = (seed >> 8) / 16777216.0f * 2.0f - 1.0f;
+    }
+    vectors[i] = Vec3(c[0], c[1], c[2]);
+  }
+  return vectors;
+}
+
+// The scene from the regression check's front view, for the CPU passes
+struct CPUFixture
+{
+  vector<float> modelData;
+  vector<RasterDraw> draws;
+  Mat4 view;
+  Mat4 proj;
+  SSAOSettings settings;
+  GBuffer gbuffer;
+  vector<float> occlusion;
+
+  CPUFixture()
+  {
+    if (!loadModelMesh(modelPath, modelData)) {
+      fprintf(stderr, "Couldn't load %s\n", modelPath);
+      exit(1);
+    }
+    sceneDraws(modelData, draws);
+    sceneMatrices(Vec3(0, 1.5f, 1.5f), Vec3(0, 0, 0), view, proj);
+    cpuOcclusionSettings(defaultKernelSize, defaultNoiseSize, defaultKernelSeed, false, settings);
+    gbuffer.width = 1024;
+    gbuffer.height = 768;
+    rasterizeGBuffer(draws, view, proj, true, gbuffer, 0, NULL);
+    computeOcclusionCPU(gbuffer, settings, occlusion, 0);
+  }
+};
+
+CPUFixture& cpuFixture()
+{
+  static CPUFixture fixture;
+  return fixture;
+}
+
+}
+
+// ---------------------------------------------------------------- math
+
+void BM_Vec3Normalize(benchmark::State& state)
+{
+  vector<Vec3> vectors = randomVectors();
+  for (auto _ : state) {
+    for (int i = 0; i < mathBatch; i++) {
+      Vec3 v = vectors[i].normalized();
+      benchmark::DoNotOptimize(v);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * mathBatch);
+}
+BENCHMARK(BM_Vec3Normalize);
+
+void BM_Vec3CrossDot(benchmark::State& state)
+{
+  vector<Vec3> vectors = randomVectors();
+  for (auto _ : state) {
+    float total = 0.0f;
+    for (int i = 0; i + 1 < mathBatch; i++)
+      total += vectors[i].cross(vectors[i + 1]).dot(vectors[i]);
+    benchmark::DoNotOptimize(total);
+  }
+  state.SetItemsProcessed(state.iterations() * (mathBatch - 1));
+}
+BENCHMARK(BM_Vec3CrossDot);
+
+// Flat-normal computation, as buildModelVertexData() does per face
+void BM_Vec3FaceNormal(benchmark::State& state)
+{
+  vector<Vec3> vectors = randomVectors();
+  for (auto _ : state) {
+    for (int i = 0; i + 2 < mathBatch; i += 3) {
+      Vec3 normal = (vectors[i + 1] - vectors[i]).cross(vectors[i + 2] - vectors[i]);
+      normal.normalize();
+      benchmark::DoNotOptimize(normal);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * (mathBatch / 3));
+}
+BENCHMARK(BM_Vec3FaceNormal);
+
+void BM_Mat4Multiply(benchmark::State& state)
+{
+  Mat4 view, viewNormal;
+  Mat4::lookAtMatrix(Vec3(0, 1.5f, 1.5f), Vec3(0, 0, 0), Vec3(0, 1, 0), view, viewNormal);
+  Mat4 proj = Mat4::perspectiveMatrix(1.5f, 1.333333f, 0.1f, 1000.0f);
+  for (auto _ : state) {
+    Mat4 mvp = proj * view;
+    benchmark::DoNotOptimize(mvp);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Mat4Multiply);
+
+void BM_Mat4TransformPoint(benchmark::State& state)
+{
+  vector<Vec3> vectors = randomVectors();
+  Mat4 view, viewNormal;
+  Mat4::lookAtMatrix(Vec3(0, 1.5f, 1.5f), Vec3(0, 0, 0), Vec3(0, 1, 0), view, viewNormal);
+  for (auto _ : state) {
+    for (int i = 0; i < mathBatch; i++) {
+      Vec3 v = view * vectors[i];
+      benchmark::DoNotOptimize(v);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * mathBatch);
+}
+BENCHMARK(BM_Mat4TransformPoint);
+
+void BM_Mat4Inverse(benchmark::State& state)
+{
+  Mat4 view, viewNormal;
+  Mat4::lookAtMatrix(Vec3(0, 1.5f, 1.5f), Vec3(0, 0, 0), Vec3(0, 1, 0), view, viewNormal);
+  Mat4 mvp = Mat4::perspectiveMatrix(1.5f, 1.333333f, 0.1f, 1000.0f) * view;
+  for (auto _ : state) {
+    Mat4 inverse = mvp.inverse();
+    benchmark::DoNotOptimize(inverse);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Mat4Inverse);
+
+// ---------------------------------------------------------------- loading
+
+// Parsing alone: ply_read() with callbacks that just store the values
+void BM_PlyRead(benchmark::State& state, long long triangles)
+{
+  string path = meshPath(triangles);
+  long long faces = 0;
+  for (auto _ : state) {
+    PlyMesh mesh;
+    if (!readPlyMesh(path, mesh)) {
+      state.SkipWithError("Couldn't read the mesh");
+      return;
+    }
+    faces = (long long)mesh.faceIndices.size() / 3;
+    benchmark::DoNotOptimize(mesh.vertices.data());
+  }
+  state.SetItemsProcessed(state.iterations() * faces);
+  state.SetBytesProcessed(state.iterations() * fileSize(path));
+  state.counters["triangles"] = (double)faces;
+}
+
+// What loadModel() spends after parsing: scaling, flat normals and
+// de-indexing into vertex data
+void BM_BuildModelVertexData(benchmark::State& state, long long triangles)
+{
+  PlyMesh mesh;
+  if (!readPlyMesh(meshPath(triangles), mesh)) {
+    state.SkipWithError("Couldn't read the mesh");
+    return;
+  }
+  vector<float> vertexData(mesh.faceIndices.size() * floatsPerVertex);
+  for (auto _ : state) {
+    buildModelVertexData(mesh.vertices, mesh.faceIndices, mesh.maxValue, vertexData.data());
+    benchmark::DoNotOptimize(vertexData.data());
+  }
+  long long faces = (long long)mesh.faceIndices.size() / 3;
+  state.SetItemsProcessed(state.iterations() * faces);
+  state.counters["triangles"] = (double)faces;
+}
+
+// The whole of loadModelMesh(), parsing included
+void BM_LoadModelMesh(benchmark::State& state, long long triangles)
+{
+  string path = meshPath(triangles);
+  size_t floats = 0;
+  for (auto _ : state) {
+    vector<float> vertexData;
+    if (!loadModelMesh(path.c_str(), vertexData)) {
+      state.SkipWithError("Couldn't load the mesh");
+      return;
+    }
+    floats = vertexData.size();
+    benchmark::DoNotOptimize(vertexData.data());
+  }
+  long long faces = (long long)(floats / floatsPerVertex / 3);
+  state.SetItemsProcessed(state.iterations() * faces);
+  state.counters["triangles"] = (double)faces;
+}
+
+// Simplifying the bunny by halves down to minLODTriangles, every level in one
+// pass as loadModelLODs() does
+void BM_SimplifyMesh(benchmark::State& state)
+{
+  PlyMesh mesh;
+  if (!readPlyMesh(modelPath, mesh)) {
+    state.SkipWithError("Couldn't read the mesh");
+    return;
+  }
+  vector<size_t> targets;
+  for (size_t triangles = mesh.faceIndices.size() / 3 / 2; triangles >= (size_t)minLODTriangles; triangles /= 2)
+    targets.push_back(triangles);
+  for (auto _ : state) {
+    Arena arena;
+    vector<SimplifiedMesh> levels;
+    simplifyMesh(mesh.vertices, mesh.faceIndices, targets, arena, levels);
+    benchmark::DoNotOptimize(levels.data());
+  }
+  long long faces = (long long)mesh.faceIndices.size() / 3;
+  state.SetItemsProcessed(state.iterations() * faces);
+  state.counters["triangles"] = (double)faces;
+}
+BENCHMARK(BM_SimplifyMesh)->Unit(benchmark::kMillisecond);
+
+// buildMeshlets() alone, without the cache
+void BM_BuildMeshlets(benchmark::State& state, long long triangles)
+{
+  PlyMesh mesh;
+  if (!readPlyMesh(meshPath(triangles), mesh)) {
+    state.SkipWithError("Couldn't read the mesh");
+    return;
+  }
+  ArenaVector<unsigned int> triangleOrder;
+  vector<Meshlet> meshlets;
+  for (auto _ : state) {
+    buildMeshlets(mesh.vertices, mesh.faceIndices, (int)state.range(0), triangleOrder, meshlets);
+    benchmark::DoNotOptimize(meshlets.data());
+  }
+  long long faces = (long long)mesh.faceIndices.size() / 3;
+  state.SetItemsProcessed(state.iterations() * faces);
+  state.counters["triangles"] = (double)faces;
+  state.counters["meshlets"] = (double)meshlets.size();
+}
+
+void BM_ReadTexture(benchmark::State& state, int size, bool rle)
+{
+  string path = texturePath(size, rle);
+  for (auto _ : state) {
+    int width, height, components;
+    unsigned* pixels = read_texture(path.c_str(), &width, &height, &components);
+    benchmark::DoNotOptimize(pixels);
+    free(pixels);
+  }
+  state.SetItemsProcessed(state.iterations() * size * size);
+  state.SetBytesProcessed(state.iterations() * fileSize(path));
+}
+
+// ---------------------------------------------------------------- CPU passes
+
+void BM_RasterizeGBuffer(benchmark::State& state)
+{
+  CPUFixture& fixture = cpuFixture();
+  GBuffer gbuffer;
+  gbuffer.width = fixture.gbuffer.width;
+  gbuffer.height = fixture.gbuffer.height;
+  RasterStats stats;
+  for (auto _ : state)
+    rasterizeGBuffer(fixture.draws, fixture.view, fixture.proj, true, gbuffer, (int)state.range(0), &stats);
+  state.SetItemsProcessed(state.iterations() * stats.triangles);
+  state.counters["pixels_shaded"] = (double)stats.pixelsShaded;
+}
+BENCHMARK(BM_RasterizeGBuffer)->ArgName("threads")->Arg(1)->Arg(0)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_ComputeOcclusion(benchmark::State& state)
+{
+  CPUFixture& fixture = cpuFixture();
+  vector<float> occlusion;
+  for (auto _ : state)
+    computeOcclusionCPU(fixture.gbuffer, fixture.settings, occlusion, (int)state.range(0));
+  state.SetItemsProcessed(state.iterations() * fixture.gbuffer.width * fixture.gbuffer.height);
+}
+BENCHMARK(BM_ComputeOcclusion)->ArgName("threads")->Arg(1)->Arg(0)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_BlurOcclusion(benchmark::State& state)
+{
+  CPUFixture& fixture = cpuFixture();
+  vector<float> blurred;
+  for (auto _ : state) {
+    blurOcclusionCPU(fixture.occlusion, fixture.gbuffer.width, fixture.gbuffer.height, true, blurred,
+        (int)state.range(0));
+  }
+  state.SetItemsProcessed(state.iterations() * fixture.gbuffer.width * fixture.gbuffer.height);
+}
+BENCHMARK(BM_BlurOcclusion)->ArgName("threads")->Arg(1)->Arg(0)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// ---------------------------------------------------------------- culling
+
+// Bounds of a grid of "count" bunnies, as the renderer's --instances draws
+void gridInstanceBounds(int count, SceneDescription& scene, vector<AABB>& bounds)
+{
+  AABB meshBounds;
+  vertexDataBounds(cpuFixture().modelData.data(), cpuFixture().modelData.size(), meshBounds);
+  gridScene(count, scene);
+  bounds.resize(count);
+  for (int i = 0; i < count; i++)
+    transformBounds(meshBounds, instanceTransform(scene.instances[i]), bounds[i]);
+}
+
+void BM_BuildBVH(benchmark::State& state)
+{
+  SceneDescription scene;
+  vector<AABB> bounds;
+  gridInstanceBounds((int)state.range(0), scene, bounds);
+  InstanceBVH bvh;
+  for (auto _ : state)
+    buildBVH(bounds, bvh);
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.counters["nodes"] = (double)bvh.nodes.size();
+}
+BENCHMARK(BM_BuildBVH)->ArgName("instances")->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+// Turns a tenth of the instances each iteration and refits
+void BM_RefitBVH(benchmark::State& state)
+{
+  SceneDescription scene;
+  vector<AABB> bounds;
+  int count = (int)state.range(0);
+  gridInstanceBounds(count, scene, bounds);
+  InstanceBVH bvh;
+  buildBVH(bounds, bvh);
+  AABB meshBounds;
+  vertexDataBounds(cpuFixture().modelData.data(), cpuFixture().modelData.size(), meshBounds);
+  vector<int> changed;
+  for (int i = 0; i < count; i += 10)
+    changed.push_back(i);
+  int rebuilds = 0;
+  for (auto _ : state) {
+    for (size_t i = 0; i < changed.size(); i++) {
+      SceneInstance& instance = scene.instances[changed[i]];
+      instance.yaw += 2.0f;
+      transformBounds(meshBounds, instanceTransform(instance), bounds[changed[i]]);
+    }
+    if (updateBVH(bvh, changed, bounds))
+      rebuilds++;
+  }
+  state.SetItemsProcessed(state.iterations() * changed.size());
+  state.counters["rebuilds"] = rebuilds;
+}
+BENCHMARK(BM_RefitBVH)->ArgName("instances")->Arg(10000)->Arg(100000)->Unit(benchmark::kMicrosecond);
+
+// From the default camera, which sees a few thousand of the instances
+void BM_CullBVH(benchmark::State& state)
+{
+  SceneDescription scene;
+  vector<AABB> bounds;
+  gridInstanceBounds((int)state.range(0), scene, bounds);
+  InstanceBVH bvh;
+  buildBVH(bounds, bvh);
+  Mat4 view, proj;
+  sceneMatrices(Vec3(0, 1.5f, 1.5f), Vec3(0, 0, 0), view, proj);
+  Frustum frustum;
+  frustumFromMatrix(proj * view, frustum);
+  vector<int> visible;
+  CullStats stats;
+  for (auto _ : state)
+    cullBVH(bvh, frustum, visible, &stats);
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.counters["visible"] = stats.visible;
+  state.counters["nodes_visited"] = stats.nodesVisited;
+}
+BENCHMARK(BM_CullBVH)->ArgName("instances")->Arg(10000)->Arg(100000)->Unit(benchmark::kMicrosecond);
+
+// Culls one instance's meshlets, seen whole from the regression check's
+// front view (view 0) or close up, with much of it out of view (view 1).
+// The counters are the share of meshlets rejected.
+void BM_CullMeshlets(benchmark::State& state, long long triangles)
+{
+  PlyMesh mesh;
+  if (!readPlyMesh(meshPath(triangles), mesh)) {
+    state.SkipWithError("Couldn't read the mesh");
+    return;
+  }
+  ArenaVector<unsigned int> triangleOrder;
+  vector<Meshlet> meshlets;
+  buildMeshlets(mesh.vertices, mesh.faceIndices, 0, triangleOrder, meshlets);
+  transformMeshlets(1.0f / mesh.maxValue, Vec3(0.0f, -0.5f, 0.0f), meshlets);
+
+  Vec3 eye = state.range(0) == 0 ? Vec3(0.0f, 1.5f, 1.5f) : Vec3(0.1f, 0.1f, 0.4f);
+  Mat4 view, proj;
+  sceneMatrices(eye, Vec3(0.0f, 0.0f, 0.0f), view, proj);
+  Frustum frustum;
+  frustumFromMatrix(proj * view, frustum);
+  const float rows[12] = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f };
+
+  vector<MeshletRun> runs;
+  MeshletCullStats stats = { 0, 0, 0 };
+  for (auto _ : state) {
+    runs.clear();
+    cullMeshlets(meshlets.data(), (int)meshlets.size(), rows, frustum, eye, runs, stats);
+    benchmark::DoNotOptimize(runs.data());
+  }
+  state.SetItemsProcessed(state.iterations() * meshlets.size());
+  state.counters["meshlets"] = (double)meshlets.size();
+  state.counters["rejected"] = (double)(stats.outsideFrustum + stats.backfacing) / stats.tested;
+  state.counters["frustum"] = (double)stats.outsideFrustum / stats.tested;
+  state.counters["backfacing"] = (double)stats.backfacing / stats.tested;
+}
+
+// ---------------------------------------------------------------- jobs
+
+// The job system's counts since resetJobStats(), per iteration
+void reportJobStats(benchmark::State& state)
+{
+  JobStats stats = jobStats();
+  state.counters["jobs"] = benchmark::Counter((double)stats.jobsRun, benchmark::Counter::kAvgIterations);
+  state.counters["steals"] = benchmark::Counter((double)stats.steals, benchmark::Counter::kAvgIterations);
+  state.counters["failed_steals"] = benchmark::Counter((double)stats.failedSteals, benchmark::Counter::kAvgIterations);
+  state.counters["contended"] = benchmark::Counter((double)stats.contendedLocks, benchmark::Counter::kAvgIterations);
+  state.counters["sleeps"] = benchmark::Counter((double)stats.sleeps, benchmark::Counter::kAvgIterations);
+}
+
+// parallelFor() over 1 to all cores, on items that cost more the further
+// along they are, so the threads only finish together by stealing
+void BM_JobsParallelFor(benchmark::State& state)
+{
+  const int items = 1 << 16;
+  vector<float> results(items);
+  resetJobStats();
+  for (auto _ : state) {
+    parallelFor(items, 256, (int)state.range(0), [&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        float x = (float)i;
+        for (int step = 0; step <= i >> 10; step++)
+          x = sqrtf(x + (float)step);
+        results[i] = x;
+      }
+    });
+    benchmark::DoNotOptimize(results.data());
+  }
+  state.SetItemsProcessed(state.iterations() * items);
+  reportJobStats(state);
+}
+BENCHMARK(BM_JobsParallelFor)->ArgName("threads")->DenseRange(1, defaultThreadCount())
+    ->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+// Scheduling cost of a graph of small jobs: a root, "width" jobs after it and
+// one after all of those, eight times over, each round after the last
+void BM_JobsGraph(benchmark::State& state)
+{
+  const int rounds = 8;
+  int width = (int)state.range(0);
+  vector<float> results(width);
+  resetJobStats();
+  for (auto _ : state) {
+    Job last;
+    for (int round = 0; round < rounds; round++) {
+      Job root = addJob([] { }, last ? vector<Job>(1, last) : vector<Job>());
+      vector<Job> middle;
+      for (int i = 0; i < width; i++) {
+        middle.push_back(addJob([&results, i] {
+          float x = (float)i;
+          for (int step = 0; step < 256; step++)
+            x = sqrtf(x + (float)step);
+          results[i] = x;
+        }, vector<Job>(1, root)));
+      }
+      last = addJob([] { }, middle);
+    }
+    waitForJob(last);
+    benchmark::DoNotOptimize(results.data());
+  }
+  state.SetItemsProcessed(state.iterations() * rounds * (width + 2));
+  state.counters["workers"] = jobWorkerCount();
+  reportJobStats(state);
+}
+BENCHMARK(BM_JobsGraph)->ArgName("width")->Arg(16)->Arg(256)->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+// ---------------------------------------------------------------- setup
+
+void printUsage(const char* program)
+{
+  fprintf(stderr, "Usage: %s [Google Benchmark options] [options]\n", program);
+  fprintf(stderr, "  --data-dir DIR         where generated meshes and images are kept (default: system temp)\n");
+  fprintf(stderr, "  --max-triangles N      largest synthetic mesh to benchmark (default 5000000; up to 50000000,\n");
+  fprintf(stderr, "                         which takes about 1 GB on disk and 6 GB of memory)\n");
+}
+
+// Mesh sizes are only known once the options are read, so the loading
+// benchmarks are registered here rather than with BENCHMARK()
+void registerLoadingBenchmarks()
+{
+  for (size_t i = 0; i < sizeof(meshSizes) / sizeof(meshSizes[0]); i++) {
+    long long triangles = meshSizes[i];
+    if (triangles > maxTriangles)
+      continue;
+    string suffix = triangles == 0 ? "/bunny" : "/" + std::to_string(triangles / 1000000) + "M";
+    benchmark::RegisterBenchmark(("BM_PlyRead" + suffix).c_str(), BM_PlyRead, triangles)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("BM_BuildModelVertexData" + suffix).c_str(), BM_BuildModelVertexData, triangles)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("BM_LoadModelMesh" + suffix).c_str(), BM_LoadModelMesh, triangles)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("BM_BuildMeshlets" + suffix).c_str(), BM_BuildMeshlets, triangles)
+        ->ArgName("threads")->Arg(1)->Arg(0)->Unit(benchmark::kMillisecond)->UseRealTime();
+    benchmark::RegisterBenchmark(("BM_CullMeshlets" + suffix).c_str(), BM_CullMeshlets, triangles)
+        ->ArgName("view")->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+  }
+  for (size_t i = 0; i < sizeof(textureSizes) / sizeof(textureSizes[0]); i++) {
+    int size = textureSizes[i];
+    for (int rle = 0; rle < 2; rle++) {
+      string name = "BM_ReadTexture/" + std::to_string(size) + (rle ? "/rle" : "/verbatim");
+      benchmark::RegisterBenchmark(name.c_str(), BM_ReadTexture, size, rle != 0)->Unit(benchmark::kMicrosecond);
+    }
+  }
+}
+
+// entry point
+int main(int argc, char* argv[])
+{
+  benchmark::Initialize(&argc, argv);
+
+  const char* temp = getenv("TMPDIR");
+  dataDir = temp != NULL && temp[0] != '\0' ? temp : "/tmp";
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--data-dir") == 0 && i + 1 < argc) {
+      dataDir = argv[++i];
+    }
+    else if (strcmp(argv[i], "--max-triangles") == 0 && i + 1 < argc) {
+      maxTriangles = atoll(argv[++i]);
+    }
+    else {
+      fprintf(stderr, "Unknown argument %s\n", argv[i]);
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (!fileExists(modelPath)) {
+    fprintf(stderr, "Couldn't find %s; run from FinalProject/.\n", modelPath);
+    return 1;
+  }
+
+  registerLoadingBenchmarks();
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
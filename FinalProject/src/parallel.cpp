@@ -0,0 +1,131 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "jobs.h"
+
+using std::vector;
+
+namespace {
+
+// The chunks a thread still has to do, [begin, end), packed into one word so
+// the owner (taking from the front) and thieves (taking from the back) can
+// both update it with a single compare-and-swap
+class ChunkRange
+{
+public:
+  ChunkRange() : range(0) { }
+
+  void set(unsigned int begin, unsigned int end)
+  {
+    range.store(pack(begin, end));
+  }
+
+  // Takes the first chunk, returning false if there's none left
+  bool pop(unsigned int& chunk)
+  {
+    unsigned long long current = range.load();
+    for (;;) {
+      unsigned int begin = beginOf(current);
+      unsigned int end = endOf(current);
+      if (begin >= end)
+        return false;
+      if (range.compare_exchange_weak(current, pack(begin + 1, end))) {
+        chunk = begin;
+        return true;
+      }
+    }
+  }
+
+  // Takes the back half of what's left, returning false if there's nothing
+  bool steal(unsigned int& begin, unsigned int& end)
+  {
+    unsigned long long current = range.load();
+    for (;;) {
+      unsigned int first = beginOf(current);
+      unsigned int last = endOf(current);
+      if (first >= last)
+        return false;
+      unsigned int middle = first + (last - first) / 2;
+      if (range.compare_exchange_weak(current, pack(first, middle))) {
+        begin = middle;
+        end = last;
+        return true;
+      }
+    }
+  }
+
+private:
+  static unsigned long long pack(unsigned int begin, unsigned int end)
+  {
+    return ((unsigned long long)end << 32) | begin;
+  }
+  static unsigned int beginOf(unsigned long long packed) { return (unsigned int)packed; }
+  static unsigned int endOf(unsigned long long packed) { return (unsigned int)(packed >> 32); }
+
+  std::atomic<unsigned long long> range;
+};
+
+void runWorker(int self, vector<ChunkRange>& ranges, int count, int grain,
+    const std::function<void(int, int)>& body)
+{
+  int threadCount = (int)ranges.size();
+  for (;;) {
+    unsigned int chunk;
+    while (ranges[self].pop(chunk))
+      body(chunk * grain, std::min((int)(chunk + 1) * grain, count));
+
+    // Out of work: look for a thread that still has some, starting with the
+    // next one along so thieves spread out
+    bool stole = false;
+    for (int i = 1; i < threadCount && !stole; i++) {
+      unsigned int begin, end;
+      if (ranges[(self + i) % threadCount].steal(begin, end)) {
+        ranges[self].set(begin, end);
+        stole = true;
+      }
+    }
+    if (!stole)
+      return;
+  }
+}
+
+}
+
+int defaultThreadCount()
+{
+  int cores = (int)std::thread::hardware_concurrency();
+  return cores > 0 ? cores : 1;
+}
+
+void parallelFor(int count, int grain, int threadCount, const std::function<void(int, int)>& body)
+{
+  if (count <= 0)
+    return;
+  if (grain < 1)
+    grain = 1;
+  int chunks = (count + grain - 1) / grain;
+  if (threadCount <= 0)
+    threadCount = defaultThreadCount();
+  threadCount = std::min(threadCount, chunks);
+
+  if (threadCount == 1) {
+    for (int begin = 0; begin < count; begin += grain)
+      body(begin, std::min(begin + grain, count));
+    return;
+  }
+
+  // Deal the chunks out evenly to start with
+  vector<ChunkRange> ranges(threadCount);
+  for (int i = 0; i < threadCount; i++)
+    ranges[i].set((unsigned int)((long long)chunks * i / threadCount), (unsigned int)((long long)chunks * (i + 1) / threadCount));
+
+  vector<Job> jobs;
+  for (int i = 1; i < threadCount; i++)
+    jobs.push_back(addJob([&, i] { runWorker(i, ranges, count, grain, body); }));
+  runWorker(0, ranges, count, grain, body);
+  waitForJobs(jobs);
+}
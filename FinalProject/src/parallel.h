@@ -0,0 +1,22 @@
+// File: parallel.h
+//
+// Splits loops over the job system's threads (jobs.h), for the CPU renderer
+// (rasterizer.cpp and cpussao.cpp), loading and culling.
+
+#ifndef SP_PARALLEL_H_
+#define SP_PARALLEL_H_
+
+#include <functional>
+
+// Threads to use when asked for 0: one per core
+int defaultThreadCount();
+
+// Calls body(begin, end) on consecutive ranges of at most "grain" items
+// until all of [0, count) is covered, over "threadCount" threads (0 for one
+// per core): the calling thread and a job for each of the others. Each starts
+// on an equal share of the ranges and, once through it, steals half of what's
+// left of another's, so uneven work still finishes together. Returns when
+// everything is done. Can be called from inside a job.
+void parallelFor(int count, int grain, int threadCount, const std::function<void(int, int)>& body);
+
+#endif // SP_PARALLEL_H_
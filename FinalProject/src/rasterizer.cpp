@@ -0,0 +1,683 @@
+// File: rasterizer.cpp
+//
+// Vertices are snapped to 1/16 pixel and edge functions are evaluated
+// exactly, in integers, at pixel centers, with a top-left fill rule, so
+// triangles sharing an edge never both cover (or both miss) a pixel on it.
+// Clipping is done in clip space, against the near and far planes and a
+// guard band 16 times the screen's size, which keeps snapped coordinates
+// small enough that edge functions over an 8x8 block fit in 32 bits.
+
+#include "rasterizer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SP_RASTERIZER_SSE 1
+#include <emmintrin.h>
+#else
+#define SP_RASTERIZER_SSE 0
+#endif
+
+#include "parallel.h"
+#include "walltime.h"
+#include "trace.h"
+
+using std::vector;
+
+namespace {
+
+const int subpixelBits = 4;
+const int subpixelScale = 1 << subpixelBits;
+// Guard band, in multiples of the screen's half-size in NDC
+const float guardBand = 16.0f;
+// Triangles set up and binned together
+const int setupBatchSize = 1024;
+
+const int clipPlaneCount = 6;
+// Most vertices a triangle can have after clipping against every plane
+const int maxClippedVertices = 3 + clipPlaneCount;
+
+// A vertex after the vertex shader
+struct ClipVertex
+{
+  float clip[4];
+  // The shader's positionV and normalV
+  float view[3];
+  float normal[3];
+};
+
+// Everything needed to rasterize and shade one (clipped) triangle
+struct SetupTriangle
+{
+  // Edge functions E = A*x + B*y + C over subpixel sample positions, with the
+  // fill rule folded into C, so a sample is covered where all three are at
+  // least 0. Edge i is the one opposite vertex i.
+  int edgeA[3];
+  int edgeB[3];
+  long long edgeC[3];
+  // Pixel bounding box, inclusive, clamped to the screen
+  int minX;
+  int minY;
+  int maxX;
+  int maxY;
+  // Window depth, and the screen-space barycentric weights of vertices 1 and
+  // 2, as a*x + b*y + c over pixels counted from (minX, minY)
+  float depthPlane[3];
+  float weight1Plane[3];
+  float weight2Plane[3];
+  // Nearest depth of any vertex
+  float minDepth;
+  float invW[3];
+  float view[3][3];
+  float normal[3][3];
+  const Material* material;
+};
+
+// The triangles one setup batch produced, and which of them touch each tile
+struct SetupBatch
+{
+  vector<SetupTriangle> triangles;
+  vector<vector<int> > bins;
+  int trianglesDrawn;
+};
+
+// Work counters, kept per tile and added up at the end
+struct TileCounters
+{
+  long long blocksCulled;
+  long long blocksRasterized;
+  long long pixelsShaded;
+};
+
+// One rasterizeGBuffer() call's shared state
+struct Frame
+{
+  int width;
+  int height;
+  int tilesX;
+  int tilesY;
+  int blocksX;
+  Mat4 mvp;
+  Mat4 view;
+  bool writeNormals;
+  GBuffer* gbuffer;
+  // Farthest depth in each 8x8 block
+  vector<float> blockMaxDepth;
+};
+
+float roundToByte(float value)
+{
+  value = std::min(std::max(value, 0.0f), 1.0f);
+  return floorf(value * 255.0f + 0.5f) / 255.0f;
+}
+
+float dot3(const float* a, const float* b)
+{
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+void normalize3(float* v)
+{
+  float length = sqrtf(dot3(v, v));
+  if (length > 0.0f) {
+    v[0] /= length;
+    v[1] /= length;
+    v[2] /= length;
+  }
+}
+
+void transformVertex(const Frame& frame, const float* vertex, ClipVertex& out)
+{
+  const float* mvp = reinterpret_cast<const float*>(&frame.mvp);
+  const float* view = reinterpret_cast<const float*>(&frame.view);
+  for (int row = 0; row < 4; row++)
+    out.clip[row] = mvp[row] * vertex[0] + mvp[4 + row] * vertex[1] + mvp[8 + row] * vertex[2] + mvp[12 + row];
+  for (int row = 0; row < 3; row++)
+    out.view[row] = view[row] * vertex[0] + view[4 + row] * vertex[1] + view[8 + row] * vertex[2] + view[12 + row];
+  // The normal matrix is the identity
+  out.normal[0] = vertex[3];
+  out.normal[1] = vertex[4];
+  out.normal[2] = vertex[5];
+}
+
+// Signed distance to a clip plane, negative outside
+float planeDistance(const ClipVertex& v, int plane)
+{
+  const float* c = v.clip;
+  switch (plane) {
+    case 0: return c[3] + c[2];
+    case 1: return c[3] - c[2];
+    case 2: return guardBand * c[3] + c[0];
+    case 3: return guardBand * c[3] - c[0];
+    case 4: return guardBand * c[3] + c[1];
+    default: return guardBand * c[3] - c[1];
+  }
+}
+
+int outcode(const ClipVertex& v)
+{
+  int code = 0;
+  for (int plane = 0; plane < clipPlaneCount; plane++) {
+    if (planeDistance(v, plane) < 0.0f)
+      code |= 1 << plane;
+  }
+  return code;
+}
+
+ClipVertex lerpVertex(const ClipVertex& a, const ClipVertex& b, float t)
+{
+  ClipVertex result;
+  for (int i = 0; i < 4; i++)
+    result.clip[i] = a.clip[i] + (b.clip[i] - a.clip[i]) * t;
+  for (int i = 0; i < 3; i++) {
+    result.view[i] = a.view[i] + (b.view[i] - a.view[i]) * t;
+    result.normal[i] = a.normal[i] + (b.normal[i] - a.normal[i]) * t;
+  }
+  return result;
+}
+
+// Sutherland-Hodgman against the planes in "planes". Returns the number of
+// vertices left in "polygon".
+int clipPolygon(ClipVertex* polygon, int count, int planes)
+{
+  ClipVertex scratch[maxClippedVertices];
+  for (int plane = 0; plane < clipPlaneCount && count > 0; plane++) {
+    if (!(planes & (1 << plane)))
+      continue;
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+      const ClipVertex& a = polygon[i];
+      const ClipVertex& b = polygon[(i + 1) % count];
+      float da = planeDistance(a, plane);
+      float db = planeDistance(b, plane);
+      if (da >= 0.0f)
+        scratch[kept++] = a;
+      if ((da >= 0.0f) != (db >= 0.0f))
+        scratch[kept++] = lerpVertex(a, b, da / (da - db));
+    }
+    std::copy(scratch, scratch + kept, polygon);
+    count = kept;
+  }
+  return count;
+}
+
+// Where edge "edge" is over the samples of pixels [x0, x1] x [y0, y1]:
+// -1 if it's outside at all of them, 1 if inside at all of them, else 0
+int classifyRect(const SetupTriangle& t, int edge, int x0, int y0, int x1, int y1)
+{
+  long long sx0 = (long long)x0 * subpixelScale + subpixelScale / 2;
+  long long sy0 = (long long)y0 * subpixelScale + subpixelScale / 2;
+  long long sx1 = (long long)x1 * subpixelScale + subpixelScale / 2;
+  long long sy1 = (long long)y1 * subpixelScale + subpixelScale / 2;
+  long long a = t.edgeA[edge];
+  long long b = t.edgeB[edge];
+  long long minE = t.edgeC[edge] + (a > 0 ? a * sx0 : a * sx1) + (b > 0 ? b * sy0 : b * sy1);
+  long long maxE = t.edgeC[edge] + (a > 0 ? a * sx1 : a * sx0) + (b > 0 ? b * sy1 : b * sy0);
+  if (maxE < 0)
+    return -1;
+  return minE >= 0 ? 1 : 0;
+}
+
+// Sets up a triangle and bins it. Returns false if it's culled.
+bool setupTriangle(const Frame& frame, const ClipVertex& v0, const ClipVertex& v1, const ClipVertex& v2,
+    const Material* material, SetupBatch& batch)
+{
+  const ClipVertex* v[3] = { &v0, &v1, &v2 };
+  SetupTriangle t;
+  long long x[3];
+  long long y[3];
+  float depth[3];
+  for (int i = 0; i < 3; i++) {
+    float invW = 1.0f / v[i]->clip[3];
+    float windowX = (v[i]->clip[0] * invW + 1.0f) * 0.5f * frame.width;
+    float windowY = (v[i]->clip[1] * invW + 1.0f) * 0.5f * frame.height;
+    x[i] = (long long)floorf(windowX * subpixelScale + 0.5f);
+    y[i] = (long long)floorf(windowY * subpixelScale + 0.5f);
+    depth[i] = std::min(std::max(v[i]->clip[2] * invW * 0.5f + 0.5f, 0.0f), 1.0f);
+    t.invW[i] = invW;
+    for (int c = 0; c < 3; c++) {
+      t.view[i][c] = v[i]->view[c];
+      t.normal[i][c] = v[i]->normal[c];
+    }
+  }
+
+  // Counter-clockwise in window space (y up) is front facing
+  long long area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+  if (area <= 0)
+    return false;
+
+  long long minSX = std::min(x[0], std::min(x[1], x[2]));
+  long long maxSX = std::max(x[0], std::max(x[1], x[2]));
+  long long minSY = std::min(y[0], std::min(y[1], y[2]));
+  long long maxSY = std::max(y[0], std::max(y[1], y[2]));
+  // Pixels whose centers can be inside
+  t.minX = (int)std::max(0LL, (minSX - subpixelScale / 2 + subpixelScale - 1) >> subpixelBits);
+  t.minY = (int)std::max(0LL, (minSY - subpixelScale / 2 + subpixelScale - 1) >> subpixelBits);
+  t.maxX = (int)std::min((long long)frame.width - 1, (maxSX - subpixelScale / 2) >> subpixelBits);
+  t.maxY = (int)std::min((long long)frame.height - 1, (maxSY - subpixelScale / 2) >> subpixelBits);
+  if (t.minX > t.maxX || t.minY > t.maxY)
+    return false;
+
+  long long originSX = (long long)t.minX * subpixelScale + subpixelScale / 2;
+  long long originSY = (long long)t.minY * subpixelScale + subpixelScale / 2;
+  double weightPlane[3][3];
+  for (int i = 0; i < 3; i++) {
+    int a = (i + 1) % 3;
+    int b = (i + 2) % 3;
+    long long dx = x[b] - x[a];
+    long long dy = y[b] - y[a];
+    long long edgeA = -dy;
+    long long edgeB = dx;
+    long long edgeC = -(edgeA * x[a] + edgeB * y[a]);
+
+    // Screen-space weight of vertex i is its edge function over the area
+    weightPlane[i][0] = (double)(edgeA * subpixelScale) / area;
+    weightPlane[i][1] = (double)(edgeB * subpixelScale) / area;
+    weightPlane[i][2] = (double)(edgeA * originSX + edgeB * originSY + edgeC) / area;
+
+    // Top-left rule: samples exactly on an edge belong to the triangle only
+    // if it's a left edge (going down) or a top edge (flat, going left)
+    bool topLeft = dy < 0 || (dy == 0 && dx < 0);
+    t.edgeA[i] = (int)edgeA;
+    t.edgeB[i] = (int)edgeB;
+    t.edgeC[i] = edgeC - (topLeft ? 0 : 1);
+  }
+
+  for (int c = 0; c < 3; c++) {
+    t.weight1Plane[c] = (float)weightPlane[1][c];
+    t.weight2Plane[c] = (float)weightPlane[2][c];
+    t.depthPlane[c] = (float)(weightPlane[1][c] * (depth[1] - depth[0]) + weightPlane[2][c] * (depth[2] - depth[0]));
+  }
+  t.depthPlane[2] += depth[0];
+  t.minDepth = std::min(depth[0], std::min(depth[1], depth[2]));
+  t.material = material;
+
+  // Bin into every tile the triangle might cover
+  int index = (int)batch.triangles.size();
+  bool binned = false;
+  for (int ty = t.minY / rasterTileSize; ty <= t.maxY / rasterTileSize; ty++) {
+    for (int tx = t.minX / rasterTileSize; tx <= t.maxX / rasterTileSize; tx++) {
+      int x0 = std::max(tx * rasterTileSize, t.minX);
+      int y0 = std::max(ty * rasterTileSize, t.minY);
+      int x1 = std::min(tx * rasterTileSize + rasterTileSize - 1, t.maxX);
+      int y1 = std::min(ty * rasterTileSize + rasterTileSize - 1, t.maxY);
+      if (classifyRect(t, 0, x0, y0, x1, y1) < 0 || classifyRect(t, 1, x0, y0, x1, y1) < 0 ||
+          classifyRect(t, 2, x0, y0, x1, y1) < 0)
+        continue;
+      batch.bins[ty * frame.tilesX + tx].push_back(index);
+      binned = true;
+    }
+  }
+  if (binned)
+    batch.triangles.push_back(t);
+  return binned;
+}
+
+// Transforms, clips and sets up triangles [begin, end) of all the draws
+// together
+void setupBatch(const Frame& frame, const vector<RasterDraw>& draws, int begin, int end, SetupBatch& batch)
+{
+  batch.triangles.clear();
+  batch.bins.assign(frame.tilesX * frame.tilesY, vector<int>());
+  batch.trianglesDrawn = 0;
+
+  int drawIndex = 0;
+  int drawStart = 0;
+  for (int triangle = begin; triangle < end; triangle++) {
+    while (triangle - drawStart >= draws[drawIndex].vertexCount / 3) {
+      drawStart += draws[drawIndex].vertexCount / 3;
+      drawIndex++;
+    }
+    const RasterDraw& draw = draws[drawIndex];
+    const float* vertices = draw.vertexData + (triangle - drawStart) * 3 * floatsPerVertex;
+
+    ClipVertex polygon[maxClippedVertices];
+    for (int i = 0; i < 3; i++)
+      transformVertex(frame, vertices + i * floatsPerVertex, polygon[i]);
+    int codes[3] = { outcode(polygon[0]), outcode(polygon[1]), outcode(polygon[2]) };
+    if (codes[0] & codes[1] & codes[2])
+      continue;
+    int count = 3;
+    int planes = codes[0] | codes[1] | codes[2];
+    if (planes)
+      count = clipPolygon(polygon, count, planes);
+
+    // Fan out what's left
+    for (int i = 1; i + 1 < count; i++) {
+      if (setupTriangle(frame, polygon[0], polygon[i], polygon[i + 1], draw.material, batch))
+        batch.trianglesDrawn++;
+    }
+  }
+}
+
+// phong.frag, for one pixel
+void shadePixel(Frame& frame, const SetupTriangle& t, int px, int py)
+{
+  float dx = (float)(px - t.minX);
+  float dy = (float)(py - t.minY);
+  float weight1 = t.weight1Plane[0] * dx + t.weight1Plane[1] * dy + t.weight1Plane[2];
+  float weight2 = t.weight2Plane[0] * dx + t.weight2Plane[1] * dy + t.weight2Plane[2];
+  float weights[3] = { 1.0f - weight1 - weight2, weight1, weight2 };
+
+  // Perspective correct interpolation
+  float total = 0.0f;
+  for (int i = 0; i < 3; i++) {
+    weights[i] *= t.invW[i];
+    total += weights[i];
+  }
+  float position[3] = { 0.0f, 0.0f, 0.0f };
+  float normal[3] = { 0.0f, 0.0f, 0.0f };
+  for (int i = 0; i < 3; i++) {
+    float weight = weights[i] / total;
+    for (int c = 0; c < 3; c++) {
+      position[c] += weight * t.view[i][c];
+      normal[c] += weight * t.normal[i][c];
+    }
+  }
+  normalize3(normal);
+
+  const Material& material = *t.material;
+  const Light& light = sceneLight;
+  float toLight[3] = { light.position[0] - position[0], light.position[1] - position[1], light.position[2] - position[2] };
+  normalize3(toLight);
+  float diffuseC = dot3(normal, toLight);
+
+  float specularScale = 0.0f;
+  if (diffuseC >= 0.0f) {
+    float incident[3] = { -toLight[0], -toLight[1], -toLight[2] };
+    float d = 2.0f * dot3(normal, incident);
+    float reflection[3] = { incident[0] - d * normal[0], incident[1] - d * normal[1], incident[2] - d * normal[2] };
+    normalize3(reflection);
+    float toEye[3] = { -position[0], -position[1], -position[2] };
+    normalize3(toEye);
+    float specPreExp = dot3(reflection, toEye);
+    if (specPreExp > 0.0f)
+      specularScale = powf(specPreExp, material.shininess);
+  }
+
+  int pixel = py * frame.width + px;
+  GBuffer& gbuffer = *frame.gbuffer;
+  for (int c = 0; c < 3; c++) {
+    float color = light.ambient[c] * material.ambient[c] + std::max(0.0f, diffuseC) * material.diffuse[c] * light.diffuse[c] +
+        specularScale * light.specular[c] * material.specular[c];
+    // Both targets are 8 bits a channel
+    gbuffer.color[pixel * 3 + c] = roundToByte(color);
+    if (frame.writeNormals)
+      gbuffer.normals[pixel * 3 + c] = roundToByte(0.5f * (normal[c] + 1.0f));
+  }
+}
+
+// Depth tests and shades the pixels of one block [bx0, bx0 + 8) x
+// [by0, by0 + 8) the triangle covers. Edges set in "partialEdges" need
+// testing; the others cover the whole block.
+bool rasterizeBlock(Frame& frame, const SetupTriangle& t, int bx0, int by0, int partialEdges, TileCounters& counters)
+{
+  int blockWidth = std::min(rasterBlockSize, frame.width - bx0);
+  int blockHeight = std::min(rasterBlockSize, frame.height - by0);
+  float* depthBuffer = &frame.gbuffer->depth[0];
+
+  // Edge values at the block's first sample, and their steps per pixel.
+  // Only partly covered edges get here, so they're small.
+  int edgeCount = 0;
+  int edgeStart[3];
+  int edgeStepX[3];
+  int edgeStepY[3];
+  for (int i = 0; i < 3; i++) {
+    if (!(partialEdges & (1 << i)))
+      continue;
+    long long sx = (long long)bx0 * subpixelScale + subpixelScale / 2;
+    long long sy = (long long)by0 * subpixelScale + subpixelScale / 2;
+    edgeStart[edgeCount] = (int)(t.edgeA[i] * sx + t.edgeB[i] * sy + t.edgeC[i]);
+    edgeStepX[edgeCount] = t.edgeA[i] * subpixelScale;
+    edgeStepY[edgeCount] = t.edgeB[i] * subpixelScale;
+    edgeCount++;
+  }
+  float depthStart = t.depthPlane[0] * (bx0 - t.minX) + t.depthPlane[1] * (by0 - t.minY) + t.depthPlane[2];
+
+  bool wrote = false;
+#if SP_RASTERIZER_SSE
+  __m128i edgeRow[3];
+  __m128i edgeQuadStep[3];
+  __m128i edgeRowStep[3];
+  for (int e = 0; e < edgeCount; e++) {
+    edgeRow[e] = _mm_add_epi32(_mm_set1_epi32(edgeStart[e]),
+        _mm_set_epi32(3 * edgeStepX[e], 2 * edgeStepX[e], edgeStepX[e], 0));
+    edgeQuadStep[e] = _mm_set1_epi32(4 * edgeStepX[e]);
+    edgeRowStep[e] = _mm_set1_epi32(edgeStepY[e]);
+  }
+  const float depthStepX = t.depthPlane[0];
+  __m128 depthRow = _mm_add_ps(_mm_set1_ps(depthStart), _mm_set_ps(3 * depthStepX, 2 * depthStepX, depthStepX, 0.0f));
+  const __m128 depthQuadStep = _mm_set1_ps(4 * depthStepX);
+  const __m128 depthRowStep = _mm_set1_ps(t.depthPlane[1]);
+  const __m128i minusOne = _mm_set1_epi32(-1);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+
+  for (int row = 0; row < blockHeight; row++) {
+    int py = by0 + row;
+    for (int quad = 0; quad * 4 < blockWidth; quad++) {
+      __m128i covered = minusOne;
+      for (int e = 0; e < edgeCount; e++) {
+        __m128i value = quad ? _mm_add_epi32(edgeRow[e], edgeQuadStep[e]) : edgeRow[e];
+        covered = _mm_and_si128(covered, _mm_cmpgt_epi32(value, minusOne));
+      }
+      int coveredBits = _mm_movemask_ps(_mm_castsi128_ps(covered));
+      // Past the right of the screen
+      if (blockWidth - quad * 4 < 4)
+        coveredBits &= (1 << (blockWidth - quad * 4)) - 1;
+      if (!coveredBits)
+        continue;
+
+      __m128 depth = quad ? _mm_add_ps(depthRow, depthQuadStep) : depthRow;
+      depth = _mm_min_ps(_mm_max_ps(depth, zero), one);
+      float* stored = depthBuffer + py * frame.width + bx0 + quad * 4;
+      int passBits;
+      if (coveredBits == 0xf || blockWidth - quad * 4 >= 4) {
+        __m128 old = _mm_loadu_ps(stored);
+        __m128 pass = _mm_and_ps(_mm_castsi128_ps(covered), _mm_cmplt_ps(depth, old));
+        passBits = _mm_movemask_ps(pass) & coveredBits;
+        if (passBits)
+          _mm_storeu_ps(stored, _mm_or_ps(_mm_and_ps(pass, depth), _mm_andnot_ps(pass, old)));
+      }
+      else {
+        // Don't touch memory past the screen's edge
+        float depths[4];
+        _mm_storeu_ps(depths, depth);
+        passBits = 0;
+        for (int lane = 0; lane < 4; lane++) {
+          if ((coveredBits & (1 << lane)) && depths[lane] < stored[lane]) {
+            stored[lane] = depths[lane];
+            passBits |= 1 << lane;
+          }
+        }
+      }
+
+      for (int lane = 0; lane < 4; lane++) {
+        if (passBits & (1 << lane)) {
+          shadePixel(frame, t, bx0 + quad * 4 + lane, py);
+          counters.pixelsShaded++;
+          wrote = true;
+        }
+      }
+    }
+    for (int e = 0; e < edgeCount; e++)
+      edgeRow[e] = _mm_add_epi32(edgeRow[e], edgeRowStep[e]);
+    depthRow = _mm_add_ps(depthRow, depthRowStep);
+  }
+#else
+  for (int row = 0; row < blockHeight; row++) {
+    int py = by0 + row;
+    for (int column = 0; column < blockWidth; column++) {
+      bool covered = true;
+      for (int e = 0; e < edgeCount && covered; e++)
+        covered = edgeStart[e] + column * edgeStepX[e] + row * edgeStepY[e] >= 0;
+      if (!covered)
+        continue;
+      float depth = depthStart + t.depthPlane[0] * column + t.depthPlane[1] * row;
+      depth = std::min(std::max(depth, 0.0f), 1.0f);
+      float& stored = depthBuffer[py * frame.width + bx0 + column];
+      if (depth < stored) {
+        stored = depth;
+        shadePixel(frame, t, bx0 + column, py);
+        counters.pixelsShaded++;
+        wrote = true;
+      }
+    }
+  }
+#endif
+  return wrote;
+}
+
+void updateBlockMaxDepth(Frame& frame, int bx, int by)
+{
+  int x0 = bx * rasterBlockSize;
+  int y0 = by * rasterBlockSize;
+  int x1 = std::min(x0 + rasterBlockSize, frame.width);
+  int y1 = std::min(y0 + rasterBlockSize, frame.height);
+  float maxDepth = 0.0f;
+  for (int y = y0; y < y1; y++) {
+    for (int x = x0; x < x1; x++)
+      maxDepth = std::max(maxDepth, frame.gbuffer->depth[y * frame.width + x]);
+  }
+  frame.blockMaxDepth[by * frame.blocksX + bx] = maxDepth;
+}
+
+void rasterizeTriangle(Frame& frame, const SetupTriangle& t, int tileX0, int tileY0, int tileX1, int tileY1,
+    TileCounters& counters)
+{
+  int x0 = std::max(t.minX, tileX0);
+  int y0 = std::max(t.minY, tileY0);
+  int x1 = std::min(t.maxX, tileX1);
+  int y1 = std::min(t.maxY, tileY1);
+  for (int by = y0 / rasterBlockSize; by <= y1 / rasterBlockSize; by++) {
+    for (int bx = x0 / rasterBlockSize; bx <= x1 / rasterBlockSize; bx++) {
+      // Behind everything already in the block
+      if (t.minDepth >= frame.blockMaxDepth[by * frame.blocksX + bx]) {
+        counters.blocksCulled++;
+        continue;
+      }
+
+      int bx0 = bx * rasterBlockSize;
+      int by0 = by * rasterBlockSize;
+      int partialEdges = 0;
+      bool outside = false;
+      for (int i = 0; i < 3 && !outside; i++) {
+        int where = classifyRect(t, i, bx0, by0, bx0 + rasterBlockSize - 1, by0 + rasterBlockSize - 1);
+        if (where < 0)
+          outside = true;
+        else if (where == 0)
+          partialEdges |= 1 << i;
+      }
+      if (outside)
+        continue;
+
+      counters.blocksRasterized++;
+      if (rasterizeBlock(frame, t, bx0, by0, partialEdges, counters))
+        updateBlockMaxDepth(frame, bx, by);
+    }
+  }
+}
+
+void rasterizeTile(Frame& frame, const vector<SetupBatch>& batches, int tile, TileCounters& counters)
+{
+  int tileX0 = (tile % frame.tilesX) * rasterTileSize;
+  int tileY0 = (tile / frame.tilesX) * rasterTileSize;
+  int tileX1 = std::min(tileX0 + rasterTileSize, frame.width) - 1;
+  int tileY1 = std::min(tileY0 + rasterTileSize, frame.height) - 1;
+
+  // Clear the tile's part of every buffer
+  GBuffer& gbuffer = *frame.gbuffer;
+  for (int y = tileY0; y <= tileY1; y++) {
+    int rowStart = y * frame.width + tileX0;
+    int rowLength = tileX1 - tileX0 + 1;
+    std::fill(&gbuffer.depth[rowStart], &gbuffer.depth[rowStart] + rowLength, 1.0f);
+    std::fill(&gbuffer.color[rowStart * 3], &gbuffer.color[rowStart * 3] + rowLength * 3, 0.0f);
+    if (frame.writeNormals)
+      std::fill(&gbuffer.normals[rowStart * 3], &gbuffer.normals[rowStart * 3] + rowLength * 3, 0.0f);
+  }
+  for (int by = tileY0 / rasterBlockSize; by <= tileY1 / rasterBlockSize; by++) {
+    for (int bx = tileX0 / rasterBlockSize; bx <= tileX1 / rasterBlockSize; bx++)
+      frame.blockMaxDepth[by * frame.blocksX + bx] = 1.0f;
+  }
+
+  // Batches, and the triangles in them, are in draw order
+  for (size_t b = 0; b < batches.size(); b++) {
+    const vector<int>& bin = batches[b].bins[tile];
+    for (size_t i = 0; i < bin.size(); i++)
+      rasterizeTriangle(frame, batches[b].triangles[bin[i]], tileX0, tileY0, tileX1, tileY1, counters);
+  }
+}
+
+}
+
+void rasterizeGBuffer(const vector<RasterDraw>& draws, const Mat4& view, const Mat4& proj, bool writeNormals,
+    GBuffer& gbuffer, int threadCount, RasterStats* stats)
+{
+  TRACE_ZONE("rasterizeGBuffer");
+  Frame frame;
+  frame.width = gbuffer.width;
+  frame.height = gbuffer.height;
+  frame.tilesX = (frame.width + rasterTileSize - 1) / rasterTileSize;
+  frame.tilesY = (frame.height + rasterTileSize - 1) / rasterTileSize;
+  frame.blocksX = (frame.width + rasterBlockSize - 1) / rasterBlockSize;
+  int blocksY = (frame.height + rasterBlockSize - 1) / rasterBlockSize;
+  frame.mvp = proj * view;
+  frame.view = view;
+  frame.writeNormals = writeNormals;
+  frame.gbuffer = &gbuffer;
+  frame.blockMaxDepth.resize(frame.blocksX * blocksY);
+
+  int pixels = frame.width * frame.height;
+  gbuffer.depth.resize(pixels);
+  gbuffer.color.resize(pixels * 3);
+  gbuffer.normals.resize(writeNormals ? pixels * 3 : 0);
+
+  int triangleCount = 0;
+  for (size_t i = 0; i < draws.size(); i++)
+    triangleCount += draws[i].vertexCount / 3;
+
+  double start = wallClockMs();
+  vector<SetupBatch> batches((triangleCount + setupBatchSize - 1) / setupBatchSize);
+  {
+    TRACE_ZONE("setupTriangles");
+    parallelFor(triangleCount, setupBatchSize, threadCount, [&](int begin, int end) {
+      setupBatch(frame, draws, begin, end, batches[begin / setupBatchSize]);
+    });
+  }
+  double setupDone = wallClockMs();
+
+  std::atomic<long long> blocksCulled(0);
+  std::atomic<long long> blocksRasterized(0);
+  std::atomic<long long> pixelsShaded(0);
+  {
+    TRACE_ZONE("rasterizeTiles");
+    parallelFor(frame.tilesX * frame.tilesY, 1, threadCount, [&](int begin, int end) {
+      for (int tile = begin; tile < end; tile++) {
+        TileCounters counters = { 0, 0, 0 };
+        rasterizeTile(frame, batches, tile, counters);
+        blocksCulled += counters.blocksCulled;
+        blocksRasterized += counters.blocksRasterized;
+        pixelsShaded += counters.pixelsShaded;
+      }
+    });
+  }
+  double rasterDone = wallClockMs();
+
+  if (stats != NULL) {
+    stats->triangles = triangleCount;
+    stats->trianglesDrawn = 0;
+    stats->binnedTriangles = 0;
+    for (size_t b = 0; b < batches.size(); b++) {
+      stats->trianglesDrawn += batches[b].trianglesDrawn;
+      for (size_t tile = 0; tile < batches[b].bins.size(); tile++)
+        stats->binnedTriangles += batches[b].bins[tile].size();
+    }
+    stats->blocksCulled = blocksCulled;
+    stats->blocksRasterized = blocksRasterized;
+    stats->pixelsShaded = pixelsShaded;
+    stats->setupMs = setupDone - start;
+    stats->rasterMs = rasterDone - setupDone;
+  }
+}
@@ -0,0 +1,62 @@
+// File: rasterizer.h
+//
+// A software rasterizer for the G-buffer pass. It draws triangles the way
+// drawModel(true) does (back faces culled, nearest wins, lit by phong.frag)
+// into a GBuffer, without GL, so the whole frame can be rendered and the
+// occlusion checked (cpussao.h) on machines with no GPU at all.
+//
+// The screen is split into tiles. Triangles are transformed, clipped, set up
+// and sorted into the tiles they touch in parallel batches, then the tiles
+// are rasterized in parallel, each by a single thread, so the buffers need
+// no locking. Coverage is tested four pixels at a time with SSE edge
+// functions, and each 8x8 block remembers its farthest depth, so blocks a
+// triangle is entirely behind are skipped without testing a pixel.
+
+#ifndef SP_RASTERIZER_H_
+#define SP_RASTERIZER_H_
+
+#include <vector>
+
+#include "mat4.h"
+#include "scene.h"
+#include "cpussao.h"
+
+const int rasterTileSize = 64;
+const int rasterBlockSize = 8;
+
+// One draw call: triangles in the vertex format of scene.h
+struct RasterDraw
+{
+  const float* vertexData;
+  int vertexCount;
+  const Material* material;
+};
+
+// What one rasterizeGBuffer() call did
+struct RasterStats
+{
+  // Triangles given, and how many were left to draw after culling and
+  // clipping (clipping can split one into several)
+  int triangles;
+  int trianglesDrawn;
+  // Triangle/tile pairs binned
+  long long binnedTriangles;
+  // 8x8 blocks skipped because the triangle was behind everything in them,
+  // and blocks tested pixel by pixel
+  long long blocksCulled;
+  long long blocksRasterized;
+  // Pixels that passed the depth test and were shaded
+  long long pixelsShaded;
+  double setupMs;
+  double rasterMs;
+};
+
+// Clears "gbuffer", which has to have its width and height set, and draws
+// "draws" into it in order with the given view and projection, like
+// drawModel(true). Normals are only written if "writeNormals" is set;
+// otherwise gbuffer.normals is left empty. Uses "threadCount" threads (0 for
+// one per core). "stats" may be NULL.
+void rasterizeGBuffer(const std::vector<RasterDraw>& draws, const Mat4& view, const Mat4& proj, bool writeNormals,
+    GBuffer& gbuffer, int threadCount, RasterStats* stats);
+
+#endif // SP_RASTERIZER_H_
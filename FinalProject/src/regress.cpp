@@ -0,0 +1,305 @@
+// File: regress.cpp
+//
+// Checks rendering output against stored reference images, so changes that
+// are only meant to make things faster can't quietly make them look worse.
+// Renders a few fixed views, with occlusion on and off, on the CPU (see
+// cpuframe.h) and compares each with its reference in tests/reference: how
+// many pixels are off by more than a tolerance, PSNR and SSIM all have to be
+// within limits. Frames from other renderers (headless --output, say) can be
+// checked against any reference with --compare, shrunk first if they're
+// bigger than it (ctest does that for headless's frames; see
+// tests/glregress.cmake).
+//
+// Exits with 0 if everything passes and 1 otherwise.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "vec3.h"
+#include "scene.h"
+#include "kernel.h"
+#include "cpuframe.h"
+#include "image.h"
+#include "imagediff.h"
+#include "walltime.h"
+
+using std::string;
+using std::vector;
+
+// Size the views are rendered at. Small, so the whole check takes well
+// under a second.
+const int regressWidth = 256;
+const int regressHeight = 192;
+
+struct RegressView
+{
+  const char* name;
+  Vec3 eye;
+};
+
+const RegressView regressViews[] = {
+  { "front", Vec3(0.0f, 1.5f, 1.5f) },
+  { "side", Vec3(1.6f, 0.8f, 0.4f) },
+  { "close", Vec3(-0.3f, 0.3f, 0.9f) }
+};
+const int regressViewCount = sizeof(regressViews) / sizeof(regressViews[0]);
+
+// Options
+string referenceDir = "tests/reference";
+string outputDir;
+bool updateReferences = false;
+int threadCount = 0;
+int kernelSize = defaultKernelSize;
+int noiseSize = defaultNoiseSize;
+unsigned int kernelSeed = defaultKernelSeed;
+bool reconstructNormals = false;
+string compareImage;
+string compareReference;
+string heatmapPath;
+int downsampleFactor = 1;
+
+// Limits
+int tolerance = 8;
+double maxPercentOff = 0.5;
+double minPSNR = 35.0;
+double minSSIM = 0.98;
+
+void printUsage(const char* program)
+{
+  fprintf(stderr, "Usage: %s [options]\n", program);
+  fprintf(stderr, "  --reference-dir DIR    where the reference images are (default tests/reference)\n");
+  fprintf(stderr, "  --update               render the references again instead of checking against them\n");
+  fprintf(stderr, "                         (with --compare, write IMAGE as REF)\n");
+  fprintf(stderr, "  --output DIR           write each rendered view and its heatmap to DIR\n");
+  fprintf(stderr, "  --threads N            threads to render with (default: one per core)\n");
+  fprintf(stderr, "  --tolerance N          largest channel difference (of 255) not counted as off (default 8)\n");
+  fprintf(stderr, "  --max-off P            most pixels that may be off, in percent (default 0.5)\n");
+  fprintf(stderr, "  --min-psnr DB          lowest PSNR allowed (default 35)\n");
+  fprintf(stderr, "  --min-ssim S           lowest SSIM allowed (default 0.98)\n");
+  fprintf(stderr, "  --compare IMAGE REF    only compare two PPM images\n");
+  fprintf(stderr, "  --heatmap FILE         with --compare, write where they differ to FILE\n");
+  fprintf(stderr, "  --downsample N         with --compare, shrink IMAGE N times each way first\n");
+  fprintf(stderr, "  --kernel-size N, --noise-size N, --seed N, --reconstruct-normals\n");
+  fprintf(stderr, "                         render with other occlusion settings than the references\n");
+  fprintf(stderr, "                         (kernel size %d-%d, noise size 1-%d)\n", minKernelSize, maxKernelSize,
+      maxNoiseSize);
+}
+
+void parseArguments(int argc, char* argv[])
+{
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--reference-dir") == 0 && i + 1 < argc) {
+      referenceDir = argv[++i];
+    }
+    else if (strcmp(argv[i], "--update") == 0) {
+      updateReferences = true;
+    }
+    else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+      outputDir = argv[++i];
+    }
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threadCount = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+      tolerance = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--max-off") == 0 && i + 1 < argc) {
+      maxPercentOff = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--min-psnr") == 0 && i + 1 < argc) {
+      minPSNR = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--min-ssim") == 0 && i + 1 < argc) {
+      minSSIM = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--compare") == 0 && i + 2 < argc) {
+      compareImage = argv[++i];
+      compareReference = argv[++i];
+    }
+    else if (strcmp(argv[i], "--heatmap") == 0 && i + 1 < argc) {
+      heatmapPath = argv[++i];
+    }
+    else if (strcmp(argv[i], "--downsample") == 0 && i + 1 < argc) {
+      downsampleFactor = atoi(argv[++i]);
+      if (downsampleFactor < 1)
+        downsampleFactor = 1;
+    }
+    else if (strcmp(argv[i], "--kernel-size") == 0 && i + 1 < argc) {
+      kernelSize = atoi(argv[++i]);
+      if (kernelSize < minKernelSize)
+        kernelSize = minKernelSize;
+      if (kernelSize > maxKernelSize)
+        kernelSize = maxKernelSize;
+    }
+    else if (strcmp(argv[i], "--noise-size") == 0 && i + 1 < argc) {
+      noiseSize = atoi(argv[++i]);
+      if (noiseSize < 1)
+        noiseSize = 1;
+      if (noiseSize > maxNoiseSize)
+        noiseSize = maxNoiseSize;
+    }
+    else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      kernelSeed = (unsigned int)strtoul(argv[++i], NULL, 10);
+    }
+    else if (strcmp(argv[i], "--reconstruct-normals") == 0) {
+      reconstructNormals = true;
+    }
+    else {
+      fprintf(stderr, "Unknown argument %s\n", argv[i]);
+      printUsage(argv[0]);
+      exit(1);
+    }
+  }
+}
+
+void writeImage(const string& path, const vector<unsigned char>& pixels, int width, int height)
+{
+  if (!writePPM(path.c_str(), &pixels[0], width, height, false)) {
+    fprintf(stderr, "Couldn't write %s\n", path.c_str());
+    exit(1);
+  }
+}
+
+// Compares "image" with "reference", prints the result on one line after
+// "label" and writes a heatmap to "heatmapFile" unless it's empty. Returns
+// whether it's within the limits.
+bool checkImage(const char* label, const vector<unsigned char>& image, const vector<unsigned char>& reference,
+    int width, int height, const string& heatmapFile)
+{
+  ImageDifference difference = compareImages(image, reference, width, height, tolerance);
+  double percentOff = 100.0 * difference.fractionOver;
+  bool pass = percentOff <= maxPercentOff && difference.psnr >= minPSNR && difference.ssim >= minSSIM;
+
+  char psnr[16];
+  if (std::isinf(difference.psnr))
+    strcpy(psnr, "inf");
+  else
+    sprintf(psnr, "%.2f", difference.psnr);
+  printf("%-14s max %3d/255  off %6.3f%%  PSNR %6s dB  SSIM %.5f  %s\n", label, difference.maxDifference, percentOff,
+      psnr, difference.ssim, pass ? "pass" : "FAIL");
+
+  if (!heatmapFile.empty()) {
+    vector<unsigned char> heatmap;
+    differenceHeatmap(image, reference, width, height, tolerance, heatmap);
+    writeImage(heatmapFile, heatmap, width, height);
+  }
+  return pass;
+}
+
+bool readImage(const string& path, vector<unsigned char>& pixels, int& width, int& height)
+{
+  if (!readPPM(path.c_str(), pixels, width, height)) {
+    fprintf(stderr, "Couldn't read %s\n", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Compares the two --compare images, or with --update makes the first one
+// the reference
+int compareFiles()
+{
+  vector<unsigned char> image, reference;
+  int width, height, referenceWidth, referenceHeight;
+  if (!readImage(compareImage, image, width, height))
+    return 1;
+  if (downsampleFactor > 1) {
+    vector<unsigned char> full;
+    full.swap(image);
+    downsampleImage(full, width, height, downsampleFactor, image);
+    width /= downsampleFactor;
+    height /= downsampleFactor;
+  }
+  if (updateReferences) {
+    writeImage(compareReference, image, width, height);
+    printf("Wrote %s\n", compareReference.c_str());
+    return 0;
+  }
+  if (!readImage(compareReference, reference, referenceWidth, referenceHeight))
+    return 1;
+  if (width != referenceWidth || height != referenceHeight) {
+    printf("%s is %dx%d but %s is %dx%d: FAIL\n", compareImage.c_str(), width, height, compareReference.c_str(),
+        referenceWidth, referenceHeight);
+    return 1;
+  }
+  return checkImage("image", image, reference, width, height, heatmapPath) ? 0 : 1;
+}
+
+// Renders every view in both modes and checks them, or writes them as the
+// new references
+int checkViews()
+{
+  vector<float> modelData;
+  if (!loadModelMesh(modelPath, modelData)) {
+    fprintf(stderr, "Couldn't load %s\n", modelPath);
+    return 1;
+  }
+  vector<RasterDraw> draws;
+  sceneDraws(modelData, draws);
+  SSAOSettings settings;
+  cpuOcclusionSettings(kernelSize, noiseSize, kernelSeed, reconstructNormals, settings);
+
+  GBuffer gbuffer;
+  gbuffer.width = regressWidth;
+  gbuffer.height = regressHeight;
+  vector<unsigned char> pixels;
+  vector<unsigned char> topDown(regressWidth * regressHeight * 3);
+  int failures = 0;
+  double start = wallClockMs();
+
+  for (int view = 0; view < regressViewCount; view++) {
+    for (int ao = 0; ao < 2; ao++) {
+      string name = string(regressViews[view].name) + (ao ? "_ao" : "_noao");
+      renderFrameCPU(draws, ao ? &settings : NULL, regressViews[view].eye, Vec3(0, 0, 0), threadCount, gbuffer,
+          pixels, NULL, NULL);
+      // Images on disk have their top row first
+      int rowBytes = regressWidth * 3;
+      for (int y = 0; y < regressHeight; y++)
+        memcpy(&topDown[y * rowBytes], &pixels[(regressHeight - 1 - y) * rowBytes], rowBytes);
+
+      string referencePath = referenceDir + "/" + name + ".ppm";
+      if (updateReferences) {
+        writeImage(referencePath, topDown, regressWidth, regressHeight);
+        printf("Wrote %s\n", referencePath.c_str());
+        continue;
+      }
+
+      if (!outputDir.empty())
+        writeImage(outputDir + "/" + name + ".ppm", topDown, regressWidth, regressHeight);
+      vector<unsigned char> reference;
+      int width, height;
+      if (!readImage(referencePath, reference, width, height)) {
+        failures++;
+        continue;
+      }
+      if (width != regressWidth || height != regressHeight) {
+        printf("%-14s reference is %dx%d, not %dx%d  FAIL\n", name.c_str(), width, height, regressWidth,
+            regressHeight);
+        failures++;
+        continue;
+      }
+      string heatmapFile = outputDir.empty() ? "" : outputDir + "/" + name + "_diff.ppm";
+      if (!checkImage(name.c_str(), topDown, reference, regressWidth, regressHeight, heatmapFile))
+        failures++;
+    }
+  }
+
+  if (!updateReferences) {
+    printf("%d of %d images within limits (%.0f ms).\n", regressViewCount * 2 - failures, regressViewCount * 2,
+        wallClockMs() - start);
+  }
+  return failures == 0 ? 0 : 1;
+}
+
+// entry point
+int main(int argc, char* argv[])
+{
+  parseArguments(argc, argv);
+  if (!compareImage.empty())
+    return compareFiles();
+  return checkViews();
+}
@@ -0,0 +1,1948 @@
+// File: render.cpp
+//
+// OpenGL state, model loading and the drawing passes: the G-buffer pass, the
+// ambient occlusion variants, temporal accumulation and the final blur.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "GL/glew.h"
+
+#include "render.h"
+#include "vec3.h"
+#include "mat4.h"
+#include "shaders.h"
+#include "kernel.h"
+#include "scene.h"
+#include "bvh.h"
+#include "meshlet.h"
+#include "gpucull.h"
+#include "streaming.h"
+#include "framering.h"
+#include "parallel.h"
+#include "cpussao.h"
+#include "walltime.h"
+#include "gputimer.h"
+#include "trace.h"
+
+using std::string;
+using std::vector;
+
+void spinInstances();
+void updateStreaming();
+void finishLoading();
+void drawModel(bool ssao);
+void cullClusters(const Mat4& viewProj);
+void doSSAO();
+void doDeinterleavedSSAO();
+void doComputeSSAO();
+void doTemporalAccumulation();
+void doBlur();
+void sceneMatrices(Mat4& view, Mat4& proj);
+void frameKernel(int frame, vector<GLfloat>& sampleOffsets, float& angle, int& noiseShiftX, int& noiseShiftY);
+
+// the camera info
+Vec3 eye;
+Vec3 lookat;
+
+GLuint outputFramebuffer = 0;
+
+// Shader programs and attrib/uniform locations
+GLuint phongProg;
+GLint phongProgPosAttrib;
+GLint phongProgNormAttrib;
+GLint phongProgInstanceRowAttribs[3];
+GLint phongProgModelViewMat;
+GLint phongProgMvpMat;
+GLint phongProgNormalMat;
+GLint phongProgLAmb;
+GLint phongProgLPos;
+GLint phongProgLDif;
+GLint phongProgLSpc;
+GLint phongProgKAmb;
+GLint phongProgKDif;
+GLint phongProgKSpc;
+GLint phongProgKShn;
+GLint phongProgDoSSAO;
+// The FrameData uniform block, GL_INVALID_INDEX when the shaders were
+// compiled without uniform buffers and take plain uniforms instead
+GLuint phongProgFrameBlock;
+
+GLuint aoProg;
+GLint aoProgPosAttrib;
+GLint aoProgDepthTexture;
+GLint aoProgNormTexture;
+GLint aoProgRandomTexture;
+GLint aoProgProjMat;
+GLint aoProgInvProjMat;
+GLint aoProgSampleOffsets;
+GLint aoProgSampleRadius;
+GLint aoProgRandomTexCoordScale;
+GLint aoProgRandomTexOffset;
+GLint aoProgSampleCount;
+GLint aoProgFrameAngle;
+GLint aoProgReconstructNormals;
+GLint aoProgInvRes;
+
+GLuint deinterleaveProg;
+GLint deinterleaveProgPosAttrib;
+GLint deinterleaveProgDepthTexture;
+GLint deinterleaveProgNormTexture;
+GLint deinterleaveProgLayerOffset;
+GLint deinterleaveProgReconstructNormals;
+GLint deinterleaveProgInvProjMat;
+
+GLuint aoLayerProg;
+GLint aoLayerProgPosAttrib;
+GLint aoLayerProgDepthTexture;
+GLint aoLayerProgNormTexture;
+GLint aoLayerProgLayer;
+GLint aoLayerProgLayerOffset;
+GLint aoLayerProgFullRes;
+GLint aoLayerProgRandomVector;
+GLint aoLayerProgProjMat;
+GLint aoLayerProgInvProjMat;
+GLint aoLayerProgSampleOffsets;
+GLint aoLayerProgSampleRadius;
+GLint aoLayerProgSampleCount;
+GLint aoLayerProgFrameAngle;
+
+GLuint reinterleaveProg;
+GLint reinterleaveProgPosAttrib;
+GLint reinterleaveProgAoTexture;
+
+GLuint aoComputeProg;
+GLint aoComputeProgDepthTexture;
+GLint aoComputeProgNormTexture;
+GLint aoComputeProgRandomTexture;
+GLint aoComputeProgColorTexture;
+GLint aoComputeProgRandomTexOffset;
+GLint aoComputeProgProjMat;
+GLint aoComputeProgInvProjMat;
+GLint aoComputeProgSampleOffsets;
+GLint aoComputeProgSampleRadius;
+GLint aoComputeProgSampleCount;
+GLint aoComputeProgFrameAngle;
+GLint aoComputeProgReconstructNormals;
+
+GLuint temporalProg;
+GLint temporalProgPosAttrib;
+GLint temporalProgAoTexture;
+GLint temporalProgDepthTexture;
+GLint temporalProgHistoryTexture;
+GLint temporalProgInvProjMat;
+GLint temporalProgInvViewMat;
+GLint temporalProgPrevViewProjMat;
+GLint temporalProgHistoryValid;
+GLint temporalProgMaxHistoryLength;
+GLint temporalProgDepthRejectThreshold;
+
+GLuint blurProg;
+GLint blurProgPosAttrib;
+GLint blurProgAoTexture;
+GLint blurProgColorTexture;
+GLint blurProgInvRes;
+
+GLuint floorBuf;
+
+// What's drawn: the meshes, the instances of each, and where they come from
+SceneDescription scene;
+string sceneFile;
+int sceneInstanceCount;
+// How many instances, from the first, turn a little every frame
+int spinningInstances;
+
+// One draw of a mesh's vertices per frame, for all of its visible instances
+// at once, which take up instanceCount transforms of instanceBuf from
+// firstInstance on. A mesh has a batch for each level of detail, finest
+// first, and each level's meshlets are meshletCount of sceneMeshlets from
+// firstMeshlet on. The floor is the last batch, with one instance.
+struct DrawBatch
+{
+  // -1 for the floor
+  int mesh;
+  int lod;
+  // How far this level's surface may be from the full mesh's (model units)
+  float lodError;
+  GLuint buffer;
+  GLint firstVertex;
+  GLsizei vertexCount;
+  int firstMeshlet;
+  int meshletCount;
+  const Material* material;
+  int firstInstance;
+  int instanceCount;
+};
+vector<DrawBatch> drawBatches;
+// The batch each mesh's finest level is drawn by, or -1 if it has no
+// instances or hasn't been loaded yet, how many levels it has, and how many
+// instances
+vector<int> meshBatches;
+vector<int> meshLODCounts;
+vector<int> meshInstanceCounts;
+// Where each mesh's levels go in sceneVertexBuf, and how many vertices they
+// can take up there
+vector<GLint> meshFirstVertex;
+vector<long long> meshVertexCapacity;
+// Set once every mesh has streamed in
+bool sceneLoaded;
+// Bytes the loader can upload a frame
+float uploadBudgetMB;
+// Every mesh's vertices, one after another, so GPU culling can draw them all
+// with one call
+GLuint sceneVertexBuf;
+// The batch of each instance's mesh's finest level, or -1 until the mesh is
+// loaded, and how many levels it has
+vector<int> instanceBatches;
+vector<int> instanceLODCounts;
+
+// Every instance's transform, as its top three rows (12 floats), and its
+// world-space bounds, which the BVH is built over
+const int floatsPerInstance = 12;
+vector<GLfloat> instanceTransforms;
+GLfloat floorTransform[floatsPerInstance];
+vector<AABB> meshBounds;
+vector<AABB> instanceBounds;
+InstanceBVH sceneBVH;
+// Only draw the instances in view
+bool cullingEnabled;
+vector<int> visibleInstances;
+// The batch each visible instance is drawn by
+vector<int> visibleBatches;
+// Cull on the GPU and draw with one indirect call, only usable with GL 4.3
+bool gpuCullingSupported;
+int gpuCullingState;
+
+// Cull each visible instance's meshlets against the frustum and by their
+// normal cones, and draw what's left with one indirect call (GL 4.3)
+vector<Meshlet> sceneMeshlets;
+string meshletCacheDir;
+bool clusterCullingSupported;
+int clusterCullingState;
+// As glMultiDrawArraysIndirect() reads them
+struct DrawArraysCommand
+{
+  GLuint count;
+  GLuint instanceCount;
+  GLuint first;
+  GLuint baseInstance;
+};
+vector<DrawArraysCommand> clusterCommands;
+long long clusterTriangles;
+GLuint clusterCommandBuf;
+// Meshlets are culled clusterCullSlots instances at a time, each lot
+// possibly on another thread, and put together in order after
+const int clusterCullSlots = 64;
+struct ClusterCullChunk
+{
+  vector<MeshletRun> runs;
+  vector<DrawArraysCommand> commands;
+  MeshletCullStats stats;
+  long long triangles;
+};
+vector<ClusterCullChunk> clusterChunks;
+// The batch each slot of instanceData is drawn by
+vector<int> slotBatches;
+
+// Draw each instance at the coarsest level of detail whose error covers at
+// most lodPixelError pixels. Levels are only built if this is on at load.
+const int maxLODLevels = 8;
+int lodState;
+float lodPixelError;
+bool lodsBuilt;
+// Pixels a unit spans at a distance of one, with sceneMatrices()' 90 degree
+// vertical field of view
+const float lodPixelsPerUnit = wHeight * 0.5f;
+
+// The transforms of the instances drawn this frame, grouped by mesh, as
+// instanceBuf holds them. Kept here too for drawing one instance at a time
+// without instancing.
+vector<GLfloat> instanceData;
+GLuint instanceBuf;
+// Where this frame's instanceData and clusterCommands went: the frame ring,
+// or instanceBuf and clusterCommandBuf when it isn't mapped or they didn't fit
+GLuint frameInstanceBuf;
+GLintptr frameInstanceOffset;
+GLuint frameCommandBuf;
+GLintptr frameCommandOffset;
+
+// The phong shaders' FrameData block, laid out std140
+struct FrameUniforms
+{
+  GLfloat modelViewMat[16];
+  GLfloat modelViewProjMat[16];
+  GLfloat normalMat[16];
+  // vec3s, each padded to four floats
+  GLfloat lAmbient[4];
+  GLfloat lPosition[4];
+  GLfloat lDiffuse[4];
+  GLfloat lSpecular[4];
+};
+const GLuint frameUniformBinding = 0;
+// The frame ring binds its buffer to GL_COPY_WRITE_BUFFER, core in GL 3.1
+bool frameRingSupported;
+// GL 3.1 or ARB_uniform_buffer_object, which the phong shaders use when the
+// driver has it
+bool uniformBuffersSupported;
+GLint uniformOffsetAlignment;
+// For the uniforms when they don't go in the ring
+GLuint frameUniformBuf;
+// glDrawArraysInstanced() and glVertexAttribDivisor(), core in GL 3.3
+bool instancingSupported;
+
+SceneDrawStats lastDrawStats;
+
+// Program functionality variables
+// Shading related
+int ambientOcclusionState;
+float depthDiscontinuityRadius;
+// Deinterleaved AO related
+int deinterleavedAOState;
+// Compute shader AO related, only usable with GL 4.3
+bool computeAOSupported;
+int computeAOState;
+// Temporal AO related
+int temporalAOState;
+int temporalSamplesPerFrame;
+float temporalMaxHistoryLength;
+float temporalDepthRejectThreshold;
+
+// Counts frames drawn, drives the per-frame kernel/noise rotation
+int frameNum = 0;
+
+double beginPass(RenderPass pass);
+void endPass(RenderPass pass, double start);
+
+bool finishEachPass = false;
+double lastPassMs[passCount];
+
+// Reconstruct normals from depth instead of writing a normal G-buffer target
+int reconstructNormalsState;
+
+// Framebuffers, textures to render to, renderbuffers, other textures
+GLuint framebuffer;
+GLuint depthTexture;
+GLuint colorTexture;
+GLuint normalTexture;
+GLuint aoTexture;
+GLuint depthRenderbuffer;
+GLuint randomTexture;
+
+// Two accumulated AO histories, written alternately. Each holds
+// (occlusion, frames accumulated, view depth).
+GLuint aoHistoryTextures[2];
+int aoHistoryCurrent;
+bool aoHistoryValid;
+// View-projection of the last frame drawn, for reprojecting the history
+Mat4 prevViewProj;
+
+// Quarter resolution copies of depth, normals and occlusion, one layer per
+// pixel of each 4x4 block
+const static int deinterleaveFactor = 4;
+const static int deinterleavedLayers = deinterleaveFactor * deinterleaveFactor;
+GLuint deinterleavedDepthTexture;
+GLuint deinterleavedNormalTexture;
+GLuint deinterleavedAoTexture;
+
+// Final, blurred and shaded image written by the compute shader path
+GLuint aoComputeOutputTexture;
+
+// Sample kernel and random rotation texture, both generated at startup.
+// Rotation directions are already scaled and biased from [-1, 1] to [0, 1].
+int kernelSize;
+int noiseSize;
+unsigned int kernelSeed;
+vector<GLfloat> kernelOffsets;
+vector<GLfloat> randomDirections;
+
+// draw the scene
+void renderFrame()
+{
+  TRACE_ZONE("renderFrame");
+  updateStreaming();
+  spinInstances();
+  if (frameRingSupported)
+    beginFrameRing();
+  GLenum error = glGetError();
+  if (error != GL_NO_ERROR)
+  {
+    fprintf(stderr, "gl error\n");
+  }
+  glClearColor(0, 0, 0, 0);
+
+  // Also collects pass timings from earlier frames, if they're ready
+  beginGpuFrame();
+
+  for (int pass = 0; pass < passCount; pass++)
+    lastPassMs[pass] = -1.0;
+
+  // If we're rendering with ambient occlusion
+  if (ambientOcclusionState) {
+    double passStart = beginPass(passScene);
+    drawModel(true);
+    endPass(passScene, passStart);
+
+    // The compute path blurs in the same dispatch, so there's no separate
+    // occlusion texture for temporal accumulation to work on
+    bool useCompute = computeAOState && !temporalAOState;
+    passStart = beginPass(passOcclusion);
+    if (useCompute)
+      doComputeSSAO();
+    else if (deinterleavedAOState)
+      doDeinterleavedSSAO();
+    else
+      doSSAO();
+    endPass(passOcclusion, passStart);
+    if (!useCompute) {
+      if (temporalAOState) {
+        passStart = beginPass(passTemporal);
+        doTemporalAccumulation();
+        endPass(passTemporal, passStart);
+      }
+      passStart = beginPass(passBlur);
+      doBlur();
+      endPass(passBlur, passStart);
+    }
+  }
+  else {
+    double passStart = beginPass(passScene);
+    glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+    glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+    drawModel(false);
+    endPass(passScene, passStart);
+  }
+
+  endGpuFrame();
+  if (frameRingSupported)
+    endFrameRing();
+
+  Mat4 view, proj;
+  sceneMatrices(view, proj);
+  prevViewProj = proj * view;
+
+  frameNum++;
+  //printf("%d\n", frameNum);
+}
+
+// ----------------- INITIALIZATION FUNCTIONS -------------- //
+void setupState()
+{
+  ambientOcclusionState = 0;
+  depthDiscontinuityRadius = defaultSampleRadius;
+  deinterleavedAOState = 0;
+  computeAOSupported = false;
+  computeAOState = 1;
+  reconstructNormalsState = 0;
+  temporalAOState = 0;
+  temporalSamplesPerFrame = 4;
+  temporalMaxHistoryLength = 16.0f;
+  temporalDepthRejectThreshold = 0.02f;
+  aoHistoryCurrent = 0;
+  aoHistoryValid = false;
+  kernelSize = defaultKernelSize;
+  noiseSize = defaultNoiseSize;
+  kernelSeed = defaultKernelSeed;
+  sceneFile.clear();
+  sceneInstanceCount = 0;
+  spinningInstances = 0;
+  cullingEnabled = true;
+  gpuCullingSupported = false;
+  gpuCullingState = 0;
+  clusterCullingSupported = false;
+  clusterCullingState = 0;
+  const char* temp = getenv("TMPDIR");
+  if (temp == NULL || temp[0] == '\0')
+    temp = getenv("TEMP");
+  meshletCacheDir = temp != NULL && temp[0] != '\0' ? temp : "/tmp";
+  lodState = 1;
+  lodPixelError = 1.0f;
+  lodsBuilt = false;
+  uploadBudgetMB = 4.0f;
+  sceneLoaded = false;
+}
+
+bool parseRenderArgument(int argc, char* argv[], int& i)
+{
+  if (strcmp(argv[i], "--kernel-size") == 0 && i + 1 < argc) {
+    kernelSize = atoi(argv[++i]);
+    if (kernelSize < minKernelSize)
+      kernelSize = minKernelSize;
+    if (kernelSize > maxKernelSize)
+      kernelSize = maxKernelSize;
+  }
+  else if (strcmp(argv[i], "--noise-size") == 0 && i + 1 < argc) {
+    noiseSize = atoi(argv[++i]);
+    if (noiseSize < 1)
+      noiseSize = 1;
+    if (noiseSize > maxNoiseSize)
+      noiseSize = maxNoiseSize;
+  }
+  else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+    kernelSeed = (unsigned int)strtoul(argv[++i], NULL, 10);
+  }
+  else if (strcmp(argv[i], "--ao") == 0) {
+    ambientOcclusionState = 1;
+  }
+  else if (strcmp(argv[i], "--temporal") == 0) {
+    temporalAOState = 1;
+  }
+  else if (strcmp(argv[i], "--deinterleaved") == 0) {
+    deinterleavedAOState = 1;
+  }
+  else if (strcmp(argv[i], "--no-compute") == 0) {
+    computeAOState = 0;
+  }
+  else if (strcmp(argv[i], "--reconstruct-normals") == 0) {
+    reconstructNormalsState = 1;
+  }
+  else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc) {
+    sceneFile = argv[++i];
+  }
+  else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc) {
+    sceneInstanceCount = atoi(argv[++i]);
+    if (sceneInstanceCount < 1)
+      sceneInstanceCount = 1;
+  }
+  else if (strcmp(argv[i], "--no-cull") == 0) {
+    cullingEnabled = false;
+  }
+  else if (strcmp(argv[i], "--gpu-cull") == 0) {
+    gpuCullingState = 1;
+  }
+  else if (strcmp(argv[i], "--cluster-cull") == 0) {
+    clusterCullingState = 1;
+  }
+  else if (strcmp(argv[i], "--meshlet-cache") == 0 && i + 1 < argc) {
+    meshletCacheDir = argv[++i];
+  }
+  else if (strcmp(argv[i], "--upload-budget") == 0 && i + 1 < argc) {
+    uploadBudgetMB = (float)atof(argv[++i]);
+    if (uploadBudgetMB <= 0.0f)
+      uploadBudgetMB = 4.0f;
+  }
+  else if (strcmp(argv[i], "--no-lod") == 0) {
+    lodState = 0;
+  }
+  else if (strcmp(argv[i], "--lod-error") == 0 && i + 1 < argc) {
+    lodPixelError = (float)atof(argv[++i]);
+    if (lodPixelError <= 0.0f)
+      lodPixelError = 1.0f;
+  }
+  else if (strcmp(argv[i], "--spin") == 0 && i + 1 < argc) {
+    spinningInstances = atoi(argv[++i]);
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+void printRenderUsage()
+{
+  fprintf(stderr, "  --kernel-size 4-64     samples per pixel\n");
+  fprintf(stderr, "  --noise-size 1-64     rotation texture size\n");
+  fprintf(stderr, "  --seed S               kernel and rotation seed\n");
+  fprintf(stderr, "  --ao                   start with ambient occlusion on\n");
+  fprintf(stderr, "  --temporal             start with temporal accumulation on\n");
+  fprintf(stderr, "  --deinterleaved        start with deinterleaved occlusion on\n");
+  fprintf(stderr, "  --no-compute           don't use the compute shader path\n");
+  fprintf(stderr, "  --reconstruct-normals  start with normals rebuilt from depth\n");
+  fprintf(stderr, "  --scene FILE           draw the meshes and instances FILE lists\n");
+  fprintf(stderr, "  --instances N          draw N bunnies on a grid\n");
+  fprintf(stderr, "  --no-cull              draw every instance, not just those in view\n");
+  fprintf(stderr, "  --gpu-cull             start with culling on the GPU (needs OpenGL 4.3)\n");
+  fprintf(stderr, "  --cluster-cull         start with culling each instance's meshlets on the CPU (needs OpenGL 4.3)\n");
+  fprintf(stderr, "  --meshlet-cache DIR    where meshlets are kept between runs (default: system temp; \"\" for nowhere)\n");
+  fprintf(stderr, "  --spin N               turn the first N instances a little every frame\n");
+  fprintf(stderr, "  --upload-budget MB     most vertex data to upload a frame while meshes stream in (default 4)\n");
+  fprintf(stderr, "  --no-lod               always draw meshes at full detail (and don't build coarser levels)\n");
+  fprintf(stderr, "  --lod-error PIXELS     largest error a coarser level may show on screen (default 1)\n");
+}
+
+// Builds the sample kernel and random rotations from the current settings.
+// The same seed always gives the same kernel, so runs can be compared.
+void generateKernel()
+{
+  TRACE_ZONE("generateKernel");
+  generateSSAOKernel(kernelSize, kernelSeed, kernelOffsets);
+  generateRotationNoise(noiseSize, kernelSeed, randomDirections);
+  printf("Using a %d sample kernel, %dx%d rotation texture, seed %u.\n", kernelSize, noiseSize, noiseSize, kernelSeed);
+}
+
+void setKernelSize(int size)
+{
+  kernelSize = size;
+  generateSSAOKernel(kernelSize, kernelSeed, kernelOffsets);
+}
+
+void initializeOpenGL()
+{
+  TRACE_ZONE("initializeOpenGL");
+  // Use the compute shader path whenever the context can run it
+  computeAOSupported = GLEW_VERSION_4_3 ? true : false;
+  computeAOState = computeAOSupported && computeAOState;
+  if (computeAOState)
+    printf("OpenGL 4.3 available, using compute shader ambient occlusion.\n");
+  instancingSupported = GLEW_VERSION_3_3 ? true : false;
+  gpuCullingSupported = computeAOSupported;
+  gpuCullingState = gpuCullingSupported && gpuCullingState;
+  clusterCullingSupported = computeAOSupported;
+  clusterCullingState = clusterCullingSupported && clusterCullingState;
+  frameRingSupported = GLEW_VERSION_3_1 ? true : false;
+  if (frameRingSupported)
+    initFrameRing(1 << 20);
+  uniformBuffersSupported = GLEW_VERSION_3_1 || GLEW_ARB_uniform_buffer_object;
+  if (uniformBuffersSupported) {
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformOffsetAlignment);
+    glGenBuffers(1, &frameUniformBuf);
+  }
+
+  glEnable(GL_DEPTH_TEST);
+
+  glEnable(GL_CULL_FACE);
+  glFrontFace(GL_CCW);
+  glCullFace(GL_BACK);
+
+  // Enable and configure textures on applicable texture units
+  glActiveTexture(GL_TEXTURE0);
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  // Create our framebuffer
+  glGenFramebuffers(1, &framebuffer);
+
+  // Setup a texture to render depth to
+  glGenTextures(1, &depthTexture);
+  glBindTexture(GL_TEXTURE_2D, depthTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, wWidth, wHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  // Setup a texture to render color to
+  glGenTextures(1, &colorTexture);
+  glBindTexture(GL_TEXTURE_2D, colorTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, wWidth, wHeight, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  
+  // Setup a texture to store normals in
+  glGenTextures(1, &normalTexture);
+  glBindTexture(GL_TEXTURE_2D, normalTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, wWidth, wHeight, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  // Setup a texture to store occlusion values in
+  glGenTextures(1, &aoTexture);
+  glBindTexture(GL_TEXTURE_2D, aoTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, wWidth, wHeight, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  
+  // Setup two textures to accumulate occlusion over time in. Depth is
+  // kept alongside for rejecting stale history, so these need float precision.
+  glGenTextures(2, aoHistoryTextures);
+  for (int i = 0; i < 2; i++) {
+    glBindTexture(GL_TEXTURE_2D, aoHistoryTextures[i]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, wWidth, wHeight, 0, GL_RGBA, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  }
+
+  // Setup texture arrays for deinterleaved occlusion, one quarter res layer per
+  // pixel in each 4x4 block
+  int layerWidth = wWidth / deinterleaveFactor;
+  int layerHeight = wHeight / deinterleaveFactor;
+  glGenTextures(1, &deinterleavedDepthTexture);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, deinterleavedDepthTexture);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32F, layerWidth, layerHeight, deinterleavedLayers, 0, GL_RED, GL_FLOAT, NULL);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  glGenTextures(1, &deinterleavedNormalTexture);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, deinterleavedNormalTexture);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, layerWidth, layerHeight, deinterleavedLayers, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, NULL);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  glGenTextures(1, &deinterleavedAoTexture);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, deinterleavedAoTexture);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, layerWidth, layerHeight, deinterleavedLayers, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, NULL);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  // Setup a texture for the compute shader path to write its result to
+  if (computeAOSupported) {
+    glGenTextures(1, &aoComputeOutputTexture);
+    glBindTexture(GL_TEXTURE_2D, aoComputeOutputTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, wWidth, wHeight, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  }
+
+  initGpuTimers(passCount, renderPassNames);
+
+  // Setup a renderbuffer to use for depth
+  glGenRenderbuffers(1, &depthRenderbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, wWidth, wHeight);
+
+  // Set up a texture used to store random sample offset values
+  glGenTextures(1, &randomTexture);
+  glBindTexture(GL_TEXTURE_2D, randomTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, noiseSize, noiseSize, 0, GL_RGB, GL_FLOAT, randomDirections.data());
+  // Every pixel gets exactly one of the generated rotations
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+  // Set up buffer for floor data
+  glGenBuffers(1, &floorBuf);
+  glBindBuffer(GL_ARRAY_BUFFER, floorBuf);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(floorVertexData), floorVertexData, GL_STATIC_DRAW);
+}
+
+void loadShaders()
+{
+  TRACE_ZONE("loadShaders");
+  // Phong shaders
+  phongProg = createProgram(loadShader(GL_VERTEX_SHADER, "shaders/phong.vert"),
+      loadShader(GL_FRAGMENT_SHADER, "shaders/phong.frag"));
+  
+  phongProgPosAttrib = glGetAttribLocation(phongProg, "positionIn");
+  phongProgNormAttrib = glGetAttribLocation(phongProg, "normalIn");
+  phongProgInstanceRowAttribs[0] = glGetAttribLocation(phongProg, "instanceRow0");
+  phongProgInstanceRowAttribs[1] = glGetAttribLocation(phongProg, "instanceRow1");
+  phongProgInstanceRowAttribs[2] = glGetAttribLocation(phongProg, "instanceRow2");
+  phongProgModelViewMat = glGetUniformLocation(phongProg, "modelViewMat");
+  phongProgMvpMat = glGetUniformLocation(phongProg, "modelViewProjMat");
+  phongProgNormalMat = glGetUniformLocation(phongProg, "normalMat");
+  phongProgLAmb = glGetUniformLocation(phongProg, "lAmbient");
+  phongProgLPos = glGetUniformLocation(phongProg, "lPosition");
+  phongProgLDif = glGetUniformLocation(phongProg, "lDiffuse");
+  phongProgLSpc = glGetUniformLocation(phongProg, "lSpecular");
+  phongProgKAmb = glGetUniformLocation(phongProg, "kAmbient");
+  phongProgKDif = glGetUniformLocation(phongProg, "kDiffuse");
+  phongProgKSpc = glGetUniformLocation(phongProg, "kSpecular");
+  phongProgKShn = glGetUniformLocation(phongProg, "kShininess");
+  phongProgDoSSAO = glGetUniformLocation(phongProg, "doSSAO");
+  phongProgFrameBlock = uniformBuffersSupported ? glGetUniformBlockIndex(phongProg, "FrameData") : GL_INVALID_INDEX;
+  if (phongProgFrameBlock != GL_INVALID_INDEX)
+    glUniformBlockBinding(phongProg, phongProgFrameBlock, frameUniformBinding);
+
+  // Ambient occlusion shaders
+  aoProg = createProgram(loadShader(GL_VERTEX_SHADER, "shaders/ssao.vert"),
+      loadShader(GL_FRAGMENT_SHADER, "shaders/ssao.frag"));
+
+  aoProgPosAttrib = glGetAttribLocation(aoProg, "positionIn");
+  aoProgDepthTexture = glGetUniformLocation(aoProg, "depthTex");
+  aoProgNormTexture = glGetUniformLocation(aoProg, "normTex");
+  aoProgRandomTexture = glGetUniformLocation(aoProg, "randomTex");
+  aoProgProjMat = glGetUniformLocation(aoProg, "projMat");
+  aoProgInvProjMat = glGetUniformLocation(aoProg, "invProjMat");
+  aoProgSampleOffsets = glGetUniformLocation(aoProg, "sampleOffsets");
+  aoProgSampleRadius = glGetUniformLocation(aoProg, "sampleRadius");
+  aoProgRandomTexCoordScale = glGetUniformLocation(aoProg, "randomTexCoordScale");
+  aoProgRandomTexOffset = glGetUniformLocation(aoProg, "randomTexOffset");
+  aoProgSampleCount = glGetUniformLocation(aoProg, "sampleCount");
+  aoProgFrameAngle = glGetUniformLocation(aoProg, "frameAngle");
+  aoProgReconstructNormals = glGetUniformLocation(aoProg, "reconstructNormals");
+  aoProgInvRes = glGetUniformLocation(aoProg, "invRes");
+
+  // Deinterleaved ambient occlusion shaders
+  deinterleaveProg = createProgram(loadShader(GL_VERTEX_SHADER, "shaders/ssao.vert"),
+      loadShader(GL_FRAGMENT_SHADER, "shaders/deinterleave.frag"));
+
+  deinterleaveProgPosAttrib = glGetAttribLocation(deinterleaveProg, "positionIn");
+  deinterleaveProgDepthTexture = glGetUniformLocation(deinterleaveProg, "depthTex");
+  deinterleaveProgNormTexture = glGetUniformLocation(deinterleaveProg, "normTex");
+  deinterleaveProgLayerOffset = glGetUniformLocation(deinterleaveProg, "layerOffset");
+  deinterleaveProgReconstructNormals = glGetUniformLocation(deinterleaveProg, "reconstructNormals");
+  deinterleaveProgInvProjMat = glGetUniformLocation(deinterleaveProg, "invProjMat");
+
+  aoLayerProg = createProgram(loadShader(GL_VERTEX_SHADER, "shaders/ssao.vert"),
+      loadShader(GL_FRAGMENT_SHADER, "shaders/ssao_layer.frag"));
+
+  aoLayerProgPosAttrib = glGetAttribLocation(aoLayerProg, "positionIn");
+  aoLayerProgDepthTexture = glGetUniformLocation(aoLayerProg, "depthTex");
+  aoLayerProgNormTexture = glGetUniformLocation(aoLayerProg, "normTex");
+  aoLayerProgLayer = glGetUniformLocation(aoLayerProg, "layer");
+  aoLayerProgLayerOffset = glGetUniformLocation(aoLayerProg, "layerOffset");
+  aoLayerProgFullRes = glGetUniformLocation(aoLayerProg, "fullRes");
+  aoLayerProgRandomVector = glGetUniformLocation(aoLayerProg, "randomVector");
+  aoLayerProgProjMat = glGetUniformLocation(aoLayerProg, "projMat");
+  aoLayerProgInvProjMat = glGetUniformLocation(aoLayerProg, "invProjMat");
+  aoLayerProgSampleOffsets = glGetUniformLocation(aoLayerProg, "sampleOffsets");
+  aoLayerProgSampleRadius = glGetUniformLocation(aoLayerProg, "sampleRadius");
+  aoLayerProgSampleCount = glGetUniformLocation(aoLayerProg, "sampleCount");
+  aoLayerProgFrameAngle = glGetUniformLocation(aoLayerProg, "frameAngle");
+
+  reinterleaveProg = createProgram(loadShader(GL_VERTEX_SHADER, "shaders/ssao.vert"),
+      loadShader(GL_FRAGMENT_SHADER, "shaders/reinterleave.frag"));
+
+  reinterleaveProgPosAttrib = glGetAttribLocation(reinterleaveProg, "positionIn");
+  reinterleaveProgAoTexture = glGetUniformLocation(reinterleaveProg, "aoTex");
+
+  // Compute shader ambient occlusion, which also does the blur
+  if (computeAOSupported) {
+    aoComputeProg = createComputeProgram(loadShader(GL_COMPUTE_SHADER, "shaders/ssao.comp"));
+
+    aoComputeProgDepthTexture = glGetUniformLocation(aoComputeProg, "depthTex");
+    aoComputeProgNormTexture = glGetUniformLocation(aoComputeProg, "normTex");
+    aoComputeProgRandomTexture = glGetUniformLocation(aoComputeProg, "randomTex");
+    aoComputeProgColorTexture = glGetUniformLocation(aoComputeProg, "colorTex");
+    aoComputeProgRandomTexOffset = glGetUniformLocation(aoComputeProg, "randomTexOffset");
+    aoComputeProgProjMat = glGetUniformLocation(aoComputeProg, "projMat");
+    aoComputeProgInvProjMat = glGetUniformLocation(aoComputeProg, "invProjMat");
+    aoComputeProgSampleOffsets = glGetUniformLocation(aoComputeProg, "sampleOffsets");
+    aoComputeProgSampleRadius = glGetUniformLocation(aoComputeProg, "sampleRadius");
+    aoComputeProgSampleCount = glGetUniformLocation(aoComputeProg, "sampleCount");
+    aoComputeProgFrameAngle = glGetUniformLocation(aoComputeProg, "frameAngle");
+    aoComputeProgReconstructNormals = glGetUniformLocation(aoComputeProg, "reconstructNormals");
+  }
+
+  // Temporal accumulation shaders
+  temporalProg = createProgram(loadShader(GL_VERTEX_SHADER, "shaders/ssao.vert"),
+      loadShader(GL_FRAGMENT_SHADER, "shaders/temporal.frag"));
+
+  temporalProgPosAttrib = glGetAttribLocation(temporalProg, "positionIn");
+  temporalProgAoTexture = glGetUniformLocation(temporalProg, "aoTex");
+  temporalProgDepthTexture = glGetUniformLocation(temporalProg, "depthTex");
+  temporalProgHistoryTexture = glGetUniformLocation(temporalProg, "historyTex");
+  temporalProgInvProjMat = glGetUniformLocation(temporalProg, "invProjMat");
+  temporalProgInvViewMat = glGetUniformLocation(temporalProg, "invViewMat");
+  temporalProgPrevViewProjMat = glGetUniformLocation(temporalProg, "prevViewProjMat");
+  temporalProgHistoryValid = glGetUniformLocation(temporalProg, "historyValid");
+  temporalProgMaxHistoryLength = glGetUniformLocation(temporalProg, "maxHistoryLength");
+  temporalProgDepthRejectThreshold = glGetUniformLocation(temporalProg, "depthRejectThreshold");
+
+  // Blur texture shaders
+  blurProg = createProgram(loadShader(GL_VERTEX_SHADER, "shaders/blur.vert"),
+      loadShader(GL_FRAGMENT_SHADER, "shaders/blur.frag"));
+
+  blurProgPosAttrib = glGetAttribLocation(blurProg, "positionIn");
+  blurProgAoTexture = glGetUniformLocation(blurProg, "aoTex");
+  blurProgColorTexture = glGetUniformLocation(blurProg, "colorTex");
+  blurProgInvRes = glGetUniformLocation(blurProg, "invRes");
+
+}
+
+// Writes the top three rows of "transform" to "rows"
+void putTransformRows(const Mat4& transform, GLfloat* rows)
+{
+  const GLfloat values[floatsPerInstance] = {
+    transform.m11, transform.m21, transform.m31, transform.m41,
+    transform.m12, transform.m22, transform.m32, transform.m42,
+    transform.m13, transform.m23, transform.m33, transform.m43
+  };
+  memcpy(rows, values, sizeof(values));
+}
+
+// Updates instance "i"'s transform and bounds from the scene description
+void placeInstance(int i)
+{
+  const SceneInstance& instance = scene.instances[i];
+  Mat4 transform = instanceTransform(instance);
+  putTransformRows(transform, &instanceTransforms[i * floatsPerInstance]);
+  transformBounds(meshBounds[instance.mesh], transform, instanceBounds[i]);
+}
+
+void loadModel()
+{
+  TRACE_ZONE("loadModel");
+  if (!sceneFile.empty()) {
+    if (!loadSceneFile(sceneFile.c_str(), scene))
+      exit(1);
+  }
+  else if (sceneInstanceCount > 0) {
+    gridScene(sceneInstanceCount, scene);
+  }
+  else {
+    defaultScene(scene);
+  }
+
+  // The meshes' vertex data all goes in one VBO, shared by all their
+  // instances. Each mesh gets room for its whole chain of levels, under twice
+  // its triangles, so the buffer never has to grow as they stream in.
+  int instanceCount = (int)scene.instances.size();
+  meshInstanceCounts.assign(scene.meshPaths.size(), 0);
+  for (int i = 0; i < instanceCount; i++)
+    meshInstanceCounts[scene.instances[i].mesh]++;
+  drawBatches.clear();
+  sceneMeshlets.clear();
+  meshBatches.assign(scene.meshPaths.size(), -1);
+  meshLODCounts.assign(scene.meshPaths.size(), 0);
+  meshFirstVertex.assign(scene.meshPaths.size(), 0);
+  meshVertexCapacity.assign(scene.meshPaths.size(), 0);
+  // Until a mesh is in, its instances are points, and aren't drawn
+  AABB point = { { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f } };
+  meshBounds.assign(scene.meshPaths.size(), point);
+  lodsBuilt = lodState != 0;
+  vector<int> streamedMeshes;
+  long long vertexCapacity = 0;
+  for (size_t mesh = 0; mesh < scene.meshPaths.size(); mesh++) {
+    if (meshInstanceCounts[mesh] == 0)
+      continue;
+    long triCount = modelTriangleCount(scene.meshPaths[mesh].c_str());
+    if (triCount < 0) {
+      fprintf(stderr, "Couldn't load %s\n", scene.meshPaths[mesh].c_str());
+      exit(1);
+    }
+    meshFirstVertex[mesh] = (GLint)vertexCapacity;
+    meshVertexCapacity[mesh] = (long long)triCount * 3 * (lodsBuilt ? 2 : 1);
+    vertexCapacity += meshVertexCapacity[mesh];
+    streamedMeshes.push_back((int)mesh);
+  }
+  glGenBuffers(1, &sceneVertexBuf);
+  glBindBuffer(GL_ARRAY_BUFFER, sceneVertexBuf);
+  glBufferData(GL_ARRAY_BUFFER, vertexCapacity * floatsPerVertex * sizeof(GLfloat), NULL, GL_STATIC_DRAW);
+
+  // The floor, stretched under everything. It's never culled, and it stays
+  // the last batch as the meshes' batches go in ahead of it.
+  DrawBatch floor = { -1, 0, 0.0f, floorBuf, 0, floorVertexCount, 0, 0, &floorMaterial, 0, 1 };
+  float stretch = floorScale(scene);
+  putTransformRows(Mat4::scalingMatrix(stretch, 1.0f, stretch), floorTransform);
+  drawBatches.push_back(floor);
+
+  instanceTransforms.resize(instanceCount * floatsPerInstance);
+  instanceBounds.resize(instanceCount);
+  for (int i = 0; i < instanceCount; i++)
+    placeInstance(i);
+  buildBVH(instanceBounds, sceneBVH);
+
+  // Filled every frame with the instances in view, and the commands for
+  // their meshlets that pass
+  glGenBuffers(1, &instanceBuf);
+  if (clusterCullingSupported)
+    glGenBuffers(1, &clusterCommandBuf);
+
+  instanceBatches.assign(instanceCount, -1);
+  instanceLODCounts.assign(instanceCount, 0);
+  sceneLoaded = false;
+  initUploads((size_t)(uploadBudgetMB * 1024.0f * 1024.0f));
+  startStreaming(scene.meshPaths, streamedMeshes, lodsBuilt ? maxLODLevels : 1, meshletCacheDir);
+  printf("Streaming %d meshes for %d instances, uploading up to %.1f MB a frame.\n", (int)streamedMeshes.size(),
+      instanceCount, uploadBudgetMB);
+  if (streamedMeshes.empty())
+    finishLoading();
+}
+
+// Gives a mesh the loader has finished its batches and meshlets, and queues
+// its vertices for upload
+void addStreamedMesh(StreamedMesh& streamed)
+{
+  int mesh = streamed.mesh;
+  vector<MeshLOD>& lods = streamed.lods;
+  meshBatches[mesh] = (int)drawBatches.size() - 1;
+  meshLODCounts[mesh] = (int)lods.size();
+
+  // Coarser levels can stick out a little past the full mesh, so the
+  // bounds cover them all
+  long long vertexCount = 0;
+  vector<DrawBatch> batches;
+  for (size_t lod = 0; lod < lods.size(); lod++) {
+    DrawBatch batch;
+    batch.mesh = mesh;
+    batch.lod = (int)lod;
+    batch.lodError = lods[lod].error;
+    batch.buffer = sceneVertexBuf;
+    batch.material = &modelMaterial;
+    batch.firstInstance = 0;
+    batch.instanceCount = 0;
+    batch.firstVertex = meshFirstVertex[mesh] + (GLint)vertexCount;
+    batch.vertexCount = (GLsizei)(lods[lod].vertexData.size() / floatsPerVertex);
+    vertexCount += batch.vertexCount;
+    batch.firstMeshlet = (int)sceneMeshlets.size();
+    batch.meshletCount = (int)lods[lod].meshlets.size();
+    sceneMeshlets.insert(sceneMeshlets.end(), lods[lod].meshlets.begin(), lods[lod].meshlets.end());
+    AABB bounds;
+    vertexDataBounds(lods[lod].vertexData.data(), lods[lod].vertexData.size(), bounds);
+    if (lod == 0) {
+      meshBounds[mesh] = bounds;
+    }
+    else {
+      for (int axis = 0; axis < 3; axis++) {
+        meshBounds[mesh].min[axis] = std::min(meshBounds[mesh].min[axis], bounds.min[axis]);
+        meshBounds[mesh].max[axis] = std::max(meshBounds[mesh].max[axis], bounds.max[axis]);
+      }
+    }
+    batches.push_back(batch);
+  }
+  if (vertexCount > meshVertexCapacity[mesh]) {
+    fprintf(stderr, "%s came out bigger than its header said\n", scene.meshPaths[mesh].c_str());
+    exit(1);
+  }
+  drawBatches.insert(drawBatches.end() - 1, batches.begin(), batches.end());
+
+  // Each level goes up straight from the loader's arena, which is released
+  // once the last is in, and the mesh is shown then
+  for (size_t lod = 0; lod < lods.size(); lod++) {
+    size_t offset = (size_t)batches[lod].firstVertex * floatsPerVertex * sizeof(GLfloat);
+    queueUpload(sceneVertexBuf, offset, lods[lod].vertexData, streamed.arena, lod + 1 == lods.size() ? mesh : -1);
+  }
+}
+
+// Lets a mesh's instances be drawn, now its vertices are all uploaded
+void showStreamedMesh(int mesh)
+{
+  int instanceCount = (int)scene.instances.size();
+  for (int i = 0; i < instanceCount; i++) {
+    if (scene.instances[i].mesh != mesh)
+      continue;
+    instanceBatches[i] = meshBatches[mesh];
+    instanceLODCounts[i] = meshLODCounts[mesh];
+    placeInstance(i);
+  }
+}
+
+// Once every mesh is in: GPU culling gets its copy of every instance, and
+// draws each level of each mesh with the command of the same index as its
+// batch
+void finishLoading()
+{
+  finishStreaming();
+  sceneLoaded = true;
+  int instanceCount = (int)scene.instances.size();
+  if (gpuCullingSupported) {
+    vector<GpuCullMesh> cullMeshes(drawBatches.size() - 1);
+    for (size_t batch = 0; batch < cullMeshes.size(); batch++) {
+      cullMeshes[batch].firstVertex = drawBatches[batch].firstVertex;
+      cullMeshes[batch].vertexCount = drawBatches[batch].vertexCount;
+      cullMeshes[batch].instanceCount = meshInstanceCounts[drawBatches[batch].mesh];
+      cullMeshes[batch].lod = drawBatches[batch].lod;
+      cullMeshes[batch].lodError = drawBatches[batch].lodError;
+    }
+    initGpuCulling(cullMeshes, wWidth, wHeight);
+    updateGpuInstances(0, instanceCount, instanceTransforms.data(), instanceBounds.data(), instanceBatches.data(),
+        instanceLODCounts.data());
+  }
+
+  int meshCount = 0;
+  long long triangles = 0;
+  for (size_t mesh = 0; mesh < scene.meshPaths.size(); mesh++) {
+    if (meshBatches[mesh] < 0)
+      continue;
+    meshCount++;
+    triangles += (long long)drawBatches[meshBatches[mesh]].vertexCount / 3 * meshInstanceCounts[mesh];
+  }
+  int drawCalls = instancingSupported ? (int)drawBatches.size() : instanceCount + 1;
+  printf("Scene: %d meshes (%d levels of detail), %d instances, %lld triangles at full detail, up to %d draw calls a pass%s, %d BVH nodes.\n",
+      meshCount, (int)drawBatches.size() - 1, instanceCount, triangles, drawCalls,
+      instancingSupported ? "" : " (no instancing support)", (int)sceneBVH.nodes.size());
+}
+
+void updateStreaming()
+{
+  if (sceneLoaded)
+    return;
+  TRACE_ZONE("updateStreaming");
+  StreamedMesh streamed;
+  string failedPath;
+  StreamedMeshResult result;
+  while ((result = takeStreamedMesh(streamed, failedPath)) == streamedMeshReady)
+    addStreamedMesh(streamed);
+  // Exiting joins the background jobs, which need the lock takeStreamedMesh()
+  // has just let go of
+  if (result == streamedMeshFailed) {
+    fprintf(stderr, "Couldn't load %s\n", failedPath.c_str());
+    exit(1);
+  }
+
+  vector<int> uploaded;
+  pumpUploads(uploaded);
+  if (uploaded.empty())
+    return;
+  for (size_t i = 0; i < uploaded.size(); i++)
+    showStreamedMesh(uploaded[i]);
+  buildBVH(instanceBounds, sceneBVH);
+  if (streamingDone())
+    finishLoading();
+}
+
+void waitForScene()
+{
+  TRACE_ZONE("waitForScene");
+  while (!sceneLoaded) {
+    updateStreaming();
+    // Nothing's being drawn to push the copies along
+    glFlush();
+    if (!sceneLoaded)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+bool sceneStreamedIn()
+{
+  return sceneLoaded;
+}
+// ------------------- DRAW FUNCTIONS ----------------- //
+// Computes the camera and projection transforms the scene is drawn with
+void sceneMatrices(Mat4& view, Mat4& proj)
+{
+  sceneMatrices(eye, lookat, view, proj);
+}
+
+// Describes the occlusion path renderFrame() takes in the current state
+const char* aoModeName()
+{
+  if (computeAOState && !temporalAOState)
+    return "compute shader (with blur)";
+  return deinterleavedAOState ? "deinterleaved" : "interleaved";
+}
+
+// Prints the GPU time of each pass over the last frames, along with how much
+// the G-buffer pass writes, then starts over
+bool reportPassTimes()
+{
+  flushGpuTimers();
+  SampleStats frame = gpuFrameStats();
+  if (frame.count == 0)
+    return false;
+
+  // Color and depth are 4 bytes a pixel, and so are normals when stored
+  int bytesPerPixel = reconstructNormalsState ? 8 : 12;
+  double gbufferMB = (double)wWidth * wHeight * bytesPerPixel / (1024.0 * 1024.0);
+  printf("%s occlusion, %s normals (G-buffer writes %.1f MB/frame), last %d frames:\n", aoModeName(),
+      reconstructNormalsState ? "reconstructed" : "stored", gbufferMB, frame.count);
+  printf("  %-10s %9s %9s %9s %9s %9s\n", "pass (ms)", "mean", "p50", "p95", "p99", "max");
+  for (int pass = 0; pass < passCount; pass++) {
+    SampleStats stats = gpuPassStats(pass);
+    if (stats.count > 0)
+      printf("  %-10s %9.3f %9.3f %9.3f %9.3f %9.3f\n", renderPassNames[pass], stats.mean, stats.p50, stats.p95, stats.p99, stats.max);
+  }
+  printf("  %-10s %9.3f %9.3f %9.3f %9.3f %9.3f\n", "frame", frame.mean, frame.p50, frame.p95, frame.p99, frame.max);
+  if (gpuTimerDroppedFrames() > 0)
+    printf("  (%d frames not timed, results came back too late)\n", gpuTimerDroppedFrames());
+  resetGpuTimerStats();
+  return true;
+}
+
+// Starts timing a pass on the GPU, and on the CPU too if finishEachPass is set
+double beginPass(RenderPass pass)
+{
+  double start = 0.0;
+  if (finishEachPass) {
+    glFinish();
+    start = wallClockMs();
+  }
+  beginGpuPass(pass);
+  return start;
+}
+
+void endPass(RenderPass pass, double start)
+{
+  endGpuPass(pass);
+  if (finishEachPass) {
+    glFinish();
+    lastPassMs[pass] = wallClockMs() - start;
+  }
+}
+
+void discardPassTimes()
+{
+  glFinish();
+  flushGpuTimers();
+  resetGpuTimerStats();
+}
+
+void readGBuffer(GBuffer& gbuffer)
+{
+  TRACE_ZONE("readGBuffer");
+  gbuffer.width = wWidth;
+  gbuffer.height = wHeight;
+  gbuffer.depth.resize(wWidth * wHeight);
+  gbuffer.color.resize(wWidth * wHeight * 3);
+  gbuffer.normals.resize(reconstructNormalsState ? 0 : wWidth * wHeight * 3);
+
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glBindTexture(GL_TEXTURE_2D, depthTexture);
+  glGetTexImage(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, GL_FLOAT, &gbuffer.depth[0]);
+  glBindTexture(GL_TEXTURE_2D, colorTexture);
+  glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, &gbuffer.color[0]);
+  if (!reconstructNormalsState) {
+    glBindTexture(GL_TEXTURE_2D, normalTexture);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, &gbuffer.normals[0]);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void occlusionSettings(SSAOSettings& settings)
+{
+  occlusionProjection(settings.projMat, settings.invProjMat);
+
+  // frameNum has already moved on to the next frame
+  int noiseShiftX, noiseShiftY;
+  float angle;
+  frameKernel(frameNum > 0 ? frameNum - 1 : 0, settings.sampleOffsets, angle, noiseShiftX, noiseShiftY);
+  settings.sampleRadius = depthDiscontinuityRadius;
+  settings.frameAngle = angle;
+
+  settings.randomDirections = randomDirections;
+  settings.noiseSize = noiseSize;
+  settings.noiseShiftX = noiseShiftX;
+  settings.noiseShiftY = noiseShiftY;
+  settings.reconstructNormals = reconstructNormalsState != 0;
+  // Only the fragment shader path keeps occlusion in an 8-bit texture
+  settings.quantizeOcclusion = !(computeAOState && !temporalAOState);
+}
+
+// Picks which of the kernel's samples, which rotation and which shift of the
+// random texture this frame's occlusion pass uses
+void frameKernel(int frame, vector<GLfloat>& sampleOffsets, float& angle, int& noiseShiftX, int& noiseShiftY)
+{
+  if (temporalAOState) {
+    // Only take a few taps a frame, stepping through the kernel and the
+    // random texture, and spinning the kernel, so the accumulated history
+    // sees many more distinct samples than a single frame does. Samples
+    // get farther out along the kernel, so each frame takes every
+    // "slices"th one, to cover every radius; the last slice also takes
+    // whatever is left over past a whole number of slices.
+    const static float goldenAngle = 2.39996323f;
+    int slices = std::max(kernelSize / temporalSamplesPerFrame, 1);
+    int slice = frame % slices;
+    int strided = std::min(slices * temporalSamplesPerFrame, kernelSize);
+    sampleOffsets.clear();
+    for (int sample = slice; sample < strided; sample += slices) {
+      vector<GLfloat>::const_iterator offset = kernelOffsets.begin() + sample * 3;
+      sampleOffsets.insert(sampleOffsets.end(), offset, offset + 3);
+    }
+    if (slice == slices - 1) {
+      sampleOffsets.insert(sampleOffsets.end(), kernelOffsets.begin() + strided * 3,
+          kernelOffsets.begin() + kernelSize * 3);
+    }
+    angle = goldenAngle * frame;
+    noiseShiftX = frame % noiseSize;
+    noiseShiftY = (frame / noiseSize) % noiseSize;
+  }
+  else {
+    sampleOffsets.assign(kernelOffsets.begin(), kernelOffsets.begin() + kernelSize * 3);
+    angle = 0.0f;
+    noiseShiftX = 0;
+    noiseShiftY = 0;
+  }
+}
+
+// Sets the phong program's material uniforms
+void setMaterial(const Material& material)
+{
+  glUniform3fv(phongProgKAmb, 1, material.ambient);
+  glUniform3fv(phongProgKDif, 1, material.diffuse);
+  glUniform3fv(phongProgKSpc, 1, material.specular);
+  glUniform1f(phongProgKShn, material.shininess);
+}
+// Draws every instance of "batch", whose vertex attributes are already set
+void drawInstances(const DrawBatch& batch)
+{
+  if (batch.instanceCount == 0)
+    return;
+  if (!instancingSupported) {
+    // The transform is a constant attribute, changed between draws
+    for (int instance = batch.firstInstance; instance < batch.firstInstance + batch.instanceCount; instance++) {
+      for (int row = 0; row < 3; row++)
+        glVertexAttrib4fv(phongProgInstanceRowAttribs[row], &instanceData[instance * floatsPerInstance + row * 4]);
+      glDrawArrays(GL_TRIANGLES, batch.firstVertex, batch.vertexCount);
+      lastDrawStats.drawCalls++;
+    }
+    return;
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, frameInstanceBuf);
+  for (int row = 0; row < 3; row++) {
+    GLint attrib = phongProgInstanceRowAttribs[row];
+    size_t offset = frameInstanceOffset + (batch.firstInstance * floatsPerInstance + row * 4) * sizeof(GLfloat);
+    glEnableVertexAttribArray(attrib);
+    glVertexAttribPointer(attrib, 4, GL_FLOAT, GL_FALSE, floatsPerInstance * sizeof(GLfloat), reinterpret_cast<void*>(offset));
+    glVertexAttribDivisor(attrib, 1);
+  }
+  glDrawArraysInstanced(GL_TRIANGLES, batch.firstVertex, batch.vertexCount, batch.instanceCount);
+  lastDrawStats.drawCalls++;
+  // The other passes' programs may put their attributes where these were
+  for (int row = 0; row < 3; row++) {
+    glVertexAttribDivisor(phongProgInstanceRowAttribs[row], 0);
+    glDisableVertexAttribArray(phongProgInstanceRowAttribs[row]);
+  }
+}
+
+// Turns the first spinningInstances instances a little and refits the BVH
+// around their new bounds
+void spinInstances()
+{
+  int count = std::min(spinningInstances, (int)scene.instances.size());
+  if (count <= 0)
+    return;
+  TRACE_ZONE("spinInstances");
+  vector<int> changed(count);
+  for (int i = 0; i < count; i++) {
+    scene.instances[i].yaw += 2.0f;
+    placeInstance(i);
+    changed[i] = i;
+  }
+  updateBVH(sceneBVH, changed, instanceBounds);
+  if (gpuCullingSupported && sceneLoaded)
+    updateGpuInstances(0, count, instanceTransforms.data(), instanceBounds.data(), instanceBatches.data(),
+        instanceLODCounts.data());
+}
+
+// How far "bounds" can be from "eye", which is how far a level of detail's
+// error is seen from. cull.comp works it out the same way.
+float lodDistance(const AABB& bounds, const Vec3& eye)
+{
+  float center[3], radius = 0.0f, distance = 0.0f;
+  const float eyePosition[3] = { eye.x, eye.y, eye.z };
+  for (int axis = 0; axis < 3; axis++) {
+    center[axis] = (bounds.min[axis] + bounds.max[axis]) * 0.5f;
+    float half = (bounds.max[axis] - bounds.min[axis]) * 0.5f;
+    radius += half * half;
+    distance += (center[axis] - eyePosition[axis]) * (center[axis] - eyePosition[axis]);
+  }
+  return std::max(sqrtf(distance) - sqrtf(radius), 1e-4f);
+}
+
+// The coarsest level of detail of instance "i" whose error would cover at
+// most lodPixelError pixels
+int pickLOD(int i)
+{
+  int levels = instanceLODCounts[i];
+  if (!lodState || levels <= 1)
+    return 0;
+  // Instances are scaled uniformly, so any row of the transform has the scale
+  const GLfloat* row = &instanceTransforms[i * floatsPerInstance];
+  float scale = sqrtf(row[0] * row[0] + row[1] * row[1] + row[2] * row[2]);
+  float reach = lodDistance(instanceBounds[i], eye) * lodPixelError / (scale * lodPixelsPerUnit);
+  for (int lod = levels - 1; lod > 0; lod--) {
+    if (drawBatches[instanceBatches[i] + lod].lodError <= reach)
+      return lod;
+  }
+  return 0;
+}
+
+// Copies "bytes" of "data" into this frame's region of the frame ring, setting
+// "buffer" and "offset" to where they went. Returns false if the ring isn't in
+// use or they don't fit.
+bool writeFrameData(const void* data, size_t bytes, size_t alignment, GLuint& buffer, GLintptr& offset)
+{
+  FrameSlice slice;
+  if (!frameRingSupported || !allocateFrameData(bytes, alignment, slice))
+    return false;
+  memcpy(slice.data, data, bytes);
+  flushFrameData(slice);
+  buffer = slice.buffer;
+  offset = slice.offset;
+  return true;
+}
+
+// Puts this frame's data for "target" in the frame ring, or in new storage for
+// "fallback" if it doesn't fit, so there's no waiting for the last frame's
+// draws either way
+void uploadFrameData(GLenum target, GLuint fallback, const void* data, size_t bytes, GLuint& buffer, GLintptr& offset)
+{
+  if (writeFrameData(data, bytes, 16, buffer, offset))
+    return;
+  glBindBuffer(target, fallback);
+  // Never empty, so the buffer can be bound
+  glBufferData(target, bytes > 0 ? bytes : 16, bytes > 0 ? data : NULL, GL_STREAM_DRAW);
+  glBindBuffer(target, 0);
+  buffer = fallback;
+  offset = 0;
+}
+
+// Finds the instances in view of "viewProj", fills in each batch's share of
+// them and writes their transforms out for drawing. With GPU culling, only the
+// floor's is written; the meshes' instances are left to cull.comp.
+void cullInstances(const Mat4& viewProj)
+{
+  TRACE_ZONE("cullInstances");
+  double start = wallClockMs();
+  int instanceCount = (int)scene.instances.size();
+  lastDrawStats.clustersTested = 0;
+  lastDrawStats.clustersOutsideFrustum = 0;
+  lastDrawStats.clustersBackfacing = 0;
+  if (cullingEnabled && gpuCullingState && sceneLoaded) {
+    Frustum frustum;
+    frustumFromMatrix(viewProj, frustum);
+    float lodScale = lodState ? lodPixelsPerUnit / lodPixelError : 0.0f;
+    cullOnGpu(frustum, eye, lodScale, frameNum);
+    for (size_t batch = 0; batch < drawBatches.size(); batch++) {
+      drawBatches[batch].firstInstance = 0;
+      drawBatches[batch].instanceCount = drawBatches[batch].mesh < 0 ? 1 : 0;
+    }
+    instanceData.assign(floorTransform, floorTransform + floatsPerInstance);
+    uploadFrameData(GL_ARRAY_BUFFER, instanceBuf, instanceData.data(), instanceData.size() * sizeof(GLfloat),
+        frameInstanceBuf, frameInstanceOffset);
+
+    GpuCullStats stats = gpuCullStats();
+    lastDrawStats.culled = stats.frustumCulled + stats.occluded;
+    lastDrawStats.occluded = stats.occluded;
+    lastDrawStats.cullMs = wallClockMs() - start;
+    return;
+  }
+
+  if (cullingEnabled) {
+    Frustum frustum;
+    frustumFromMatrix(viewProj, frustum);
+    cullBVH(sceneBVH, frustum, visibleInstances, NULL);
+  }
+  else {
+    visibleInstances.resize(instanceCount);
+    for (int i = 0; i < instanceCount; i++)
+      visibleInstances[i] = i;
+  }
+
+  // Instances of meshes still streaming in aren't drawn yet
+  if (!sceneLoaded) {
+    visibleInstances.erase(std::remove_if(visibleInstances.begin(), visibleInstances.end(),
+        [](int instance) { return instanceBatches[instance] < 0; }), visibleInstances.end());
+  }
+
+  // Group the visible instances by mesh and level of detail, the floor after
+  // them
+  int visibleCount = (int)visibleInstances.size();
+  visibleBatches.resize(visibleCount);
+  parallelFor(visibleCount, 1024, 0, [](int begin, int end) {
+    for (int i = begin; i < end; i++)
+      visibleBatches[i] = instanceBatches[visibleInstances[i]] + pickLOD(visibleInstances[i]);
+  });
+  for (size_t batch = 0; batch < drawBatches.size(); batch++)
+    drawBatches[batch].instanceCount = drawBatches[batch].mesh < 0 ? 1 : 0;
+  for (int i = 0; i < visibleCount; i++)
+    drawBatches[visibleBatches[i]].instanceCount++;
+  int first = 0;
+  for (size_t batch = 0; batch < drawBatches.size(); batch++) {
+    drawBatches[batch].firstInstance = first;
+    first += drawBatches[batch].instanceCount;
+  }
+
+  instanceData.resize((visibleCount + 1) * floatsPerInstance);
+  vector<int> next(drawBatches.size());
+  for (size_t batch = 0; batch < drawBatches.size(); batch++)
+    next[batch] = drawBatches[batch].firstInstance;
+  for (int i = 0; i < visibleCount; i++) {
+    int instance = visibleInstances[i];
+    int slot = next[visibleBatches[i]]++;
+    memcpy(&instanceData[slot * floatsPerInstance], &instanceTransforms[instance * floatsPerInstance],
+        floatsPerInstance * sizeof(GLfloat));
+  }
+  memcpy(&instanceData[drawBatches.back().firstInstance * floatsPerInstance], floorTransform, sizeof(floorTransform));
+
+  uploadFrameData(GL_ARRAY_BUFFER, instanceBuf, instanceData.data(), instanceData.size() * sizeof(GLfloat),
+      frameInstanceBuf, frameInstanceOffset);
+  if (cullingEnabled && clusterCullingState)
+    cullClusters(viewProj);
+
+  lastDrawStats.culled = instanceCount - visibleCount;
+  lastDrawStats.occluded = 0;
+  lastDrawStats.cullMs = wallClockMs() - start;
+}
+
+// Culls the meshlets of every instance cullInstances() kept, and writes a
+// command for each run of them that passes, drawing one instance
+void cullClusters(const Mat4& viewProj)
+{
+  TRACE_ZONE("cullClusters");
+  Frustum frustum;
+  frustumFromMatrix(viewProj, frustum);
+  // The floor's slot comes after every mesh's
+  int slots = drawBatches.back().firstInstance;
+  slotBatches.resize(slots);
+  for (size_t b = 0; b < drawBatches.size(); b++) {
+    const DrawBatch& batch = drawBatches[b];
+    for (int slot = batch.firstInstance; batch.mesh >= 0 && slot < batch.firstInstance + batch.instanceCount; slot++)
+      slotBatches[slot] = (int)b;
+  }
+
+  int chunkCount = (slots + clusterCullSlots - 1) / clusterCullSlots;
+  if ((int)clusterChunks.size() < chunkCount)
+    clusterChunks.resize(chunkCount);
+  parallelFor(slots, clusterCullSlots, 0, [&](int begin, int end) {
+    ClusterCullChunk& chunk = clusterChunks[begin / clusterCullSlots];
+    chunk.commands.clear();
+    chunk.triangles = 0;
+    chunk.stats.tested = chunk.stats.outsideFrustum = chunk.stats.backfacing = 0;
+    for (int slot = begin; slot < end; slot++) {
+      const DrawBatch& batch = drawBatches[slotBatches[slot]];
+      chunk.runs.clear();
+      cullMeshlets(&sceneMeshlets[batch.firstMeshlet], batch.meshletCount, &instanceData[slot * floatsPerInstance],
+          frustum, eye, chunk.runs, chunk.stats);
+      for (size_t run = 0; run < chunk.runs.size(); run++) {
+        DrawArraysCommand command = { chunk.runs[run].triangleCount * 3, 1,
+                                      (GLuint)batch.firstVertex + chunk.runs[run].firstTriangle * 3, (GLuint)slot };
+        chunk.commands.push_back(command);
+        chunk.triangles += chunk.runs[run].triangleCount;
+      }
+    }
+  });
+
+  MeshletCullStats stats = { 0, 0, 0 };
+  clusterCommands.clear();
+  clusterTriangles = 0;
+  for (int c = 0; c < chunkCount; c++) {
+    const ClusterCullChunk& chunk = clusterChunks[c];
+    clusterCommands.insert(clusterCommands.end(), chunk.commands.begin(), chunk.commands.end());
+    clusterTriangles += chunk.triangles;
+    stats.tested += chunk.stats.tested;
+    stats.outsideFrustum += chunk.stats.outsideFrustum;
+    stats.backfacing += chunk.stats.backfacing;
+  }
+
+  uploadFrameData(GL_DRAW_INDIRECT_BUFFER, clusterCommandBuf, clusterCommands.data(),
+      clusterCommands.size() * sizeof(DrawArraysCommand), frameCommandBuf, frameCommandOffset);
+  lastDrawStats.clustersTested = stats.tested;
+  lastDrawStats.clustersOutsideFrustum = stats.outsideFrustum;
+  lastDrawStats.clustersBackfacing = stats.backfacing;
+}
+
+// Draws what cullClusters() left, every mesh in one call
+void drawClusters()
+{
+  glBindBuffer(GL_ARRAY_BUFFER, frameInstanceBuf);
+  for (int row = 0; row < 3; row++) {
+    GLint attrib = phongProgInstanceRowAttribs[row];
+    glEnableVertexAttribArray(attrib);
+    glVertexAttribPointer(attrib, 4, GL_FLOAT, GL_FALSE, floatsPerInstance * sizeof(GLfloat),
+        reinterpret_cast<void*>(frameInstanceOffset + row * 4 * sizeof(GLfloat)));
+    glVertexAttribDivisor(attrib, 1);
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, frameCommandBuf);
+  glMultiDrawArraysIndirect(GL_TRIANGLES, reinterpret_cast<void*>(frameCommandOffset),
+      (GLsizei)clusterCommands.size(), 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  for (int row = 0; row < 3; row++) {
+    glVertexAttribDivisor(phongProgInstanceRowAttribs[row], 0);
+    glDisableVertexAttribArray(phongProgInstanceRowAttribs[row]);
+  }
+}
+
+void drawModel(bool ssao)
+{
+  TRACE_ZONE("drawModel");
+  // Normals only need writing out if the occlusion pass isn't rebuilding them
+  bool writeNormals = ssao && !reconstructNormalsState;
+  if (ssao) {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, writeNormals ? normalTexture : 0, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+    GLenum bufs[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(writeNormals ? 2 : 1, bufs);
+  }
+  else {
+    glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+  }
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  Mat4 ident = Mat4::identityMatrix();
+  Mat4 view, proj;
+  sceneMatrices(view, proj);
+
+  Mat4 mvp = proj * view;
+
+  // Culling on the GPU runs its own program, so it goes first
+  bool gpuCulled = cullingEnabled && gpuCullingState && sceneLoaded;
+  bool clusterCulled = cullingEnabled && !gpuCulled && clusterCullingState;
+  cullInstances(mvp);
+
+  glUseProgram(phongProg);
+
+  if (phongProgFrameBlock != GL_INVALID_INDEX) {
+    FrameUniforms uniforms;
+    memset(&uniforms, 0, sizeof(uniforms));
+    memcpy(uniforms.modelViewMat, &view, sizeof(uniforms.modelViewMat));
+    memcpy(uniforms.modelViewProjMat, &mvp, sizeof(uniforms.modelViewProjMat));
+    memcpy(uniforms.normalMat, &ident, sizeof(uniforms.normalMat));
+    memcpy(uniforms.lAmbient, sceneLight.ambient, sizeof(sceneLight.ambient));
+    memcpy(uniforms.lPosition, sceneLight.position, sizeof(sceneLight.position));
+    memcpy(uniforms.lDiffuse, sceneLight.diffuse, sizeof(sceneLight.diffuse));
+    memcpy(uniforms.lSpecular, sceneLight.specular, sizeof(sceneLight.specular));
+    GLuint buffer;
+    GLintptr offset;
+    if (!writeFrameData(&uniforms, sizeof(uniforms), uniformOffsetAlignment, buffer, offset)) {
+      glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuf);
+      glBufferData(GL_UNIFORM_BUFFER, sizeof(uniforms), &uniforms, GL_STREAM_DRAW);
+      buffer = frameUniformBuf;
+      offset = 0;
+    }
+    glBindBufferRange(GL_UNIFORM_BUFFER, frameUniformBinding, buffer, offset, sizeof(uniforms));
+  }
+  else {
+    glUniformMatrix4fv(phongProgModelViewMat, 1, GL_FALSE, reinterpret_cast<float*>(&view));
+    glUniformMatrix4fv(phongProgMvpMat, 1, GL_FALSE, reinterpret_cast<float*>(&mvp));
+    glUniformMatrix4fv(phongProgNormalMat, 1, GL_FALSE, reinterpret_cast<float*>(&ident));
+
+    // Lighting uniforms
+    glUniform3fv(phongProgLAmb, 1, sceneLight.ambient);
+    glUniform3fv(phongProgLPos, 1, sceneLight.position);
+    glUniform3fv(phongProgLDif, 1, sceneLight.diffuse);
+    glUniform3fv(phongProgLSpc, 1, sceneLight.specular);
+  }
+  setMaterial(modelMaterial);
+
+  if (writeNormals) {
+    glUniform1f(phongProgDoSSAO, 1.0f);
+  }
+  else {
+    glUniform1f(phongProgDoSSAO, 0.0f);
+  }
+
+  // Set up vertex attributes
+  glEnableVertexAttribArray(phongProgPosAttrib);
+  glEnableVertexAttribArray(phongProgNormAttrib);
+
+  lastDrawStats.drawCalls = 0;
+  lastDrawStats.instances = 0;
+  lastDrawStats.triangles = 0;
+  if (gpuCulled) {
+    // Every mesh at once, from the commands cull.comp wrote. The counts come
+    // from an earlier frame's culling.
+    glBindBuffer(GL_ARRAY_BUFFER, sceneVertexBuf);
+    glVertexAttribPointer(phongProgPosAttrib, 3, GL_FLOAT, GL_FALSE, floatsPerVertex * sizeof(GLfloat), reinterpret_cast<void*>(0));
+    glVertexAttribPointer(phongProgNormAttrib, 3, GL_FLOAT, GL_FALSE, floatsPerVertex * sizeof(GLfloat), reinterpret_cast<void*>(3*sizeof(GLfloat)));
+    drawGpuCulled(phongProgInstanceRowAttribs);
+    GpuCullStats stats = gpuCullStats();
+    lastDrawStats.drawCalls++;
+    lastDrawStats.instances += stats.visible;
+    lastDrawStats.triangles += stats.triangles;
+  }
+  if (clusterCulled) {
+    // Every mesh's meshlets that passed at once
+    glBindBuffer(GL_ARRAY_BUFFER, sceneVertexBuf);
+    glVertexAttribPointer(phongProgPosAttrib, 3, GL_FLOAT, GL_FALSE, floatsPerVertex * sizeof(GLfloat), reinterpret_cast<void*>(0));
+    glVertexAttribPointer(phongProgNormAttrib, 3, GL_FLOAT, GL_FALSE, floatsPerVertex * sizeof(GLfloat), reinterpret_cast<void*>(3*sizeof(GLfloat)));
+    drawClusters();
+    lastDrawStats.drawCalls++;
+    lastDrawStats.triangles += clusterTriangles;
+  }
+  for (size_t i = 0; i < drawBatches.size(); i++) {
+    const DrawBatch& batch = drawBatches[i];
+    if (clusterCulled && batch.mesh >= 0)
+      lastDrawStats.instances += batch.instanceCount;
+    if ((gpuCulled || clusterCulled) && batch.mesh >= 0)
+      continue;
+    setMaterial(*batch.material);
+    glBindBuffer(GL_ARRAY_BUFFER, batch.buffer);
+    glVertexAttribPointer(phongProgPosAttrib, 3, GL_FLOAT, GL_FALSE, floatsPerVertex * sizeof(GLfloat), reinterpret_cast<void*>(0));
+    glVertexAttribPointer(phongProgNormAttrib, 3, GL_FLOAT, GL_FALSE, floatsPerVertex * sizeof(GLfloat), reinterpret_cast<void*>(3*sizeof(GLfloat)));
+    drawInstances(batch);
+    lastDrawStats.instances += batch.instanceCount;
+    lastDrawStats.triangles += (long long)batch.vertexCount / 3 * batch.instanceCount;
+  }
+
+  // The next frame's culling tests against this frame's depth
+  if (ssao && gpuCulled)
+    buildHiZ(depthTexture, mvp, frameNum);
+}
+
+void doSSAO()
+{
+  TRACE_ZONE("doSSAO");
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glDrawBuffer(GL_COLOR_ATTACHMENT0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, aoTexture, 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
+  // Detach any depth textures
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRenderbuffer);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  glUseProgram(aoProg);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, depthTexture);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, normalTexture);
+  glActiveTexture(GL_TEXTURE2);
+  glBindTexture(GL_TEXTURE_2D, randomTexture);
+  glActiveTexture(GL_TEXTURE0);
+  
+  Mat4 projMat, invProjMat;
+  occlusionProjection(projMat, invProjMat);
+
+  glUniform1i(aoProgDepthTexture, 0);
+  glUniform1i(aoProgNormTexture, 1);
+  glUniform1i(aoProgRandomTexture, 2);
+  glUniform2f(aoProgRandomTexCoordScale, (float)wWidth / noiseSize, (float)wHeight / noiseSize);
+  glUniformMatrix4fv(aoProgProjMat, 1, GL_FALSE, reinterpret_cast<GLfloat*>(&projMat));
+  glUniformMatrix4fv(aoProgInvProjMat, 1, GL_FALSE, reinterpret_cast<GLfloat*>(&invProjMat));
+  vector<GLfloat> sampleOffsets;
+  int noiseShiftX, noiseShiftY;
+  float angle;
+  frameKernel(frameNum, sampleOffsets, angle, noiseShiftX, noiseShiftY);
+  glUniform3fv(aoProgSampleOffsets, (GLsizei)sampleOffsets.size() / 3, sampleOffsets.data());
+  glUniform1i(aoProgSampleCount, (GLint)sampleOffsets.size() / 3);
+  glUniform1f(aoProgFrameAngle, angle);
+  glUniform2f(aoProgRandomTexOffset, (float)noiseShiftX / noiseSize, (float)noiseShiftY / noiseSize);
+  glUniform1f(aoProgSampleRadius, depthDiscontinuityRadius);
+  glUniform1f(aoProgReconstructNormals, reconstructNormalsState ? 1.0f : 0.0f);
+  glUniform2f(aoProgInvRes, 1.0f / wWidth, 1.0f / wHeight);
+
+  static const float verts[8] = { 1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, -1.0f, -1.0f };
+
+  glEnableVertexAttribArray(aoProgPosAttrib);
+
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glVertexAttribPointer(aoProgPosAttrib, 2, GL_FLOAT, GL_FALSE, 0, verts);
+
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+// Same result as doSSAO(), but computed on quarter resolution layers that each
+// hold one pixel out of every 4x4 block. Within a layer the random rotation is
+// constant, so depth lookups of neighboring pixels stay close in the texture.
+void doDeinterleavedSSAO()
+{
+  TRACE_ZONE("doDeinterleavedSSAO");
+  static const float verts[8] = { 1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, -1.0f, -1.0f };
+
+  int layerWidth = wWidth / deinterleaveFactor;
+  int layerHeight = wHeight / deinterleaveFactor;
+
+  Mat4 projMat, invProjMat;
+  occlusionProjection(projMat, invProjMat);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  // These passes only touch color
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, 0);
+  glDisable(GL_DEPTH_TEST);
+  glViewport(0, 0, layerWidth, layerHeight);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  // Split depth and normals into layers
+  glUseProgram(deinterleaveProg);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, depthTexture);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, normalTexture);
+  glActiveTexture(GL_TEXTURE0);
+  glUniform1i(deinterleaveProgDepthTexture, 0);
+  glUniform1i(deinterleaveProgNormTexture, 1);
+  glUniform1f(deinterleaveProgReconstructNormals, reconstructNormalsState ? 1.0f : 0.0f);
+  glUniformMatrix4fv(deinterleaveProgInvProjMat, 1, GL_FALSE, reinterpret_cast<GLfloat*>(&invProjMat));
+
+  GLenum bufs[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+  glDrawBuffers(2, bufs);
+  glEnableVertexAttribArray(deinterleaveProgPosAttrib);
+  glVertexAttribPointer(deinterleaveProgPosAttrib, 2, GL_FLOAT, GL_FALSE, 0, verts);
+  for (int layer = 0; layer < deinterleavedLayers; layer++) {
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, deinterleavedDepthTexture, 0, layer);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, deinterleavedNormalTexture, 0, layer);
+    glUniform2i(deinterleaveProgLayerOffset, layer % deinterleaveFactor, layer / deinterleaveFactor);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  }
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
+
+  // Compute occlusion for each layer
+  glUseProgram(aoLayerProg);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, deinterleavedDepthTexture);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, deinterleavedNormalTexture);
+  glActiveTexture(GL_TEXTURE0);
+
+  vector<GLfloat> sampleOffsets;
+  int noiseShiftX, noiseShiftY;
+  float angle;
+  frameKernel(frameNum, sampleOffsets, angle, noiseShiftX, noiseShiftY);
+
+  glUniform1i(aoLayerProgDepthTexture, 0);
+  glUniform1i(aoLayerProgNormTexture, 1);
+  glUniform2f(aoLayerProgFullRes, (float)wWidth, (float)wHeight);
+  glUniformMatrix4fv(aoLayerProgProjMat, 1, GL_FALSE, reinterpret_cast<GLfloat*>(&projMat));
+  glUniformMatrix4fv(aoLayerProgInvProjMat, 1, GL_FALSE, reinterpret_cast<GLfloat*>(&invProjMat));
+  glUniform3fv(aoLayerProgSampleOffsets, (GLsizei)sampleOffsets.size() / 3, sampleOffsets.data());
+  glUniform1i(aoLayerProgSampleCount, (GLint)sampleOffsets.size() / 3);
+  glUniform1f(aoLayerProgFrameAngle, angle);
+  glUniform1f(aoLayerProgSampleRadius, depthDiscontinuityRadius);
+
+  glDrawBuffer(GL_COLOR_ATTACHMENT0);
+  glEnableVertexAttribArray(aoLayerProgPosAttrib);
+  glVertexAttribPointer(aoLayerProgPosAttrib, 2, GL_FLOAT, GL_FALSE, 0, verts);
+  for (int layer = 0; layer < deinterleavedLayers; layer++) {
+    int offsetX = layer % deinterleaveFactor;
+    int offsetY = layer / deinterleaveFactor;
+    // The random texture lookup the interleaved pass would do for the first
+    // 4x4 block. This matches it exactly when the random texture is 4x4.
+    int randomIndex = ((offsetX + noiseShiftX) % noiseSize) + ((offsetY + noiseShiftY) % noiseSize) * noiseSize;
+    const GLfloat* random = randomDirections.data() + randomIndex * 3;
+    Vec3 randomVector(2.0f * random[0] - 1.0f, 2.0f * random[1] - 1.0f, 2.0f * random[2] - 1.0f);
+    randomVector.normalize();
+
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, deinterleavedAoTexture, 0, layer);
+    glUniform1i(aoLayerProgLayer, layer);
+    glUniform2i(aoLayerProgLayerOffset, offsetX, offsetY);
+    glUniform3f(aoLayerProgRandomVector, randomVector.x, randomVector.y, randomVector.z);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  }
+
+  // Put the layers back together into the full resolution occlusion texture
+  glViewport(0, 0, wWidth, wHeight);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, aoTexture, 0);
+
+  glUseProgram(reinterleaveProg);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, deinterleavedAoTexture);
+  glUniform1i(reinterleaveProgAoTexture, 0);
+
+  glEnableVertexAttribArray(reinterleaveProgPosAttrib);
+  glVertexAttribPointer(reinterleaveProgPosAttrib, 2, GL_FLOAT, GL_FALSE, 0, verts);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRenderbuffer);
+  glEnable(GL_DEPTH_TEST);
+}
+
+// Same result as doSSAO() followed by doBlur(), in a single compute dispatch
+// that keeps each tile's depth, normals and occlusion in shared memory
+void doComputeSSAO()
+{
+  TRACE_ZONE("doComputeSSAO");
+  glUseProgram(aoComputeProg);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, depthTexture);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, normalTexture);
+  glActiveTexture(GL_TEXTURE2);
+  glBindTexture(GL_TEXTURE_2D, randomTexture);
+  glActiveTexture(GL_TEXTURE3);
+  glBindTexture(GL_TEXTURE_2D, colorTexture);
+  glActiveTexture(GL_TEXTURE0);
+  glBindImageTexture(0, aoComputeOutputTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+
+  Mat4 projMat, invProjMat;
+  occlusionProjection(projMat, invProjMat);
+
+  vector<GLfloat> sampleOffsets;
+  int noiseShiftX, noiseShiftY;
+  float angle;
+  frameKernel(frameNum, sampleOffsets, angle, noiseShiftX, noiseShiftY);
+
+  glUniform1i(aoComputeProgDepthTexture, 0);
+  glUniform1i(aoComputeProgNormTexture, 1);
+  glUniform1i(aoComputeProgRandomTexture, 2);
+  glUniform1i(aoComputeProgColorTexture, 3);
+  glUniform2i(aoComputeProgRandomTexOffset, noiseShiftX, noiseShiftY);
+  glUniformMatrix4fv(aoComputeProgProjMat, 1, GL_FALSE, reinterpret_cast<GLfloat*>(&projMat));
+  glUniformMatrix4fv(aoComputeProgInvProjMat, 1, GL_FALSE, reinterpret_cast<GLfloat*>(&invProjMat));
+  glUniform3fv(aoComputeProgSampleOffsets, (GLsizei)sampleOffsets.size() / 3, sampleOffsets.data());
+  glUniform1i(aoComputeProgSampleCount, (GLint)sampleOffsets.size() / 3);
+  glUniform1f(aoComputeProgFrameAngle, angle);
+  glUniform1f(aoComputeProgSampleRadius, depthDiscontinuityRadius);
+  glUniform1f(aoComputeProgReconstructNormals, reconstructNormalsState ? 1.0f : 0.0f);
+
+  // One workgroup per 16x16 tile
+  glDispatchCompute((wWidth + 15) / 16, (wHeight + 15) / 16, 1);
+  glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+
+  // Actually put it on the screen
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+  glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, aoComputeOutputTexture, 0);
+  glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, outputFramebuffer);
+  glBlitFramebuffer(0, 0, wWidth, wHeight, 0, 0, wWidth, wHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+}
+
+void doTemporalAccumulation()
+{
+  TRACE_ZONE("doTemporalAccumulation");
+  // Blend this frame's occlusion into the history reprojected from last frame
+  int previous = aoHistoryCurrent;
+  aoHistoryCurrent = 1 - aoHistoryCurrent;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glDrawBuffer(GL_COLOR_ATTACHMENT0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, aoHistoryTextures[aoHistoryCurrent], 0);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  glUseProgram(temporalProg);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, aoTexture);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, depthTexture);
+  glActiveTexture(GL_TEXTURE2);
+  glBindTexture(GL_TEXTURE_2D, aoHistoryTextures[previous]);
+  glActiveTexture(GL_TEXTURE0);
+
+  Mat4 view, proj;
+  sceneMatrices(view, proj);
+  Mat4 invView = view.inverse();
+  Mat4 invProj = proj.inverse();
+
+  glUniform1i(temporalProgAoTexture, 0);
+  glUniform1i(temporalProgDepthTexture, 1);
+  glUniform1i(temporalProgHistoryTexture, 2);
+  glUniformMatrix4fv(temporalProgInvProjMat, 1, GL_FALSE, reinterpret_cast<GLfloat*>(&invProj));
+  glUniformMatrix4fv(temporalProgInvViewMat, 1, GL_FALSE, reinterpret_cast<GLfloat*>(&invView));
+  glUniformMatrix4fv(temporalProgPrevViewProjMat, 1, GL_FALSE, reinterpret_cast<GLfloat*>(&prevViewProj));
+  glUniform1f(temporalProgHistoryValid, aoHistoryValid ? 1.0f : 0.0f);
+  glUniform1f(temporalProgMaxHistoryLength, temporalMaxHistoryLength);
+  glUniform1f(temporalProgDepthRejectThreshold, temporalDepthRejectThreshold);
+
+  static const float verts[8] = { 1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, -1.0f, -1.0f };
+
+  glEnableVertexAttribArray(temporalProgPosAttrib);
+
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glVertexAttribPointer(temporalProgPosAttrib, 2, GL_FLOAT, GL_FALSE, 0, verts);
+
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+  aoHistoryValid = true;
+}
+
+void doBlur()
+{
+  TRACE_ZONE("doBlur");
+  // Actually render to the screen
+  glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  glUseProgram(blurProg);
+  glActiveTexture(GL_TEXTURE0);
+  if (temporalAOState)
+    glBindTexture(GL_TEXTURE_2D, aoHistoryTextures[aoHistoryCurrent]);
+  else
+    glBindTexture(GL_TEXTURE_2D, aoTexture);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, colorTexture);
+  glActiveTexture(GL_TEXTURE0);
+
+  glUniform1i(blurProgAoTexture, 0);
+  glUniform1i(blurProgColorTexture, 1);
+
+  glUniform2f(blurProgInvRes, 1.0f / wWidth, 1.0f / wHeight);
+
+  static const float verts[8] = { 1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, -1.0f, -1.0f };
+
+  glEnableVertexAttribArray(blurProgPosAttrib);
+
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glVertexAttribPointer(blurProgPosAttrib, 2, GL_FLOAT, GL_FALSE, 0, verts);
+
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
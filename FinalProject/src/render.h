@@ -0,0 +1,125 @@
+// File: render.h
+//
+// The OpenGL setup and drawing shared by the windowed program (main.cpp) and
+// the headless renderer (headless.cpp). Everything here assumes a current GL
+// context with GLEW initialized, and draws the finished frame into
+// outputFramebuffer.
+
+#ifndef SP_RENDER_H_
+#define SP_RENDER_H_
+
+#include "GL/glew.h"
+
+#include "vec3.h"
+
+struct GBuffer;
+struct SSAOSettings;
+
+// Size of the window, or of the offscreen image when headless
+const int wWidth = 1024;
+const int wHeight = 768;
+
+// the camera info
+extern Vec3 eye;
+extern Vec3 lookat;
+
+// Framebuffer the finished frame is drawn into. 0 is the window's.
+extern GLuint outputFramebuffer;
+
+// Program functionality variables
+extern int ambientOcclusionState;
+extern float depthDiscontinuityRadius;
+extern int deinterleavedAOState;
+extern bool computeAOSupported;
+extern int computeAOState;
+extern int temporalAOState;
+extern int temporalSamplesPerFrame;
+extern bool aoHistoryValid;
+extern int reconstructNormalsState;
+extern int kernelSize;
+extern bool cullingEnabled;
+extern bool gpuCullingSupported;
+extern int gpuCullingState;
+extern bool clusterCullingSupported;
+extern int clusterCullingState;
+extern int lodState;
+extern bool lodsBuilt;
+
+// The parts of a frame renderFrame() times separately. The scene pass is the
+// G-buffer pass with occlusion on and the whole frame without it.
+enum RenderPass { passScene, passOcclusion, passTemporal, passBlur, passCount };
+const char* const renderPassNames[passCount] = { "scene", "occlusion", "temporal", "blur" };
+
+// When set, renderFrame() waits for the GPU before and after each pass and
+// puts the wall-clock time it took in lastPassMs, or -1 for passes it
+// skipped. That serializes the CPU and GPU, but every pass is measured on
+// every frame, which the timer queries don't guarantee.
+extern bool finishEachPass;
+extern double lastPassMs[passCount];
+
+// What the last frame's scene pass drew, counting the floor. Instances of a
+// mesh share one draw call when instancing is supported. "culled" instances
+// were out of view, and finding them (and uploading the rest) took "cullMs".
+// With GPU culling, "occluded" of them were hidden behind the last frame's
+// depth, "cullMs" only covers setting up the dispatch, and the counts are a
+// frame behind.
+struct SceneDrawStats
+{
+  int drawCalls;
+  int instances;
+  long long triangles;
+  int culled;
+  int occluded;
+  // Meshlets of the drawn instances tested, and rejected, with cluster culling
+  long long clustersTested;
+  long long clustersOutsideFrustum;
+  long long clustersBackfacing;
+  double cullMs;
+};
+extern SceneDrawStats lastDrawStats;
+
+// Sets every option to its default
+void setupState();
+
+// If argv[i] is one of the rendering options, applies it, advances i past
+// any value it takes, and returns true
+bool parseRenderArgument(int argc, char* argv[], int& i);
+void printRenderUsage();
+
+// Builds the sample kernel and random rotations from the current settings
+void generateKernel();
+// Regenerates the kernel with a new sample count
+void setKernelSize(int size);
+
+void initializeOpenGL();
+void loadShaders();
+// Reads the scene chosen with --scene or --instances (the bunny by default),
+// builds the BVH its instances are culled with and starts its meshes
+// streaming in (streaming.h). renderFrame() takes in what's ready each frame;
+// instances are drawn once their mesh is in.
+void loadModel();
+// Waits for every mesh to stream in, without drawing
+void waitForScene();
+bool sceneStreamedIn();
+
+// Draws one frame into outputFramebuffer with the current settings and camera
+void renderFrame();
+
+// Describes the occlusion path renderFrame() takes in the current state
+const char* aoModeName();
+
+// Prints statistics of each pass's GPU time over the last gpuTimerWindow
+// frames, along with how much the G-buffer pass writes, then starts over.
+// Waits for frames still in flight. Returns false if nothing has been timed.
+bool reportPassTimes();
+// Waits for any pass timings still in flight and throws everything timed so
+// far away, e.g. after warm-up frames
+void discardPassTimes();
+
+// Copies back the G-buffer of the last frame drawn with occlusion on, for the
+// CPU occlusion pass (cpussao.h)
+void readGBuffer(GBuffer& gbuffer);
+// Fills "settings" with what the occlusion pass used for the last frame
+void occlusionSettings(SSAOSettings& settings);
+
+#endif // SP_RENDER_H_
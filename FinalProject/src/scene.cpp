@@ -0,0 +1,393 @@
+#include "scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "rply.h"
+
+#include "jobs.h"
+#include "parallel.h"
+#include "simplify.h"
+#include "trace.h"
+
+using std::string;
+using std::vector;
+
+const float floorVertexData[floorVertexCount * floatsPerVertex] = {
+  -10.0f, -0.4f, -10.0f, 0.0f, 1.0f, 0.0f,
+  -10.0f, -0.4f,  10.0f, 0.0f, 1.0f, 0.0f,
+   10.0f, -0.4f,  10.0f, 0.0f, 1.0f, 0.0f,
+   10.0f, -0.4f,  10.0f, 0.0f, 1.0f, 0.0f,
+   10.0f, -0.4f, -10.0f, 0.0f, 1.0f, 0.0f,
+  -10.0f, -0.4f, -10.0f, 0.0f, 1.0f, 0.0f
+};
+
+const Material modelMaterial = {
+  { 0.2f, 0.1f, 0.0f },
+  { 0.6f, 0.2f, 0.1f },
+  { 0.0f, 0.0f, 0.0f },
+  0.0f
+};
+
+const Material floorMaterial = {
+  { 1.0f, 1.0f, 1.0f },
+  { 1.0f, 1.0f, 1.0f },
+  { 1.0f, 1.0f, 1.0f },
+  2.0f
+};
+
+const Light sceneLight = {
+  { 1.0f, 1.0f, 1.0f },
+  { 0.0f, 0.0f, 0.5f },
+  { 1.0f, 1.0f, 1.0f },
+  { 0.3f, 0.3f, 0.3f }
+};
+
+namespace {
+
+// What the PLY callbacks fill in, kept in "arena"
+struct PlyData
+{
+  explicit PlyData(Arena& arena) : arena(arena), vertices(ArenaAllocator<float>(&arena)),
+    faceIndices(ArenaAllocator<unsigned int>(&arena)) { }
+
+  Arena& arena;
+  ArenaVector<float> vertices;
+  ArenaVector<unsigned int> faceIndices;
+  float maxValue;
+};
+
+// rply's memory, from the arena the model is read into
+void* plyArenaAlloc(void* adata, void* pointer, size_t oldSize, size_t newSize)
+{
+  return static_cast<Arena*>(adata)->reallocate(pointer, oldSize, newSize, alignof(std::max_align_t));
+}
+
+void loadErrorCallback(p_ply ply, const char* message)
+{
+  fprintf(stderr, "Error loading model: %s\n", message);
+}
+
+int readVertexCallback(p_ply_argument argument)
+{
+  PlyData* data;
+  long axis;
+  ply_get_argument_user_data(argument, reinterpret_cast<void**>(&data), &axis);
+  long index;
+  ply_get_argument_element(argument, NULL, &index);
+
+  float value = (float)ply_get_argument_value(argument);
+  data->vertices[index * 3 + axis] = value;
+  if (fabs(value) > data->maxValue)
+    data->maxValue = (float)fabs(value);
+  return 1;
+}
+
+int readFaceCallback(p_ply_argument argument)
+{
+  PlyData* data;
+  ply_get_argument_user_data(argument, reinterpret_cast<void**>(&data), NULL);
+  long index;
+  ply_get_argument_element(argument, NULL, &index);
+
+  // The list's length comes through as value -1
+  long valueIndex;
+  ply_get_argument_property(argument, NULL, NULL, &valueIndex);
+  if (valueIndex >= 0 && valueIndex < 3)
+    data->faceIndices[index * 3 + valueIndex] = (unsigned int)ply_get_argument_value(argument);
+  return 1;
+}
+
+void putVertex(float* out, const Vec3& position, const Vec3& normal)
+{
+  out[0] = position.x;
+  out[1] = position.y;
+  out[2] = position.z;
+  out[3] = normal.x;
+  out[4] = normal.y;
+  out[5] = normal.z;
+}
+
+// Reads the vertices and faces of a PLY model
+bool readPlyModel(const char* path, PlyData& data)
+{
+  p_ply plyModel = ply_open_alloc(path, loadErrorCallback, 0, NULL, plyArenaAlloc, &data.arena);
+  if (!plyModel)
+    return false;
+  if (!ply_read_header(plyModel)) {
+    ply_close(plyModel);
+    return false;
+  }
+
+  data.maxValue = 0.0f;
+  long vertexCount = ply_set_read_cb(plyModel, "vertex", "x", readVertexCallback, &data, 0);
+  ply_set_read_cb(plyModel, "vertex", "y", readVertexCallback, &data, 1);
+  ply_set_read_cb(plyModel, "vertex", "z", readVertexCallback, &data, 2);
+  long triCount = ply_set_read_cb(plyModel, "face", "vertex_indices", readFaceCallback, &data, 0);
+  data.vertices.resize(vertexCount * 3);
+  data.faceIndices.resize(triCount * 3);
+
+  bool read = ply_read(plyModel) != 0;
+  ply_close(plyModel);
+  return read;
+}
+
+// Splits a level into meshlets and builds its vertex data, in "arena", in
+// their order. The working memory comes from the arena "faceIndices" is in.
+void buildLODVertexData(const ArenaVector<float>& vertices, const ArenaVector<unsigned int>& faceIndices,
+    float maxValue, const char* meshletCacheDir, Arena& arena, MeshLOD& lod)
+{
+  ArenaVector<unsigned int> triangleOrder(faceIndices.get_allocator());
+  buildMeshletsCached(meshletCacheDir, vertices, faceIndices, 0, triangleOrder, lod.meshlets);
+  ArenaVector<unsigned int> orderedIndices(faceIndices.size(), 0, faceIndices.get_allocator());
+  for (size_t i = 0; i < triangleOrder.size(); i++) {
+    for (int corner = 0; corner < 3; corner++)
+      orderedIndices[i * 3 + corner] = faceIndices[triangleOrder[i] * 3 + corner];
+  }
+  lod.vertexData = ArenaVector<float>(faceIndices.size() * floatsPerVertex, 0.0f, ArenaAllocator<float>(&arena));
+  buildModelVertexData(vertices, orderedIndices, maxValue, lod.vertexData.data());
+  transformMeshlets(1.0f / maxValue, Vec3(0.0f, -0.5f, 0.0f), lod.meshlets);
+}
+
+}
+
+bool loadModelMesh(const char* path, vector<float>& vertexData)
+{
+  TRACE_ZONE("loadModelMesh");
+  vertexData.clear();
+
+  Arena arena;
+  PlyData data(arena);
+  if (!readPlyModel(path, data))
+    return false;
+
+  vertexData.resize(data.faceIndices.size() * floatsPerVertex);
+  buildModelVertexData(data.vertices, data.faceIndices, data.maxValue, vertexData.data());
+  return true;
+}
+
+long modelTriangleCount(const char* path)
+{
+  p_ply plyModel = ply_open(path, loadErrorCallback, 0, NULL);
+  if (!plyModel)
+    return -1;
+  if (!ply_read_header(plyModel)) {
+    ply_close(plyModel);
+    return -1;
+  }
+  long triCount = 0;
+  p_ply_element element = NULL;
+  while ((element = ply_get_next_element(plyModel, element)) != NULL) {
+    const char* name;
+    long instances;
+    ply_get_element_info(element, &name, &instances);
+    if (strcmp(name, "face") == 0)
+      triCount = instances;
+  }
+  ply_close(plyModel);
+  return triCount;
+}
+
+bool loadModelLODs(const char* path, int maxLevels, const char* meshletCacheDir, Arena& arena,
+    vector<MeshLOD>& lods)
+{
+  TRACE_ZONE("loadModelLODs");
+  lods.clear();
+
+  Arena scratch;
+  PlyData data(scratch);
+  if (!readPlyModel(path, data))
+    return false;
+
+  // Halve the triangles each level, in one simplification pass
+  vector<size_t> targets;
+  size_t triangles = data.faceIndices.size() / 3;
+  while ((int)targets.size() + 1 < maxLevels && triangles / 2 >= minLODTriangles) {
+    triangles /= 2;
+    targets.push_back(triangles);
+  }
+
+  // The full mesh is built while it's simplified, and the coarser levels once
+  // that's done
+  lods.resize(1);
+  vector<SimplifiedMesh> levels;
+  vector<MeshLOD> coarser;
+  Job full = addJob([&] {
+    buildLODVertexData(data.vertices, data.faceIndices, data.maxValue, meshletCacheDir, arena, lods[0]);
+  });
+  Job simplified = addJob([&] { simplifyMesh(data.vertices, data.faceIndices, targets, scratch, levels); });
+  Job built = addJob([&] {
+    coarser.resize(levels.size());
+    parallelFor((int)levels.size(), 1, 0, [&](int begin, int end) {
+      for (int level = begin; level < end; level++) {
+        buildLODVertexData(levels[level].vertices, levels[level].indices, data.maxValue, meshletCacheDir, arena,
+            coarser[level]);
+      }
+    });
+  }, vector<Job>(1, simplified));
+  waitForJob(full);
+  waitForJob(built);
+
+  // Errors come back in the file's units; the model is scaled to fit a unit cube
+  lods[0].error = 0.0f;
+  for (size_t level = 0; level < levels.size(); level++) {
+    lods.push_back(std::move(coarser[level]));
+    lods.back().error = levels[level].error / data.maxValue;
+  }
+  return true;
+}
+
+void buildModelVertexData(const ArenaVector<float>& vertices, const ArenaVector<unsigned int>& faceIndices,
+    float maxValue, float* vertexData)
+{
+  TRACE_ZONE("buildModelVertexData");
+  // Scale vertices to unit cube
+  float scaleFactor = 1.0f / maxValue;
+  Vec3 halfUnit(0.0f, 0.5f, 0.0f);
+  size_t triCount = faceIndices.size() / 3;
+  parallelFor((int)triCount, 16384, 0, [&](int begin, int end) {
+    for (size_t face = begin; face < (size_t)end; face++) {
+      Vec3 v[3];
+      for (int corner = 0; corner < 3; corner++) {
+        unsigned int vi = faceIndices[face * 3 + corner];
+        v[corner] = Vec3(vertices[vi * 3], vertices[vi * 3 + 1], vertices[vi * 3 + 2]);
+        v[corner] = v[corner].scale(scaleFactor).subtract(halfUnit);
+      }
+
+      Vec3 normal = (v[1] - v[0]).cross(v[2] - v[0]);
+      normal.normalize();
+
+      for (int corner = 0; corner < 3; corner++)
+        putVertex(vertexData + (face * 3 + corner) * floatsPerVertex, v[corner], normal);
+    }
+  });
+}
+
+void defaultScene(SceneDescription& scene)
+{
+  gridScene(1, scene);
+}
+
+void gridScene(int count, SceneDescription& scene)
+{
+  // Far enough apart that neighbors don't touch however they're turned
+  const float spacing = 1.25f;
+  scene.meshPaths.assign(1, modelPath);
+  scene.instances.clear();
+  int side = (int)ceil(sqrt((double)count));
+  for (int i = 0; i < count; i++) {
+    SceneInstance instance;
+    instance.mesh = 0;
+    instance.position = Vec3((i % side - (side - 1) * 0.5f) * spacing, 0.0f,
+        (i / side - (side - 1) * 0.5f) * spacing);
+    instance.yaw = (float)(i * 137 % 360);
+    instance.scale = 1.0f;
+    scene.instances.push_back(instance);
+  }
+}
+
+bool loadSceneFile(const char* path, SceneDescription& scene)
+{
+  std::ifstream file(path);
+  if (!file) {
+    fprintf(stderr, "Couldn't open %s\n", path);
+    return false;
+  }
+
+  scene.meshPaths.clear();
+  scene.instances.clear();
+  vector<string> meshNames;
+  string line;
+  for (int lineNumber = 1; std::getline(file, line); lineNumber++) {
+    size_t comment = line.find('#');
+    if (comment != string::npos)
+      line.erase(comment);
+    std::istringstream words(line);
+    string keyword, name;
+    if (!(words >> keyword))
+      continue;
+
+    if (keyword == "mesh") {
+      string meshPath;
+      if (!(words >> name >> meshPath)) {
+        fprintf(stderr, "%s:%d: expected mesh NAME PATH\n", path, lineNumber);
+        return false;
+      }
+      meshNames.push_back(name);
+      scene.meshPaths.push_back(meshPath);
+    }
+    else if (keyword == "instance") {
+      SceneInstance instance;
+      instance.yaw = 0.0f;
+      instance.scale = 1.0f;
+      if (!(words >> name >> instance.position.x >> instance.position.y >> instance.position.z)) {
+        fprintf(stderr, "%s:%d: expected instance NAME X Y Z [YAW [SCALE]]\n", path, lineNumber);
+        return false;
+      }
+      if (words >> instance.yaw)
+        words >> instance.scale;
+      instance.mesh = -1;
+      for (size_t i = 0; i < meshNames.size(); i++) {
+        if (meshNames[i] == name)
+          instance.mesh = (int)i;
+      }
+      if (instance.mesh < 0) {
+        fprintf(stderr, "%s:%d: no mesh named %s\n", path, lineNumber, name.c_str());
+        return false;
+      }
+      scene.instances.push_back(instance);
+    }
+    else {
+      fprintf(stderr, "%s:%d: unknown keyword %s\n", path, lineNumber, keyword.c_str());
+      return false;
+    }
+  }
+
+  if (scene.instances.empty()) {
+    fprintf(stderr, "%s has no instances\n", path);
+    return false;
+  }
+  return true;
+}
+
+Mat4 instanceTransform(const SceneInstance& instance)
+{
+  const static double pi = acos(0.0) * 2;
+  return Mat4::translationMatrix(instance.position.x, instance.position.y, instance.position.z) *
+      Mat4::rotationAboutYMatrix((float)(instance.yaw * pi / 180.0)) *
+      Mat4::scalingMatrix(instance.scale, instance.scale, instance.scale);
+}
+
+float floorScale(const SceneDescription& scene)
+{
+  // The floor's half width, and how far a model reaches from its origin
+  const float floorExtent = 10.0f;
+  const float modelExtent = 1.0f;
+  float extent = 0.0f;
+  for (size_t i = 0; i < scene.instances.size(); i++) {
+    const SceneInstance& instance = scene.instances[i];
+    float reach = modelExtent * instance.scale;
+    extent = std::max(extent, std::max(fabsf(instance.position.x), fabsf(instance.position.z)) + reach);
+  }
+  return std::max(1.0f, extent / floorExtent);
+}
+
+void sceneMatrices(const Vec3& eye, const Vec3& lookat, Mat4& view, Mat4& proj)
+{
+  const static double pi = acos(0.0) * 2;
+  Mat4 viewNorm;
+  Mat4::lookAtMatrix(eye, lookat, Vec3(0, 1, 0), view, viewNorm);
+  proj = Mat4::perspectiveMatrix(pi * 0.5, 1.333333f, 0.1f, 1000.0f);
+}
+
+void occlusionProjection(Mat4& proj, Mat4& invProj)
+{
+  static const double pi = acos(0.0) * 0.5;
+  proj = Mat4::perspectiveMatrix(pi * 0.5, 1.333333f, 0.1f, 1000.0f);
+  invProj = Mat4::perspectiveInvMatrix(pi * 0.5, 1.3333333f, 0.1f, 1000.0f);
+}
@@ -0,0 +1,140 @@
+// File: scene.h
+//
+// What gets drawn, apart from how: the bunny and floor geometry, their
+// materials, the light and the camera transforms. None of it needs GL, so
+// the GL renderer (render.cpp) and the software rasterizer (rasterizer.cpp)
+// draw exactly the same scene.
+
+#ifndef SP_SCENE_H_
+#define SP_SCENE_H_
+
+#include <string>
+#include <vector>
+
+#include "arena.h"
+#include "vec3.h"
+#include "mat4.h"
+#include "meshlet.h"
+
+// Where the model is, relative to FinalProject/
+const char* const modelPath = "resources/bun_zipper.ply";
+
+// Vertex data is interleaved position and normal, 6 floats a vertex, with
+// every 3 vertices a triangle
+const int floatsPerVertex = 6;
+
+// Reads a PLY model into "vertexData", scaled to fit a unit cube, with its
+// base moved down by half a unit and one flat normal per triangle. Returns
+// false (leaving "vertexData" empty) if it can't be read.
+bool loadModelMesh(const char* path, std::vector<float>& vertexData);
+
+// One level of detail of a model: vertex data as loadModelMesh() makes it,
+// but with the triangles in meshlet order, its meshlets in the same units,
+// and how far its surface may be from the full model's
+struct MeshLOD
+{
+  ArenaVector<float> vertexData;
+  std::vector<Meshlet> meshlets;
+  float error;
+};
+
+// Coarser levels stop at about this many triangles
+const int minLODTriangles = 256;
+
+// Reads a PLY model as loadModelMesh() does into "lods"[0], followed by
+// simplified versions of it (simplify.h), each with half the triangles of
+// the one before, up to "maxLevels" levels in all. Every level is split into
+// meshlets, which are kept in "meshletCacheDir" (see buildMeshletsCached()).
+// The full mesh is built as a job (jobs.h) alongside the simplification.
+// The levels' vertex data goes in "arena"; everything else the load needs,
+// rply's memory included, comes from an arena of its own that's released
+// before returning.
+bool loadModelLODs(const char* path, int maxLevels, const char* meshletCacheDir, Arena& arena,
+    std::vector<MeshLOD>& lods);
+
+// How many triangles a PLY model has, from its header alone, or -1 if it
+// can't be read
+long modelTriangleCount(const char* path);
+
+// What loadModelMesh() does once the file is read: "vertices" are x, y, z
+// triples, every 3 of "faceIndices" a triangle, and "maxValue" the largest
+// absolute coordinate. "vertexData" needs room for floatsPerVertex floats
+// for each of "faceIndices".
+void buildModelVertexData(const ArenaVector<float>& vertices, const ArenaVector<unsigned int>& faceIndices,
+    float maxValue, float* vertexData);
+
+// Two triangles, facing up, under the model
+const int floorVertexCount = 6;
+extern const float floorVertexData[floorVertexCount * floatsPerVertex];
+
+// Phong coefficients for phong.frag
+struct Material
+{
+  float ambient[3];
+  float diffuse[3];
+  float specular[3];
+  float shininess;
+};
+
+extern const Material modelMaterial;
+extern const Material floorMaterial;
+
+// The scene's one light. Its position is in view space.
+struct Light
+{
+  float ambient[3];
+  float position[3];
+  float diffuse[3];
+  float specular[3];
+};
+
+extern const Light sceneLight;
+
+// One placement of a mesh: scaled (uniformly) by "scale", turned "yaw"
+// degrees about the vertical axis, then moved to "position"
+struct SceneInstance
+{
+  int mesh;
+  Vec3 position;
+  float yaw;
+  float scale;
+};
+
+// The models to draw, each loaded once, and every instance of them. The
+// floor isn't part of it; it's always drawn, stretched to fit the instances.
+struct SceneDescription
+{
+  std::vector<std::string> meshPaths;
+  std::vector<SceneInstance> instances;
+};
+
+// The bunny, once, at the origin
+void defaultScene(SceneDescription& scene);
+
+// "count" bunnies on a square grid centered on the origin, each turned a
+// different way (apart from the first, so a count of 1 is the default scene)
+void gridScene(int count, SceneDescription& scene);
+
+// Reads a scene file. Each line is one of
+//   mesh NAME PATH                      (PATH relative to FinalProject/)
+//   instance NAME X Y Z [YAW [SCALE]]   (NAME a mesh named earlier)
+// and # starts a comment. Prints what's wrong and returns false if it can't
+// be read or describes no instances.
+bool loadSceneFile(const char* path, SceneDescription& scene);
+
+// The model transform of "instance"
+Mat4 instanceTransform(const SceneInstance& instance);
+
+// How much the floor is stretched in x and z to reach past every instance.
+// Never less than 1, so the default scene's floor is unchanged.
+float floorScale(const SceneDescription& scene);
+
+// The camera and projection transforms the scene is drawn with
+void sceneMatrices(const Vec3& eye, const Vec3& lookat, Mat4& view, Mat4& proj);
+
+// The projection the occlusion pass unprojects depth with. It has a much
+// narrower field of view than the one the scene is drawn with; the
+// occlusion pass has always been tuned against it, so it stays.
+void occlusionProjection(Mat4& proj, Mat4& invProj);
+
+#endif // SP_SCENE_H_
@@ -47,7 +47,8 @@ GLuint loadShader(GLenum shaderType, const char* filename)
     glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &result);
     GLchar* compilationLog = new char[result];
     glGetShaderInfoLog(shader, result, &result, compilationLog);
-    const char* whichShader = (shaderType == GL_VERTEX_SHADER ? "Vertex" : "Fragment");
+    const char* whichShader = (shaderType == GL_VERTEX_SHADER ? "Vertex" :
+        (shaderType == GL_COMPUTE_SHADER ? "Compute" : "Fragment"));
     fprintf(stderr, "%s shader compilation failed in file %s\nLog: %s\n", whichShader, filename, compilationLog);
     delete[] compilationLog;
     exit(1);
@@ -56,13 +57,8 @@ GLuint loadShader(GLenum shaderType, const char* filename)
   return shader;
 }
 
-GLuint createProgram(GLuint vertexShader, GLuint fragShader)
+static void checkLinkStatus(GLuint prog)
 {
-  GLuint prog = glCreateProgram();
-  glAttachShader(prog, vertexShader);
-  glAttachShader(prog, fragShader);
-  glLinkProgram(prog);
-
   // Check link status and log
   GLint result;
   glGetProgramiv(prog, GL_LINK_STATUS, &result);
@@ -75,6 +71,27 @@ GLuint createProgram(GLuint vertexShader, GLuint fragShader)
     delete[] linkLog;
     exit(1);
   }
+}
+
+GLuint createProgram(GLuint vertexShader, GLuint fragShader)
+{
+  GLuint prog = glCreateProgram();
+  glAttachShader(prog, vertexShader);
+  glAttachShader(prog, fragShader);
+  glLinkProgram(prog);
+
+  checkLinkStatus(prog);
+
+  return prog;
+}
+
+GLuint createComputeProgram(GLuint computeShader)
+{
+  GLuint prog = glCreateProgram();
+  glAttachShader(prog, computeShader);
+  glLinkProgram(prog);
+
+  checkLinkStatus(prog);
 
   return prog;
 }
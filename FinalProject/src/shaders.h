@@ -7,4 +7,6 @@ GLuint loadShader(GLenum shaderType, const char* filename);
 
 GLuint createProgram(GLuint vertexShader, GLuint fragShader);
 
+GLuint createComputeProgram(GLuint computeShader);
+
 #endif // SP_SHADERS_H_
\ No newline at end of file
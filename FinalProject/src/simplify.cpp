@@ -0,0 +1,468 @@
+#include "simplify.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+
+#include "trace.h"
+
+using std::vector;
+
+namespace {
+
+// How much more a boundary edge's plane counts than a triangle's, so holes
+// and open edges keep their shape
+const double boundaryWeight = 100.0;
+// Collapses that turn a triangle's normal by more than about 80 degrees are
+// skipped, which also keeps triangles from flipping over
+const double minNormalCos = 0.2;
+// Below this, a vertex's quadric is too flat to place it at its minimum
+const double minDeterminant = 1e-9;
+
+// The symmetric matrix of a sum of squared plane distances
+struct Quadric
+{
+  double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+};
+
+void clearQuadric(Quadric& q)
+{
+  q.a2 = q.ab = q.ac = q.ad = q.b2 = q.bc = q.bd = q.c2 = q.cd = q.d2 = 0.0;
+}
+
+// Adds "weight" times the squared distance to the plane a*x + b*y + c*z + d = 0
+void addPlane(Quadric& q, double a, double b, double c, double d, double weight)
+{
+  q.a2 += weight * a * a; q.ab += weight * a * b; q.ac += weight * a * c; q.ad += weight * a * d;
+  q.b2 += weight * b * b; q.bc += weight * b * c; q.bd += weight * b * d;
+  q.c2 += weight * c * c; q.cd += weight * c * d;
+  q.d2 += weight * d * d;
+}
+
+void addQuadric(Quadric& q, const Quadric& other)
+{
+  q.a2 += other.a2; q.ab += other.ab; q.ac += other.ac; q.ad += other.ad;
+  q.b2 += other.b2; q.bc += other.bc; q.bd += other.bd;
+  q.c2 += other.c2; q.cd += other.cd;
+  q.d2 += other.d2;
+}
+
+double evaluate(const Quadric& q, const double* p)
+{
+  double x = p[0], y = p[1], z = p[2];
+  return q.a2 * x * x + 2.0 * q.ab * x * y + 2.0 * q.ac * x * z + 2.0 * q.ad * x
+       + q.b2 * y * y + 2.0 * q.bc * y * z + 2.0 * q.bd * y
+       + q.c2 * z * z + 2.0 * q.cd * z + q.d2;
+}
+
+// Where "q" is smallest, if it has a single minimum
+bool minimize(const Quadric& q, double* p)
+{
+  double det = q.a2 * (q.b2 * q.c2 - q.bc * q.bc) - q.ab * (q.ab * q.c2 - q.bc * q.ac) + q.ac * (q.ab * q.bc - q.b2 * q.ac);
+  if (fabs(det) < minDeterminant)
+    return false;
+  // Cramer's rule on A p = -b
+  double bx = -q.ad, by = -q.bd, bz = -q.cd;
+  p[0] = (bx * (q.b2 * q.c2 - q.bc * q.bc) - q.ab * (by * q.c2 - q.bc * bz) + q.ac * (by * q.bc - q.b2 * bz)) / det;
+  p[1] = (q.a2 * (by * q.c2 - q.bc * bz) - bx * (q.ab * q.c2 - q.bc * q.ac) + q.ac * (q.ab * bz - by * q.ac)) / det;
+  p[2] = (q.a2 * (q.b2 * bz - q.bc * by) - q.ab * (q.ab * bz - by * q.ac) + bx * (q.ab * q.bc - q.b2 * q.ac)) / det;
+  return true;
+}
+
+void cross(const double* u, const double* v, double* result)
+{
+  result[0] = u[1] * v[2] - u[2] * v[1];
+  result[1] = u[2] * v[0] - u[0] * v[2];
+  result[2] = u[0] * v[1] - u[1] * v[0];
+}
+
+// The (unnormalized) normal of the triangle "p0", "p1", "p2"
+void triangleNormal(const double* p0, const double* p1, const double* p2, double* normal)
+{
+  double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+  double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+  cross(e1, e2, normal);
+}
+
+double length(const double* v)
+{
+  return sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+}
+
+// A candidate collapse of edge "from"-"to" into "to", moved to "position".
+// Stale once either vertex has changed since ("versions" no longer match).
+struct Collapse
+{
+  double cost;
+  double position[3];
+  unsigned int from, to;
+  unsigned int fromVersion, toVersion;
+
+  bool operator<(const Collapse& other) const
+  {
+    // std::priority_queue puts the largest first
+    return cost > other.cost;
+  }
+};
+
+class Simplifier
+{
+public:
+  Simplifier(const ArenaVector<float>& vertices, const ArenaVector<unsigned int>& indices, Arena& arena);
+  void run(const vector<size_t>& targetTriangles, vector<SimplifiedMesh>& levels);
+
+private:
+  void buildQuadrics();
+  void pushCollapse(unsigned int a, unsigned int b);
+  bool linkConditionHolds(unsigned int a, unsigned int b);
+  bool keepsOrientation(unsigned int vertex, unsigned int other, const double* position);
+  void collapse(const Collapse& c);
+  void snapshot(SimplifiedMesh& mesh) const;
+
+  // Everything below, and the snapshots, are in the arena
+  ArenaAllocator<float> allocator;
+  ArenaVector<double> positions;
+  ArenaVector<unsigned int> faces;
+  ArenaVector<char> faceAlive;
+  size_t aliveFaces;
+  // The faces around each vertex, which may include dead ones
+  ArenaVector<ArenaVector<unsigned int> > vertexFaces;
+  ArenaVector<Quadric> quadrics;
+  ArenaVector<unsigned int> versions;
+  ArenaVector<char> vertexAlive;
+  std::priority_queue<Collapse, ArenaVector<Collapse> > queue;
+  double maxCost;
+  // Scratch for the link condition
+  ArenaVector<unsigned int> neighborsA, neighborsB;
+};
+
+Simplifier::Simplifier(const ArenaVector<float>& vertices, const ArenaVector<unsigned int>& indices, Arena& arena)
+  : allocator(&arena), positions(vertices.begin(), vertices.end(), allocator),
+    faces(indices.begin(), indices.end(), allocator), faceAlive(indices.size() / 3, 1, allocator),
+    aliveFaces(indices.size() / 3),
+    vertexFaces(vertices.size() / 3, ArenaVector<unsigned int>(allocator), allocator),
+    quadrics(vertices.size() / 3, Quadric(), allocator), versions(vertices.size() / 3, 0, allocator),
+    vertexAlive(vertices.size() / 3, 1, allocator),
+    queue(std::less<Collapse>(), ArenaVector<Collapse>(allocator)), maxCost(0.0),
+    neighborsA(allocator), neighborsB(allocator)
+{
+  // Triangles with a repeated corner have no plane and nothing to lose
+  size_t faceCount = faces.size() / 3;
+  for (size_t face = 0; face < faceCount; face++) {
+    const unsigned int* f = &faces[face * 3];
+    if (f[0] == f[1] || f[1] == f[2] || f[2] == f[0]) {
+      faceAlive[face] = 0;
+      aliveFaces--;
+    }
+  }
+
+  // Each vertex's faces get exactly the room they need, as an arena can't
+  // reuse what growing leaves behind
+  ArenaVector<unsigned int> valences(vertexFaces.size(), 0, allocator);
+  for (size_t face = 0; face < faceCount; face++) {
+    if (faceAlive[face]) {
+      for (int corner = 0; corner < 3; corner++)
+        valences[faces[face * 3 + corner]]++;
+    }
+  }
+  for (size_t v = 0; v < vertexFaces.size(); v++)
+    vertexFaces[v].reserve(valences[v]);
+  for (size_t face = 0; face < faceCount; face++) {
+    if (faceAlive[face]) {
+      for (int corner = 0; corner < 3; corner++)
+        vertexFaces[faces[face * 3 + corner]].push_back((unsigned int)face);
+    }
+  }
+}
+
+void Simplifier::buildQuadrics()
+{
+  for (size_t v = 0; v < quadrics.size(); v++)
+    clearQuadric(quadrics[v]);
+
+  // Every edge once, as (smaller, larger, face), to find the boundary
+  struct Edge
+  {
+    unsigned int a, b, face;
+    bool operator<(const Edge& other) const
+    {
+      return a < other.a || (a == other.a && b < other.b);
+    }
+  };
+  ArenaVector<Edge> edges(allocator);
+  edges.reserve(aliveFaces * 3);
+
+  size_t faceCount = faces.size() / 3;
+  for (size_t face = 0; face < faceCount; face++) {
+    if (!faceAlive[face])
+      continue;
+    const unsigned int* f = &faces[face * 3];
+    double normal[3];
+    triangleNormal(&positions[f[0] * 3], &positions[f[1] * 3], &positions[f[2] * 3], normal);
+    double len = length(normal);
+    if (len > 0.0) {
+      double a = normal[0] / len, b = normal[1] / len, c = normal[2] / len;
+      const double* p = &positions[f[0] * 3];
+      double d = -(a * p[0] + b * p[1] + c * p[2]);
+      for (int corner = 0; corner < 3; corner++)
+        addPlane(quadrics[f[corner]], a, b, c, d, 1.0);
+    }
+    for (int corner = 0; corner < 3; corner++) {
+      Edge edge = { std::min(f[corner], f[(corner + 1) % 3]), std::max(f[corner], f[(corner + 1) % 3]), (unsigned int)face };
+      edges.push_back(edge);
+    }
+  }
+  std::sort(edges.begin(), edges.end());
+
+  // An edge only one face has is on the boundary. Its plane goes through the
+  // edge, at right angles to the face.
+  for (size_t i = 0; i < edges.size(); ) {
+    size_t j = i + 1;
+    while (j < edges.size() && edges[j].a == edges[i].a && edges[j].b == edges[i].b)
+      j++;
+    if (j - i == 1) {
+      const unsigned int* f = &faces[edges[i].face * 3];
+      double faceNormal[3];
+      triangleNormal(&positions[f[0] * 3], &positions[f[1] * 3], &positions[f[2] * 3], faceNormal);
+      const double* pa = &positions[edges[i].a * 3];
+      const double* pb = &positions[edges[i].b * 3];
+      double along[3] = { pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2] };
+      double normal[3];
+      cross(along, faceNormal, normal);
+      double len = length(normal);
+      if (len > 0.0) {
+        double a = normal[0] / len, b = normal[1] / len, c = normal[2] / len;
+        double d = -(a * pa[0] + b * pa[1] + c * pa[2]);
+        addPlane(quadrics[edges[i].a], a, b, c, d, boundaryWeight);
+        addPlane(quadrics[edges[i].b], a, b, c, d, boundaryWeight);
+      }
+    }
+    pushCollapse(edges[i].a, edges[i].b);
+    i = j;
+  }
+}
+
+// Queues the cheaper way of collapsing edge "a"-"b"
+void Simplifier::pushCollapse(unsigned int a, unsigned int b)
+{
+  Quadric q = quadrics[a];
+  addQuadric(q, quadrics[b]);
+
+  Collapse c;
+  c.from = a;
+  c.to = b;
+  c.fromVersion = versions[a];
+  c.toVersion = versions[b];
+  if (minimize(q, c.position)) {
+    c.cost = evaluate(q, c.position);
+  }
+  else {
+    // Too flat to have one best place; try the ends and the middle
+    const double* pa = &positions[a * 3];
+    const double* pb = &positions[b * 3];
+    double middle[3] = { (pa[0] + pb[0]) * 0.5, (pa[1] + pb[1]) * 0.5, (pa[2] + pb[2]) * 0.5 };
+    const double* candidates[3] = { pa, pb, middle };
+    c.cost = -1.0;
+    for (int i = 0; i < 3; i++) {
+      double cost = evaluate(q, candidates[i]);
+      if (c.cost < 0.0 || cost < c.cost) {
+        c.cost = cost;
+        c.position[0] = candidates[i][0];
+        c.position[1] = candidates[i][1];
+        c.position[2] = candidates[i][2];
+      }
+    }
+  }
+  c.cost = std::max(c.cost, 0.0);
+  queue.push(c);
+}
+
+// The vertices sharing a face with "vertex", sorted
+void gatherNeighbors(const ArenaVector<unsigned int>& faces, const ArenaVector<char>& faceAlive,
+    const ArenaVector<unsigned int>& vertexFaces, unsigned int vertex, ArenaVector<unsigned int>& neighbors)
+{
+  neighbors.clear();
+  for (size_t i = 0; i < vertexFaces.size(); i++) {
+    unsigned int face = vertexFaces[i];
+    if (!faceAlive[face])
+      continue;
+    for (int corner = 0; corner < 3; corner++)
+      if (faces[face * 3 + corner] != vertex)
+        neighbors.push_back(faces[face * 3 + corner]);
+  }
+  std::sort(neighbors.begin(), neighbors.end());
+  neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+}
+
+// Collapsing an edge is only safe if the vertices next to both ends are just
+// the ones across the edge's faces; otherwise the surface gets pinched
+bool Simplifier::linkConditionHolds(unsigned int a, unsigned int b)
+{
+  gatherNeighbors(faces, faceAlive, vertexFaces[a], a, neighborsA);
+  gatherNeighbors(faces, faceAlive, vertexFaces[b], b, neighborsB);
+  if (!std::binary_search(neighborsA.begin(), neighborsA.end(), b))
+    return false;
+
+  int shared = 0;
+  for (size_t i = 0, j = 0; i < neighborsA.size() && j < neighborsB.size(); ) {
+    if (neighborsA[i] < neighborsB[j]) {
+      i++;
+    }
+    else if (neighborsB[j] < neighborsA[i]) {
+      j++;
+    }
+    else {
+      shared++;
+      i++;
+      j++;
+    }
+  }
+  int edgeFaces = 0;
+  const ArenaVector<unsigned int>& around = vertexFaces[a];
+  for (size_t i = 0; i < around.size(); i++) {
+    const unsigned int* f = &faces[around[i] * 3];
+    if (faceAlive[around[i]] && (f[0] == b || f[1] == b || f[2] == b))
+      edgeFaces++;
+  }
+  return shared == edgeFaces;
+}
+
+// Whether moving "vertex" to "position" leaves the faces around it (other
+// than those it shares with "other", which go away) facing about the same way
+bool Simplifier::keepsOrientation(unsigned int vertex, unsigned int other, const double* position)
+{
+  const ArenaVector<unsigned int>& around = vertexFaces[vertex];
+  for (size_t i = 0; i < around.size(); i++) {
+    unsigned int face = around[i];
+    if (!faceAlive[face])
+      continue;
+    const unsigned int* f = &faces[face * 3];
+    if (f[0] == other || f[1] == other || f[2] == other)
+      continue;
+    const double* corners[3];
+    for (int corner = 0; corner < 3; corner++)
+      corners[corner] = &positions[f[corner] * 3];
+    double before[3];
+    triangleNormal(corners[0], corners[1], corners[2], before);
+    for (int corner = 0; corner < 3; corner++)
+      if (f[corner] == vertex)
+        corners[corner] = position;
+    double after[3];
+    triangleNormal(corners[0], corners[1], corners[2], after);
+    double lengths = length(before) * length(after);
+    if (lengths <= 0.0)
+      return false;
+    if ((before[0] * after[0] + before[1] * after[1] + before[2] * after[2]) < minNormalCos * lengths)
+      return false;
+  }
+  return true;
+}
+
+// Merges "from" into "to", at the collapse's position
+void Simplifier::collapse(const Collapse& c)
+{
+  unsigned int from = c.from, to = c.to;
+  positions[to * 3] = c.position[0];
+  positions[to * 3 + 1] = c.position[1];
+  positions[to * 3 + 2] = c.position[2];
+  addQuadric(quadrics[to], quadrics[from]);
+  vertexAlive[from] = 0;
+  versions[from]++;
+  versions[to]++;
+  maxCost = std::max(maxCost, c.cost);
+
+  // Faces across the edge go; the rest of "from"'s become "to"'s
+  ArenaVector<unsigned int>& fromFaces = vertexFaces[from];
+  ArenaVector<unsigned int>& toFaces = vertexFaces[to];
+  for (size_t i = 0; i < fromFaces.size(); i++) {
+    unsigned int face = fromFaces[i];
+    if (!faceAlive[face])
+      continue;
+    unsigned int* f = &faces[face * 3];
+    if (f[0] == to || f[1] == to || f[2] == to) {
+      faceAlive[face] = 0;
+      aliveFaces--;
+      continue;
+    }
+    for (int corner = 0; corner < 3; corner++)
+      if (f[corner] == from)
+        f[corner] = to;
+    toFaces.push_back(face);
+  }
+  ArenaVector<unsigned int>(allocator).swap(fromFaces);
+  size_t kept = 0;
+  for (size_t i = 0; i < toFaces.size(); i++)
+    if (faceAlive[toFaces[i]])
+      toFaces[kept++] = toFaces[i];
+  toFaces.resize(kept);
+
+  // Every edge out of "to" costs something different now
+  gatherNeighbors(faces, faceAlive, toFaces, to, neighborsA);
+  for (size_t i = 0; i < neighborsA.size(); i++)
+    pushCollapse(to, neighborsA[i]);
+}
+
+// Copies out the live faces and the vertices they use
+void Simplifier::snapshot(SimplifiedMesh& mesh) const
+{
+  ArenaVector<unsigned int> remap(vertexAlive.size(), ~0u, allocator);
+  // Reserved up front, for the same reason as each vertex's faces
+  mesh.vertices = ArenaVector<float>(allocator);
+  mesh.indices = ArenaVector<unsigned int>(allocator);
+  mesh.vertices.reserve(std::count(vertexAlive.begin(), vertexAlive.end(), 1) * 3);
+  mesh.indices.reserve(aliveFaces * 3);
+  size_t faceCount = faces.size() / 3;
+  for (size_t face = 0; face < faceCount; face++) {
+    if (!faceAlive[face])
+      continue;
+    for (int corner = 0; corner < 3; corner++) {
+      unsigned int vertex = faces[face * 3 + corner];
+      if (remap[vertex] == ~0u) {
+        remap[vertex] = (unsigned int)(mesh.vertices.size() / 3);
+        for (int axis = 0; axis < 3; axis++)
+          mesh.vertices.push_back((float)positions[vertex * 3 + axis]);
+      }
+      mesh.indices.push_back(remap[vertex]);
+    }
+  }
+  mesh.error = (float)sqrt(maxCost);
+}
+
+void Simplifier::run(const vector<size_t>& targetTriangles, vector<SimplifiedMesh>& levels)
+{
+  levels.clear();
+  buildQuadrics();
+
+  size_t target = 0;
+  while (target < targetTriangles.size()) {
+    if (aliveFaces <= targetTriangles[target]) {
+      levels.push_back(SimplifiedMesh());
+      snapshot(levels.back());
+      target++;
+      continue;
+    }
+    if (queue.empty())
+      break;
+
+    Collapse c = queue.top();
+    queue.pop();
+    if (!vertexAlive[c.from] || !vertexAlive[c.to] || versions[c.from] != c.fromVersion || versions[c.to] != c.toVersion)
+      continue;
+    if (!linkConditionHolds(c.from, c.to))
+      continue;
+    if (!keepsOrientation(c.from, c.to, c.position) || !keepsOrientation(c.to, c.from, c.position))
+      continue;
+    collapse(c);
+  }
+}
+
+} // namespace
+
+void simplifyMesh(const ArenaVector<float>& vertices, const ArenaVector<unsigned int>& indices,
+    const vector<size_t>& targetTriangles, Arena& arena, vector<SimplifiedMesh>& levels)
+{
+  TRACE_ZONE("simplifyMesh");
+  Simplifier simplifier(vertices, indices, arena);
+  simplifier.run(targetTriangles, levels);
+}
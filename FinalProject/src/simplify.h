@@ -0,0 +1,37 @@
+// File: simplify.h
+//
+// Mesh simplification by edge collapse (Garland and Heckbert's quadric error
+// metric). Each vertex carries the sum of the squared distances to the
+// planes of the triangles around it; the edge whose collapse adds the least
+// to that goes first, and the merged vertex goes wherever the sum is
+// smallest. Collapses that would fold a triangle over or pinch the surface
+// are skipped, and boundary edges are held in place by planes across them.
+
+#ifndef SP_SIMPLIFY_H_
+#define SP_SIMPLIFY_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "arena.h"
+
+// An indexed triangle mesh: x, y, z triples, and every 3 indices a triangle.
+// "error" is how far the surface may have moved from the original's, in the
+// units of the coordinates: the square root of the largest quadric error of
+// any collapse so far. Zero for an unsimplified mesh.
+struct SimplifiedMesh
+{
+  ArenaVector<float> vertices;
+  ArenaVector<unsigned int> indices;
+  float error;
+};
+
+// Simplifies "vertices" and "indices" in one pass, taking a copy each time
+// the triangle count gets down to the next of "targetTriangles" (which must
+// be decreasing). Stops early if no more edges can be collapsed, so "levels"
+// may come back with fewer meshes than there were targets. The copies, and
+// everything the simplifier works with along the way, are kept in "arena".
+void simplifyMesh(const ArenaVector<float>& vertices, const ArenaVector<unsigned int>& indices,
+    const std::vector<size_t>& targetTriangles, Arena& arena, std::vector<SimplifiedMesh>& levels);
+
+#endif // SP_SIMPLIFY_H_
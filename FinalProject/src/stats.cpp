@@ -0,0 +1,39 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+
+using std::vector;
+
+namespace {
+
+// Nearest-rank percentile of already sorted samples
+double percentile(const vector<double>& sorted, double p)
+{
+  int rank = (int)ceil(p / 100.0 * sorted.size());
+  if (rank < 1)
+    rank = 1;
+  return sorted[rank - 1];
+}
+
+}
+
+SampleStats summarizeSamples(vector<double> samples)
+{
+  SampleStats stats = { 0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+  if (samples.empty())
+    return stats;
+
+  std::sort(samples.begin(), samples.end());
+  double total = 0.0;
+  for (vector<double>::size_type i = 0; i < samples.size(); i++)
+    total += samples[i];
+
+  stats.count = (int)samples.size();
+  stats.mean = total / samples.size();
+  stats.p50 = percentile(samples, 50.0);
+  stats.p95 = percentile(samples, 95.0);
+  stats.p99 = percentile(samples, 99.0);
+  stats.max = samples.back();
+  return stats;
+}
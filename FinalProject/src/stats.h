@@ -0,0 +1,21 @@
+#ifndef SP_STATS_H_
+#define SP_STATS_H_
+
+#include <vector>
+
+// Summary of a set of timings. Percentiles are nearest-rank, so each one is
+// an actual sample.
+struct SampleStats
+{
+  int count;
+  double mean;
+  double p50;
+  double p95;
+  double p99;
+  double max;
+};
+
+// Summarizes "samples". Everything is 0 if there are none.
+SampleStats summarizeSamples(std::vector<double> samples);
+
+#endif // SP_STATS_H_
@@ -0,0 +1,213 @@
+#include "streaming.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <mutex>
+
+#include "jobs.h"
+#include "trace.h"
+#include "walltime.h"
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// Some of a mesh's data on its way to the GPU
+struct Upload
+{
+  GLuint buffer;
+  size_t offset;
+  // Released, if nothing else holds it, once "data" is in
+  std::shared_ptr<Arena> arena;
+  ArenaVector<float> data;
+  // Bytes already copied in
+  size_t done;
+  int tag;
+};
+
+// Shared with the loading jobs
+vector<Job> loadJobs;
+vector<string> workPaths;
+int workLevels = 1;
+string workCacheDir;
+std::mutex finishedMutex;
+std::deque<StreamedMesh> finishedMeshes;
+vector<string> failedPaths;
+
+int meshesTaken = 0;
+
+std::deque<Upload> uploads;
+size_t uploadBudget = 0;
+// The staging ring: stagingRingSize slots of uploadBudget bytes, mapped for
+// good, and the fence after the copies out of each
+bool persistent = false;
+GLuint stagingBuf = 0;
+unsigned char* stagingMemory = NULL;
+GLsync slotFences[stagingRingSize];
+int currentSlot = 0;
+
+StreamingStats stats;
+
+void loadMesh(int index)
+{
+  StreamedMesh mesh;
+  mesh.mesh = index;
+  mesh.arena = std::make_shared<Arena>();
+  const string& path = workPaths[index];
+  bool loaded = loadModelLODs(path.c_str(), workLevels, workCacheDir.c_str(), *mesh.arena, mesh.lods);
+  std::lock_guard<std::mutex> lock(finishedMutex);
+  if (loaded)
+    finishedMeshes.push_back(std::move(mesh));
+  else
+    failedPaths.push_back(path);
+}
+
+} // namespace
+
+void startStreaming(const vector<string>& paths, const vector<int>& meshes, int maxLevels,
+    const string& meshletCacheDir)
+{
+  workPaths = paths;
+  workLevels = maxLevels;
+  workCacheDir = meshletCacheDir;
+  meshesTaken = 0;
+  for (size_t i = 0; i < meshes.size(); i++) {
+    int mesh = meshes[i];
+    loadJobs.push_back(addBackgroundJob([mesh] { loadMesh(mesh); }));
+  }
+}
+
+StreamedMeshResult takeStreamedMesh(StreamedMesh& mesh, string& failedPath)
+{
+  std::lock_guard<std::mutex> lock(finishedMutex);
+  if (!failedPaths.empty()) {
+    failedPath = failedPaths[0];
+    return streamedMeshFailed;
+  }
+  if (finishedMeshes.empty())
+    return noStreamedMesh;
+  mesh = std::move(finishedMeshes.front());
+  finishedMeshes.pop_front();
+  meshesTaken++;
+  return streamedMeshReady;
+}
+
+void initUploads(size_t budgetBytes)
+{
+  // Copy offsets stay float aligned
+  uploadBudget = std::max(budgetBytes / sizeof(float) * sizeof(float), sizeof(float));
+  memset(&stats, 0, sizeof(stats));
+  persistent = false;
+  // GLEW headers from before 1.10, like the one bundled for Visual Studio,
+  // don't have buffer storage; built with them, uploads always go in with
+  // glBufferSubData
+#ifdef GL_ARB_buffer_storage
+  if (!GLEW_VERSION_4_4 && !GLEW_ARB_buffer_storage)
+    return;
+
+  GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  glGenBuffers(1, &stagingBuf);
+  glBindBuffer(GL_COPY_READ_BUFFER, stagingBuf);
+  glBufferStorage(GL_COPY_READ_BUFFER, uploadBudget * stagingRingSize, NULL, flags);
+  stagingMemory = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, uploadBudget * stagingRingSize, flags));
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  if (stagingMemory == NULL) {
+    glDeleteBuffers(1, &stagingBuf);
+    stagingBuf = 0;
+    return;
+  }
+  for (int slot = 0; slot < stagingRingSize; slot++)
+    slotFences[slot] = 0;
+  currentSlot = 0;
+  persistent = true;
+  stats.persistent = true;
+#endif
+}
+
+void queueUpload(GLuint buffer, size_t offset, ArenaVector<float>& data, const std::shared_ptr<Arena>& arena,
+    int tag)
+{
+  uploads.push_back(Upload());
+  Upload& upload = uploads.back();
+  upload.buffer = buffer;
+  upload.offset = offset;
+  upload.arena = arena;
+  upload.data.swap(data);
+  upload.done = 0;
+  upload.tag = tag;
+}
+
+void pumpUploads(vector<int>& finished)
+{
+  if (uploads.empty())
+    return;
+  TRACE_ZONE("pumpUploads");
+  double start = wallClockMs();
+
+  // The GPU may still be copying out of this slot from stagingRingSize frames ago
+  if (persistent && slotFences[currentSlot] != 0) {
+    if (glClientWaitSync(slotFences[currentSlot], 0, 0) == GL_TIMEOUT_EXPIRED) {
+      stats.busyFrames++;
+      return;
+    }
+    glDeleteSync(slotFences[currentSlot]);
+    slotFences[currentSlot] = 0;
+  }
+
+  size_t used = 0;
+  if (persistent)
+    glBindBuffer(GL_COPY_READ_BUFFER, stagingBuf);
+  while (used < uploadBudget && !uploads.empty()) {
+    Upload& upload = uploads.front();
+    size_t total = upload.data.size() * sizeof(float);
+    size_t size = std::min(uploadBudget - used, total - upload.done);
+    const unsigned char* source = reinterpret_cast<const unsigned char*>(upload.data.data()) + upload.done;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, upload.buffer);
+    if (persistent) {
+      size_t stagingOffset = currentSlot * uploadBudget + used;
+      memcpy(stagingMemory + stagingOffset, source, size);
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, stagingOffset, upload.offset + upload.done, size);
+    }
+    else {
+      glBufferSubData(GL_COPY_WRITE_BUFFER, upload.offset + upload.done, size, source);
+    }
+    upload.done += size;
+    used += size;
+    if (upload.done == total) {
+      if (upload.tag >= 0) {
+        finished.push_back(upload.tag);
+        stats.meshesUploaded++;
+      }
+      uploads.pop_front();
+    }
+  }
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  if (persistent) {
+    slotFences[currentSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    currentSlot = (currentSlot + 1) % stagingRingSize;
+  }
+  stats.bytesUploaded += used;
+  stats.uploadFrames++;
+  stats.maxUploadMs = std::max(stats.maxUploadMs, wallClockMs() - start);
+}
+
+bool streamingDone()
+{
+  return meshesTaken == (int)loadJobs.size() && uploads.empty();
+}
+
+void finishStreaming()
+{
+  waitForJobs(loadJobs);
+  loadJobs.clear();
+  meshesTaken = 0;
+}
+
+StreamingStats streamingStats()
+{
+  return stats;
+}
@@ -0,0 +1,84 @@
+// File: streaming.h
+//
+// Loads meshes in the background, so the window keeps drawing while they come
+// in. A background job (jobs.h) for each mesh reads it and builds its levels
+// of detail and meshlets (loadModelLODs()). The render thread takes what they've finished
+// and uploads it a piece at a time, at most a budget of bytes a frame,
+// through a persistently mapped staging ring: each piece is copied into
+// place on the GPU, and a fence on each slot of the ring says when it can be
+// written again. If the slot is still busy, that frame uploads nothing rather
+// than wait. Without buffer storage (GL 4.4) the pieces go straight in with
+// glBufferSubData(), still a budget's worth a frame.
+
+#ifndef SP_STREAMING_H_
+#define SP_STREAMING_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "GL/glew.h"
+
+#include "arena.h"
+#include "scene.h"
+
+// Frames of uploads that can be in flight at once
+const int stagingRingSize = 3;
+
+// A mesh that has finished loading: which of the paths it was, and its
+// levels, with their vertex data in "arena"
+struct StreamedMesh
+{
+  int mesh;
+  std::shared_ptr<Arena> arena;
+  std::vector<MeshLOD> lods;
+};
+
+// Starts loading "paths"[i] for each i in "meshes", with up to "maxLevels"
+// levels of detail and meshlets cached in "meshletCacheDir"
+void startStreaming(const std::vector<std::string>& paths, const std::vector<int>& meshes, int maxLevels,
+    const std::string& meshletCacheDir);
+
+enum StreamedMeshResult { noStreamedMesh, streamedMeshReady, streamedMeshFailed };
+
+// Takes a mesh that has finished loading, if there is one, without waiting.
+// If a mesh couldn't be read, gives back its path in "failedPath" instead,
+// for the caller to report once the background jobs can finish.
+StreamedMeshResult takeStreamedMesh(StreamedMesh& mesh, std::string& failedPath);
+
+// Makes the staging ring, with room for "budgetBytes" a frame. Needs a
+// current context.
+void initUploads(size_t budgetBytes);
+
+// Takes "data" to go into "buffer" at byte "offset", holding on to "arena",
+// which it's in, until all of it has been copied in. "tag" is handed back by
+// pumpUploads() then, unless it's negative.
+void queueUpload(GLuint buffer, size_t offset, ArenaVector<float>& data, const std::shared_ptr<Arena>& arena,
+    int tag);
+
+// Uploads up to the budget of what's queued, unless this frame's slot of the
+// ring is still being copied from, and appends the tags of the uploads that
+// finished to "finished"
+void pumpUploads(std::vector<int>& finished);
+
+// True once every mesh has been taken and every upload has gone in
+bool streamingDone();
+
+// Tidies up once streamingDone()
+void finishStreaming();
+
+struct StreamingStats
+{
+  int meshesUploaded;
+  long long bytesUploaded;
+  // Frames that uploaded something, and those that couldn't because the
+  // ring was busy
+  int uploadFrames;
+  int busyFrames;
+  // The longest a frame spent writing into the ring
+  double maxUploadMs;
+  bool persistent;
+};
+StreamingStats streamingStats();
+
+#endif // SP_STREAMING_H_
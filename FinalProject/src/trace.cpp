@@ -0,0 +1,177 @@
+#include "trace.h"
+
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "walltime.h"
+
+using std::string;
+using std::vector;
+
+bool traceEnabled = false;
+
+namespace {
+
+struct TraceEvent
+{
+  const char* name;
+  double startUs;
+  double durationUs;
+};
+
+// One thread's events, kept as a ring. The lock is only ever contended while
+// writeTrace() copies the events out.
+struct ThreadBuffer
+{
+  std::mutex lock;
+  vector<TraceEvent> events;
+  long long recorded;
+  int tid;
+  string name;
+};
+
+string traceFile;
+double traceStartMs = 0.0;
+
+std::mutex registryLock;
+vector<ThreadBuffer*> threadBuffers;
+// GPU events get their own track
+ThreadBuffer* gpuBuffer = NULL;
+
+thread_local ThreadBuffer* currentBuffer = NULL;
+
+ThreadBuffer* newBuffer(const char* name)
+{
+  ThreadBuffer* buffer = new ThreadBuffer;
+  buffer->events.resize(traceEventsPerThread);
+  buffer->recorded = 0;
+
+  std::lock_guard<std::mutex> guard(registryLock);
+  buffer->tid = (int)threadBuffers.size() + 1;
+  char defaultName[32];
+  sprintf(defaultName, "thread %d", buffer->tid);
+  buffer->name = name != NULL ? name : defaultName;
+  threadBuffers.push_back(buffer);
+  return buffer;
+}
+
+ThreadBuffer* threadBuffer()
+{
+  if (currentBuffer == NULL)
+    currentBuffer = newBuffer(NULL);
+  return currentBuffer;
+}
+
+void record(ThreadBuffer* buffer, const char* name, double startUs, double endUs)
+{
+  std::lock_guard<std::mutex> guard(buffer->lock);
+  TraceEvent& event = buffer->events[buffer->recorded % traceEventsPerThread];
+  event.name = name;
+  event.startUs = startUs;
+  event.durationUs = endUs - startUs;
+  buffer->recorded++;
+}
+
+void writeString(FILE* file, const char* s)
+{
+  fputc('"', file);
+  for (; *s != '\0'; s++) {
+    if (*s == '"' || *s == '\\')
+      fputc('\\', file);
+    fputc(*s, file);
+  }
+  fputc('"', file);
+}
+
+void writeBuffer(FILE* file, ThreadBuffer* buffer, bool& first)
+{
+  std::lock_guard<std::mutex> guard(buffer->lock);
+
+  fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", first ? "" : ",", buffer->tid);
+  writeString(file, buffer->name.c_str());
+  fprintf(file, "}}");
+  first = false;
+
+  long long oldest = buffer->recorded > traceEventsPerThread ? buffer->recorded - traceEventsPerThread : 0;
+  for (long long i = oldest; i < buffer->recorded; i++) {
+    const TraceEvent& event = buffer->events[i % traceEventsPerThread];
+    fprintf(file, ",\n{\"name\":");
+    writeString(file, event.name);
+    fprintf(file, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}", event.startUs, event.durationUs, buffer->tid);
+  }
+}
+
+}
+
+bool parseTraceArgument(int argc, char* argv[], int& i)
+{
+  if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+    traceFile = argv[++i];
+#if SP_TRACE
+    traceEnabled = true;
+    traceStartMs = wallClockMs();
+    gpuBuffer = newBuffer("GPU");
+    currentBuffer = newBuffer("main");
+#else
+    fprintf(stderr, "Built with SP_TRACE=0, ignoring --trace.\n");
+#endif
+    return true;
+  }
+  return false;
+}
+
+void printTraceUsage()
+{
+  fprintf(stderr, "  --trace FILE           record a CPU/GPU timeline, saved to FILE as Chrome trace JSON\n");
+}
+
+void traceSetThreadName(const char* name)
+{
+  if (!traceEnabled)
+    return;
+  ThreadBuffer* buffer = threadBuffer();
+  std::lock_guard<std::mutex> guard(buffer->lock);
+  buffer->name = name;
+}
+
+double traceNowUs()
+{
+  return (wallClockMs() - traceStartMs) * 1000.0;
+}
+
+void traceRecord(const char* name, double startUs, double endUs)
+{
+  record(threadBuffer(), name, startUs, endUs);
+}
+
+void traceRecordGpu(const char* name, double startUs, double endUs)
+{
+  if (gpuBuffer != NULL)
+    record(gpuBuffer, name, startUs, endUs);
+}
+
+bool writeTrace()
+{
+  if (!traceEnabled)
+    return false;
+
+  FILE* file = fopen(traceFile.c_str(), "w");
+  if (file == NULL) {
+    fprintf(stderr, "Couldn't write trace to %s\n", traceFile.c_str());
+    return false;
+  }
+
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  bool first = true;
+  std::lock_guard<std::mutex> guard(registryLock);
+  for (vector<ThreadBuffer*>::size_type i = 0; i < threadBuffers.size(); i++)
+    writeBuffer(file, threadBuffers[i], first);
+  fprintf(file, "\n]}\n");
+  fclose(file);
+
+  printf("Wrote trace to %s\n", traceFile.c_str());
+  return true;
+}
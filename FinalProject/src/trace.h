@@ -0,0 +1,76 @@
+// File: trace.h
+//
+// A small timeline tracer. TRACE_ZONE("name") records how long the rest of
+// the enclosing scope takes on the calling thread; GPU pass times are added
+// to the same timeline by gputimer.cpp. writeTrace() saves everything as
+// Chrome trace JSON, which chrome://tracing and ui.perfetto.dev both open.
+//
+// Tracing is compiled in unless SP_TRACE is defined to 0, and does nothing
+// until traceEnabled is set. A disabled zone costs one branch.
+
+#ifndef SP_TRACE_H_
+#define SP_TRACE_H_
+
+#ifndef SP_TRACE
+#define SP_TRACE 1
+#endif
+
+// Events each thread keeps. Once full, the oldest are overwritten.
+const int traceEventsPerThread = 1 << 16;
+
+extern bool traceEnabled;
+
+// If argv[i] is one of the trace options, applies it, advances i past any
+// value it takes, and returns true
+bool parseTraceArgument(int argc, char* argv[], int& i);
+void printTraceUsage();
+
+// Names the calling thread in the trace
+void traceSetThreadName(const char* name);
+
+// Microseconds since tracing started, on the clock trace events use
+double traceNowUs();
+
+// Records an event that ran from "startUs" to "endUs" on the calling thread.
+// "name" has to outlive the trace (normally a string literal).
+void traceRecord(const char* name, double startUs, double endUs);
+// Records a GPU event, times already converted to traceNowUs()'s clock
+void traceRecordGpu(const char* name, double startUs, double endUs);
+
+// Writes everything recorded so far to the file given with --trace. Returns
+// false if tracing is off or the file can't be written.
+bool writeTrace();
+
+#if SP_TRACE
+
+class TraceZone
+{
+public:
+  explicit TraceZone(const char* name) : name(traceEnabled ? name : 0), start(0.0)
+  {
+    if (this->name != 0)
+      start = traceNowUs();
+  }
+
+  ~TraceZone()
+  {
+    if (name != 0)
+      traceRecord(name, start, traceNowUs());
+  }
+
+private:
+  const char* name;
+  double start;
+};
+
+#define SP_TRACE_CONCAT2(a, b) a##b
+#define SP_TRACE_CONCAT(a, b) SP_TRACE_CONCAT2(a, b)
+#define TRACE_ZONE(name) TraceZone SP_TRACE_CONCAT(traceZone, __LINE__)(name)
+
+#else
+
+#define TRACE_ZONE(name) ((void)0)
+
+#endif
+
+#endif // SP_TRACE_H_
@@ -0,0 +1,286 @@
+#include "update.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+
+namespace {
+
+// Events from the input thread to the update thread. Each index only ever
+// moves forward, and each is written by one side.
+class InputQueue
+{
+public:
+  InputQueue() : head(0), tail(0) { }
+
+  bool push(const InputEvent& event)
+  {
+    unsigned int last = tail.load(std::memory_order_relaxed);
+    if (last - head.load(std::memory_order_acquire) == (unsigned int)inputQueueSize)
+      return false;
+    events[last % inputQueueSize] = event;
+    tail.store(last + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(InputEvent& event)
+  {
+    unsigned int first = head.load(std::memory_order_relaxed);
+    if (first == tail.load(std::memory_order_acquire))
+      return false;
+    event = events[first % inputQueueSize];
+    head.store(first + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  InputEvent events[inputQueueSize];
+  std::atomic<unsigned int> head;
+  std::atomic<unsigned int> tail;
+};
+
+// Cameras from the update thread to the GL thread. The writer fills its back
+// buffer and swaps it for the middle one; the reader swaps its front buffer
+// for the middle one when that's newer. The middle index carries a bit saying
+// whether it's been published since the reader last took it.
+class CameraBuffer
+{
+public:
+  CameraBuffer() : back(0), front(1), middle(2) { }
+
+  void publish(const CameraState& camera)
+  {
+    buffers[back] = camera;
+    back = middle.exchange(back | freshBit) & indexMask;
+  }
+
+  bool take(CameraState& camera)
+  {
+    if ((middle.load() & freshBit) == 0)
+      return false;
+    front = middle.exchange(front) & indexMask;
+    camera = buffers[front];
+    return true;
+  }
+
+private:
+  static const int indexMask = 3;
+  static const int freshBit = 4;
+
+  CameraState buffers[3];
+  // Only the writer uses back, and only the reader front
+  int back;
+  int front;
+  std::atomic<int> middle;
+};
+
+InputQueue inputQueue;
+CameraBuffer cameraBuffer;
+
+std::thread updateThread;
+std::atomic<bool> stopping(false);
+
+std::atomic<long long> steps(0);
+std::atomic<long long> eventsApplied(0);
+std::atomic<long long> eventsDropped(0);
+std::atomic<long long> stepsSkipped(0);
+
+// The update thread's own
+CameraState camera;
+// keep track of which button is down and where the last position was
+int cur_button = -1;
+int last_x;
+int last_y;
+
+void mouseButton(const InputEvent& event)
+{
+  if (event.down) {
+    cur_button = event.button;
+  }
+  else {
+    if (event.button == cur_button)
+      cur_button = -1;
+  }
+
+  last_x = event.x;
+  last_y = event.y;
+}
+
+// Moves the camera as myGlutMotion() used to, returning whether it did
+bool mouseMotion(const InputEvent& event)
+{
+  // the change in mouse position
+  int dx = event.x-last_x;
+  int dy = event.y-last_y;
+  last_x = event.x;
+  last_y = event.y;
+
+  Vec3& eye = camera.eye;
+  Vec3& lookat = camera.lookat;
+  float scale, len, theta;
+  Vec3 neye, neye2;
+  Vec3 f, r, u;
+
+  switch(cur_button) {
+  case mouseTranslate:
+    // translate
+    f = lookat.add(eye.scale(-1));
+    u.x = 0;
+    u.y = 1;
+    u.z = 0;
+
+    // scale the change by how far away we are
+    scale = f.norm() * 0.007;
+
+    r = f.cross(u);
+    u = r.cross(f);
+
+    r.normalize();
+    u.normalize();
+
+    eye = eye.add(r.scale(-1).scale(dx).scale(scale));
+    eye = eye.add(u.scale(dy).scale(scale));
+
+    lookat = lookat.add(r.scale(-1).scale(dx).scale(scale));
+    lookat = lookat.add(u.scale(dy).scale(scale));
+
+    return true;
+
+  case mouseZoom:
+    // zoom
+    f = lookat.add(eye.scale(-1));
+
+    len = f.norm();
+    f.normalize();
+
+    // scale the change by how far away we are
+    len -= sqrt(len)*dx*0.03;
+
+    eye = lookat.add(f.scale(-1).scale(len));
+
+    // make sure the eye and lookat points are sufficiently far away
+    // push the lookat point forward if it is too close
+    if (len < 1) {
+      printf("lookat move: %f\n", len);
+      lookat = eye.add(f);
+    }
+
+    return true;
+
+  case mouseRotate:
+    // rotate
+
+    neye = eye.add(lookat.scale(-1));
+
+    // first rotate in the x/z plane
+    theta = -dx * 0.007;
+    neye2.x = (float)cos(theta)*neye.x + (float)sin(theta)*neye.z;
+    neye2.y = neye.y;
+    neye2.z =-(float)sin(theta)*neye.x + (float)cos(theta)*neye.z;
+
+
+    // now rotate vertically
+    theta = -dy * 0.007;
+
+    f = neye2.scale(-1);
+    u.x = 0;
+    u.y = 1;
+    u.z = 0;
+
+    r = f.cross(u);
+    u = r.cross(f);
+
+    len = f.norm();
+    f.normalize();
+    u.normalize();
+
+    neye = f.scale(cos(theta)).add(u.scale(sin(theta))).scale(len);
+
+    eye = lookat.add(neye.scale(-1));
+
+    return true;
+  }
+  return false;
+}
+
+// One step: everything that came in since the last, then the camera out if
+// it moved
+void step()
+{
+  bool moved = false;
+  InputEvent event;
+  while (inputQueue.pop(event)) {
+    if (event.type == inputMouseButton)
+      mouseButton(event);
+    else
+      moved = mouseMotion(event) || moved;
+    eventsApplied++;
+  }
+  camera.step = steps++;
+  if (moved)
+    cameraBuffer.publish(camera);
+}
+
+void runUpdates()
+{
+  typedef std::chrono::steady_clock Clock;
+  const Clock::duration stepLength = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(1.0 / updateStepsPerSecond));
+  Clock::time_point next = Clock::now();
+  while (!stopping) {
+    step();
+    next += stepLength;
+    // After a stall, carry on from now rather than run the missed steps back
+    // to back
+    Clock::time_point now = Clock::now();
+    if (now > next + stepLength) {
+      stepsSkipped += (now - next) / stepLength;
+      next = now;
+    }
+    std::this_thread::sleep_until(next);
+  }
+}
+
+}
+
+void startUpdates(const Vec3& eye, const Vec3& lookat)
+{
+  camera.eye = eye;
+  camera.lookat = lookat;
+  camera.step = 0;
+  stopping = false;
+  updateThread = std::thread(runUpdates);
+}
+
+void stopUpdates()
+{
+  if (!updateThread.joinable())
+    return;
+  stopping = true;
+  updateThread.join();
+}
+
+bool pushInput(const InputEvent& event)
+{
+  if (inputQueue.push(event))
+    return true;
+  eventsDropped++;
+  return false;
+}
+
+bool takeCamera(CameraState& state)
+{
+  return cameraBuffer.take(state);
+}
+
+UpdateStats updateStats()
+{
+  UpdateStats stats;
+  stats.steps = steps;
+  stats.eventsApplied = eventsApplied;
+  stats.eventsDropped = eventsDropped;
+  stats.stepsSkipped = stepsSkipped;
+  return stats;
+}
@@ -0,0 +1,76 @@
+// File: update.h
+//
+// Moves the camera on a thread of its own, at a fixed rate, apart from
+// drawing. The GLUT callbacks push mouse input onto a single-producer,
+// single-consumer queue; each step, the update thread applies what came in
+// and publishes the camera through a triple buffer, which the GL thread takes
+// the newest state from before drawing. Neither side ever waits for the
+// other: a full queue drops the event, and an unread camera is replaced.
+
+#ifndef SP_UPDATE_H_
+#define SP_UPDATE_H_
+
+#include "vec3.h"
+
+const int updateStepsPerSecond = 120;
+// Input events that can wait for the next step
+const int inputQueueSize = 256;
+
+enum InputEventType
+{
+  inputMouseButton,
+  inputMouseMotion
+};
+
+// What dragging with each mouse button does
+enum MouseButton
+{
+  mouseTranslate,
+  mouseZoom,
+  mouseRotate,
+  mouseOther
+};
+
+// A GLUT mouse or motion callback's arguments; "button" and "down" are only
+// for inputMouseButton
+struct InputEvent
+{
+  InputEventType type;
+  MouseButton button;
+  bool down;
+  int x;
+  int y;
+};
+
+struct CameraState
+{
+  Vec3 eye;
+  Vec3 lookat;
+  // The update step it was published at
+  long long step;
+};
+
+// Starts the update thread with the camera at "eye", looking at "lookat"
+void startUpdates(const Vec3& eye, const Vec3& lookat);
+// Stops it; the camera it last published can still be taken
+void stopUpdates();
+
+// Queues an event for the next step, from the one thread that handles input.
+// Returns false, dropping it, if the queue is full.
+bool pushInput(const InputEvent& event);
+
+// Fills in "camera" and returns true if one has been published since the last
+// call, from the one thread that draws
+bool takeCamera(CameraState& camera);
+
+struct UpdateStats
+{
+  long long steps;
+  long long eventsApplied;
+  long long eventsDropped;
+  // Steps that started more than a step late, and were skipped over
+  long long stepsSkipped;
+};
+UpdateStats updateStats();
+
+#endif // SP_UPDATE_H_
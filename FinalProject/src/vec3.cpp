@@ -5,7 +5,7 @@
  * Contains function definitions for the Vec3 class.
  */
 
-#include "Vec3.h"
+#include "vec3.h"
 
 #include <cmath>
 
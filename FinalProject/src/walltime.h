@@ -0,0 +1,8 @@
+#ifndef SP_WALLTIME_H_
+#define SP_WALLTIME_H_
+
+// Milliseconds on a monotonic, high resolution clock. Only differences
+// between two calls mean anything.
+double wallClockMs();
+
+#endif // SP_WALLTIME_H_
@@ -0,0 +1,89 @@
+# Renders regress's three fixed views with headless, through one of the GL
+# paths, and checks each frame against its reference in tests/reference/gl
+# with regress --compare. ctest runs it once for each path (see
+# CMakeLists.txt), from FinalProject/:
+#
+#   cmake -DHEADLESS=... -DREGRESS=... -DMODE=compute -DOUTPUT_DIR=... -P tests/glregress.cmake
+#
+# With -DUPDATE=ON the frames become the new references instead.
+#
+# Frames are rendered at the window size, 1024x768, and shrunk four times
+# each way to the references' 256x192. Pixels may be twice as far off as in
+# regress's own check, and PSNR a dB lower, since llvmpipe and GPUs don't
+# rasterize or round quite alike; turning occlusion off, or switching to
+# another path, still fails.
+
+foreach(variable HEADLESS REGRESS MODE OUTPUT_DIR)
+  if(NOT DEFINED ${variable})
+    message(FATAL_ERROR "glregress.cmake needs -D${variable}")
+  endif()
+endforeach()
+
+# The same views as regress.cpp's regressViews
+set(views front side close)
+set(front_eye 0 1.5 1.5)
+set(side_eye 1.6 0.8 0.4)
+set(close_eye -0.3 0.3 0.9)
+
+if(MODE STREQUAL "noao")
+  set(modeArguments)
+elseif(MODE STREQUAL "fragment")
+  set(modeArguments --ao --no-compute)
+elseif(MODE STREQUAL "compute")
+  set(modeArguments --ao)
+elseif(MODE STREQUAL "deinterleaved")
+  set(modeArguments --ao --no-compute --deinterleaved)
+elseif(MODE STREQUAL "temporal")
+  set(modeArguments --ao --no-compute --temporal)
+else()
+  message(FATAL_ERROR "MODE has to be noao, fragment, compute, deinterleaved or temporal, not ${MODE}")
+endif()
+
+# A few frames from the same spot, so temporal accumulation has something to
+# accumulate; the last one is checked
+set(frameCount 4)
+set(checkedFrame frame_0003.ppm)
+set(limits --tolerance 16 --max-off 0.5 --min-psnr 34 --min-ssim 0.98)
+
+set(modeDir ${OUTPUT_DIR}/${MODE})
+set(failures 0)
+foreach(view ${views})
+  set(name ${view}_${MODE})
+  set(viewDir ${modeDir}/${view})
+  file(REMOVE_RECURSE ${viewDir})
+  file(MAKE_DIRECTORY ${viewDir})
+
+  execute_process(
+    COMMAND ${HEADLESS} --frames ${frameCount} --orbit-degrees 0 --eye ${${view}_eye} ${modeArguments}
+      --meshlet-cache ${modeDir} --output ${viewDir}
+    OUTPUT_FILE ${viewDir}/headless.log
+    ERROR_FILE ${viewDir}/headless.log
+    RESULT_VARIABLE result)
+  if(NOT result EQUAL 0)
+    message("${name}: headless failed (${result}), see ${viewDir}/headless.log")
+    math(EXPR failures "${failures} + 1")
+    continue()
+  endif()
+
+  set(reference tests/reference/gl/${name}.ppm)
+  if(UPDATE)
+    execute_process(COMMAND ${REGRESS} --compare ${viewDir}/${checkedFrame} ${reference} --downsample 4 --update
+      RESULT_VARIABLE result)
+  else()
+    execute_process(
+      COMMAND ${REGRESS} --compare ${viewDir}/${checkedFrame} ${reference} --downsample 4 ${limits}
+        --heatmap ${viewDir}/diff.ppm
+      OUTPUT_VARIABLE output
+      RESULT_VARIABLE result)
+    string(REGEX REPLACE "^image *" "" output "${output}")
+    string(STRIP "${output}" output)
+    message("${name}  ${output}")
+  endif()
+  if(NOT result EQUAL 0)
+    math(EXPR failures "${failures} + 1")
+  endif()
+endforeach()
+
+if(failures GREATER 0)
+  message(FATAL_ERROR "${failures} of 3 ${MODE} views failed; frames and heatmaps are in ${modeDir}")
+endif()